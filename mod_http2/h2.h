@@ -178,6 +178,19 @@ struct h2_headers {
     apr_off_t   raw_bytes;      /* RAW network bytes that generated this request - if known. */
 };
 
+/**
+ * Points in time in the life of a stream, as seen by the c1 processing.
+ * A value of 0 means that the point has not been reached (yet).
+ */
+typedef struct h2_stream_timing {
+    apr_time_t opened;          /* stream was created */
+    apr_time_t headers_done;    /* request headers were complete */
+    apr_time_t queued;          /* stream was scheduled for processing */
+    apr_time_t first_data;      /* first DATA frame was written */
+    apr_time_t last_data;       /* latest DATA frame was written */
+    apr_time_t closed;          /* stream was closed */
+} h2_stream_timing;
+
 typedef apr_status_t h2_io_data_cb(void *ctx, const char *data, apr_off_t len);
 
 typedef int h2_stream_pri_cmp_fn(int stream_id1, int stream_id2, void *session);
@@ -187,5 +200,6 @@ typedef struct h2_stream *h2_stream_get_fn(struct h2_session *session, int strea
 #define H2_HDR_CONFORMANCE      "http2-hdr-conformance"
 #define H2_HDR_CONFORMANCE_UNSAFE      "unsafe"
 #define H2_PUSH_MODE_NOTE       "http2-push-mode"
+#define H2_PRELOAD_NOTE         "http2-preloads"
 
 #endif /* defined(__mod_h2__h2__) */
@@ -29,7 +29,9 @@
 #include "h2_private.h"
 #include "h2_conn_ctx.h"
 #include "h2_util.h"
+#include "h2_locks.h"
 #include "h2_bucket_beam.h"
+#include "h2_probes.h"
 
 
 #define H2_BLIST_INIT(b)        APR_RING_INIT(&(b)->list, apr_bucket, link);
@@ -53,6 +55,18 @@
     } while (0)
 
 
+/* child wide counts of waits on beams, for status reports */
+static volatile apr_uint32_t waits_full, blocked_full;
+static volatile apr_uint32_t waits_empty, blocked_empty;
+
+void h2_beam_wait_stats_get(h2_beam_wait_stats *stats)
+{
+    stats->full_waits = apr_atomic_read32(&waits_full);
+    stats->full_blocked = apr_atomic_read32(&blocked_full);
+    stats->empty_waits = apr_atomic_read32(&waits_empty);
+    stats->empty_blocked = apr_atomic_read32(&blocked_empty);
+}
+
 /* registry for bucket converting `h2_bucket_beamer` functions */
 static apr_array_header_t *beamers;
 
@@ -156,9 +170,9 @@ static int report_consumption(h2_bucket_beam *beam, int locked)
         if (cb) {
             void *ctx = beam->cons_ctx;
             
-            if (locked) apr_thread_mutex_unlock(beam->lock);
+            if (locked) H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
             cb(ctx, beam, len);
-            if (locked) apr_thread_mutex_lock(beam->lock);
+            if (locked) H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
             rv = 1;
         }
         beam->recv_bytes_reported += len;
@@ -212,9 +226,37 @@ static int buffer_is_empty(h2_bucket_beam *beam)
             && H2_BLIST_EMPTY(&beam->buckets_to_send));
 }
 
+/* Invoke the receive callback, unless batching holds it back. Once
+ * the buffer is empty, the sender may wait on our report, so nothing
+ * is held back then. */
+static void recv_notify(h2_bucket_beam *beam, int consumed)
+{
+    apr_off_t pending = beam->recv_bytes - beam->recv_bytes_notified;
+    apr_time_t now;
+
+    if (!beam->recv_cb || (!consumed && pending <= 0)) {
+        return;
+    }
+    if (beam->recv_notify_min > 0 && pending < beam->recv_notify_min
+        && !buffer_is_empty(beam)) {
+        now = apr_time_now();
+        if (!beam->recv_notify_since) {
+            beam->recv_notify_since = now;
+            return;
+        }
+        if (now - beam->recv_notify_since < beam->recv_notify_delay) {
+            return;
+        }
+    }
+    beam->recv_bytes_notified = beam->recv_bytes;
+    beam->recv_notify_since = 0;
+    beam->recv_cb(beam->recv_ctx, beam);
+}
+
 static apr_status_t wait_not_empty(h2_bucket_beam *beam, conn_rec *c, apr_read_type_e block)
 {
     apr_status_t rv = APR_SUCCESS;
+    int waited = 0;
     
     while (buffer_is_empty(beam) && APR_SUCCESS == rv) {
         if (beam->aborted) {
@@ -223,15 +265,29 @@ static apr_status_t wait_not_empty(h2_bucket_beam *beam, conn_rec *c, apr_read_t
         else if (APR_BLOCK_READ != block) {
             rv = APR_EAGAIN;
         }
-        else if (beam->timeout > 0) {
-            H2_BEAM_LOG(beam, c, APLOG_TRACE2, rv, "wait_not_empty, timeout", NULL);
-            rv = apr_thread_cond_timedwait(beam->change, beam->lock, beam->timeout);
-        }
         else {
-            H2_BEAM_LOG(beam, c, APLOG_TRACE2, rv, "wait_not_empty, forever", NULL);
-            rv = apr_thread_cond_wait(beam->change, beam->lock);
+            if (!waited) {
+                H2_PROBE3(beam_wait_empty, beam->id, beam->name, 1);
+                apr_atomic_inc32(&waits_empty);
+                apr_atomic_inc32(&blocked_empty);
+                waited = 1;
+            }
+            if (beam->timeout > 0) {
+                H2_BEAM_LOG(beam, c, APLOG_TRACE2, rv, "wait_not_empty, timeout", NULL);
+                rv = H2_COND_TIMEDWAIT(beam->change, beam->lock, beam->timeout,
+                                       H2_LOCK_BEAM, &beam->lock_since);
+            }
+            else {
+                H2_BEAM_LOG(beam, c, APLOG_TRACE2, rv, "wait_not_empty, forever", NULL);
+                rv = H2_COND_WAIT(beam->change, beam->lock,
+                                  H2_LOCK_BEAM, &beam->lock_since);
+            }
         }
     }
+    if (waited) {
+        H2_PROBE3(beam_wait_empty, beam->id, beam->name, 0);
+        apr_atomic_dec32(&blocked_empty);
+    }
     return rv;
 }
 
@@ -241,6 +297,7 @@ static apr_status_t wait_not_full(h2_bucket_beam *beam, conn_rec *c,
 {
     apr_status_t rv = APR_SUCCESS;
     apr_size_t left;
+    int waited = 0;
     
     while (0 == (left = calc_space_left(beam)) && APR_SUCCESS == rv) {
         if (beam->aborted) {
@@ -250,16 +307,28 @@ static apr_status_t wait_not_full(h2_bucket_beam *beam, conn_rec *c,
             rv = APR_EAGAIN;
         }
         else {
+            if (!waited) {
+                H2_PROBE3(beam_wait_full, beam->id, beam->name, 1);
+                apr_atomic_inc32(&waits_full);
+                apr_atomic_inc32(&blocked_full);
+                waited = 1;
+            }
             if (beam->timeout > 0) {
                 H2_BEAM_LOG(beam, c, APLOG_TRACE2, rv, "wait_not_full, timeout", NULL);
-                rv = apr_thread_cond_timedwait(beam->change, beam->lock, beam->timeout);
+                rv = H2_COND_TIMEDWAIT(beam->change, beam->lock, beam->timeout,
+                                       H2_LOCK_BEAM, &beam->lock_since);
             }
             else {
                 H2_BEAM_LOG(beam, c, APLOG_TRACE2, rv, "wait_not_full, forever", NULL);
-                rv = apr_thread_cond_wait(beam->change, beam->lock);
+                rv = H2_COND_WAIT(beam->change, beam->lock,
+                                  H2_LOCK_BEAM, &beam->lock_since);
             }
         }
     }
+    if (waited) {
+        H2_PROBE3(beam_wait_full, beam->id, beam->name, 0);
+        apr_atomic_dec32(&blocked_full);
+    }
     *pspace_left = left;
     return rv;
 }
@@ -286,12 +355,14 @@ static void recv_buffer_cleanup(h2_bucket_beam *beam)
         
         /* need to do this unlocked since bucket destroy might 
          * call this beam again. */
-        apr_thread_mutex_unlock(beam->lock);
+        H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
         apr_brigade_destroy(bb);
-        apr_thread_mutex_lock(beam->lock);
+        H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
 
         apr_thread_cond_broadcast(beam->change);
         if (beam->recv_cb) {
+            beam->recv_bytes_notified = beam->recv_bytes;
+            beam->recv_notify_since = 0;
             beam->recv_cb(beam->recv_ctx, beam);
         }
     }
@@ -356,25 +427,25 @@ cleanup:
 
 void h2_beam_buffer_size_set(h2_bucket_beam *beam, apr_size_t buffer_size)
 {
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     beam->max_buf_size = buffer_size;
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
 }
 
 void h2_beam_set_copy_files(h2_bucket_beam * beam, int enabled)
 {
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     beam->copy_files = enabled;
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
 }
 
 apr_size_t h2_beam_buffer_size_get(h2_bucket_beam *beam)
 {
     apr_size_t buffer_size = 0;
     
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     buffer_size = beam->max_buf_size;
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     return buffer_size;
 }
 
@@ -382,22 +453,22 @@ apr_interval_time_t h2_beam_timeout_get(h2_bucket_beam *beam)
 {
     apr_interval_time_t timeout;
 
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     timeout = beam->timeout;
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     return timeout;
 }
 
 void h2_beam_timeout_set(h2_bucket_beam *beam, apr_interval_time_t timeout)
 {
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     beam->timeout = timeout;
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
 }
 
 void h2_beam_abort(h2_bucket_beam *beam, conn_rec *c)
 {
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     beam->aborted = 1;
     if (c == beam->from) {
         /* sender aborts */
@@ -416,7 +487,7 @@ void h2_beam_abort(h2_bucket_beam *beam, conn_rec *c)
         recv_buffer_cleanup(beam);
     }
     apr_thread_cond_broadcast(beam->change);
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
 }
 
 static apr_status_t append_bucket(h2_bucket_beam *beam,
@@ -537,7 +608,7 @@ apr_status_t h2_beam_send(h2_bucket_beam *beam, conn_rec *from,
     int was_empty;
 
     /* Called from the sender thread to add buckets to the beam */
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     ap_assert(beam->from == from);
     ap_assert(sender_bb);
     H2_BEAM_LOG(beam, from, APLOG_TRACE2, rv, "start send", sender_bb);
@@ -574,7 +645,7 @@ apr_status_t h2_beam_send(h2_bucket_beam *beam, conn_rec *from,
         rv = APR_ECONNABORTED;
     }
     H2_BEAM_LOG(beam, from, APLOG_TRACE2, rv, "end send", sender_bb);
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     return rv;
 }
 
@@ -590,7 +661,7 @@ apr_status_t h2_beam_receive(h2_bucket_beam *beam,
     apr_off_t remain;
     int consumed_buckets = 0;
 
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     H2_BEAM_LOG(beam, to, APLOG_TRACE2, 0, "start receive", bb);
     if (readbytes <= 0) {
         readbytes = (apr_off_t)APR_SIZE_MAX;
@@ -734,9 +805,7 @@ transfer:
         }
     }
 
-    if (beam->recv_cb && consumed_buckets > 0) {
-        beam->recv_cb(beam->recv_ctx, beam);
-    }
+    recv_notify(beam, consumed_buckets > 0);
 
     if (transferred) {
         apr_thread_cond_broadcast(beam->change);
@@ -755,35 +824,44 @@ transfer:
 
 leave:
     H2_BEAM_LOG(beam, to, APLOG_TRACE2, rv, "end receive", bb);
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     return rv;
 }
 
 void h2_beam_on_consumed(h2_bucket_beam *beam, 
                          h2_beam_io_callback *io_cb, void *ctx)
 {
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     beam->cons_io_cb = io_cb;
     beam->cons_ctx = ctx;
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
 }
 
 void h2_beam_on_received(h2_bucket_beam *beam,
                          h2_beam_ev_callback *recv_cb, void *ctx)
 {
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     beam->recv_cb = recv_cb;
     beam->recv_ctx = ctx;
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
+}
+
+void h2_beam_on_received_batch(h2_bucket_beam *beam, apr_off_t min_bytes,
+                               apr_interval_time_t max_delay)
+{
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
+    beam->recv_notify_min = min_bytes;
+    beam->recv_notify_delay = max_delay;
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
 }
 
 void h2_beam_on_was_empty(h2_bucket_beam *beam,
                           h2_beam_ev_callback *was_empty_cb, void *ctx)
 {
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     beam->was_empty_cb = was_empty_cb;
     beam->was_empty_ctx = ctx;
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
 }
 
 
@@ -805,9 +883,9 @@ apr_off_t h2_beam_get_buffered(h2_bucket_beam *beam)
 {
     apr_off_t l = 0;
 
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     l = get_buffered_data_len(beam);
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     return l;
 }
 
@@ -816,13 +894,13 @@ apr_off_t h2_beam_get_mem_used(h2_bucket_beam *beam)
     apr_bucket *b;
     apr_off_t l = 0;
 
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     for (b = H2_BLIST_FIRST(&beam->buckets_to_send);
         b != H2_BLIST_SENTINEL(&beam->buckets_to_send);
         b = APR_BUCKET_NEXT(b)) {
         l += bucket_mem_used(b);
     }
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     return l;
 }
 
@@ -836,9 +914,9 @@ int h2_beam_empty(h2_bucket_beam *beam)
 {
     int empty = 1;
 
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     empty = is_empty(beam);
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     return empty;
 }
 
@@ -846,8 +924,8 @@ int h2_beam_report_consumption(h2_bucket_beam *beam)
 {
     int rv = 0;
 
-    apr_thread_mutex_lock(beam->lock);
+    H2_LOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     rv = report_consumption(beam, 1);
-    apr_thread_mutex_unlock(beam->lock);
+    H2_UNLOCK(beam->lock, H2_LOCK_BEAM, &beam->lock_since);
     return rv;
 }
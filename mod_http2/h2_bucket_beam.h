@@ -68,6 +68,9 @@ struct h2_bucket_beam {
     int copy_files;
 
     struct apr_thread_mutex_t *lock;
+#ifdef H2_LOCK_STATS
+    apr_time_t lock_since;          /* when lock was last acquired */
+#endif
     struct apr_thread_cond_t *change;
     
     h2_beam_ev_callback *was_empty_cb; /* event: beam changed to non-empty in h2_beam_send() */
@@ -77,6 +80,10 @@ struct h2_bucket_beam {
 
     apr_off_t recv_bytes;             /* amount of bytes transferred in h2_beam_receive() */
     apr_off_t recv_bytes_reported;    /* amount of bytes reported as received via callback */
+    apr_off_t recv_bytes_notified;    /* recv_bytes when recv_cb was last invoked */
+    apr_off_t recv_notify_min;        /* bytes to receive before recv_cb is invoked */
+    apr_interval_time_t recv_notify_delay; /* max delay of a recv_cb invocation */
+    apr_time_t recv_notify_since;     /* when recv_cb was first held back or 0 */
     h2_beam_io_callback *cons_io_cb;  /* report: recv_bytes deltas for sender */
     void *cons_ctx;
 };
@@ -204,6 +211,20 @@ void h2_beam_on_consumed(h2_bucket_beam *beam,
 void h2_beam_on_received(h2_bucket_beam *beam,
                          h2_beam_ev_callback *recv_cb, void *ctx);
 
+/**
+ * Let the receive callback be invoked only once min_bytes have been
+ * received or the beam has run empty. This batches notifications for
+ * receivers reading in small pieces. The delay is checked on receives
+ * only: the first receive max_delay or more after one was held back
+ * invokes the callback, there is no timer doing it in between.
+ * A min_bytes of 0 invokes it on every receive.
+ * @param beam the beam to set the batching on
+ * @param min_bytes bytes to receive before the callback is invoked
+ * @param max_delay max time a received amount is held back
+ */
+void h2_beam_on_received_batch(h2_bucket_beam *beam, apr_off_t min_bytes,
+                               apr_interval_time_t max_delay);
+
 /**
  * Register a call back from the sender side to be invoked when send
  * has added to a previously empty beam.
@@ -234,6 +255,19 @@ apr_off_t h2_beam_get_buffered(h2_bucket_beam *beam);
  */
 apr_off_t h2_beam_get_mem_used(h2_bucket_beam *beam);
 
+typedef struct {
+    apr_uint32_t full_waits;      /* blocking sends that had to wait */
+    apr_uint32_t full_blocked;    /* senders waiting right now */
+    apr_uint32_t empty_waits;     /* blocking receives that had to wait */
+    apr_uint32_t empty_blocked;   /* receivers waiting right now */
+} h2_beam_wait_stats;
+
+/**
+ * Get the counts of waits on full/empty beams in this child process.
+ * The totals wrap around.
+ */
+void h2_beam_wait_stats_get(h2_beam_wait_stats *stats);
+
 typedef apr_bucket *h2_bucket_beamer(h2_bucket_beam *beam,
                                      apr_bucket_brigade *dest,
                                      const apr_bucket *src);
@@ -38,9 +38,13 @@
 #include "h2_conn_ctx.h"
 #include "h2_headers.h"
 #include "h2_mplx.h"
+#include "h2_poller.h"
 #include "h2_session.h"
 #include "h2_stream.h"
 #include "h2_protocol.h"
+#include "h2_preload.h"
+#include "h2_push.h"
+#include "h2_status.h"
 #include "h2_workers.h"
 #include "h2_c1.h"
 #include "h2_version.h"
@@ -49,6 +53,7 @@
 static struct h2_workers *workers;
 
 static int async_mpm;
+static int mpm_can_poll;
 
 APR_OPTIONAL_FN_TYPE(ap_logio_add_bytes_in) *h2_c_logio_add_bytes_in;
 APR_OPTIONAL_FN_TYPE(ap_logio_add_bytes_out) *h2_c_logio_add_bytes_out;
@@ -68,6 +73,11 @@ apr_status_t h2_c1_child_init(apr_pool_t *pool, server_rec *s)
         async_mpm = 0;
         status = APR_SUCCESS;
     }
+#ifdef AP_MPMQ_CAN_POLL
+    if (ap_mpm_query(AP_MPMQ_CAN_POLL, &mpm_can_poll) != APR_SUCCESS) {
+        mpm_can_poll = 0;
+    }
+#endif
 
     h2_config_init(pool);
 
@@ -81,6 +91,22 @@ apr_status_t h2_c1_child_init(apr_pool_t *pool, server_rec *s)
     h2_c_logio_add_bytes_in = APR_RETRIEVE_OPTIONAL_FN(ap_logio_add_bytes_in);
     h2_c_logio_add_bytes_out = APR_RETRIEVE_OPTIONAL_FN(ap_logio_add_bytes_out);
 
+    status = h2_push_child_init(pool, s);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    status = h2_preload_child_init(pool, s);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    status = h2_status_child_init(pool, s, workers);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    status = h2_poller_child_init(pool, s);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
     return h2_mplx_c1_child_init(pool, s);
 }
 
@@ -111,6 +137,10 @@ apr_status_t h2_c1_setup(conn_rec *c, request_rec *r, server_rec *s)
     ctx = h2_conn_ctx_get(c);
     ap_assert(ctx);
     ctx->session = session;
+    /* the mpm can only watch our c2 pipes when there are some */
+    session->wait_suspend = async_mpm && mpm_can_poll && H2_POLL_STREAMS
+                            && !h2_poller_active()
+                            && h2_config_sgeti(s, H2_CONF_WAIT_SUSPEND);
     /* remove the input filter of mod_reqtimeout, now that the connection
      * is established and we have switched to h2. reqtimeout has supervised
      * possibly configured handshake timeouts and needs to get out of the way
@@ -121,6 +151,57 @@ cleanup:
     return rv;
 }
 
+#ifdef AP_MPMQ_CAN_POLL
+static void c1_resume(void *baton);
+static void c1_resume_timeout(void *baton);
+
+static apr_status_t c1_wait_register(conn_rec *c, h2_session *session)
+{
+    apr_array_header_t *pfds;
+    apr_status_t rv;
+
+    /* the previous registration has fired or timed out */
+    if (session->suspend_pool) {
+        apr_pool_clear(session->suspend_pool);
+    }
+    else {
+        apr_pool_create(&session->suspend_pool, session->pool);
+        apr_pool_tag(session->suspend_pool, "h2_suspend");
+    }
+    rv = h2_mplx_c1_pfds_get(session->mplx, session->suspend_pool, &pfds);
+    if (APR_SUCCESS != rv) goto cleanup;
+    rv = ap_mpm_register_poll_callback_timeout(session->suspend_pool, pfds,
+                                               c1_resume, c1_resume_timeout,
+                                               c, session->s->timeout);
+cleanup:
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE2, rv, c,
+                  H2_SSSN_MSG(session, "register wait in mpm"));
+    return rv;
+}
+
+static void c1_resume(void *baton)
+{
+    conn_rec *c = baton;
+    h2_conn_ctx_t *conn_ctx = h2_conn_ctx_get(c);
+
+    h2_c1_run(c);
+    if (!conn_ctx->session->suspended) {
+        ap_mpm_resume_suspended(c);
+    }
+}
+
+static void c1_resume_timeout(void *baton)
+{
+    conn_rec *c = baton;
+    h2_conn_ctx_t *conn_ctx = h2_conn_ctx_get(c);
+
+    conn_ctx->session->suspended = 0;
+    h2_session_dispatch_event(conn_ctx->session, H2_SESSION_EV_CONN_TIMEOUT,
+                              APR_TIMEUP, NULL);
+    c1_resume(baton);
+}
+#endif /* AP_MPMQ_CAN_POLL */
+
 apr_status_t h2_c1_run(conn_rec *c)
 {
     apr_status_t status;
@@ -136,6 +217,27 @@ apr_status_t h2_c1_run(conn_rec *c)
         }
     
         status = h2_session_process(conn_ctx->session, async_mpm);
+#ifdef AP_MPMQ_CAN_POLL
+        while (conn_ctx->session->suspended && c->cs) {
+            apr_status_t rv;
+
+            if (!c->suspended_baton) {
+                /* we register once the mpm has suspended c1 */
+                c->cs->state = CONN_STATE_SUSPENDED;
+                return APR_SUCCESS;
+            }
+            /* resumed by the mpm, still suspended there */
+            rv = c1_wait_register(c, conn_ctx->session);
+            if (APR_SUCCESS == rv) {
+                return APR_SUCCESS;
+            }
+            if (!APR_STATUS_IS_EAGAIN(rv)) {
+                /* keep the thread and wait in the session */
+                conn_ctx->session->wait_suspend = 0;
+            }
+            status = h2_session_process(conn_ctx->session, async_mpm);
+        }
+#endif
         
         if (APR_STATUS_IS_EOF(status)) {
             ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, c, 
@@ -310,6 +412,30 @@ static int h2_c1_hook_pre_close(conn_rec *c)
     return DECLINED;
 }
 
+#ifdef AP_MPMQ_CAN_POLL
+static void h2_c1_hook_suspend_connection(conn_rec *c, request_rec *r)
+{
+    h2_conn_ctx_t *ctx;
+    apr_status_t rv;
+
+    (void)r;
+    if (c->master) {
+        return;
+    }
+    ctx = h2_conn_ctx_get(c);
+    if (ctx && ctx->session && ctx->session->suspended) {
+        rv = c1_wait_register(c, ctx->session);
+        if (APR_SUCCESS != rv) {
+            if (!APR_STATUS_IS_EAGAIN(rv)) {
+                /* cannot wait in the mpm, do it here then */
+                ctx->session->wait_suspend = 0;
+            }
+            c1_resume(c);
+        }
+    }
+}
+#endif
+
 static const char* const mod_ssl[]        = { "mod_ssl.c", NULL};
 static const char* const mod_reqtimeout[] = { "mod_ssl.c", "mod_reqtimeout.c", NULL};
 
@@ -328,6 +454,13 @@ void h2_c1_register_hooks(void)
      * already. */
     ap_hook_pre_close_connection(h2_c1_hook_pre_close, NULL, mod_ssl, APR_HOOK_LAST);
 
+#ifdef AP_MPMQ_CAN_POLL
+    /* Sessions waiting on their streams with 'H2WaitSuspend on' leave
+     * the watching of their sockets and pipes to the mpm. */
+    ap_hook_suspend_connection(h2_c1_hook_suspend_connection,
+                               NULL, NULL, APR_HOOK_MIDDLE);
+#endif
+
     /* special bucket type transfer through a h2_bucket_beam */
     h2_register_bucket_beamer(h2_bucket_headers_beam);
 }
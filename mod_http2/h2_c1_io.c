@@ -15,6 +15,7 @@
  */
  
 #include <assert.h>
+#include <stdlib.h>
 #include <apr_strings.h>
 #include <ap_mpm.h>
 #include <mpm_common.h>
@@ -35,6 +36,8 @@
 #include "h2_protocol.h"
 #include "h2_session.h"
 #include "h2_util.h"
+#include "h2_zerocopy.h"
+#include "h2_probes.h"
 
 #define TLS_DATA_MAX          (16*1024) 
 
@@ -58,6 +61,13 @@
 
 #define BUF_REMAIN            ((apr_size_t)(bmax-off))
 
+/* Input is read in chunks between these sizes. The size doubles
+ * when a read fills it and halves after IN_BUF_SHRINK_READS reads in a
+ * row have used less than a quarter of it. */
+#define IN_BUF_MIN            (16*1024)
+#define IN_BUF_MAX            (256*1024)
+#define IN_BUF_SHRINK_READS   16
+
 static void h2_c1_io_bb_log(conn_rec *c, int stream_id, int level,
                             const char *tag, apr_bucket_brigade *bb)
 {
@@ -138,6 +148,17 @@ static void h2_c1_io_bb_log(conn_rec *c, int stream_id, int level,
     }
 
 
+static apr_status_t c1_io_in_buf_cleanup(void *data)
+{
+    h2_c1_io *io = data;
+
+    if (io->in_buf) {
+        free(io->in_buf);
+        io->in_buf = NULL;
+    }
+    return APR_SUCCESS;
+}
+
 apr_status_t h2_c1_io_init(h2_c1_io *io, h2_session *session)
 {
     conn_rec *c = session->c1;
@@ -147,6 +168,23 @@ apr_status_t h2_c1_io_init(h2_c1_io *io, h2_session *session)
     io->is_tls = ap_ssl_conn_is_ssl(session->c1);
     io->buffer_output  = io->is_tls;
     io->flush_threshold = 4 * (apr_size_t)h2_config_sgeti64(session->s, H2_CONF_STREAM_MAX_MEM);
+    io->in_buf_size = IN_BUF_MIN;
+    io->in_more = apr_brigade_create(c->pool, c->bucket_alloc);
+    /* io lives in the session, which is gone before c->pool cleanups run */
+    apr_pool_cleanup_register(session->pool, io, c1_io_in_buf_cleanup,
+                              apr_pool_cleanup_null);
+
+    io->zc_size = h2_config_sgeti(session->s, H2_CONF_ZEROCOPY_SIZE);
+    if (!io->is_tls && io->zc_size > 0) {
+        apr_status_t rv = h2_zerocopy_create(&io->zc, c->pool,
+                                             ap_get_conn_socket(c),
+                                             c->bucket_alloc, session->s->timeout);
+        if (APR_SUCCESS != rv) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, rv, c,
+                          "h2_c1_io(%ld): MSG_ZEROCOPY not available", c->id);
+            io->zc = NULL;
+        }
+    }
 
     if (io->buffer_output) {
         /* This is what we start with, 
@@ -257,10 +295,28 @@ static apr_status_t read_to_scratch(h2_c1_io *io, apr_bucket *b)
     return status;
 }
 
+static apr_status_t pass_zerocopy(h2_c1_io *io)
+{
+    conn_rec *c = io->session->c1;
+    apr_size_t written;
+    apr_status_t rv;
+
+    /* We write to the socket ourselves, which is a blocking flush. */
+    rv = h2_zerocopy_send(io->zc, io->output, &written);
+    if (written && h2_c_logio_add_bytes_out) {
+        h2_c_logio_add_bytes_out(c, (apr_off_t)written);
+    }
+    if (APR_SUCCESS != rv) {
+        c->aborted = 1;
+    }
+    io->unflushed = 0;
+    return rv;
+}
+
 static apr_status_t pass_output(h2_c1_io *io, int flush)
 {
     conn_rec *c = io->session->c1;
-    apr_off_t bblen;
+    apr_off_t bblen, zclen;
     apr_status_t rv;
     
     append_scratch(io);
@@ -277,8 +333,17 @@ static apr_status_t pass_output(h2_c1_io *io, int flush)
     io->unflushed = !APR_BUCKET_IS_FLUSH(APR_BRIGADE_LAST(io->output));
     apr_brigade_length(io->output, 0, &bblen);
     C1_IO_BB_LOG(c, 0, APLOG_TRACE2, "out", io->output);
+    H2_PROBE3(c1_flush, io->session->id, (long)bblen, flush);
     
-    rv = ap_pass_brigade(c->output_filters, io->output);
+    if (io->zc && !c->data_in_output_filters
+        && h2_zerocopy_can_send(io->output, &zclen)
+        && zclen >= io->zc_size) {
+        /* large, all in memory and nothing queued before it */
+        rv = pass_zerocopy(io);
+    }
+    else {
+        rv = ap_pass_brigade(c->output_filters, io->output);
+    }
     if (APR_SUCCESS != rv) goto cleanup;
 
     io->buffered_len = 0;
@@ -421,16 +486,13 @@ cleanup:
     return rv;
 }
 
-static apr_status_t c1_in_feed_bucket(h2_session *session,
-                                      apr_bucket *b, apr_ssize_t *inout_len)
+static apr_status_t c1_in_feed_data(h2_session *session, const char *data,
+                                    apr_size_t len, apr_ssize_t *inout_len)
 {
     apr_status_t rv = APR_SUCCESS;
-    apr_size_t len;
-    const char *data;
     ssize_t n;
 
-    rv = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
-    while (APR_SUCCESS == rv && len > 0) {
+    while (len > 0) {
         n = nghttp2_session_mem_recv(session->ngh2, (const uint8_t *)data, len);
 
         ap_log_cerror(APLOG_MARK, APLOG_TRACE4, 0, session->c1,
@@ -442,17 +504,15 @@ static apr_status_t c1_in_feed_bucket(h2_session *session,
                                  (int)n, nghttp2_strerror((int)n));
                 rv = APR_EGENERAL;
             }
+            break;
         }
-        else {
-            *inout_len += n;
-            if ((apr_ssize_t)len <= n) {
-                break;
-            }
-            len -= (apr_size_t)n;
-            data += n;
+        *inout_len += n;
+        if ((apr_ssize_t)len <= n) {
+            break;
         }
+        len -= (apr_size_t)n;
+        data += n;
     }
-
     return rv;
 }
 
@@ -460,37 +520,138 @@ static apr_status_t c1_in_feed_brigade(h2_session *session,
                                        apr_bucket_brigade *bb,
                                        apr_ssize_t *inout_len)
 {
+    h2_c1_io *io = &session->io;
     apr_status_t rv = APR_SUCCESS;
-    apr_bucket* b;
+    apr_bucket *b, *end;
+    apr_size_t len;
+    const char *data;
 
     *inout_len = 0;
-    while (!APR_BRIGADE_EMPTY(bb)) {
-        b = APR_BRIGADE_FIRST(bb);
+    b = APR_BRIGADE_FIRST(bb);
+    if (b != APR_BRIGADE_SENTINEL(bb)
+        && APR_BUCKET_NEXT(b) == APR_BRIGADE_SENTINEL(bb)) {
+        /* a single bucket, feed it without copying */
         if (!APR_BUCKET_IS_METADATA(b)) {
-            rv = c1_in_feed_bucket(session, b, inout_len);
-            if (APR_SUCCESS != rv) goto cleanup;
+            rv = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+            if (APR_SUCCESS == rv) {
+                rv = c1_in_feed_data(session, data, len, inout_len);
+            }
         }
-        apr_bucket_delete(b);
+        goto cleanup;
+    }
+
+    /* Several buckets, from the core input filter on cleartext or from
+     * TLS reads collected in read_and_feed(). Copy them into our buffer,
+     * so nghttp2 sees them in one piece. */
+    if (!io->in_buf) {
+        io->in_buf = ap_malloc(io->in_buf_size);
+    }
+    while (!APR_BRIGADE_EMPTY(bb)) {
+        len = io->in_buf_size;
+        rv = apr_brigade_flatten(bb, io->in_buf, &len);
+        if (APR_SUCCESS != rv || len == 0) goto cleanup;
+        rv = apr_brigade_partition(bb, (apr_off_t)len, &end);
+        if (APR_SUCCESS != rv) goto cleanup;
+        while ((b = APR_BRIGADE_FIRST(bb)) != end) {
+            apr_bucket_delete(b);
+        }
+        rv = c1_in_feed_data(session, io->in_buf, len, inout_len);
+        if (APR_SUCCESS != rv) goto cleanup;
     }
 cleanup:
     apr_brigade_cleanup(bb);
     return rv;
 }
 
+/* Grow the input buffer when reads fill it, shrink it again when
+ * the connection has calmed down. */
+static void c1_in_buf_adapt(h2_c1_io *io, apr_off_t nread)
+{
+    apr_size_t size = io->in_buf_size;
+
+    if (nread >= (apr_off_t)size && size < IN_BUF_MAX) {
+        size *= 2;
+        io->in_buf_small = 0;
+    }
+    else if (nread < (apr_off_t)(size / 4) && size > IN_BUF_MIN) {
+        if (++io->in_buf_small >= IN_BUF_SHRINK_READS) {
+            size /= 2;
+            io->in_buf_small = 0;
+        }
+    }
+    else {
+        io->in_buf_small = 0;
+    }
+    if (size != io->in_buf_size) {
+        io->in_buf_size = size;
+        if (io->in_buf) {
+            free(io->in_buf);
+            io->in_buf = NULL;
+        }
+    }
+}
+
+void h2_c1_io_in_release(h2_c1_io *io)
+{
+    if (io->in_buf) {
+        free(io->in_buf);
+        io->in_buf = NULL;
+    }
+    io->in_buf_size = IN_BUF_MIN;
+    io->in_buf_small = 0;
+}
+
+/* mod_ssl returns at most AP_IOBUFSIZE bytes per read, whatever we ask
+ * for. Read on until the input buffer is full or nothing more is there,
+ * so that TLS input is batched like cleartext. Anything but data ends
+ * the batch, a failure is seen again on the next read. */
+static void c1_in_read_more(h2_session *session, apr_off_t *pbytes_read)
+{
+    h2_c1_io *io = &session->io;
+    apr_off_t len;
+    apr_status_t rv;
+
+    while (*pbytes_read >= 0 && *pbytes_read < (apr_off_t)io->in_buf_size) {
+        rv = ap_get_brigade(session->c1->input_filters, io->in_more,
+                            AP_MODE_READBYTES, APR_NONBLOCK_READ,
+                            (apr_off_t)io->in_buf_size - *pbytes_read);
+        if (APR_SUCCESS != rv || APR_BRIGADE_EMPTY(io->in_more)) {
+            apr_brigade_cleanup(io->in_more);
+            break;
+        }
+        apr_brigade_length(io->in_more, 0, &len);
+        APR_BRIGADE_CONCAT(session->bbtmp, io->in_more);
+        if (len <= 0) {
+            *pbytes_read = len;
+            break;
+        }
+        *pbytes_read += len;
+    }
+}
+
 static apr_status_t read_and_feed(h2_session *session)
 {
-    apr_ssize_t bytes_fed, bytes_requested;
+    apr_ssize_t bytes_fed;
+    apr_off_t bytes_read;
     apr_status_t rv;
 
-    bytes_requested = H2MAX(APR_BUCKET_BUFF_SIZE, session->max_stream_mem * 4);
     rv = ap_get_brigade(session->c1->input_filters,
                         session->bbtmp, AP_MODE_READBYTES,
-                        APR_NONBLOCK_READ, bytes_requested);
+                        APR_NONBLOCK_READ, (apr_off_t)session->io.in_buf_size);
 
     if (APR_SUCCESS == rv) {
+        /* -1 for buckets of unknown length, do not mistake it for
+         * a small read */
+        apr_brigade_length(session->bbtmp, 0, &bytes_read);
+        if (session->io.is_tls) {
+            c1_in_read_more(session, &bytes_read);
+        }
         h2_util_bb_log(session->c1, session->id, APLOG_TRACE2, "c1 in", session->bbtmp);
         rv = c1_in_feed_brigade(session, session->bbtmp, &bytes_fed);
         session->io.bytes_read += bytes_fed;
+        if (bytes_read >= 0) {
+            c1_in_buf_adapt(&session->io, bytes_read);
+        }
     }
     return rv;
 }
@@ -48,6 +48,14 @@ typedef struct {
     char *scratch;
     apr_size_t ssize;
     apr_size_t slen;
+
+    char *in_buf;               /* contiguous input fed to nghttp2 */
+    apr_size_t in_buf_size;     /* bytes requested from input filters */
+    int in_buf_small;           /* consecutive reads using little of it */
+    apr_bucket_brigade *in_more; /* further TLS reads for one batch */
+
+    struct h2_zerocopy *zc;     /* for MSG_ZEROCOPY writes on cleartext c1 */
+    apr_off_t zc_size;          /* min length of a write to use it */
 } h2_c1_io;
 
 apr_status_t h2_c1_io_init(h2_c1_io *io, struct h2_session *session);
@@ -87,6 +95,12 @@ int h2_c1_io_needs_flush(h2_c1_io *io);
  */
 int h2_c1_io_pending(h2_c1_io *io);
 
+/**
+ * Free the input buffer and start again at the minimum size with the
+ * next read. For connections going idle.
+ */
+void h2_c1_io_in_release(h2_c1_io *io);
+
 struct h2_session;
 
 /**
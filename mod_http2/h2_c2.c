@@ -44,6 +44,7 @@
 #include "h2_c2_filter.h"
 #include "h2_protocol.h"
 #include "h2_mplx.h"
+#include "h2_preload.h"
 #include "h2_request.h"
 #include "h2_headers.h"
 #include "h2_session.h"
@@ -151,6 +152,21 @@ static int abort_on_oom(int retcode)
     return retcode; /* unreachable, hopefully. */
 }
 
+/* number of c2 pools, each with its own allocator, alive in this child */
+static volatile apr_uint32_t c2_pools;
+
+static apr_status_t c2_pool_cleanup(void *dummy)
+{
+    (void)dummy;
+    apr_atomic_dec32(&c2_pools);
+    return APR_SUCCESS;
+}
+
+apr_uint32_t h2_c2_pool_count(void)
+{
+    return apr_atomic_read32(&c2_pools);
+}
+
 conn_rec *h2_c2_create(conn_rec *c1, apr_pool_t *parent)
 {
     apr_allocator_t *allocator;
@@ -180,6 +196,8 @@ conn_rec *h2_c2_create(conn_rec *c1, apr_pool_t *parent)
     apr_allocator_owner_set(allocator, pool);
     apr_pool_abort_set(abort_on_oom, pool);
     apr_pool_tag(pool, "h2_c2_conn");
+    apr_atomic_inc32(&c2_pools);
+    apr_pool_cleanup_register(pool, NULL, c2_pool_cleanup, apr_pool_cleanup_null);
 
     c2 = (conn_rec *) apr_palloc(pool, sizeof(conn_rec));
     memcpy(c2, c1, sizeof(conn_rec));
@@ -435,6 +453,9 @@ static apr_status_t beam_out(conn_rec *c2, h2_conn_ctx_t *conn_ctx, apr_bucket_b
         }
     }
 
+    if (!conn_ctx->response_at && !APR_BRIGADE_EMPTY(bb)) {
+        conn_ctx->response_at = apr_time_now();
+    }
     rv = h2_beam_send(conn_ctx->beam_out, c2, bb, APR_BLOCK_READ, &written);
 
     if (APR_STATUS_IS_EAGAIN(rv)) {
@@ -642,10 +663,13 @@ static int h2_c2_hook_process(conn_rec* c)
 static void check_push(request_rec *r, const char *tag)
 {
     apr_array_header_t *push_list = h2_config_push_list(r);
+    int nlinks = 0;
 
-    if (!r->expecting_100 && push_list && push_list->nelts > 0) {
-        int i, old_status;
-        const char *old_line;
+    if (r->expecting_100) {
+        return;
+    }
+    if (push_list && push_list->nelts > 0) {
+        int i;
 
         ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
                       "%s, early announcing %d resources for push",
@@ -656,6 +680,13 @@ static void check_push(request_rec *r, const char *tag)
                            apr_psprintf(r->pool, "<%s>; rel=preload%s",
                                         push->uri_ref, push->critical? "; critical" : ""));
         }
+        nlinks += push_list->nelts;
+    }
+    nlinks += h2_preload_add_links(r, r->headers_out);
+    if (nlinks > 0) {
+        int old_status;
+        const char *old_line;
+
         old_status = r->status;
         old_line = r->status_line;
         r->status = 103;
@@ -44,6 +44,12 @@ apr_status_t h2_c2_child_init(apr_pool_t *pool, server_rec *s);
 conn_rec *h2_c2_create(conn_rec *c1, apr_pool_t *parent);
 void h2_c2_destroy(conn_rec *c2);
 
+/**
+ * Get the number of secondary connection pools, each with its own
+ * allocator, currently alive in this child process.
+ */
+apr_uint32_t h2_c2_pool_count(void);
+
 /**
  * Process a secondary connection for a HTTP/2 stream request.
  */
@@ -15,6 +15,7 @@
  */
  
 #include <assert.h>
+#include <limits.h>
 
 #include <apr_hash.h>
 #include <apr_lib.h>
@@ -34,6 +35,7 @@
 #include "h2_c1.h"
 #include "h2_config.h"
 #include "h2_protocol.h"
+#include "h2_push.h"
 #include "h2_private.h"
 
 #define DEF_VAL     (-1)
@@ -75,6 +77,21 @@ typedef struct h2_config {
     int padding_always;
     int output_buffered;
     apr_interval_time_t stream_timeout;/* beam timeout */
+    int push_link_cache_size;        /* # of parsed Link headers cached per child */
+    int preload_learning;            /* learn preloads for early hints */
+    int preload_max;                 /* max learned preloads announced */
+    int push_diary_digest;           /* hash function used in push diary */
+    int win_autotune;                /* adapt stream windows to rate and RTT */
+    int win_max;                     /* max autotuned stream window */
+    int win_budget;                  /* max autotuned window growth/conn */
+    apr_int64_t win_budget_child;    /* max autotuned window growth/child */
+    int win_update_batch;            /* input consumed before c1 is told */
+    apr_int64_t win_update_delay;    /* max delay of told consumption */
+    apr_int64_t idle_grace_max;      /* max wait for next request on idle c1 */
+    apr_int64_t idle_grace_min;      /* min wait for next request on idle c1 */
+    int shared_poll;                 /* threads polling c1 for all sessions */
+    int wait_suspend;                /* let the mpm watch waiting sessions */
+    int zerocopy_size;               /* min cleartext write sent with MSG_ZEROCOPY */
 } h2_config;
 
 typedef struct h2_dir_config {
@@ -110,6 +127,21 @@ static h2_config defconf = {
     1,                      /* padding always */
     1,                      /* stream output buffered */
     -1,                     /* beam timeout */
+    256,                    /* push link cache size */
+    0,                      /* preload learning */
+    4,                      /* preload max */
+    H2_PUSH_DIGEST_SHA256,  /* push diary digest */
+    0,                      /* window autotune */
+    4 * 1024 * 1024,        /* window max */
+    16 * 1024 * 1024,       /* window budget per connection */
+    256 * 1024 * 1024,      /* window budget per child */
+    32 * 1024,              /* window update batch bytes */
+    100 * 1000,             /* window update batch delay, 100ms */
+    100 * 1000,             /* idle grace max, 100ms */
+    0,                      /* idle grace min */
+    0,                      /* shared poll threads, off */
+    0,                      /* wait suspend, off */
+    0,                      /* zerocopy size, off */
 };
 
 static h2_dir_config defdconf = {
@@ -153,6 +185,21 @@ void *h2_config_create_svr(apr_pool_t *pool, server_rec *s)
     conf->padding_always       = DEF_VAL;
     conf->output_buffered      = DEF_VAL;
     conf->stream_timeout         = DEF_VAL;
+    conf->push_link_cache_size = DEF_VAL;
+    conf->preload_learning     = DEF_VAL;
+    conf->preload_max          = DEF_VAL;
+    conf->push_diary_digest    = DEF_VAL;
+    conf->win_autotune         = DEF_VAL;
+    conf->win_max              = DEF_VAL;
+    conf->win_budget           = DEF_VAL;
+    conf->win_budget_child     = DEF_VAL;
+    conf->win_update_batch     = DEF_VAL;
+    conf->win_update_delay     = DEF_VAL;
+    conf->idle_grace_max       = DEF_VAL;
+    conf->idle_grace_min       = DEF_VAL;
+    conf->shared_poll          = DEF_VAL;
+    conf->wait_suspend         = DEF_VAL;
+    conf->zerocopy_size        = DEF_VAL;
     return conf;
 }
 
@@ -195,6 +242,21 @@ static void *h2_config_merge(apr_pool_t *pool, void *basev, void *addv)
     n->padding_bits         = H2_CONFIG_GET(add, base, padding_bits);
     n->padding_always       = H2_CONFIG_GET(add, base, padding_always);
     n->stream_timeout         = H2_CONFIG_GET(add, base, stream_timeout);
+    n->push_link_cache_size = H2_CONFIG_GET(add, base, push_link_cache_size);
+    n->preload_learning     = H2_CONFIG_GET(add, base, preload_learning);
+    n->preload_max          = H2_CONFIG_GET(add, base, preload_max);
+    n->push_diary_digest    = H2_CONFIG_GET(add, base, push_diary_digest);
+    n->win_autotune         = H2_CONFIG_GET(add, base, win_autotune);
+    n->win_max              = H2_CONFIG_GET(add, base, win_max);
+    n->win_budget           = H2_CONFIG_GET(add, base, win_budget);
+    n->win_budget_child     = H2_CONFIG_GET(add, base, win_budget_child);
+    n->win_update_batch     = H2_CONFIG_GET(add, base, win_update_batch);
+    n->win_update_delay     = H2_CONFIG_GET(add, base, win_update_delay);
+    n->idle_grace_max       = H2_CONFIG_GET(add, base, idle_grace_max);
+    n->idle_grace_min       = H2_CONFIG_GET(add, base, idle_grace_min);
+    n->shared_poll          = H2_CONFIG_GET(add, base, shared_poll);
+    n->wait_suspend         = H2_CONFIG_GET(add, base, wait_suspend);
+    n->zerocopy_size        = H2_CONFIG_GET(add, base, zerocopy_size);
     return n;
 }
 
@@ -278,6 +340,36 @@ static apr_int64_t h2_srv_config_geti64(const h2_config *conf, h2_config_var_t v
             return H2_CONFIG_GET(conf, &defconf, output_buffered);
         case H2_CONF_STREAM_TIMEOUT:
             return H2_CONFIG_GET(conf, &defconf, stream_timeout);
+        case H2_CONF_PUSH_LINK_CACHE_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, push_link_cache_size);
+        case H2_CONF_PRELOAD_LEARNING:
+            return H2_CONFIG_GET(conf, &defconf, preload_learning);
+        case H2_CONF_PRELOAD_MAX:
+            return H2_CONFIG_GET(conf, &defconf, preload_max);
+        case H2_CONF_PUSH_DIARY_DIGEST:
+            return H2_CONFIG_GET(conf, &defconf, push_diary_digest);
+        case H2_CONF_WIN_AUTOTUNE:
+            return H2_CONFIG_GET(conf, &defconf, win_autotune);
+        case H2_CONF_WIN_MAX:
+            return H2_CONFIG_GET(conf, &defconf, win_max);
+        case H2_CONF_WIN_BUDGET:
+            return H2_CONFIG_GET(conf, &defconf, win_budget);
+        case H2_CONF_WIN_BUDGET_CHILD:
+            return H2_CONFIG_GET(conf, &defconf, win_budget_child);
+        case H2_CONF_WIN_UPDATE_BATCH:
+            return H2_CONFIG_GET(conf, &defconf, win_update_batch);
+        case H2_CONF_WIN_UPDATE_DELAY:
+            return H2_CONFIG_GET(conf, &defconf, win_update_delay);
+        case H2_CONF_IDLE_GRACE_MAX:
+            return H2_CONFIG_GET(conf, &defconf, idle_grace_max);
+        case H2_CONF_IDLE_GRACE_MIN:
+            return H2_CONFIG_GET(conf, &defconf, idle_grace_min);
+        case H2_CONF_SHARED_POLL:
+            return H2_CONFIG_GET(conf, &defconf, shared_poll);
+        case H2_CONF_WAIT_SUSPEND:
+            return H2_CONFIG_GET(conf, &defconf, wait_suspend);
+        case H2_CONF_ZEROCOPY_SIZE:
+            return H2_CONFIG_GET(conf, &defconf, zerocopy_size);
         default:
             return DEF_VAL;
     }
@@ -340,6 +432,39 @@ static void h2_srv_config_seti(h2_config *conf, h2_config_var_t var, int val)
         case H2_CONF_OUTPUT_BUFFER:
             H2_CONFIG_SET(conf, output_buffered, val);
             break;
+        case H2_CONF_PUSH_LINK_CACHE_SIZE:
+            H2_CONFIG_SET(conf, push_link_cache_size, val);
+            break;
+        case H2_CONF_PRELOAD_LEARNING:
+            H2_CONFIG_SET(conf, preload_learning, val);
+            break;
+        case H2_CONF_PRELOAD_MAX:
+            H2_CONFIG_SET(conf, preload_max, val);
+            break;
+        case H2_CONF_PUSH_DIARY_DIGEST:
+            H2_CONFIG_SET(conf, push_diary_digest, val);
+            break;
+        case H2_CONF_WIN_AUTOTUNE:
+            H2_CONFIG_SET(conf, win_autotune, val);
+            break;
+        case H2_CONF_WIN_MAX:
+            H2_CONFIG_SET(conf, win_max, val);
+            break;
+        case H2_CONF_WIN_BUDGET:
+            H2_CONFIG_SET(conf, win_budget, val);
+            break;
+        case H2_CONF_WIN_UPDATE_BATCH:
+            H2_CONFIG_SET(conf, win_update_batch, val);
+            break;
+        case H2_CONF_SHARED_POLL:
+            H2_CONFIG_SET(conf, shared_poll, val);
+            break;
+        case H2_CONF_WAIT_SUSPEND:
+            H2_CONFIG_SET(conf, wait_suspend, val);
+            break;
+        case H2_CONF_ZEROCOPY_SIZE:
+            H2_CONFIG_SET(conf, zerocopy_size, val);
+            break;
         default:
             break;
     }
@@ -354,6 +479,18 @@ static void h2_srv_config_seti64(h2_config *conf, h2_config_var_t var, apr_int64
         case H2_CONF_STREAM_TIMEOUT:
             H2_CONFIG_SET(conf, stream_timeout, val);
             break;
+        case H2_CONF_WIN_BUDGET_CHILD:
+            H2_CONFIG_SET(conf, win_budget_child, val);
+            break;
+        case H2_CONF_WIN_UPDATE_DELAY:
+            H2_CONFIG_SET(conf, win_update_delay, val);
+            break;
+        case H2_CONF_IDLE_GRACE_MAX:
+            H2_CONFIG_SET(conf, idle_grace_max, val);
+            break;
+        case H2_CONF_IDLE_GRACE_MIN:
+            H2_CONFIG_SET(conf, idle_grace_min, val);
+            break;
         default:
             h2_srv_config_seti(conf, var, (int)val);
             break;
@@ -868,6 +1005,170 @@ static const char *h2_conf_set_stream_timeout(cmd_parms *cmd,
     return NULL;
 }
 
+static const char *h2_conf_set_push_link_cache_size(cmd_parms *cmd,
+                                                    void *dirconf, const char *value)
+{
+    int val = (int)apr_atoi64(value);
+    if (val < 0) {
+        return "value must be >= 0";
+    }
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_PUSH_LINK_CACHE_SIZE, val);
+    return NULL;
+}
+
+static const char *h2_conf_set_preload_learning(cmd_parms *cmd,
+                                                void *dirconf, const char *value)
+{
+    int val;
+
+    if (!strcasecmp(value, "On")) val = 1;
+    else if (!strcasecmp(value, "Off")) val = 0;
+    else return "value must be On or Off";
+
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_PRELOAD_LEARNING, val);
+    return NULL;
+}
+
+static const char *h2_conf_set_preload_max(cmd_parms *cmd,
+                                           void *dirconf, const char *value)
+{
+    int val = (int)apr_atoi64(value);
+    if (val < 0) {
+        return "value must be >= 0";
+    }
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_PRELOAD_MAX, val);
+    return NULL;
+}
+
+static const char *h2_conf_set_push_diary_digest(cmd_parms *cmd,
+                                                 void *dirconf, const char *value)
+{
+    int val;
+
+    if (!strcasecmp(value, "fast")) val = H2_PUSH_DIGEST_FAST;
+    else if (!strcasecmp(value, "SHA256")) val = H2_PUSH_DIGEST_SHA256;
+    else return "value must be 'fast' or 'SHA256'";
+
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_PUSH_DIARY_DIGEST, val);
+    return NULL;
+}
+
+static const char *h2_conf_set_win_autotune(cmd_parms *cmd,
+                                            void *dirconf, const char *value)
+{
+    int val;
+
+    if (!strcasecmp(value, "On")) val = 1;
+    else if (!strcasecmp(value, "Off")) val = 0;
+    else return "value must be On or Off";
+
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WIN_AUTOTUNE, val);
+    return NULL;
+}
+
+static const char *h2_conf_set_win_max(cmd_parms *cmd,
+                                       void *dirconf, const char *value)
+{
+    apr_int64_t val = apr_atoi64(value);
+    if (val < 1024 || val > NGHTTP2_MAX_WINDOW_SIZE) {
+        return "value must be >= 1024 and < 2^31";
+    }
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WIN_MAX, (int)val);
+    return NULL;
+}
+
+static const char *h2_conf_set_win_budget(cmd_parms *cmd, void *dirconf,
+                                          const char *conn, const char *child)
+{
+    apr_int64_t val = apr_atoi64(conn);
+    if (val < 0 || val > INT_MAX) {
+        return "connection budget must be >= 0 and < 2^31";
+    }
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WIN_BUDGET, (int)val);
+    if (child) {
+        val = apr_atoi64(child);
+        if (val < 0) {
+            return "child budget must be >= 0";
+        }
+        CONFIG_CMD_SET64(cmd, dirconf, H2_CONF_WIN_BUDGET_CHILD, val);
+    }
+    return NULL;
+}
+
+static const char *h2_conf_set_win_update_batch(cmd_parms *cmd, void *dirconf,
+                                                const char *bytes,
+                                                const char *delay)
+{
+    apr_int64_t val = apr_atoi64(bytes);
+    apr_interval_time_t timeout;
+
+    if (val < 0 || val > INT_MAX) {
+        return "bytes must be >= 0 and < 2^31";
+    }
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WIN_UPDATE_BATCH, (int)val);
+    if (delay) {
+        if (ap_timeout_parameter_parse(delay, &timeout, "ms") != APR_SUCCESS
+            || timeout < 0) {
+            return "Invalid delay value";
+        }
+        CONFIG_CMD_SET64(cmd, dirconf, H2_CONF_WIN_UPDATE_DELAY, timeout);
+    }
+    return NULL;
+}
+
+static const char *h2_conf_set_idle_grace(cmd_parms *cmd, void *dirconf,
+                                          const char *max, const char *min)
+{
+    apr_interval_time_t tmax, tmin = 0;
+
+    if (ap_timeout_parameter_parse(max, &tmax, "ms") != APR_SUCCESS
+        || tmax < 0) {
+        return "Invalid max grace value";
+    }
+    if (min && (ap_timeout_parameter_parse(min, &tmin, "ms") != APR_SUCCESS
+                || tmin < 0 || tmin > tmax)) {
+        return "Invalid min grace value, must not exceed max";
+    }
+    CONFIG_CMD_SET64(cmd, dirconf, H2_CONF_IDLE_GRACE_MAX, tmax);
+    CONFIG_CMD_SET64(cmd, dirconf, H2_CONF_IDLE_GRACE_MIN, tmin);
+    return NULL;
+}
+
+static const char *h2_conf_set_shared_poll(cmd_parms *cmd,
+                                           void *dirconf, const char *value)
+{
+    int val = (int)apr_atoi64(value);
+    if (val < 0 || val > 64) {
+        return "value must be between 0 and 64";
+    }
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_SHARED_POLL, val);
+    return NULL;
+}
+
+static const char *h2_conf_set_wait_suspend(cmd_parms *cmd,
+                                            void *dirconf, const char *value)
+{
+    int val;
+
+    if (!strcasecmp(value, "On")) val = 1;
+    else if (!strcasecmp(value, "Off")) val = 0;
+    else return "value must be On or Off";
+
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_WAIT_SUSPEND, val);
+    return NULL;
+}
+
+static const char *h2_conf_set_zerocopy_size(cmd_parms *cmd,
+                                             void *dirconf, const char *value)
+{
+    apr_int64_t val = apr_atoi64(value);
+    if (val < 0 || val > APR_INT32_MAX) {
+        return "value must be a non-negative number of bytes";
+    }
+    CONFIG_CMD_SET(cmd, dirconf, H2_CONF_ZEROCOPY_SIZE, (int)val);
+    return NULL;
+}
+
 void h2_get_num_workers(server_rec *s, int *minw, int *maxw)
 {
     int threads_per_child = 0;
@@ -938,6 +1239,30 @@ const command_rec h2_cmds[] = {
                   RSRC_CONF, "set stream output buffer on/off"),
     AP_INIT_TAKE1("H2StreamTimeout", h2_conf_set_stream_timeout, NULL,
                   RSRC_CONF, "set stream timeout"),
+    AP_INIT_TAKE1("H2PushLinkCacheSize", h2_conf_set_push_link_cache_size, NULL,
+                  RSRC_CONF, "number of parsed Link headers to cache per child"),
+    AP_INIT_TAKE1("H2PreloadLearning", h2_conf_set_preload_learning, NULL,
+                  RSRC_CONF, "on to learn preloads for 103 responses from client requests"),
+    AP_INIT_TAKE1("H2PreloadLearningMax", h2_conf_set_preload_max, NULL,
+                  RSRC_CONF, "max number of learned preloads announced in a 103 response"),
+    AP_INIT_TAKE1("H2PushDiaryDigest", h2_conf_set_push_diary_digest, NULL,
+                  RSRC_CONF, "hash function for the push diary, fast or SHA256"),
+    AP_INIT_TAKE1("H2WindowAutoTune", h2_conf_set_win_autotune, NULL,
+                  RSRC_CONF, "on to adapt stream windows to the upload rate and RTT"),
+    AP_INIT_TAKE1("H2WindowMax", h2_conf_set_win_max, NULL,
+                  RSRC_CONF, "maximum size an adapted stream window may grow to"),
+    AP_INIT_TAKE12("H2WindowBudget", h2_conf_set_win_budget, NULL,
+                   RSRC_CONF, "bytes windows may grow in total on a connection [and child]"),
+    AP_INIT_TAKE12("H2WindowUpdateBatch", h2_conf_set_win_update_batch, NULL,
+                   RSRC_CONF, "request body bytes read [and delay checked on the next read] before flow control is updated"),
+    AP_INIT_TAKE12("H2IdleGrace", h2_conf_set_idle_grace, NULL,
+                   RSRC_CONF, "max [and min] wait of an idle connection for its next request"),
+    AP_INIT_TAKE1("H2SharedPoll", h2_conf_set_shared_poll, NULL,
+                   RSRC_CONF, "number of threads per child polling all idle connections, 0 for a pollset per connection"),
+    AP_INIT_TAKE1("H2WaitSuspend", h2_conf_set_wait_suspend, NULL,
+                  RSRC_CONF, "on to free the thread of a connection waiting on its streams, with event MPM"),
+    AP_INIT_TAKE1("H2ZeroCopySize", h2_conf_set_zerocopy_size, NULL,
+                  RSRC_CONF, "min size of cleartext writes sent with MSG_ZEROCOPY, 0 to disable"),
     AP_END_CMD
 };
 
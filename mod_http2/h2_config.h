@@ -43,6 +43,21 @@ typedef enum {
     H2_CONF_PADDING_ALWAYS,
     H2_CONF_OUTPUT_BUFFER,
     H2_CONF_STREAM_TIMEOUT,
+    H2_CONF_PUSH_LINK_CACHE_SIZE,
+    H2_CONF_PRELOAD_LEARNING,
+    H2_CONF_PRELOAD_MAX,
+    H2_CONF_PUSH_DIARY_DIGEST,
+    H2_CONF_WIN_AUTOTUNE,
+    H2_CONF_WIN_MAX,
+    H2_CONF_WIN_BUDGET,
+    H2_CONF_WIN_BUDGET_CHILD,
+    H2_CONF_WIN_UPDATE_BATCH,
+    H2_CONF_WIN_UPDATE_DELAY,
+    H2_CONF_IDLE_GRACE_MAX,
+    H2_CONF_IDLE_GRACE_MIN,
+    H2_CONF_SHARED_POLL,
+    H2_CONF_WAIT_SUSPEND,
+    H2_CONF_ZEROCOPY_SIZE,
 } h2_config_var_t;
 
 struct apr_hash_t;
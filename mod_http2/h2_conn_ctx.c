@@ -92,6 +92,8 @@ apr_status_t h2_conn_ctx_init_for_c2(h2_conn_ctx_t **pctx, conn_rec *c2,
     conn_ctx->started_at = apr_time_now();
     conn_ctx->done = 0;
     conn_ctx->done_at = 0;
+    conn_ctx->response_at = 0;
+    conn_ctx->timing = stream->timing;
 
     *pctx = conn_ctx;
     return rv;
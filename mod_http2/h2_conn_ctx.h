@@ -17,6 +17,8 @@
 #ifndef __mod_h2__h2_conn_ctx__
 #define __mod_h2__h2_conn_ctx__
 
+#include "h2.h"
+
 struct h2_session;
 struct h2_stream;
 struct h2_mplx;
@@ -63,6 +65,8 @@ struct h2_conn_ctx_t {
     volatile int done;               /* c2: processing has finished */
     apr_time_t started_at;           /* c2: when processing started */
     apr_time_t done_at;              /* c2: when processing was done */
+    apr_time_t response_at;          /* c2: when response output started */
+    h2_stream_timing timing;         /* c2: timings of the stream processed */
 };
 typedef struct h2_conn_ctx_t h2_conn_ctx_t;
 
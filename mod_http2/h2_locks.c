@@ -0,0 +1,168 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+#include <apr_atomic.h>
+#include <apr_time.h>
+
+#include <httpd.h>
+
+#include "h2_locks.h"
+
+
+static const char *LockClassNames[] = {
+    "mplx",
+    "beam",
+    "workers",
+    "slot",
+    "fifo",
+};
+
+int h2_lock_stats_enabled(void)
+{
+#ifdef H2_LOCK_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+const char *h2_lock_class_name(h2_lock_class cls)
+{
+    if (cls >= 0 && cls < H2_LOCK_CLASS_COUNT) {
+        return LockClassNames[cls];
+    }
+    return "unknown";
+}
+
+apr_uint32_t h2_lock_hist_percentile(const apr_uint32_t *hist, int pct)
+{
+    apr_uint64_t total = 0, sum = 0;
+    int i;
+
+    for (i = 0; i < H2_LOCK_HIST_BUCKETS; ++i) {
+        total += hist[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    for (i = 0; i < H2_LOCK_HIST_BUCKETS; ++i) {
+        sum += hist[i];
+        if (sum * 100 >= total * (apr_uint64_t)pct) {
+            break;
+        }
+    }
+    if (i >= H2_LOCK_HIST_BUCKETS) {
+        i = H2_LOCK_HIST_BUCKETS - 1;
+    }
+    return ((apr_uint32_t)1) << i;
+}
+
+#ifdef H2_LOCK_STATS
+
+static h2_lock_stats LockStats[H2_LOCK_CLASS_COUNT];
+
+static int hist_bucket(apr_interval_time_t usecs)
+{
+    int i = 0;
+
+    while (usecs > 0 && i < H2_LOCK_HIST_BUCKETS - 1) {
+        usecs >>= 1;
+        ++i;
+    }
+    return i;
+}
+
+void h2_lock_stats_get(h2_lock_class cls, h2_lock_stats *stats)
+{
+    h2_lock_stats *ls = &LockStats[cls];
+    int i;
+
+    stats->acquired = apr_atomic_read32(&ls->acquired);
+    stats->contended = apr_atomic_read32(&ls->contended);
+    for (i = 0; i < H2_LOCK_HIST_BUCKETS; ++i) {
+        stats->wait_hist[i] = apr_atomic_read32(&ls->wait_hist[i]);
+        stats->hold_hist[i] = apr_atomic_read32(&ls->hold_hist[i]);
+    }
+}
+
+apr_status_t h2_lock_acquire(apr_thread_mutex_t *lock, h2_lock_class cls,
+                             apr_time_t *pheld_since)
+{
+    h2_lock_stats *ls = &LockStats[cls];
+    apr_status_t rv;
+
+    rv = apr_thread_mutex_trylock(lock);
+    if (APR_STATUS_IS_EBUSY(rv)) {
+        apr_time_t start = apr_time_now();
+
+        rv = apr_thread_mutex_lock(lock);
+        if (APR_SUCCESS == rv) {
+            *pheld_since = apr_time_now();
+            apr_atomic_inc32(&ls->contended);
+            apr_atomic_inc32(&ls->wait_hist[hist_bucket(*pheld_since - start)]);
+        }
+    }
+    else if (APR_SUCCESS == rv) {
+        *pheld_since = apr_time_now();
+    }
+    if (APR_SUCCESS == rv) {
+        apr_atomic_inc32(&ls->acquired);
+    }
+    return rv;
+}
+
+static void record_hold(h2_lock_class cls, apr_time_t held_since)
+{
+    apr_atomic_inc32(&LockStats[cls].hold_hist[
+        hist_bucket(apr_time_now() - held_since)]);
+}
+
+apr_status_t h2_lock_release(apr_thread_mutex_t *lock, h2_lock_class cls,
+                             apr_time_t *pheld_since)
+{
+    record_hold(cls, *pheld_since);
+    return apr_thread_mutex_unlock(lock);
+}
+
+apr_status_t h2_lock_cond_wait(apr_thread_cond_t *cond, apr_thread_mutex_t *lock,
+                               apr_interval_time_t timeout, h2_lock_class cls,
+                               apr_time_t *pheld_since)
+{
+    apr_status_t rv;
+
+    record_hold(cls, *pheld_since);
+    if (timeout >= 0) {
+        rv = apr_thread_cond_timedwait(cond, lock, timeout);
+    }
+    else {
+        rv = apr_thread_cond_wait(cond, lock);
+    }
+    /* we own the lock again, whatever the outcome of the wait */
+    *pheld_since = apr_time_now();
+    return rv;
+}
+
+#else /* H2_LOCK_STATS */
+
+void h2_lock_stats_get(h2_lock_class cls, h2_lock_stats *stats)
+{
+    (void)cls;
+    memset(stats, 0, sizeof(*stats));
+}
+
+#endif /* H2_LOCK_STATS */
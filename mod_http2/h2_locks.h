@@ -0,0 +1,109 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __mod_h2__h2_locks__
+#define __mod_h2__h2_locks__
+
+#include <apr_time.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+
+/*******************************************************************************
+ * Lock statistics
+ *
+ * Built with H2_LOCK_STATS (configure --enable-lock-stats), the locks of
+ * the multiplexers, beams, workers, worker slots and the workers' fifo
+ * are taken via the functions here. They count acquisitions, how many of
+ * those found the lock already held, and keep histograms of the time
+ * spent waiting for a contended lock and of the time it was then held.
+ * Time spent in a condition wait does not count as held.
+ *
+ * Numbers are per lock class and child process. They are shown by the
+ * server-status handlers.
+ *
+ * Without H2_LOCK_STATS, the macros below are plain apr calls.
+ ******************************************************************************/
+
+typedef enum {
+    H2_LOCK_MPLX,
+    H2_LOCK_BEAM,
+    H2_LOCK_WORKERS,
+    H2_LOCK_SLOT,
+    H2_LOCK_FIFO,
+    H2_LOCK_CLASS_COUNT
+} h2_lock_class;
+
+/* Bucket 0 counts durations below 1 usec, bucket i > 0 those in
+ * [2^(i-1), 2^i) usecs. The last bucket takes everything above. */
+#define H2_LOCK_HIST_BUCKETS    20
+
+typedef struct h2_lock_stats {
+    apr_uint32_t acquired;
+    apr_uint32_t contended;
+    apr_uint32_t wait_hist[H2_LOCK_HIST_BUCKETS];
+    apr_uint32_t hold_hist[H2_LOCK_HIST_BUCKETS];
+} h2_lock_stats;
+
+/**
+ * @return != 0 iff lock statistics are compiled in.
+ */
+int h2_lock_stats_enabled(void);
+
+/**
+ * The name of a lock class, e.g. "mplx".
+ */
+const char *h2_lock_class_name(h2_lock_class cls);
+
+/**
+ * Get a copy of the current statistics for a lock class.
+ */
+void h2_lock_stats_get(h2_lock_class cls, h2_lock_stats *stats);
+
+/**
+ * Get the upper bound in usecs of the histogram bucket where the
+ * given percentile of recorded durations is reached, 0 if empty.
+ */
+apr_uint32_t h2_lock_hist_percentile(const apr_uint32_t *hist, int pct);
+
+#ifdef H2_LOCK_STATS
+
+apr_status_t h2_lock_acquire(apr_thread_mutex_t *lock, h2_lock_class cls,
+                             apr_time_t *pheld_since);
+apr_status_t h2_lock_release(apr_thread_mutex_t *lock, h2_lock_class cls,
+                             apr_time_t *pheld_since);
+apr_status_t h2_lock_cond_wait(apr_thread_cond_t *cond, apr_thread_mutex_t *lock,
+                               apr_interval_time_t timeout, h2_lock_class cls,
+                               apr_time_t *pheld_since);
+
+#define H2_LOCK(l, cls, since)  h2_lock_acquire((l), (cls), (since))
+#define H2_UNLOCK(l, cls, since)  h2_lock_release((l), (cls), (since))
+#define H2_COND_WAIT(c, l, cls, since) \
+    h2_lock_cond_wait((c), (l), -1, (cls), (since))
+#define H2_COND_TIMEDWAIT(c, l, t, cls, since) \
+    h2_lock_cond_wait((c), (l), (t), (cls), (since))
+
+#else /* H2_LOCK_STATS */
+
+#define H2_LOCK(l, cls, since)  apr_thread_mutex_lock(l)
+#define H2_UNLOCK(l, cls, since)  apr_thread_mutex_unlock(l)
+#define H2_COND_WAIT(c, l, cls, since)  apr_thread_cond_wait((c), (l))
+#define H2_COND_TIMEDWAIT(c, l, t, cls, since) \
+    apr_thread_cond_timedwait((c), (l), (t))
+
+#endif /* H2_LOCK_STATS */
+
+#endif /* defined(__mod_h2__h2_locks__) */
@@ -40,12 +40,15 @@
 #include "h2_conn_ctx.h"
 #include "h2_protocol.h"
 #include "h2_mplx.h"
+#include "h2_poller.h"
 #include "h2_request.h"
 #include "h2_stream.h"
 #include "h2_session.h"
 #include "h2_c2.h"
 #include "h2_workers.h"
 #include "h2_util.h"
+#include "h2_locks.h"
+#include "h2_vhost_stats.h"
 
 
 /* utility for iterating over ihash stream sets */
@@ -66,6 +69,7 @@ static apr_status_t mplx_pollset_poll(h2_mplx *m, apr_interval_time_t timeout,
                             stream_ev_callback *on_stream_input,
                             stream_ev_callback *on_stream_output,
                             void *on_ctx);
+static void mplx_wakeup(h2_mplx *m);
 
 static apr_pool_t *pchild;
 
@@ -75,22 +79,28 @@ apr_status_t h2_mplx_c1_child_init(apr_pool_t *pool, server_rec *s)
     return APR_SUCCESS;
 }
 
+#define H2_MPLX_LOCK(m)    \
+    H2_LOCK(m->lock, H2_LOCK_MPLX, &m->lock_since)
+
+#define H2_MPLX_UNLOCK(m)    \
+    H2_UNLOCK(m->lock, H2_LOCK_MPLX, &m->lock_since)
+
 #define H2_MPLX_ENTER(m)    \
-    do { apr_status_t rv_lock; if ((rv_lock = apr_thread_mutex_lock(m->lock)) != APR_SUCCESS) {\
+    do { apr_status_t rv_lock; if ((rv_lock = H2_MPLX_LOCK(m)) != APR_SUCCESS) {\
         return rv_lock;\
     } } while(0)
 
 #define H2_MPLX_LEAVE(m)    \
-    apr_thread_mutex_unlock(m->lock)
+    H2_MPLX_UNLOCK(m)
  
 #define H2_MPLX_ENTER_ALWAYS(m)    \
-    apr_thread_mutex_lock(m->lock)
+    H2_MPLX_LOCK(m)
 
 #define H2_MPLX_ENTER_MAYBE(m, dolock)    \
-    if (dolock) apr_thread_mutex_lock(m->lock)
+    if (dolock) H2_MPLX_LOCK(m)
 
 #define H2_MPLX_LEAVE_MAYBE(m, dolock)    \
-    if (dolock) apr_thread_mutex_unlock(m->lock)
+    if (dolock) H2_MPLX_UNLOCK(m)
 
 static void c1_input_consumed(void *ctx, h2_bucket_beam *beam, apr_off_t length)
 {
@@ -173,6 +183,21 @@ static void m_stream_cleanup(h2_mplx *m, h2_stream *stream)
     }
 }
 
+/* number of mplx pools, each with its own allocator, alive in this child */
+static volatile apr_uint32_t mplx_pools;
+
+static apr_status_t mplx_pool_cleanup(void *dummy)
+{
+    (void)dummy;
+    apr_atomic_dec32(&mplx_pools);
+    return APR_SUCCESS;
+}
+
+apr_uint32_t h2_mplx_pool_count(void)
+{
+    return apr_atomic_read32(&mplx_pools);
+}
+
 /**
  * A h2_mplx needs to be thread-safe *and* if will be called by
  * the h2_session thread *and* the h2_worker threads. Therefore:
@@ -216,6 +241,8 @@ h2_mplx *h2_mplx_c1_create(h2_stream *stream0, server_rec *s, apr_pool_t *parent
     if (!m->pool) goto failure;
 
     apr_pool_tag(m->pool, "h2_mplx");
+    apr_atomic_inc32(&mplx_pools);
+    apr_pool_cleanup_register(m->pool, NULL, mplx_pool_cleanup, apr_pool_cleanup_null);
     apr_allocator_owner_set(allocator, m->pool);
 
     status = apr_thread_mutex_create(&mutex, APR_THREAD_MUTEX_DEFAULT,
@@ -232,6 +259,10 @@ h2_mplx *h2_mplx_c1_create(h2_stream *stream0, server_rec *s, apr_pool_t *parent
 
     m->max_streams = h2_config_sgeti(s, H2_CONF_MAX_STREAMS);
     m->stream_max_mem = h2_config_sgeti(s, H2_CONF_STREAM_MAX_MEM);
+    /* stay well below the window, so clients never stall on our batching */
+    m->input_batch = H2MIN(h2_config_sgeti(s, H2_CONF_WIN_UPDATE_BATCH),
+                           h2_config_sgeti(s, H2_CONF_WIN_SIZE) / 2);
+    m->input_batch_delay = h2_config_sgeti64(s, H2_CONF_WIN_UPDATE_DELAY);
 
     m->streams = h2_ihash_create(m->pool, offsetof(h2_stream,id));
     m->shold = h2_ihash_create(m->pool, offsetof(h2_stream,id));
@@ -244,25 +275,35 @@ h2_mplx *h2_mplx_c1_create(h2_stream *stream0, server_rec *s, apr_pool_t *parent
     m->last_mood_change = apr_time_now();
     m->mood_update_interval = apr_time_from_msec(100);
 
-    status = mplx_pollset_create(m);
-    if (APR_SUCCESS != status) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, status, m->c1, APLOGNO(10308)
-                      "nghttp2: could not create pollset");
-        goto failure;
+    conn_ctx = h2_conn_ctx_get(m->c1);
+    if (h2_poller_active()) {
+        status = h2_poller_waiter_create(&m->poll_waiter, m->pool,
+                                         conn_ctx->pfd_out_prod.desc.s);
+        if (APR_SUCCESS != status) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, m->c1,
+                          "h2_mplx(%ld): no shared poller, using own pollset",
+                          m->id);
+            m->poll_waiter = NULL;
+        }
+    }
+    if (!m->poll_waiter) {
+        status = mplx_pollset_create(m);
+        if (APR_SUCCESS != status) {
+            ap_log_cerror(APLOG_MARK, APLOG_ERR, status, m->c1, APLOGNO(10308)
+                          "nghttp2: could not create pollset");
+            goto failure;
+        }
     }
     m->streams_to_poll = apr_array_make(m->pool, 10, sizeof(h2_stream*));
     m->streams_ev_in = apr_array_make(m->pool, 10, sizeof(h2_stream*));
     m->streams_ev_out = apr_array_make(m->pool, 10, sizeof(h2_stream*));
 
-#if !H2_POLL_STREAMS
     status = apr_thread_mutex_create(&m->poll_lock, APR_THREAD_MUTEX_DEFAULT,
                                      m->pool);
     if (APR_SUCCESS != status) goto failure;
     m->streams_input_read = h2_iq_create(m->pool, 10);
     m->streams_output_written = h2_iq_create(m->pool, 10);
-#endif
 
-    conn_ctx = h2_conn_ctx_get(m->c1);
     mplx_pollset_add(m, conn_ctx);
 
     m->scratch_r = apr_pcalloc(m->pool, sizeof(*m->scratch_r));
@@ -304,6 +345,17 @@ static int m_stream_iter_wrap(void *ctx, void *stream)
     return x->cb(stream, x->ctx);
 }
 
+apr_status_t h2_mplx_c1_processing_get(h2_mplx *m, int *pcount,
+                                       int *plimit, int *pmax)
+{
+    H2_MPLX_ENTER(m);
+    *pcount = m->processing_count;
+    *plimit = m->processing_limit;
+    *pmax = m->processing_max;
+    H2_MPLX_LEAVE(m);
+    return APR_SUCCESS;
+}
+
 apr_status_t h2_mplx_c1_streams_do(h2_mplx *m, h2_mplx_stream_cb *cb, void *ctx)
 {
     stream_iter_ctx_t x;
@@ -407,7 +459,8 @@ void h2_mplx_c1_destroy(h2_mplx *m)
      *    in order to wake us and let us check again. 
      *    Eventually, this has to succeed. */    
     for (i = 0; h2_ihash_count(m->shold) > 0; ++i) {
-        status = apr_thread_cond_timedwait(m->join_wait, m->lock, apr_time_from_sec(wait_secs));
+        status = H2_COND_TIMEDWAIT(m->join_wait, m->lock, apr_time_from_sec(wait_secs),
+                                   H2_LOCK_MPLX, &m->lock_since);
         
         if (APR_STATUS_IS_TIMEUP(status)) {
             /* This can happen if we have very long running requests
@@ -499,6 +552,9 @@ static void c1_purge_streams(h2_mplx *m)
                               m->id, stream->id, c2_ctx->stream_id);
             }
 
+            /* the request is logged when c2 goes away, give it the
+             * final timings of the stream. */
+            c2_ctx->timing = stream->timing;
             h2_conn_ctx_destroy(c2);
             h2_c2_destroy(c2);
         }
@@ -597,6 +653,7 @@ static apr_status_t c1_process_stream(h2_mplx *m,
     if (APR_SUCCESS != rv) goto cleanup;
 
     stream->scheduled = 1;
+    stream->timing.queued = apr_time_now();
     h2_ihash_add(m->streams, stream);
     if (h2_stream_is_ready(stream)) {
         /* already have a response */
@@ -702,14 +759,12 @@ static void c2_beam_input_read_notify(void *ctx, h2_bucket_beam *beam)
         if (conn_ctx->pipe_in_drain[H2_PIPE_IN]) {
             apr_file_putc(1, conn_ctx->pipe_in_drain[H2_PIPE_IN]);
         }
-#if !H2_POLL_STREAMS
         else {
             apr_thread_mutex_lock(conn_ctx->mplx->poll_lock);
             h2_iq_append(conn_ctx->mplx->streams_input_read, conn_ctx->stream_id);
-            apr_pollset_wakeup(conn_ctx->mplx->pollset);
+            mplx_wakeup(conn_ctx->mplx);
             apr_thread_mutex_unlock(conn_ctx->mplx->poll_lock);
         }
-#endif
     }
 }
 
@@ -722,14 +777,12 @@ static void c2_beam_output_write_notify(void *ctx, h2_bucket_beam *beam)
         if (conn_ctx->pipe_out_prod[H2_PIPE_IN]) {
             apr_file_putc(1, conn_ctx->pipe_out_prod[H2_PIPE_IN]);
         }
-#if !H2_POLL_STREAMS
         else {
             apr_thread_mutex_lock(conn_ctx->mplx->poll_lock);
             h2_iq_append(conn_ctx->mplx->streams_output_written, conn_ctx->stream_id);
-            apr_pollset_wakeup(conn_ctx->mplx->pollset);
+            mplx_wakeup(conn_ctx->mplx);
             apr_thread_mutex_unlock(conn_ctx->mplx->poll_lock);
         }
-#endif
     }
 }
 
@@ -756,6 +809,8 @@ static apr_status_t c2_setup_io(h2_mplx *m, conn_rec *c2, h2_stream *stream)
         conn_ctx->beam_in = stream->input;
         h2_beam_on_was_empty(stream->input, c2_beam_input_write_notify, c2);
         h2_beam_on_received(stream->input, c2_beam_input_read_notify, c2);
+        h2_beam_on_received_batch(stream->input, m->input_batch,
+                                  m->input_batch_delay);
         h2_beam_on_consumed(stream->input, c1_input_consumed, stream);
     }
     else {
@@ -763,6 +818,14 @@ static apr_status_t c2_setup_io(h2_mplx *m, conn_rec *c2, h2_stream *stream)
     }
 
 #if H2_POLL_STREAMS
+    if (m->poll_waiter) {
+        /* events reach us via the iqueues, no pipes needed */
+        memset(&conn_ctx->pfd_out_prod, 0, sizeof(conn_ctx->pfd_out_prod));
+        memset(&conn_ctx->pipe_in_prod, 0, sizeof(conn_ctx->pipe_in_prod));
+        memset(&conn_ctx->pipe_in_drain, 0, sizeof(conn_ctx->pipe_in_drain));
+        goto cleanup;
+    }
+
     if (!conn_ctx->mplx_pool) {
         apr_pool_create(&conn_ctx->mplx_pool, m->pool);
         apr_pool_tag(conn_ctx->mplx_pool, "H2_MPLX_C2");
@@ -857,7 +920,7 @@ static conn_rec *s_next_c2(h2_mplx *m)
     stream->c2 = c2;
     ++m->processing_count;
     APR_ARRAY_PUSH(m->streams_to_poll, h2_stream *) = stream;
-    apr_pollset_wakeup(m->pollset);
+    mplx_wakeup(m);
 
     return c2;
 }
@@ -870,7 +933,7 @@ apr_status_t h2_mplx_worker_pop_c2(h2_mplx *m, conn_rec **out_c)
     ap_assert(m);
     ap_assert(m->lock);
     
-    if (APR_SUCCESS != (rv = apr_thread_mutex_lock(m->lock))) {
+    if (APR_SUCCESS != (rv = H2_MPLX_LOCK(m))) {
         return rv;
     }
     
@@ -908,6 +971,10 @@ static void s_c2_done(h2_mplx *m, conn_rec *c2, h2_conn_ctx_t *conn_ctx)
                   "h2_mplx(%s-%d): request done, %f ms elapsed",
                   conn_ctx->id, conn_ctx->stream_id,
                   (conn_ctx->done_at - conn_ctx->started_at) / 1000.0);
+    h2_vhost_stats_c2_done(conn_ctx->server,
+                           conn_ctx->timing.queued?
+                           (conn_ctx->started_at - conn_ctx->timing.queued) : -1,
+                           conn_ctx->done_at - conn_ctx->started_at);
     
     if (!conn_ctx->has_final_response) {
         ap_log_cerror(APLOG_MARK, APLOG_TRACE1, conn_ctx->last_err, c2,
@@ -1082,11 +1149,24 @@ static apr_status_t mplx_pollset_create(h2_mplx *m)
                               APR_POLLSET_WAKEABLE);
 }
 
+static void mplx_wakeup(h2_mplx *m)
+{
+    if (m->poll_waiter) {
+        h2_poller_wakeup(m->poll_waiter);
+    }
+    else {
+        apr_pollset_wakeup(m->pollset);
+    }
+}
+
 static apr_status_t mplx_pollset_add(h2_mplx *m, h2_conn_ctx_t *conn_ctx)
 {
     apr_status_t rv = APR_SUCCESS;
     const char *name = "";
 
+    if (!m->pollset) {
+        return APR_SUCCESS;
+    }
     if (conn_ctx->pfd_out_prod.reqevents) {
         name = "adding out";
         rv = apr_pollset_add(m->pollset, &conn_ctx->pfd_out_prod);
@@ -1112,6 +1192,9 @@ static apr_status_t mplx_pollset_remove(h2_mplx *m, h2_conn_ctx_t *conn_ctx)
     apr_status_t rv = APR_SUCCESS;
     const char *name = "";
 
+    if (!m->pollset) {
+        return APR_SUCCESS;
+    }
     if (conn_ctx->pfd_out_prod.reqevents) {
         rv = apr_pollset_remove(m->pollset, &conn_ctx->pfd_out_prod);
         conn_ctx->pfd_out_prod.reqevents = 0;
@@ -1134,6 +1217,70 @@ cleanup:
     return rv;
 }
 
+#if H2_POLL_STREAMS
+static void pfds_add(apr_array_header_t *pfds, const apr_pollfd_t *pfd)
+{
+    if (pfd->reqevents) {
+        apr_pollfd_t *npfd = apr_array_push(pfds);
+        *npfd = *pfd;
+        npfd->client_data = NULL;
+    }
+}
+
+static int pfds_collect_iter(void *ctx, void *val)
+{
+    apr_array_header_t *pfds = ctx;
+    h2_stream *stream = val;
+    h2_conn_ctx_t *conn_ctx;
+
+    if (stream->c2 && (conn_ctx = h2_conn_ctx_get(stream->c2))) {
+        pfds_add(pfds, &conn_ctx->pfd_out_prod);
+        pfds_add(pfds, &conn_ctx->pfd_in_drain);
+    }
+    return 1;
+}
+#endif /* H2_POLL_STREAMS */
+
+apr_status_t h2_mplx_c1_pfds_get(h2_mplx *m, apr_pool_t *p,
+                                 apr_array_header_t **ppfds)
+{
+#if H2_POLL_STREAMS
+    apr_array_header_t *pfds;
+    int pending;
+
+    *ppfds = NULL;
+    if (!m->pollset) {
+        /* using the shared poller, stream events arrive without pipes */
+        return APR_ENOTIMPL;
+    }
+    H2_MPLX_ENTER(m);
+    /* Events queued for us only wake up our own pollset, the copies
+     * would miss them. The same holds for streams a worker starts later:
+     * their pipes are not among the copies, only our pollset is woken. */
+    apr_thread_mutex_lock(m->poll_lock);
+    pending = !h2_iq_empty(m->streams_input_read)
+              || !h2_iq_empty(m->streams_output_written);
+    apr_thread_mutex_unlock(m->poll_lock);
+    pending = pending || !h2_iq_empty(m->q) || m->streams_to_poll->nelts > 0;
+    if (pending) {
+        H2_MPLX_LEAVE(m);
+        return APR_EAGAIN;
+    }
+    pfds = apr_array_make(p, 1 + 2 * m->processing_count, sizeof(apr_pollfd_t));
+    pfds_add(pfds, &h2_conn_ctx_get(m->c1)->pfd_out_prod);
+    h2_ihash_iter(m->streams, pfds_collect_iter, pfds);
+    h2_ihash_iter(m->shold, pfds_collect_iter, pfds);
+    H2_MPLX_LEAVE(m);
+    *ppfds = pfds;
+    return APR_SUCCESS;
+#else
+    (void)m;
+    (void)p;
+    *ppfds = NULL;
+    return APR_ENOTIMPL;
+#endif
+}
+
 static apr_status_t mplx_pollset_poll(h2_mplx *m, apr_interval_time_t timeout,
                             stream_ev_callback *on_stream_input,
                             stream_ev_callback *on_stream_output,
@@ -1144,6 +1291,8 @@ static apr_status_t mplx_pollset_poll(h2_mplx *m, apr_interval_time_t timeout,
     apr_int32_t nresults, i;
     h2_conn_ctx_t *conn_ctx;
     h2_stream *stream;
+    int c1_input;
+    apr_time_t end = (timeout > 0)? apr_time_now() + timeout : 0;
 
     /* Make sure we are not called recursively. */
     ap_assert(!m->polling);
@@ -1168,7 +1317,6 @@ static apr_status_t mplx_pollset_poll(h2_mplx *m, apr_interval_time_t timeout,
                 apr_array_clear(m->streams_to_poll);
             }
 
-#if !H2_POLL_STREAMS
             apr_thread_mutex_lock(m->poll_lock);
             if (!h2_iq_empty(m->streams_input_read)
                 || !h2_iq_empty(m->streams_output_written)) {
@@ -1190,7 +1338,48 @@ static apr_status_t mplx_pollset_poll(h2_mplx *m, apr_interval_time_t timeout,
                 break;
             }
             apr_thread_mutex_unlock(m->poll_lock);
-#endif
+            if (m->poll_waiter) {
+                nresults = 0;
+                c1_input = 0;
+                if (timeout > 0) {
+                    /* woken up before, wait only for what is left */
+                    timeout = end - apr_time_now();
+                    if (timeout <= 0) {
+                        timeout = 0;
+                    }
+                }
+                H2_MPLX_LEAVE(m);
+                if (timeout == 0) {
+                    /* do not involve the poller, just look */
+                    apr_pollfd_t c1_pfd = h2_conn_ctx_get(m->c1)->pfd_out_prod;
+                    apr_int32_t n;
+
+                    rv = apr_poll(&c1_pfd, 1, &n, 0);
+                    c1_input = (APR_SUCCESS == rv && n > 0);
+                    if (c1_input || APR_STATUS_IS_EINTR(rv)) {
+                        rv = APR_SUCCESS;
+                    }
+                }
+                else {
+                    rv = h2_poller_wait(m->poll_waiter, timeout, &c1_input);
+                }
+                H2_MPLX_ENTER_ALWAYS(m);
+                if (timeout == 0 && !c1_input) {
+                    /* The stream queues were empty above. */
+                    if (APR_SUCCESS == rv) {
+                        rv = APR_TIMEUP;
+                    }
+                    break;
+                }
+                if (c1_input && on_stream_input) {
+                    APR_ARRAY_PUSH(m->streams_ev_in, h2_stream*) = m->stream0;
+                }
+                /* woken up, look at the queues again */
+                if (APR_SUCCESS == rv && !c1_input) {
+                    rv = APR_EINTR;
+                }
+                continue;
+            }
             H2_MPLX_LEAVE(m);
             rv = apr_pollset_poll(m->pollset, timeout >= 0? timeout : -1, &nresults, &results);
             H2_MPLX_ENTER_ALWAYS(m);
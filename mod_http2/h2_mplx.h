@@ -64,6 +64,8 @@ struct h2_mplx {
     struct h2_iqueue *q;            /* all stream ids that need to be started */
 
     apr_size_t stream_max_mem;      /* max memory to buffer for a stream */
+    apr_off_t input_batch;          /* input read before c1 is notified */
+    apr_interval_time_t input_batch_delay; /* max delay of that notification */
     int max_streams;                /* max # of concurrent streams */
     int max_stream_id_started;      /* highest stream id that started processing */
 
@@ -76,18 +78,20 @@ struct h2_mplx {
     int irritations_since; /* irritations (>0) or happy events (<0) since last mood change */
 
     apr_thread_mutex_t *lock;
+#ifdef H2_LOCK_STATS
+    apr_time_t lock_since;          /* when lock was last acquired */
+#endif
     struct apr_thread_cond_t *join_wait;
     
     apr_pollset_t *pollset;         /* pollset for c1/c2 IO events */
     apr_array_header_t *streams_to_poll; /* streams to add to the pollset */
     apr_array_header_t *streams_ev_in;
     apr_array_header_t *streams_ev_out;
+    struct h2_poll_waiter *poll_waiter; /* != NULL when using the shared poller */
 
-#if !H2_POLL_STREAMS
     apr_thread_mutex_t *poll_lock; /* not the painter */
     struct h2_iqueue *streams_input_read;  /* streams whose input has been read from */
     struct h2_iqueue *streams_output_written; /* streams whose output has been written to */
-#endif
     struct h2_workers *workers;     /* h2 workers process wide instance */
 
     request_rec *scratch_r;         /* pseudo request_rec for scoreboard reporting */
@@ -102,6 +106,12 @@ apr_status_t h2_mplx_c1_child_init(apr_pool_t *pool, server_rec *s);
 h2_mplx *h2_mplx_c1_create(struct h2_stream *stream0, server_rec *s, apr_pool_t *master,
                            struct h2_workers *workers);
 
+/**
+ * Get the number of multiplexer pools, each with its own allocator,
+ * currently alive in this child process.
+ */
+apr_uint32_t h2_mplx_pool_count(void);
+
 /**
  * Destroy the mplx, shutting down all ongoing processing.
  * @param m the mplx destroyed
@@ -162,6 +172,20 @@ apr_status_t h2_mplx_c1_reprioritize(h2_mplx *m, h2_stream_pri_cmp_fn *cmp,
 
 typedef apr_status_t stream_ev_callback(void *ctx, struct h2_stream *stream);
 
+/**
+ * Get copies of the poll descriptors for c1 input and the c2 event pipes
+ * of all streams, for someone else to wait on them, e.g. the MPM. When
+ * any of them becomes ready, h2_mplx_c1_poll() will see an event.
+ * @param m the multiplexer
+ * @param p the pool to allocate the array in
+ * @param ppfds the array of apr_pollfd_t on success
+ * @return APR_ENOTIMPL when c2 events are not signalled via pipes
+ *         APR_EAGAIN when events are already pending or streams still
+ *         wait for a worker, poll instead
+ */
+apr_status_t h2_mplx_c1_pfds_get(h2_mplx *m, apr_pool_t *p,
+                                 apr_array_header_t **ppfds);
+
 /**
  * Poll the primary connection for input and the active streams for output.
  * Invoke the callback for any stream where an event happened.
@@ -176,6 +200,13 @@ void h2_mplx_c2_output_written(h2_mplx *m, conn_rec *c2);
 
 typedef int h2_mplx_stream_cb(struct h2_stream *s, void *userdata);
 
+/**
+ * Get the number of streams processing in c2s and the current and
+ * maximum limit on it, consistent at the time of the call.
+ */
+apr_status_t h2_mplx_c1_processing_get(h2_mplx *m, int *pcount,
+                                       int *plimit, int *pmax);
+
 /**
  * Iterate over all streams known to mplx from the primary connection.
  * @param m the mplx
@@ -0,0 +1,284 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include <apr_atomic.h>
+#include <apr_hash.h>
+#include <apr_poll.h>
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_proc.h>
+
+#include <httpd.h>
+#include <http_log.h>
+
+#include "h2_private.h"
+#include "h2_config.h"
+#include "h2_poller.h"
+
+/* Size of a loop's pollset. With epoll, kqueue and event ports this only
+ * limits the results of one apr_pollset_poll() call. With poll and select
+ * it is also the most sockets the pollset takes. */
+#define H2_POLLER_BATCH     1024
+
+typedef struct {
+    apr_pool_t *pool;
+    apr_pollset_t *pollset;
+    apr_thread_mutex_t *lock;       /* protects pollset changes and waiters */
+    apr_hash_t *waiters;            /* waiters with their socket in pollset */
+    apr_thread_t *thread;
+    volatile int stopping;
+    apr_uint32_t capacity;          /* max waiters, 0 for no limit */
+    volatile apr_uint32_t nwaiters; /* waiters created for this loop */
+} h2_poller_loop;
+
+struct h2_poll_waiter {
+    h2_poller_loop *loop;
+    apr_pollfd_t pfd;
+    apr_thread_mutex_t *lock;
+    apr_thread_cond_t *cond;
+    int woken;                      /* h2_poller_wakeup() was called */
+    int c1_input;                   /* c1 socket became readable */
+};
+
+static h2_poller_loop *loops;
+static int loop_count;
+static volatile apr_uint32_t loop_next;
+
+static void *APR_THREAD_FUNC loop_run(apr_thread_t *thread, void *data)
+{
+    h2_poller_loop *loop = data;
+    const apr_pollfd_t *results;
+    apr_int32_t nresults, i;
+    h2_poll_waiter *waiter;
+    apr_status_t rv;
+
+    while (!loop->stopping) {
+        rv = apr_pollset_poll(loop->pollset, -1, &nresults, &results);
+        if (APR_SUCCESS != rv) {
+            if (!APR_STATUS_IS_EINTR(rv) && !APR_STATUS_IS_TIMEUP(rv)) {
+                ap_log_perror(APLOG_MARK, APLOG_DEBUG, rv, loop->pool,
+                              "h2_poller: poll failed");
+            }
+            continue;
+        }
+        apr_thread_mutex_lock(loop->lock);
+        for (i = 0; i < nresults; ++i) {
+            waiter = results[i].client_data;
+            /* The waiter might have gone after the poll returned. Only
+             * waiters still registered are alive. */
+            if (!apr_hash_get(loop->waiters, &waiter, sizeof(waiter))) {
+                continue;
+            }
+            apr_pollset_remove(loop->pollset, &waiter->pfd);
+            apr_hash_set(loop->waiters, &waiter, sizeof(waiter), NULL);
+
+            apr_thread_mutex_lock(waiter->lock);
+            waiter->c1_input = 1;
+            apr_thread_cond_signal(waiter->cond);
+            apr_thread_mutex_unlock(waiter->lock);
+        }
+        apr_thread_mutex_unlock(loop->lock);
+    }
+    apr_thread_exit(thread, APR_SUCCESS);
+    return NULL;
+}
+
+static apr_status_t pollers_cleanup(void *data)
+{
+    apr_status_t rv;
+    int i;
+
+    (void)data;
+    for (i = 0; i < loop_count; ++i) {
+        loops[i].stopping = 1;
+        apr_pollset_wakeup(loops[i].pollset);
+    }
+    for (i = 0; i < loop_count; ++i) {
+        apr_thread_join(&rv, loops[i].thread);
+    }
+    loop_count = 0;
+    loops = NULL;
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_poller_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    apr_status_t rv = APR_SUCCESS;
+    int i, n;
+
+    n = h2_config_sgeti(s, H2_CONF_SHARED_POLL);
+    if (n <= 0) {
+        return APR_SUCCESS;
+    }
+    loops = apr_pcalloc(pchild, (apr_size_t)n * sizeof(h2_poller_loop));
+    for (i = 0; i < n; ++i) {
+        h2_poller_loop *loop = &loops[i];
+
+        apr_pool_create(&loop->pool, pchild);
+        apr_pool_tag(loop->pool, "h2_poller");
+        /* sessions add and remove their sockets while we poll */
+        rv = apr_pollset_create(&loop->pollset, H2_POLLER_BATCH, loop->pool,
+                                APR_POLLSET_THREADSAFE|APR_POLLSET_WAKEABLE);
+        if (APR_SUCCESS != rv) goto cleanup;
+        if (!strcmp("poll", apr_pollset_method_name(loop->pollset))
+            || !strcmp("select", apr_pollset_method_name(loop->pollset))) {
+            /* one slot is taken by the wakeup pipe */
+            loop->capacity = H2_POLLER_BATCH - 1;
+        }
+        rv = apr_thread_mutex_create(&loop->lock, APR_THREAD_MUTEX_DEFAULT,
+                                     loop->pool);
+        if (APR_SUCCESS != rv) goto cleanup;
+        loop->waiters = apr_hash_make(loop->pool);
+        rv = apr_thread_create(&loop->thread, NULL, loop_run, loop, loop->pool);
+        if (APR_SUCCESS != rv) goto cleanup;
+        loop_count = i + 1;
+    }
+
+cleanup:
+    if (loop_count > 0) {
+        apr_pool_cleanup_register(pchild, NULL, pollers_cleanup,
+                                  apr_pool_cleanup_null);
+    }
+    if (APR_SUCCESS != rv) {
+        /* sessions fall back to their own pollsets */
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                     "h2_poller: unable to start shared poller %d of %d, "
+                     "using a pollset per connection", i + 1, n);
+        pollers_cleanup(NULL);
+    }
+    return APR_SUCCESS;
+}
+
+int h2_poller_active(void)
+{
+    return loop_count > 0;
+}
+
+static apr_status_t waiter_cleanup(void *data)
+{
+    h2_poll_waiter *waiter = data;
+
+    apr_atomic_dec32(&waiter->loop->nwaiters);
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_poller_waiter_create(h2_poll_waiter **pwaiter, apr_pool_t *pool,
+                                     apr_socket_t *socket)
+{
+    h2_poll_waiter *waiter;
+    h2_poller_loop *loop = NULL;
+    apr_uint32_t start;
+    apr_status_t rv;
+    int i;
+
+    *pwaiter = NULL;
+    if (!loop_count) {
+        return APR_ENOTIMPL;
+    }
+    /* Every waiter might wait at the same time, so a loop with a limited
+     * pollset only takes as many as it has room for. */
+    start = apr_atomic_inc32(&loop_next);
+    for (i = 0; i < loop_count && !loop; ++i) {
+        loop = &loops[(start + (apr_uint32_t)i) % (apr_uint32_t)loop_count];
+        if (apr_atomic_inc32(&loop->nwaiters) >= loop->capacity
+            && loop->capacity) {
+            apr_atomic_dec32(&loop->nwaiters);
+            loop = NULL;
+        }
+    }
+    if (!loop) {
+        /* all full, the session uses a pollset of its own */
+        return APR_ENOSPC;
+    }
+    waiter = apr_pcalloc(pool, sizeof(*waiter));
+    waiter->loop = loop;
+    apr_pool_cleanup_register(pool, waiter, waiter_cleanup,
+                              apr_pool_cleanup_null);
+    waiter->pfd.desc_type = APR_POLL_SOCKET;
+    waiter->pfd.desc.s = socket;
+    waiter->pfd.reqevents = APR_POLLIN | APR_POLLERR | APR_POLLHUP;
+    waiter->pfd.client_data = waiter;
+    rv = apr_thread_mutex_create(&waiter->lock, APR_THREAD_MUTEX_DEFAULT, pool);
+    if (APR_SUCCESS != rv) return rv;
+    rv = apr_thread_cond_create(&waiter->cond, pool);
+    if (APR_SUCCESS != rv) return rv;
+    *pwaiter = waiter;
+    return APR_SUCCESS;
+}
+
+void h2_poller_wakeup(h2_poll_waiter *waiter)
+{
+    apr_thread_mutex_lock(waiter->lock);
+    waiter->woken = 1;
+    apr_thread_cond_signal(waiter->cond);
+    apr_thread_mutex_unlock(waiter->lock);
+}
+
+apr_status_t h2_poller_wait(h2_poll_waiter *waiter, apr_interval_time_t timeout,
+                            int *pc1_input)
+{
+    h2_poller_loop *loop = waiter->loop;
+    apr_status_t rv = APR_SUCCESS;
+    apr_time_t end = (timeout > 0)? apr_time_now() + timeout : 0;
+
+    /* The loop takes its lock before ours, never hold ours while
+     * taking the loop's. */
+    apr_thread_mutex_lock(loop->lock);
+    if (!apr_hash_get(loop->waiters, &waiter, sizeof(waiter))) {
+        rv = apr_pollset_add(loop->pollset, &waiter->pfd);
+        if (APR_SUCCESS == rv) {
+            apr_hash_set(loop->waiters, &waiter, sizeof(waiter), waiter);
+        }
+    }
+    apr_thread_mutex_unlock(loop->lock);
+    if (APR_SUCCESS != rv) {
+        return rv;
+    }
+
+    apr_thread_mutex_lock(waiter->lock);
+    while (!waiter->woken && !waiter->c1_input && APR_SUCCESS == rv) {
+        if (timeout < 0) {
+            rv = apr_thread_cond_wait(waiter->cond, waiter->lock);
+        }
+        else if (timeout > 0) {
+            rv = apr_thread_cond_timedwait(waiter->cond, waiter->lock, timeout);
+            timeout = end - apr_time_now();
+        }
+        else {
+            rv = APR_TIMEUP;
+        }
+    }
+    if (waiter->woken || waiter->c1_input) {
+        rv = APR_SUCCESS;
+    }
+    *pc1_input = waiter->c1_input;
+    waiter->woken = waiter->c1_input = 0;
+    apr_thread_mutex_unlock(waiter->lock);
+
+    if (!*pc1_input) {
+        /* not woken by the loop, our socket is still registered */
+        apr_thread_mutex_lock(loop->lock);
+        if (apr_hash_get(loop->waiters, &waiter, sizeof(waiter))) {
+            apr_pollset_remove(loop->pollset, &waiter->pfd);
+            apr_hash_set(loop->waiters, &waiter, sizeof(waiter), NULL);
+        }
+        apr_thread_mutex_unlock(loop->lock);
+    }
+    return rv;
+}
@@ -0,0 +1,76 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __mod_h2__h2_poller__
+#define __mod_h2__h2_poller__
+
+/*******************************************************************************
+ * shared poller
+ *
+ * Without it, every h2 session creates its own wakeable apr_pollset to
+ * wait for c1 input and c2 events, plus a pair of pipes for each stream
+ * to signal those events. That is one epoll instance and one wakeup pipe
+ * per connection.
+ *
+ * With 'H2SharedPoll n', a child runs n poller threads instead. Each one
+ * has a single pollset. A session that wants to wait registers its c1
+ * socket with one of them and sleeps on its own condition variable.
+ * Streams signal c2 events to that same condition, without pipes. A
+ * poller that sees a c1 socket become readable removes it again and
+ * wakes the session.
+ ******************************************************************************/
+
+typedef struct h2_poll_waiter h2_poll_waiter;
+
+/**
+ * Start the poller threads for the child, if configured.
+ */
+apr_status_t h2_poller_child_init(apr_pool_t *pchild, server_rec *s);
+
+/**
+ * != 0 if the child runs shared pollers and sessions should use them.
+ */
+int h2_poller_active(void);
+
+/**
+ * Create a waiter for the given c1 socket.
+ * @param pwaiter the created waiter on success
+ * @param pool the pool owning the waiter
+ * @param socket the c1 socket to watch for input
+ * @return APR_ENOSPC when all pollers are full, APR_ENOTIMPL when there
+ *         are none. Use a pollset of your own then.
+ */
+apr_status_t h2_poller_waiter_create(h2_poll_waiter **pwaiter, apr_pool_t *pool,
+                                     apr_socket_t *socket);
+
+/**
+ * Wake up the waiter, from any thread.
+ */
+void h2_poller_wakeup(h2_poll_waiter *waiter);
+
+/**
+ * Wait until the c1 socket has input, h2_poller_wakeup() was called or
+ * the timeout passed. A wakeup that happened before the call ends the
+ * wait at once.
+ * @param waiter the waiter
+ * @param timeout max time to wait, < 0 for no limit
+ * @param pc1_input set to != 0 when the c1 socket has input
+ * @return APR_SUCCESS, APR_TIMEUP or an error
+ */
+apr_status_t h2_poller_wait(h2_poll_waiter *waiter, apr_interval_time_t timeout,
+                            int *pc1_input);
+
+#endif /* defined(__mod_h2__h2_poller__) */
@@ -0,0 +1,468 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+
+#include <apr_strings.h>
+#include <apr_hash.h>
+#include <apr_time.h>
+#include <apr_thread_mutex.h>
+
+#include <httpd.h>
+#include <http_core.h>
+#include <http_log.h>
+
+#include "h2_private.h"
+#include "h2.h"
+#include "h2_config.h"
+#include "h2_conn_ctx.h"
+#include "h2_headers.h"
+#include "h2_preload.h"
+#include "h2_session.h"
+#include "h2_util.h"
+
+#define H2_PRELOAD_MAX_DOCS     256   /* documents remembered per child */
+#define H2_PRELOAD_MAX_RES      16    /* resources remembered per document */
+#define H2_PRELOAD_MAX_KEY_LEN  1024  /* authority + document path */
+#define H2_PRELOAD_MAX_PATH_LEN 512   /* resource path */
+#define H2_PRELOAD_DECAY_LOADS  32    /* halve counts after this many loads */
+#define H2_PRELOAD_WINDOW       apr_time_from_sec(2)
+
+/* Values of 'sec-fetch-dest' that are valid 'as' attributes of a preload */
+static const char *preload_as[] = {
+    NULL, "style", "script", "font", "image", "audio", "video", "track",
+};
+
+typedef struct {
+    char *path;                     /* path of the resource, no query */
+    int hits;                       /* decayed # of loads it was requested on */
+    int as;                         /* index into preload_as */
+    apr_uint32_t epoch;             /* load in which it was counted last */
+} preload_res;
+
+typedef struct preload_doc preload_doc;
+struct preload_doc {
+    preload_doc *hnext;             /* next document in the same hash bucket */
+    preload_doc *prev;              /* next older document in LRU list */
+    preload_doc *next;              /* next younger document in LRU list */
+    unsigned int hash;
+    char *key;
+    apr_size_t klen;
+    int loads;                      /* decayed # of loads observed */
+    apr_uint32_t epoch;             /* incremented on every load */
+    int nres;
+    preload_res res[H2_PRELOAD_MAX_RES];
+};
+
+typedef struct {
+    apr_thread_mutex_t *lock;
+    preload_doc **buckets;
+    unsigned int nbuckets;          /* a power of 2 */
+    int count;
+    preload_doc *first;             /* least recently used */
+    preload_doc *last;              /* most recently used */
+} preload_table;
+
+/* What a session remembers about the last document answered */
+struct h2_preload_ctx {
+    char key[H2_PRELOAD_MAX_KEY_LEN+1];
+    apr_size_t klen;
+    apr_size_t alen;                /* length of the authority part of key */
+    unsigned int hash;
+    apr_time_t answered_at;         /* 0 if no document is being learned */
+    apr_uint32_t epoch;             /* the load this session counted */
+    int counted;                    /* != 0 iff the load has been counted */
+};
+
+static preload_table *ptable;
+
+static void doc_free(preload_doc *doc)
+{
+    int i;
+
+    for (i = 0; i < doc->nres; ++i) {
+        free(doc->res[i].path);
+    }
+    free(doc);
+}
+
+static apr_status_t preload_cleanup(void *data)
+{
+    preload_doc *doc, *next;
+
+    (void)data;
+    for (doc = ptable->first; doc; doc = next) {
+        next = doc->next;
+        doc_free(doc);
+    }
+    ptable = NULL;
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_preload_child_init(apr_pool_t *pool, server_rec *s)
+{
+    preload_table *table;
+    apr_status_t rv;
+
+    (void)s;
+    table = apr_pcalloc(pool, sizeof(*table));
+    rv = apr_thread_mutex_create(&table->lock, APR_THREAD_MUTEX_DEFAULT, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    table->nbuckets = H2_PRELOAD_MAX_DOCS;
+    table->buckets = apr_pcalloc(pool, table->nbuckets * sizeof(preload_doc*));
+    ptable = table;
+    apr_pool_cleanup_register(pool, NULL, preload_cleanup, apr_pool_cleanup_null);
+    return APR_SUCCESS;
+}
+
+static void lru_remove(preload_table *table, preload_doc *doc)
+{
+    if (doc->prev) doc->prev->next = doc->next;
+    else table->first = doc->next;
+    if (doc->next) doc->next->prev = doc->prev;
+    else table->last = doc->prev;
+    doc->prev = doc->next = NULL;
+}
+
+static void lru_add(preload_table *table, preload_doc *doc)
+{
+    doc->prev = table->last;
+    doc->next = NULL;
+    if (table->last) table->last->next = doc;
+    else table->first = doc;
+    table->last = doc;
+}
+
+static preload_doc **bucket_find(preload_table *table, unsigned int hash, 
+                                 const char *key, apr_size_t klen)
+{
+    preload_doc **pdoc = &table->buckets[hash & (table->nbuckets - 1)];
+    
+    while (*pdoc && ((*pdoc)->hash != hash || (*pdoc)->klen != klen
+                     || memcmp((*pdoc)->key, key, klen))) {
+        pdoc = &(*pdoc)->hnext;
+    }
+    return pdoc;
+}
+
+/* Find the document for key and make it the most recently used one.
+ * If it is not known and create is set, add it, dropping the least
+ * recently used document when the table is full. */
+static preload_doc *doc_get(preload_table *table, unsigned int hash, 
+                            const char *key, apr_size_t klen, int create)
+{
+    preload_doc *doc, **pdoc;
+
+    doc = *bucket_find(table, hash, key, klen);
+    if (doc) {
+        if (doc != table->last) {
+            lru_remove(table, doc);
+            lru_add(table, doc);
+        }
+        return doc;
+    }
+    if (!create) {
+        return NULL;
+    }
+    while (table->count >= H2_PRELOAD_MAX_DOCS && table->first) {
+        preload_doc *old = table->first;
+        pdoc = bucket_find(table, old->hash, old->key, old->klen);
+        *pdoc = old->hnext;
+        lru_remove(table, old);
+        --table->count;
+        doc_free(old);
+    }
+    doc = ap_malloc(sizeof(*doc) + klen + 1);
+    memset(doc, 0, sizeof(*doc));
+    doc->hash = hash;
+    doc->klen = klen;
+    doc->key = (char*)(doc + 1);
+    memcpy(doc->key, key, klen);
+    doc->key[klen] = '\0';
+    pdoc = &table->buckets[hash & (table->nbuckets - 1)];
+    doc->hnext = *pdoc;
+    *pdoc = doc;
+    lru_add(table, doc);
+    ++table->count;
+    return doc;
+}
+
+/* Halve all counts, forgetting resources that are no longer requested. */
+static void doc_decay(preload_doc *doc)
+{
+    int i, j;
+
+    doc->loads /= 2;
+    for (i = j = 0; i < doc->nres; ++i) {
+        doc->res[i].hits /= 2;
+        if (doc->res[i].hits > 0) {
+            doc->res[j++] = doc->res[i];
+        }
+        else {
+            free(doc->res[i].path);
+        }
+    }
+    doc->nres = j;
+}
+
+static void doc_count_res(preload_doc *doc, apr_uint32_t epoch,
+                          const char *path, int as)
+{
+    preload_res *res = NULL;
+    int i;
+
+    for (i = 0; i < doc->nres; ++i) {
+        if (!strcmp(path, doc->res[i].path)) {
+            res = &doc->res[i];
+            break;
+        }
+    }
+    if (!res) {
+        if (doc->nres < H2_PRELOAD_MAX_RES) {
+            res = &doc->res[doc->nres++];
+        }
+        else {
+            /* replace the resource seen least, unless all of them
+             * are established. Decay will make room eventually. */
+            for (i = 0; i < doc->nres; ++i) {
+                if (doc->res[i].hits <= 1
+                    && (!res || doc->res[i].epoch < res->epoch)) {
+                    res = &doc->res[i];
+                }
+            }
+            if (!res) return;
+            free(res->path);
+        }
+        res->path = ap_malloc(strlen(path) + 1);
+        strcpy(res->path, path);
+        res->hits = 0;
+        res->as = as;
+        res->epoch = epoch - 1;
+    }
+    if (res->epoch != epoch) {
+        res->epoch = epoch;
+        ++res->hits;
+    }
+}
+
+static int get_as(const struct h2_request *req)
+{
+    const char *dest = apr_table_get(req->headers, "sec-fetch-dest");
+    int i;
+
+    if (dest) {
+        for (i = 1; i < (int)H2_ALEN(preload_as); ++i) {
+            if (!strcmp(dest, preload_as[i])) {
+                return i;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Learned paths are sent to other clients inside '<>' of a Link header.
+ * Only take paths without query and without characters that could end
+ * or extend the link. */
+static int is_link_path(const char *path)
+{
+    const unsigned char *s;
+
+    if (path[0] != '/') {
+        return 0;
+    }
+    for (s = (const unsigned char *)path; *s; ++s) {
+        if (*s <= ' ' || *s >= 0x7f || strchr("<>,;\"?#\\", *s)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int is_navigation(const struct h2_request *req)
+{
+    const char *s = apr_table_get(req->headers, "sec-fetch-dest");
+
+    if (s) {
+        return (!strcmp(s, "document") || !strcmp(s, "iframe")
+                || !strcmp(s, "frame"));
+    }
+    s = apr_table_get(req->headers, "accept");
+    return s && !strncasecmp(s, "text/html", 9);
+}
+
+/* Make the lookup key from authority and path, without the query. */
+static apr_size_t mk_key(char *buf, const char *authority, const char *path, 
+                         apr_size_t *palen)
+{
+    apr_size_t alen = strlen(authority), plen = strcspn(path, "?#");
+
+    if (alen + 1 + plen > H2_PRELOAD_MAX_KEY_LEN) {
+        return 0;
+    }
+    memcpy(buf, authority, alen);
+    buf[alen] = '\n';
+    memcpy(buf + alen + 1, path, plen);
+    buf[alen + 1 + plen] = '\0';
+    if (palen) *palen = alen;
+    return alen + 1 + plen;
+}
+
+static unsigned int key_hash(const char *key, apr_size_t klen)
+{
+    apr_ssize_t hlen = (apr_ssize_t)klen;
+    return apr_hashfunc_default(key, &hlen);
+}
+
+void h2_preload_on_response(h2_session *session, const struct h2_request *req,
+                            const struct h2_headers *res)
+{
+    h2_preload_ctx *ctx = session->preload;
+    const char *ctype;
+
+    if (ctx) {
+        ctx->answered_at = 0;
+    }
+    if (!ptable || res->status != 200 || !req->authority || !req->path
+        || strcmp("GET", req->method)
+        || !h2_config_sgeti(session->s, H2_CONF_PRELOAD_LEARNING)) {
+        return;
+    }
+    ctype = apr_table_get(res->headers, "content-type");
+    if (!ctype || strncasecmp(ctype, "text/html", 9)) {
+        return;
+    }
+    if (!ctx) {
+        ctx = session->preload = apr_pcalloc(session->pool, sizeof(*ctx));
+    }
+    ctx->klen = mk_key(ctx->key, req->authority, req->path, &ctx->alen);
+    if (ctx->klen > 0) {
+        ctx->hash = key_hash(ctx->key, ctx->klen);
+        ctx->answered_at = apr_time_now();
+        ctx->counted = 0;
+    }
+}
+
+void h2_preload_on_request(h2_session *session, const struct h2_request *req)
+{
+    h2_preload_ctx *ctx = session->preload;
+    apr_size_t plen;
+    preload_doc *doc;
+    int as;
+
+    if (!ctx || !ctx->answered_at || !ptable || !req->authority || !req->path
+        || strcmp("GET", req->method)) {
+        return;
+    }
+    if (apr_time_now() - ctx->answered_at > H2_PRELOAD_WINDOW) {
+        ctx->answered_at = 0;
+        return;
+    }
+    plen = strlen(req->path);
+    if (plen > H2_PRELOAD_MAX_PATH_LEN || !is_link_path(req->path)
+        || strlen(req->authority) != ctx->alen
+        || strncasecmp(req->authority, ctx->key, ctx->alen)
+        || is_navigation(req)) {
+        return;
+    }
+    if (plen == ctx->klen - ctx->alen - 1
+        && !memcmp(req->path, ctx->key + ctx->alen + 1, ctx->klen - ctx->alen - 1)) {
+        /* the document itself */
+        return;
+    }
+    /* Only what a browser loads as a subresource may be preloaded, not
+     * API calls made from the page. */
+    as = get_as(req);
+    if (!as) {
+        return;
+    }
+
+    apr_thread_mutex_lock(ptable->lock);
+    doc = doc_get(ptable, ctx->hash, ctx->key, ctx->klen, 1);
+    if (!ctx->counted) {
+        ctx->counted = 1;
+        if (++doc->loads >= H2_PRELOAD_DECAY_LOADS) {
+            doc_decay(doc);
+        }
+        ctx->epoch = ++doc->epoch;
+    }
+    doc_count_res(doc, ctx->epoch, req->path, as);
+    apr_thread_mutex_unlock(ptable->lock);
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c1,
+                  "h2_session(%ld): learned preload %s for %s",
+                  session->id, req->path, ctx->key + ctx->alen + 1);
+}
+
+int h2_preload_add_links(request_rec *r, apr_table_t *headers)
+{
+    h2_conn_ctx_t *conn_ctx = h2_conn_ctx_get(r->connection);
+    preload_res top[H2_PRELOAD_MAX_RES];
+    char key[H2_PRELOAD_MAX_KEY_LEN+1];
+    apr_size_t klen;
+    preload_doc *doc;
+    int i, j, n = 0, max;
+
+    if (!ptable || !conn_ctx || !conn_ctx->request || r->main
+        || r->method_number != M_GET
+        || !h2_config_rgeti(r, H2_CONF_PRELOAD_LEARNING)
+        || !h2_config_rgeti(r, H2_CONF_EARLY_HINTS)) {
+        return 0;
+    }
+    max = H2MIN(h2_config_rgeti(r, H2_CONF_PRELOAD_MAX), H2_PRELOAD_MAX_RES);
+    if (max <= 0 || !conn_ctx->request->authority || !conn_ctx->request->path) {
+        return 0;
+    }
+    klen = mk_key(key, conn_ctx->request->authority, 
+                  conn_ctx->request->path, NULL);
+    if (!klen) {
+        return 0;
+    }
+
+    apr_thread_mutex_lock(ptable->lock);
+    doc = doc_get(ptable, key_hash(key, klen), key, klen, 0);
+    if (doc) {
+        /* Announce resources requested on at least half the loads,
+         * most often requested first */
+        for (i = 0; i < doc->nres; ++i) {
+            const preload_res *res = &doc->res[i];
+            if (res->hits < 2 || res->hits * 2 < doc->loads) continue;
+            for (j = n; j > 0 && top[j-1].hits < res->hits; --j) {
+                if (j < max) top[j] = top[j-1];
+            }
+            if (j < max) {
+                top[j] = *res;
+                top[j].path = apr_pstrdup(r->pool, res->path);
+                if (n < max) ++n;
+            }
+        }
+    }
+    apr_thread_mutex_unlock(ptable->lock);
+
+    for (i = 0; i < n; ++i) {
+        apr_table_add(headers, "Link", 
+                      apr_psprintf(r->pool, "<%s>; rel=preload; as=%s; nopush",
+                                   top[i].path, preload_as[top[i].as]));
+    }
+    if (n > 0) {
+        apr_table_setn(r->notes, H2_PRELOAD_NOTE, apr_itoa(r->pool, n));
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                      "h2_c2(%s-%d): announcing %d learned preloads",
+                      conn_ctx->id, conn_ctx->stream_id, n);
+    }
+    return n;
+}
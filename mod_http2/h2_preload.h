@@ -0,0 +1,74 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __mod_h2__h2_preload__
+#define __mod_h2__h2_preload__
+
+struct h2_request;
+struct h2_headers;
+struct h2_session;
+
+/*******************************************************************************
+ * learned preloads
+ *
+ * - With 'H2PreloadLearning on', mod_h2 observes which resources a client
+ *   requests on the same connection shortly after a HTML document has been
+ *   answered. Requests for the same authority are counted per document path.
+ * - When the document is requested again, the resources requested on at
+ *   least half of the observed loads are announced as 'rel=preload' Link
+ *   headers in a 103 response, at most 'H2PreloadLearningMax' of them. The
+ *   links carry 'nopush', they are hints for the client only.
+ * - Counts are halved periodically, so that resources no longer used by a
+ *   document get forgotten. The number of documents and of resources per
+ *   document is limited, least recently used documents are dropped first.
+ * - The number of preloads announced is available in the request note
+ *   'http2-preloads', e.g. for logging via '%{http2-preloads}n'.
+ ******************************************************************************/
+
+typedef struct h2_preload_ctx h2_preload_ctx;
+
+/**
+ * Initialize the child process wide table of learned preloads.
+ */
+apr_status_t h2_preload_child_init(apr_pool_t *pool, server_rec *s);
+
+/**
+ * A final response for a client request has been submitted on the session.
+ * If it is a HTML document, subsequent requests may be learned as its
+ * preloads.
+ */
+void h2_preload_on_response(struct h2_session *session,
+                            const struct h2_request *req,
+                            const struct h2_headers *res);
+
+/**
+ * A client request has been received on the session. If it follows a
+ * HTML document, it is counted as one of the document's preloads.
+ */
+void h2_preload_on_request(struct h2_session *session,
+                           const struct h2_request *req);
+
+/**
+ * Add Link headers for the preloads learned for the request's document
+ * to the table.
+ * @param r the request being processed on a secondary connection
+ * @param headers the headers to add the links to
+ * @return the number of links added
+ */
+int h2_preload_add_links(request_rec *r, apr_table_t *headers);
+
+#endif /* defined(__mod_h2__h2_preload__) */
@@ -0,0 +1,58 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __mod_h2__h2_probes__
+#define __mod_h2__h2_probes__
+
+/*******************************************************************************
+ * USDT probes
+ *
+ * Static tracepoints, visible to bpftrace, systemtap, perf etc. as
+ * 'usdt:mod_http2.so:mod_http2:<name>'. When not traced, a probe is a
+ * single nop instruction and costs about nothing. Without <sys/sdt.h>
+ * at build time (or with --disable-usdt), the probes are compiled out.
+ *
+ * Probes and their arguments:
+ *   frame_recv       session id, stream id, frame type, frame length
+ *   frame_send       session id, stream id, frame type, frame length
+ *   stream_state     session id, stream id, old state, new state
+ *   worker_start     slot id, c1 id, c2 id
+ *   worker_done      slot id, c1 id, c2 id
+ *   beam_wait_full   beam id, beam name, 1 on enter, 0 on leave
+ *   beam_wait_empty  beam id, beam name, 1 on enter, 0 on leave
+ *   c1_flush         session id, bytes passed, flush requested
+ *
+ * See the bpftrace directory for scripts using these.
+ ******************************************************************************/
+
+#ifdef H2_USDT
+
+#include <sys/sdt.h>
+
+#define H2_PROBE3(n, a1, a2, a3) \
+    DTRACE_PROBE3(mod_http2, n, a1, a2, a3)
+#define H2_PROBE4(n, a1, a2, a3, a4) \
+    DTRACE_PROBE4(mod_http2, n, a1, a2, a3, a4)
+
+#else /* H2_USDT */
+
+#define H2_PROBE3(n, a1, a2, a3)
+#define H2_PROBE4(n, a1, a2, a3, a4)
+
+#endif /* H2_USDT */
+
+#endif /* defined(__mod_h2__h2_probes__) */
@@ -21,6 +21,7 @@
 #include <apr_strings.h>
 #include <apr_hash.h>
 #include <apr_time.h>
+#include <apr_thread_mutex.h>
 
 #ifdef H2_OPENSSL
 #include <openssl/evp.h>
@@ -31,6 +32,7 @@
 #include <http_log.h>
 
 #include "h2_private.h"
+#include "h2_config.h"
 #include "h2_protocol.h"
 #include "h2_util.h"
 #include "h2_push.h"
@@ -57,11 +59,17 @@ static const char *policy_str(h2_push_policy policy)
     }
 }
 
+/* A preload link found in a response, relevant for pushes */
+typedef struct {
+    const char *path;
+    int critical;
+} h2_push_link;
+
 typedef struct {
     const h2_request *req;
-    apr_uint32_t push_policy;
     apr_pool_t *pool;
-    apr_array_header_t *pushes;
+    apr_array_header_t *links;
+    apr_size_t links_len;
     const char *s;
     size_t slen;
     size_t i;
@@ -315,7 +323,7 @@ static int has_relation(link_ctx *ctx, const char *rel)
     return 0;
 }
 
-static int add_push(link_ctx *ctx)
+static int add_link(link_ctx *ctx)
 {
     /* so, we have read a Link header and need to decide
      * if we transform it into a push.
@@ -324,11 +332,7 @@ static int add_push(link_ctx *ctx)
         apr_uri_t uri;
         if (apr_uri_parse(ctx->pool, ctx->link, &uri) == APR_SUCCESS) {
             if (uri.path && same_authority(ctx->req, &uri)) {
-                char *path;
-                const char *method;
-                apr_table_t *headers;
-                h2_request *req;
-                h2_push *push;
+                h2_push_link *link;
                 
                 /* We only want to generate pushes for resources in the
                  * same authority than the original request.
@@ -336,38 +340,51 @@ static int add_push(link_ctx *ctx)
                  * check that the vhost/server is available and uses the same
                  * TLS (if any) parameters.
                  */
-                path = apr_uri_unparse(ctx->pool, &uri, APR_URI_UNP_OMITSITEPART);
-                push = apr_pcalloc(ctx->pool, sizeof(*push));
-                switch (ctx->push_policy) {
-                    case H2_PUSH_HEAD:
-                        method = "HEAD";
-                        break;
-                    default:
-                        method = "GET";
-                        break;
-                }
-                headers = apr_table_make(ctx->pool, 5);
-                apr_table_do(set_push_header, headers, ctx->req->headers, NULL);
-                req = h2_request_create(0, ctx->pool, method, ctx->req->scheme,
-                                        ctx->req->authority, path, headers);
-                /* atm, we do not push on pushes */
-                h2_request_end_headers(req, ctx->pool, 1, 0);
-                push->req = req;
-                if (has_param(ctx, "critical")) {
-                    h2_priority *prio = apr_pcalloc(ctx->pool, sizeof(*prio));
-                    prio->dependency = H2_DEPENDANT_BEFORE;
-                    push->priority = prio;
+                if (!ctx->links) {
+                    ctx->links = apr_array_make(ctx->pool, 5, sizeof(h2_push_link));
                 }
-                if (!ctx->pushes) {
-                    ctx->pushes = apr_array_make(ctx->pool, 5, sizeof(h2_push*));
-                }
-                APR_ARRAY_PUSH(ctx->pushes, h2_push*) = push;
+                link = apr_array_push(ctx->links);
+                link->path = apr_uri_unparse(ctx->pool, &uri, APR_URI_UNP_OMITSITEPART);
+                link->critical = has_param(ctx, "critical");
+                ctx->links_len += strlen(link->path) + 1;
             }
         }
     }
     return 0;
 }
 
+static h2_push *make_push(apr_pool_t *p, const h2_request *req, 
+                          apr_uint32_t push_policy, const h2_push_link *link)
+{
+    const char *method;
+    apr_table_t *headers;
+    h2_request *preq;
+    h2_push *push;
+
+    push = apr_pcalloc(p, sizeof(*push));
+    switch (push_policy) {
+        case H2_PUSH_HEAD:
+            method = "HEAD";
+            break;
+        default:
+            method = "GET";
+            break;
+    }
+    headers = apr_table_make(p, 5);
+    apr_table_do(set_push_header, headers, req->headers, NULL);
+    preq = h2_request_create(0, p, method, req->scheme, req->authority, 
+                             link->path, headers);
+    /* atm, we do not push on pushes */
+    h2_request_end_headers(preq, p, 1, 0);
+    push->req = preq;
+    if (link->critical) {
+        h2_priority *prio = apr_pcalloc(p, sizeof(*prio));
+        prio->dependency = H2_DEPENDANT_BEFORE;
+        push->priority = prio;
+    }
+    return push;
+}
+
 static void inspect_link(link_ctx *ctx, const char *s, size_t slen)
 {
     /* RFC 5988 <https://tools.ietf.org/html/rfc5988#section-6.2.1>
@@ -417,7 +434,7 @@ static void inspect_link(link_ctx *ctx, const char *s, size_t slen)
         while (read_param(ctx)) {
             /* nop */
         }
-        add_push(ctx);
+        add_link(ctx);
         if (!read_sep(ctx)) {
             break;
         }
@@ -432,6 +449,229 @@ static int head_iter(void *ctx, const char *key, const char *value)
     return 1;
 }
 
+static apr_int32_t ceil_power_of_2(apr_int32_t n)
+{
+    if (n <= 2) return 2;
+    --n;
+    n |= n >> 1;
+    n |= n >> 2;
+    n |= n >> 4;
+    n |= n >> 8;
+    n |= n >> 16;
+    return ++n;
+}
+
+/*******************************************************************************
+ * link cache
+ *
+ * The same resources tend to send the same Link headers over and over. The
+ * child wide cache remembers the preload links found for a Link header value
+ * on a scheme+authority, so that parsing happens only once.
+ ******************************************************************************/
+
+#define LINK_CACHE_MAX_KEY_LEN  (8 * 1024)
+
+typedef struct link_cache_entry link_cache_entry;
+struct link_cache_entry {
+    link_cache_entry *hnext;        /* next entry in the same hash bucket */
+    link_cache_entry *prev;         /* next older entry in LRU list */
+    link_cache_entry *next;         /* next younger entry in LRU list */
+    unsigned int hash;
+    const char *key;
+    apr_size_t klen;
+    int nlinks;
+    h2_push_link *links;
+};
+
+typedef struct {
+    apr_thread_mutex_t *lock;
+    link_cache_entry **buckets;
+    unsigned int nbuckets;          /* a power of 2 */
+    int count;
+    int max_count;
+    link_cache_entry *first;        /* least recently used */
+    link_cache_entry *last;         /* most recently used */
+} link_cache;
+
+static link_cache *lcache;
+
+static apr_status_t link_cache_cleanup(void *data)
+{
+    link_cache_entry *e, *next;
+
+    (void)data;
+    for (e = lcache->first; e; e = next) {
+        next = e->next;
+        free(e);
+    }
+    lcache = NULL;
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_push_child_init(apr_pool_t *pool, server_rec *s)
+{
+    link_cache *cache;
+    apr_status_t rv;
+    int n;
+
+    n = h2_config_sgeti(s, H2_CONF_PUSH_LINK_CACHE_SIZE);
+    if (n <= 0) {
+        return APR_SUCCESS;
+    }
+    cache = apr_pcalloc(pool, sizeof(*cache));
+    rv = apr_thread_mutex_create(&cache->lock, APR_THREAD_MUTEX_DEFAULT, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    cache->max_count = n;
+    cache->nbuckets = (unsigned int)ceil_power_of_2(n);
+    cache->buckets = apr_pcalloc(pool, cache->nbuckets * sizeof(link_cache_entry*));
+    lcache = cache;
+    apr_pool_cleanup_register(pool, NULL, link_cache_cleanup, apr_pool_cleanup_null);
+    return APR_SUCCESS;
+}
+
+static int key_iter(void *ctx, const char *key, const char *value) 
+{
+    if (!apr_strnatcasecmp("link", key)) {
+        apr_array_header_t *parts = ctx;
+        APR_ARRAY_PUSH(parts, const char*) = value;
+    }
+    return 1;
+}
+
+static const char *link_cache_key(apr_pool_t *p, const h2_request *req, 
+                                  apr_table_t *headers, apr_size_t *pklen)
+{
+    apr_array_header_t *parts = apr_array_make(p, 5, sizeof(const char*));
+    const char *key;
+
+    APR_ARRAY_PUSH(parts, const char*) = req->scheme;
+    APR_ARRAY_PUSH(parts, const char*) = req->authority;
+    apr_table_do(key_iter, parts, headers, NULL);
+    if (parts->nelts <= 2) {
+        return NULL;
+    }
+    key = apr_array_pstrcat(p, parts, '\n');
+    *pklen = strlen(key);
+    return key;
+}
+
+static void lru_remove(link_cache *cache, link_cache_entry *e)
+{
+    if (e->prev) e->prev->next = e->next;
+    else cache->first = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else cache->last = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_add(link_cache *cache, link_cache_entry *e)
+{
+    e->prev = cache->last;
+    e->next = NULL;
+    if (cache->last) cache->last->next = e;
+    else cache->first = e;
+    cache->last = e;
+}
+
+static link_cache_entry **bucket_find(link_cache *cache, unsigned int hash, 
+                                      const char *key, apr_size_t klen)
+{
+    link_cache_entry **pe = &cache->buckets[hash & (cache->nbuckets - 1)];
+    
+    while (*pe && ((*pe)->hash != hash || (*pe)->klen != klen
+                   || memcmp((*pe)->key, key, klen))) {
+        pe = &(*pe)->hnext;
+    }
+    return pe;
+}
+
+/* Get the cached links for key, copied to pool p. Return 0 if not found. */
+static int link_cache_get(link_cache *cache, apr_pool_t *p, unsigned int hash, 
+                          const char *key, apr_size_t klen,
+                          apr_array_header_t **plinks)
+{
+    link_cache_entry *e;
+    int i, found = 0;
+
+    *plinks = NULL;
+    apr_thread_mutex_lock(cache->lock);
+    e = *bucket_find(cache, hash, key, klen);
+    if (e) {
+        found = 1;
+        if (e != cache->last) {
+            lru_remove(cache, e);
+            lru_add(cache, e);
+        }
+        if (e->nlinks > 0) {
+            *plinks = apr_array_make(p, e->nlinks, sizeof(h2_push_link));
+            for (i = 0; i < e->nlinks; ++i) {
+                h2_push_link *link = apr_array_push(*plinks);
+                link->path = apr_pstrdup(p, e->links[i].path);
+                link->critical = e->links[i].critical;
+            }
+        }
+    }
+    apr_thread_mutex_unlock(cache->lock);
+    return found;
+}
+
+static void link_cache_put(link_cache *cache, unsigned int hash, 
+                           const char *key, apr_size_t klen,
+                           apr_array_header_t *links, apr_size_t links_len)
+{
+    link_cache_entry *e, **pe;
+    apr_size_t len;
+    char *s;
+    int i, nlinks = links? links->nelts : 0;
+
+    /* Allocate entry, links and all strings in one chunk */
+    len = sizeof(*e) + (apr_size_t)nlinks * sizeof(h2_push_link) + klen + 1 + links_len;
+    e = ap_malloc(len);
+    memset(e, 0, sizeof(*e));
+    e->hash = hash;
+    e->klen = klen;
+    e->nlinks = nlinks;
+    e->links = (h2_push_link*)(e + 1);
+    s = (char*)(e->links + nlinks);
+    memcpy(s, key, klen + 1);
+    e->key = s;
+    s += klen + 1;
+    for (i = 0; i < nlinks; ++i) {
+        const h2_push_link *link = &APR_ARRAY_IDX(links, i, h2_push_link);
+        apr_size_t plen = strlen(link->path) + 1;
+        memcpy(s, link->path, plen);
+        e->links[i].path = s;
+        e->links[i].critical = link->critical;
+        s += plen;
+    }
+
+    apr_thread_mutex_lock(cache->lock);
+    pe = bucket_find(cache, hash, key, klen);
+    if (*pe) {
+        /* another thread was faster */
+        free(e);
+    }
+    else {
+        while (cache->count >= cache->max_count && cache->first) {
+            link_cache_entry *old = cache->first, **pold;
+            pold = bucket_find(cache, old->hash, old->key, old->klen);
+            *pold = old->hnext;
+            lru_remove(cache, old);
+            --cache->count;
+            free(old);
+        }
+        /* the eviction might have changed our bucket chain */
+        pe = &cache->buckets[hash & (cache->nbuckets - 1)];
+        e->hnext = *pe;
+        *pe = e;
+        lru_add(cache, e);
+        ++cache->count;
+    }
+    apr_thread_mutex_unlock(cache->lock);
+}
+
 apr_array_header_t *h2_push_collect(apr_pool_t *p, const h2_request *req,
                                     apr_uint32_t push_policy, const h2_headers *res)
 {
@@ -445,19 +685,52 @@ apr_array_header_t *h2_push_collect(apr_pool_t *p, const h2_request *req,
          * where other modules can provide push information directly.
          */
         if (res->headers) {
-            link_ctx ctx;
-            
-            memset(&ctx, 0, sizeof(ctx));
-            ctx.req = req;
-            ctx.push_policy = push_policy;
-            ctx.pool = p;
-            
-            apr_table_do(head_iter, &ctx, res->headers, NULL);
-            if (ctx.pushes) {
+            apr_array_header_t *links = NULL, *pushes = NULL;
+            const char *key = NULL;
+            apr_size_t klen = 0;
+            unsigned int hash = 0;
+            int i, cached = 0;
+
+            if (lcache) {
+                key = link_cache_key(p, req, res->headers, &klen);
+                if (!key) {
+                    /* no Link headers at all */
+                    return NULL;
+                }
+                if (klen <= LINK_CACHE_MAX_KEY_LEN) {
+                    apr_ssize_t hlen = (apr_ssize_t)klen;
+                    hash = apr_hashfunc_default(key, &hlen);
+                    cached = link_cache_get(lcache, p, hash, key, klen, &links);
+                }
+                else {
+                    key = NULL;
+                }
+            }
+
+            if (!cached) {
+                link_ctx ctx;
+
+                memset(&ctx, 0, sizeof(ctx));
+                ctx.req = req;
+                ctx.pool = p;
+
+                apr_table_do(head_iter, &ctx, res->headers, NULL);
+                links = ctx.links;
+                if (key) {
+                    link_cache_put(lcache, hash, key, klen, links, ctx.links_len);
+                }
+            }
+
+            if (links && links->nelts > 0) {
+                pushes = apr_array_make(p, links->nelts, sizeof(h2_push*));
+                for (i = 0; i < links->nelts; ++i) {
+                    APR_ARRAY_PUSH(pushes, h2_push*) = make_push(p, req, push_policy,
+                        &APR_ARRAY_IDX(links, i, h2_push_link));
+                }
                 apr_table_setn(res->headers, "push-policy", 
                                policy_str(push_policy));
             }
-            return ctx.pushes;
+            return pushes;
         }
     }
     return NULL;
@@ -465,9 +738,11 @@ apr_array_header_t *h2_push_collect(apr_pool_t *p, const h2_request *req,
 
 #define GCSLOG_LEVEL   APLOG_TRACE1
 
-typedef struct h2_push_diary_entry {
+struct h2_push_diary_entry {
     apr_uint64_t hash;
-} h2_push_diary_entry;
+    int prev;                   /* next older entry in LRU list or -1 */
+    int next;                   /* next younger entry in LRU list or -1 */
+};
 
 
 #ifdef H2_OPENSSL
@@ -494,6 +769,7 @@ static void calc_sha256_hash(h2_push_diary *diary, apr_uint64_t *phash, h2_push
     sha256_update(md, push->req->authority);
     sha256_update(md, push->req->path);
     EVP_DigestFinal(md, hash, &len);
+    EVP_MD_CTX_destroy(md);
 
     val = 0;
     for (i = 0; i != len; ++i)
@@ -502,6 +778,16 @@ static void calc_sha256_hash(h2_push_diary *diary, apr_uint64_t *phash, h2_push
 }
 #endif
 
+static void calc_fast_hash(h2_push_diary *diary, apr_uint64_t *phash, h2_push *push) 
+{
+    const h2_request *req = push->req;
+    apr_uint64_t val;
+
+    val = h2_util_hash64(req->scheme, strlen(req->scheme), 0);
+    val = h2_util_hash64(req->authority, strlen(req->authority), val);
+    val = h2_util_hash64(req->path, strlen(req->path), val);
+    *phash = val >> (64 - diary->mask_bits);
+}
 
 static unsigned int val_apr_hash(const char *str) 
 {
@@ -525,16 +811,101 @@ static void calc_apr_hash(h2_push_diary *diary, apr_uint64_t *phash, h2_push *pu
     *phash = val;
 }
 
-static apr_int32_t ceil_power_of_2(apr_int32_t n)
+static int index_home(h2_push_diary *diary, apr_uint64_t hash)
 {
-    if (n <= 2) return 2;
-    --n;
-    n |= n >> 1;
-    n |= n >> 2;
-    n |= n >> 4;
-    n |= n >> 8;
-    n |= n >> 16;
-    return ++n;
+    /* hash values from the apr hash function are not well distributed
+     * in all bits, mix them before using them as table index. */
+    hash *= APR_UINT64_C(0x9e3779b97f4a7c15);
+    return (int)(hash >> 32) & diary->index_mask;
+}
+
+static void index_add(h2_push_diary *diary, int idx)
+{
+    int i = index_home(diary, diary->entries[idx].hash);
+    
+    while (diary->index[i]) {
+        i = (i + 1) & diary->index_mask;
+    }
+    diary->index[i] = idx + 1;
+}
+
+static void index_remove(h2_push_diary *diary, int idx)
+{
+    int i, j, k;
+    
+    for (i = index_home(diary, diary->entries[idx].hash); 
+         diary->index[i] != idx + 1; i = (i + 1) & diary->index_mask) {
+        ap_assert(diary->index[i]);
+    }
+    /* backward shift deletion, keeps all probe sequences intact
+     * without the need for tombstones. */
+    for (j = (i + 1) & diary->index_mask; diary->index[j]; 
+         j = (j + 1) & diary->index_mask) {
+        k = index_home(diary, diary->entries[diary->index[j]-1].hash);
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+            diary->index[i] = diary->index[j];
+            i = j;
+        }
+    }
+    diary->index[i] = 0;
+}
+
+static void lru_unlink(h2_push_diary *diary, int idx)
+{
+    h2_push_diary_entry *e = &diary->entries[idx];
+
+    if (e->prev >= 0) diary->entries[e->prev].next = e->next;
+    else diary->lru_first = e->next;
+    if (e->next >= 0) diary->entries[e->next].prev = e->prev;
+    else diary->lru_last = e->prev;
+    e->prev = e->next = -1;
+}
+
+static void lru_append(h2_push_diary *diary, int idx)
+{
+    h2_push_diary_entry *e = &diary->entries[idx];
+
+    e->prev = diary->lru_last;
+    e->next = -1;
+    if (diary->lru_last >= 0) diary->entries[diary->lru_last].next = idx;
+    else diary->lru_first = idx;
+    diary->lru_last = idx;
+}
+
+static void diary_grow(h2_push_diary *diary, int nlen)
+{
+    int i;
+
+    if (nlen > diary->nalloc) {
+        h2_push_diary_entry *nentries;
+
+        nentries = apr_pcalloc(diary->pool, sizeof(*nentries) * (apr_size_t)nlen);
+        if (diary->nelts > 0) {
+            memcpy(nentries, diary->entries, sizeof(*nentries) * (apr_size_t)diary->nelts);
+        }
+        diary->entries = nentries;
+        diary->nalloc = nlen;
+        /* keep the index table at most half full */
+        diary->index_mask = (2 * nlen) - 1;
+        diary->index = apr_pcalloc(diary->pool, sizeof(int) * (apr_size_t)(2 * nlen));
+        for (i = 0; i < diary->nelts; ++i) {
+            index_add(diary, i);
+        }
+    }
+}
+
+static void journal_add(h2_push_diary *diary, apr_uint64_t *journal, 
+                        int *pcount, apr_uint64_t hash)
+{
+    /* only keep track of changes once someone is interested in digests */
+    if (diary->sorted && !diary->journal_overflow) {
+        if (*pcount >= diary->journal_max) {
+            diary->journal_overflow = 1;
+        }
+        else {
+            journal[(*pcount)++] = hash;
+        }
+    }
 }
 
 static h2_push_diary *diary_create(apr_pool_t *p, h2_push_digest_type dtype, 
@@ -545,6 +916,7 @@ static h2_push_diary *diary_create(apr_pool_t *p, h2_push_digest_type dtype,
     if (N > 0) {
         diary = apr_pcalloc(p, sizeof(*diary));
         
+        diary->pool        = p;
         diary->NMax        = ceil_power_of_2(N);
         diary->N           = diary->NMax;
         /* the mask we use in value comparison depends on where we got
@@ -553,8 +925,10 @@ static h2_push_diary *diary_create(apr_pool_t *p, h2_push_digest_type dtype,
          * If we set the diary via a compressed golomb set, we have less
          * relevant bits and need to use a smaller mask. */
         diary->mask_bits   = 64;
+        diary->lru_first   = -1;
+        diary->lru_last    = -1;
         /* grows by doubling, start with a power of 2 */
-        diary->entries     = apr_array_make(p, 16, sizeof(h2_push_diary_entry));
+        diary_grow(diary, H2MIN(16, diary->N));
         
         switch (dtype) {
 #ifdef H2_OPENSSL
@@ -563,6 +937,10 @@ static h2_push_diary *diary_create(apr_pool_t *p, h2_push_digest_type dtype,
                 diary->dcalc       = calc_sha256_hash;
                 break;
 #endif /* ifdef H2_OPENSSL */
+            case H2_PUSH_DIGEST_FAST:
+                diary->dtype       = H2_PUSH_DIGEST_FAST;
+                diary->dcalc       = calc_fast_hash;
+                break;
             default:
                 diary->dtype       = H2_PUSH_DIGEST_APR_HASH;
                 diary->dcalc       = calc_apr_hash;
@@ -573,76 +951,76 @@ static h2_push_diary *diary_create(apr_pool_t *p, h2_push_digest_type dtype,
     return diary;
 }
 
-h2_push_diary *h2_push_diary_create(apr_pool_t *p, int N)
+h2_push_diary *h2_push_diary_create(apr_pool_t *p, h2_push_digest_type dtype, int N)
 {
-    return diary_create(p, H2_PUSH_DIGEST_SHA256, N);
+    return diary_create(p, dtype, N);
 }
 
 static int h2_push_diary_find(h2_push_diary *diary, apr_uint64_t hash)
 {
     if (diary) {
-        h2_push_diary_entry *e;
-        int i;
-
-        /* search from the end, where the last accessed digests are */
-        for (i = diary->entries->nelts-1; i >= 0; --i) {
-            e = &APR_ARRAY_IDX(diary->entries, i, h2_push_diary_entry);
-            if (e->hash == hash) {
-                return i;
+        int i, idx;
+
+        for (i = index_home(diary, hash); (idx = diary->index[i]) != 0;
+             i = (i + 1) & diary->index_mask) {
+            if (diary->entries[idx-1].hash == hash) {
+                return idx-1;
             }
         }
     }
     return -1;
 }
 
-static void move_to_last(h2_push_diary *diary, apr_size_t idx)
+static void move_to_last(h2_push_diary *diary, int idx)
 {
-    h2_push_diary_entry *entries = (h2_push_diary_entry*)diary->entries->elts;
-    h2_push_diary_entry e;
-    int lastidx;
-    
-    /* Move an existing entry to the last place */
-    if (diary->entries->nelts <= 0)
-        return;
-
-    /* move entry[idx] to the end */
-    lastidx = diary->entries->nelts - 1;
-    if (idx < lastidx) {
-        e =  entries[idx];
-        memmove(entries+idx, entries+idx+1, sizeof(h2_push_diary_entry) * (lastidx - idx));
-        entries[lastidx] = e;
+    /* Move an existing entry to the most recently used place */
+    if (idx != diary->lru_last) {
+        lru_unlink(diary, idx);
+        lru_append(diary, idx);
     }
 }
 
-static void remove_first(h2_push_diary *diary)
+static int remove_first(h2_push_diary *diary)
 {
-    h2_push_diary_entry *entries = (h2_push_diary_entry*)diary->entries->elts;
-    int lastidx;
-    
-    /* move remaining entries to index 0 */
-    lastidx = diary->entries->nelts - 1;
-    if (lastidx > 0) {
-        --diary->entries->nelts;
-        memmove(entries, entries+1, sizeof(h2_push_diary_entry) * diary->entries->nelts);
+    int idx = diary->lru_first;
+
+    /* forget the least recently used entry, return its free slot */
+    if (idx >= 0) {
+        lru_unlink(diary, idx);
+        index_remove(diary, idx);
+        journal_add(diary, diary->removed, &diary->removed_count,
+                    diary->entries[idx].hash);
     }
+    return idx;
 }
 
-static void h2_push_diary_append(h2_push_diary *diary, h2_push_diary_entry *e)
+static void h2_push_diary_append(h2_push_diary *diary, apr_uint64_t hash)
 {
-    while (diary->entries->nelts >= diary->N) {
-        remove_first(diary);
+    int idx;
+
+    if (diary->nelts >= diary->N) {
+        idx = remove_first(diary);
+    }
+    else {
+        if (diary->nelts >= diary->nalloc) {
+            diary_grow(diary, H2MIN(diary->nalloc * 2, diary->N));
+        }
+        idx = diary->nelts++;
     }
     /* append a new diary entry at the end */
-    APR_ARRAY_PUSH(diary->entries, h2_push_diary_entry) = *e;
+    diary->entries[idx].hash = hash;
+    lru_append(diary, idx);
+    index_add(diary, idx);
+    journal_add(diary, diary->added, &diary->added_count, hash);
     /* Intentional no APLOGNO */
-    ap_log_perror(APLOG_MARK, GCSLOG_LEVEL, 0, diary->entries->pool,
-                  "push_diary_append: %"APR_UINT64_T_HEX_FMT, e->hash);
+    ap_log_perror(APLOG_MARK, GCSLOG_LEVEL, 0, diary->pool,
+                  "push_diary_append: %"APR_UINT64_T_HEX_FMT, hash);
 }
 
 apr_array_header_t *h2_push_diary_update(h2_session *session, apr_array_header_t *pushes)
 {
     apr_array_header_t *npushes = pushes;
-    h2_push_diary_entry e;
+    apr_uint64_t hash;
     int i, idx;
     
     if (session->push_diary && pushes) {
@@ -652,13 +1030,13 @@ apr_array_header_t *h2_push_diary_update(h2_session *session, apr_array_header_t
             h2_push *push;
             
             push = APR_ARRAY_IDX(pushes, i, h2_push*);
-            session->push_diary->dcalc(session->push_diary, &e.hash, push);
-            idx = h2_push_diary_find(session->push_diary, e.hash);
+            session->push_diary->dcalc(session->push_diary, &hash, push);
+            idx = h2_push_diary_find(session->push_diary, hash);
             if (idx >= 0) {
                 /* Intentional no APLOGNO */
                 ap_log_cerror(APLOG_MARK, GCSLOG_LEVEL, 0, session->c1,
                               "push_diary_update: already there PUSH %s", push->req->path);
-                move_to_last(session->push_diary, (apr_size_t)idx);
+                move_to_last(session->push_diary, idx);
             }
             else {
                 /* Intentional no APLOGNO */
@@ -668,7 +1046,7 @@ apr_array_header_t *h2_push_diary_update(h2_session *session, apr_array_header_t
                     npushes = apr_array_make(pushes->pool, 5, sizeof(h2_push_diary_entry*));
                 }
                 APR_ARRAY_PUSH(npushes, h2_push*) = push;
-                h2_push_diary_append(session->push_diary, &e);
+                h2_push_diary_append(session->push_diary, hash);
             }
         }
     }
@@ -706,6 +1084,84 @@ static int cmp_puint64(const void *p1, const void *p2)
     return (*pu1 > *pu2)? 1 : ((*pu1 == *pu2)? 0 : -1);
 }
 
+static void sorted_rebuild(h2_push_diary *diary)
+{
+    int i;
+    
+    for (i = 0; i < diary->nelts; ++i) {
+        diary->sorted[i] = diary->entries[i].hash;
+    }
+    diary->sorted_count = diary->nelts;
+    qsort(diary->sorted, (apr_size_t)diary->sorted_count, sizeof(apr_uint64_t), cmp_puint64);
+}
+
+static void sorted_update(h2_push_diary *diary)
+{
+    int i, j, n;
+    
+    if (!diary->sorted) {
+        diary->journal_max = H2MAX(16, diary->N / 8);
+        diary->sorted = apr_pcalloc(diary->pool, sizeof(apr_uint64_t) 
+                                    * (apr_size_t)(diary->N + diary->journal_max));
+        diary->added = apr_pcalloc(diary->pool, sizeof(apr_uint64_t) 
+                                   * (apr_size_t)diary->journal_max);
+        diary->removed = apr_pcalloc(diary->pool, sizeof(apr_uint64_t) 
+                                     * (apr_size_t)diary->journal_max);
+        sorted_rebuild(diary);
+    }
+    else if (diary->journal_overflow) {
+        sorted_rebuild(diary);
+    }
+    else if (diary->added_count || diary->removed_count) {
+        qsort(diary->added, (apr_size_t)diary->added_count, 
+              sizeof(apr_uint64_t), cmp_puint64);
+        qsort(diary->removed, (apr_size_t)diary->removed_count, 
+              sizeof(apr_uint64_t), cmp_puint64);
+        
+        /* entries added and removed again since the last digest cancel out */
+        for (i = j = n = 0; i < diary->removed_count; ++i) {
+            while (j < diary->added_count && diary->added[j] < diary->removed[i]) {
+                ++j;
+            }
+            if (j < diary->added_count && diary->added[j] == diary->removed[i]) {
+                --diary->added_count;
+                memmove(diary->added + j, diary->added + j + 1, 
+                        sizeof(apr_uint64_t) * (apr_size_t)(diary->added_count - j));
+            }
+            else {
+                diary->removed[n++] = diary->removed[i];
+            }
+        }
+        diary->removed_count = n;
+        
+        /* remove the forgotten entries from the sorted hashes */
+        for (i = j = n = 0; i < diary->sorted_count; ++i) {
+            if (j < diary->removed_count && diary->sorted[i] == diary->removed[j]) {
+                ++j;
+                continue;
+            }
+            diary->sorted[n++] = diary->sorted[i];
+        }
+        diary->sorted_count = n;
+        
+        /* merge the new entries from the back, in place */
+        i = diary->sorted_count - 1;
+        j = diary->added_count - 1;
+        n = diary->sorted_count + diary->added_count;
+        diary->sorted_count = n;
+        while (j >= 0) {
+            if (i >= 0 && diary->sorted[i] > diary->added[j]) {
+                diary->sorted[--n] = diary->sorted[i--];
+            }
+            else {
+                diary->sorted[--n] = diary->added[j--];
+            }
+        }
+    }
+    diary->added_count = diary->removed_count = 0;
+    diary->journal_overflow = 0;
+}
+
 /* in golomb bit stream encoding, bit 0 is the 8th of the first char, or
  * more generally: 
  *      char(bit/8) & cbit_mask[(bit % 8)]
@@ -795,10 +1251,9 @@ apr_status_t h2_push_diary_digest_get(h2_push_diary *diary, apr_pool_t *pool,
     int nelts, N, i;
     unsigned char log2n, log2pmax;
     gset_encoder encoder;
-    apr_uint64_t *hashes;
-    apr_size_t hash_count;
+    apr_uint64_t hash, last = 0;
     
-    nelts = diary->entries->nelts;
+    nelts = diary->nelts;
     N = ceil_power_of_2(nelts);
     log2n = h2_log2(N);
     
@@ -836,18 +1291,15 @@ apr_status_t h2_push_diary_digest_get(h2_push_diary *diary, apr_pool_t *pool,
                   
     if (!authority || !diary->authority 
         || !strcmp("*", authority) || !strcmp(diary->authority, authority)) {
-        hash_count = diary->entries->nelts;
-        hashes = apr_pcalloc(encoder.pool, hash_count);
-        for (i = 0; i < hash_count; ++i) {
-            hashes[i] = ((&APR_ARRAY_IDX(diary->entries, i, h2_push_diary_entry))->hash 
-                         >> encoder.delta_bits);
-        }
-        
-        qsort(hashes, hash_count, sizeof(apr_uint64_t), cmp_puint64);
-        for (i = 0; i < hash_count; ++i) {
-            if (!i || (hashes[i] != hashes[i-1])) {
-                gset_encode_next(&encoder, hashes[i]);
+        /* The sorted hashes are maintained incrementally, shifting them
+         * by delta_bits keeps the order and we only need to skip duplicates. */
+        sorted_update(diary);
+        for (i = 0; i < diary->sorted_count; ++i) {
+            hash = diary->sorted[i] >> encoder.delta_bits;
+            if (!i || (hash != last)) {
+                gset_encode_next(&encoder, hash);
             }
+            last = hash;
         }
         /* Intentional no APLOGNO */
         ap_log_perror(APLOG_MARK, GCSLOG_LEVEL, 0, pool,
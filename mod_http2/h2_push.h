@@ -32,7 +32,8 @@ typedef struct h2_push {
 
 typedef enum {
     H2_PUSH_DIGEST_APR_HASH,
-    H2_PUSH_DIGEST_SHA256
+    H2_PUSH_DIGEST_SHA256,
+    H2_PUSH_DIGEST_FAST
 } h2_push_digest_type;
 
 /*******************************************************************************
@@ -41,14 +42,16 @@ typedef enum {
  * - The push diary keeps track of resources already PUSHed via HTTP/2 on this
  *   connection. It records a hash value from the absolute URL of the resource
  *   pushed.
- * - Lacking openssl, 
- * - with openssl, it uses SHA256 to calculate the hash value, otherwise it
- *   falls back to apr_hashfunc_default()
+ * - By default, it uses the fast 64 bit h2_util_hash64() to calculate the
+ *   hash value. With 'H2PushDiaryDigest SHA256' and openssl, it uses SHA256,
+ *   lacking openssl it falls back to apr_hashfunc_default()
  * - whatever the method to generate the hash, the diary keeps a maximum of 64
- *   bits per hash, limiting the memory consumption to about 
- *      H2PushDiarySize * 8 
- *   bytes. Entries are sorted by most recently used and oldest entries are
- *   forgotten first.
+ *   bits per hash. Entries are kept in a list sorted by most recently used
+ *   and oldest entries are forgotten first. An open addressing hash table
+ *   on the hash values makes lookup, insert and eviction O(1). This limits
+ *   the memory consumption to about
+ *      H2PushDiarySize * 32
+ *   bytes.
  * - While useful by itself to avoid duplicated PUSHes on the same connection,
  *   the original idea was that clients provided a 'Cache-Digest' header with
  *   the values of *their own* cached resources. This was described in
@@ -77,8 +80,17 @@ typedef struct h2_push_diary h2_push_diary;
 
 typedef void h2_push_digest_calc(h2_push_diary *diary, apr_uint64_t *phash, h2_push *push);
 
+typedef struct h2_push_diary_entry h2_push_diary_entry;
+
 struct h2_push_diary {
-    apr_array_header_t  *entries;
+    apr_pool_t          *pool;
+    h2_push_diary_entry *entries; /* slots for entries, grows up to N */
+    int                  nalloc;  /* number of slots allocated */
+    int                  nelts;   /* number of slots in use */
+    int                  lru_first; /* least recently used entry or -1 */
+    int                  lru_last;  /* most recently used entry or -1 */
+    int                 *index;   /* hash table, entry idx + 1 or 0 if free */
+    int                  index_mask; /* size of index table - 1 */
     int         NMax; /* Maximum for N, should size change be necessary */
     int         N;    /* Current maximum number of entries, power of 2 */
     apr_uint64_t         mask; /* mask for relevant bits */
@@ -86,8 +98,25 @@ struct h2_push_diary {
     const char          *authority;
     h2_push_digest_type  dtype;
     h2_push_digest_calc *dcalc;
+
+    /* Sorted hash values for the cache digest, kept up to date from a
+     * journal of changes once a digest has been requested. */
+    apr_uint64_t        *sorted;  /* sorted hashes, NULL until first digest */
+    int                  sorted_count;
+    apr_uint64_t        *added;   /* hashes added since last digest */
+    int                  added_count;
+    apr_uint64_t        *removed; /* hashes removed since last digest */
+    int                  removed_count;
+    int                  journal_max; /* max journal size before full resort */
+    int                  journal_overflow; /* journal exceeded, full resort */
 };
 
+/**
+ * Initialize the child process wide resources for pushes, e.g. the
+ * cache of parsed Link headers.
+ */
+apr_status_t h2_push_child_init(apr_pool_t *pool, server_rec *s);
+
 /**
  * Determine the list of h2_push'es to send to the client on behalf of
  * the given request/response pair.
@@ -106,10 +135,11 @@ apr_array_header_t *h2_push_collect(apr_pool_t *p,
  * Create a new push diary for the given maximum number of entries.
  * 
  * @param p the pool to use
+ * @param dtype the hash function to use for entries
  * @param N the max number of entries, rounded up to 2^x
  * @return the created diary, might be NULL of max_entries is 0
  */
-h2_push_diary *h2_push_diary_create(apr_pool_t *p, int N);
+h2_push_diary *h2_push_diary_create(apr_pool_t *p, h2_push_digest_type dtype, int N);
 
 /**
  * Filters the given pushes against the diary and returns only those pushes
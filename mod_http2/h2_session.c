@@ -16,6 +16,13 @@
  
 #include <assert.h>
 #include <stddef.h>
+#ifdef H2_TCP_INFO
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+#include <apr_atomic.h>
+#include <apr_network_io.h>
+#include <apr_portable.h>
 #include <apr_thread_cond.h>
 #include <apr_base64.h>
 #include <apr_strings.h>
@@ -44,6 +51,9 @@
 #include "h2_stream.h"
 #include "h2_c2.h"
 #include "h2_session.h"
+#include "h2_status.h"
+#include "h2_probes.h"
+#include "h2_vhost_stats.h"
 #include "h2_util.h"
 #include "h2_version.h"
 #include "h2_workers.h"
@@ -174,33 +184,70 @@ static int stream_pri_cmp(int sid1, int sid2, void *ctx)
 }
 
 /*
- * Callback when nghttp2 wants to send bytes back to the client.
+ * Pull serialized frames out of nghttp2 and add them to the c1 output
+ * until nghttp2 has nothing more to send or the output needs a flush.
+ * DATA frames with NO_COPY payload are written by on_send_data_cb()
+ * from inside the nghttp2 call.
+ * Returns 0 or a nghttp2 error code.
  */
-static ssize_t send_cb(nghttp2_session *ngh2,
-                       const uint8_t *data, size_t length,
-                       int flags, void *userp)
+static int session_mem_send(h2_session *session)
 {
-    h2_session *session = (h2_session *)userp;
+    const uint8_t *data;
+#ifdef H2_NG2_MEM_SEND2
+    nghttp2_ssize len;
+#else
+    ssize_t len;
+#endif
     apr_status_t rv;
-    (void)ngh2;
-    (void)flags;
 
-    if (h2_c1_io_needs_flush(&session->io)) {
-        return NGHTTP2_ERR_WOULDBLOCK;
+    while (!h2_c1_io_needs_flush(&session->io)) {
+#ifdef H2_NG2_MEM_SEND2
+        len = nghttp2_session_mem_send2(session->ngh2, &data);
+#else
+        len = nghttp2_session_mem_send(session->ngh2, &data);
+#endif
+        if (len <= 0) {
+            return (int)len;
+        }
+        rv = h2_c1_io_add_data(&session->io, (const char *)data, (size_t)len);
+        if (APR_SUCCESS != rv) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, rv, session->c1,
+                          APLOGNO(03062) "h2_session: send error");
+            return h2_session_status_from_apr_status(rv);
+        }
     }
+    return 0;
+}
 
-    rv = h2_c1_io_add_data(&session->io, (const char *)data, length);
-    if (APR_SUCCESS == rv) {
-        return length;
-    }
-    else if (APR_STATUS_IS_EAGAIN(rv)) {
-        return NGHTTP2_ERR_WOULDBLOCK;
+/*
+ * Serialize all frames nghttp2 has pending and flush them to the client.
+ * For shutdown, where we do not return to the session loop afterwards.
+ */
+static apr_status_t session_send_flushed(h2_session *session)
+{
+    apr_status_t rv = APR_SUCCESS;
+    int ngrv;
+
+    while (nghttp2_session_want_write(session->ngh2)) {
+        ngrv = session_mem_send(session);
+        if (ngrv != 0) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c1,
+                          H2_SSSN_MSG(session, "mem_send: %s"),
+                          nghttp2_strerror(ngrv));
+            rv = APR_EGENERAL;
+            break;
+        }
+        if (!h2_c1_io_pending(&session->io)) {
+            /* nothing nghttp2 may send now, e.g. DATA without window */
+            break;
+        }
+        rv = h2_c1_io_assure_flushed(&session->io);
+        if (APR_SUCCESS != rv) break;
     }
-    else {
-        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, rv, session->c1,
-                      APLOGNO(03062) "h2_session: send error");
-        return h2_session_status_from_apr_status(rv);
+    if (APR_SUCCESS == rv) {
+        rv = h2_c1_io_assure_flushed(&session->io);
     }
+    return rv;
 }
 
 static int on_invalid_frame_recv_cb(nghttp2_session *ngh2,
@@ -232,6 +279,7 @@ static int on_data_chunk_recv_cb(nghttp2_session *ngh2, uint8_t flags,
     h2_stream * stream;
     int rv = 0;
     
+    session->data_in += (apr_off_t)len;
     stream = get_stream(session, stream_id);
     if (stream) {
         ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c1,
@@ -273,6 +321,22 @@ static int on_stream_close_cb(nghttp2_session *ngh2, int32_t stream_id,
     return 0;
 }
 
+#ifdef H2_NG2_BEGIN_FRAME_CB
+static int on_begin_frame_cb(nghttp2_session *ngh2,
+                             const nghttp2_frame_hd *hd, void *userp)
+{
+    h2_session *session = (h2_session *)userp;
+
+    (void)ngh2;
+    /* on_frame_recv_cb() sees a header block as one HEADERS frame,
+     * the CONTINUATIONs it had on the wire only show up here. */
+    if (hd->type == NGHTTP2_CONTINUATION) {
+        session->hd_in_wire += (apr_off_t)hd->length;
+    }
+    return 0;
+}
+#endif
+
 static int on_begin_headers_cb(nghttp2_session *ngh2,
                                const nghttp2_frame *frame, void *userp)
 {
@@ -303,6 +367,7 @@ static int on_header_cb(nghttp2_session *ngh2, const nghttp2_frame *frame,
     apr_status_t status;
     
     (void)flags;
+    session->hd_in_plain += (apr_off_t)(namelen + valuelen);
     stream = get_stream(session, frame->hd.stream_id);
     if (!stream) {
         ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c1, APLOGNO(02920)
@@ -334,6 +399,8 @@ static int on_frame_recv_cb(nghttp2_session *ng2s,
     h2_stream *stream;
     apr_status_t rv = APR_SUCCESS;
     
+    H2_PROBE4(frame_recv, session->id, frame->hd.stream_id,
+              (int)frame->hd.type, (long)frame->hd.length);
     stream = frame->hd.stream_id? get_stream(session, frame->hd.stream_id) : NULL;
     if (APLOGcdebug(session->c1)) {
         char buffer[256];
@@ -358,6 +425,7 @@ static int on_frame_recv_cb(nghttp2_session *ng2s,
     ++session->frames_received;
     switch (frame->hd.type) {
         case NGHTTP2_HEADERS:
+            session->hd_in_wire += (apr_off_t)frame->hd.length;
             /* This can be HEADERS for a new stream, defining the request,
              * or HEADER may come after DATA at the end of a stream as in
              * trailers */
@@ -392,6 +460,18 @@ static int on_frame_recv_cb(nghttp2_session *ng2s,
                           session->id, (int)frame->hd.stream_id,
                           frame->window_update.window_size_increment);
             break;
+        case NGHTTP2_PING:
+            if ((frame->hd.flags & NGHTTP2_FLAG_ACK) && session->rtt_ping_sent
+                && !memcmp(frame->ping.opaque_data, &session->rtt_ping_sent,
+                           sizeof(session->rtt_ping_sent))) {
+                session->rtt_updated = apr_time_now();
+                session->rtt = session->rtt_updated - session->rtt_ping_sent;
+                session->rtt_ping_sent = 0;
+                ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c1,
+                              H2_SSSN_MSG(session, "PING rtt=%ldus"),
+                              (long)session->rtt);
+            }
+            break;
         case NGHTTP2_RST_STREAM:
             ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c1, APLOGNO(03067)
                           "h2_stream(%ld-%d): RST_STREAM by client, error=%d",
@@ -547,6 +627,10 @@ static int on_send_data_cb(nghttp2_session *ngh2,
     if (status == APR_SUCCESS) {
         stream->out_data_frames++;
         stream->out_data_octets += length;
+        stream->timing.last_data = apr_time_now();
+        if (!stream->timing.first_data) {
+            stream->timing.first_data = stream->timing.last_data;
+        }
         return 0;
     }
     else {
@@ -565,10 +649,19 @@ static int on_frame_send_cb(nghttp2_session *ngh2,
     int stream_id = frame->hd.stream_id;
     
     ++session->frames_sent;
+    H2_PROBE4(frame_send, session->id, frame->hd.stream_id,
+              (int)frame->hd.type, (long)frame->hd.length);
     switch (frame->hd.type) {
+        case NGHTTP2_HEADERS:
+            session->hd_out_wire += (apr_off_t)frame->hd.length;
+            break;
         case NGHTTP2_PUSH_PROMISE:
             /* PUSH_PROMISE we report on the promised stream */
             stream_id = frame->push_promise.promised_stream_id;
+            session->hd_out_wire += (apr_off_t)frame->hd.length;
+            break;
+        case NGHTTP2_WINDOW_UPDATE:
+            ++session->win_updates_sent;
             break;
         default:    
             break;
@@ -669,12 +762,14 @@ static apr_status_t init_callbacks(conn_rec *c, nghttp2_session_callbacks **pcb)
         return APR_EGENERAL;
     }
     
-    NGH2_SET_CALLBACK(*pcb, send, send_cb);
     NGH2_SET_CALLBACK(*pcb, on_frame_recv, on_frame_recv_cb);
     NGH2_SET_CALLBACK(*pcb, on_invalid_frame_recv, on_invalid_frame_recv_cb);
     NGH2_SET_CALLBACK(*pcb, on_data_chunk_recv, on_data_chunk_recv_cb);
     NGH2_SET_CALLBACK(*pcb, on_stream_close, on_stream_close_cb);
     NGH2_SET_CALLBACK(*pcb, on_begin_headers, on_begin_headers_cb);
+#ifdef H2_NG2_BEGIN_FRAME_CB
+    NGH2_SET_CALLBACK(*pcb, on_begin_frame, on_begin_frame_cb);
+#endif
     NGH2_SET_CALLBACK(*pcb, on_header, on_header_cb);
     NGH2_SET_CALLBACK(*pcb, send_data, on_send_data_cb);
     NGH2_SET_CALLBACK(*pcb, on_frame_send, on_frame_send_cb);
@@ -712,6 +807,31 @@ static void update_child_status(h2_session *session, int status,
     }
 }
 
+static int sum_beam_buffered(h2_stream *stream, void *ctx)
+{
+    apr_off_t *pbuffered = ctx;
+
+    if (stream->output) {
+        *pbuffered += h2_beam_get_buffered(stream->output);
+    }
+    return 1;
+}
+
+static void update_status_values(h2_session *session)
+{
+    apr_time_t now = apr_time_now();
+
+    /* Values for status reports that are too expensive to keep live */
+    if (now - session->status_updated >= apr_time_from_sec(1)) {
+        apr_off_t buffered = 0;
+
+        h2_mplx_c1_streams_do(session->mplx, sum_beam_buffered, &buffered);
+        session->status_beam_buffered = buffered;
+        session->status_updated = now;
+        h2_status_session_update(session);
+    }
+}
+
 static apr_status_t h2_session_shutdown_notice(h2_session *session)
 {
     apr_status_t status;
@@ -723,10 +843,7 @@ static apr_status_t h2_session_shutdown_notice(h2_session *session)
     
     nghttp2_submit_shutdown_notice(session->ngh2);
     session->local.accepting = 0;
-    status = nghttp2_session_send(session->ngh2);
-    if (status == APR_SUCCESS) {
-        status = h2_c1_io_assure_flushed(&session->io);
-    }
+    status = session_send_flushed(session);
     ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c1,
                   H2_SSSN_LOG(APLOGNO(03457), session, "sent shutdown notice"));
     return status;
@@ -772,10 +889,7 @@ static apr_status_t h2_session_shutdown(h2_session *session, int error,
         nghttp2_submit_goaway(session->ngh2, NGHTTP2_FLAG_NONE, 
                               session->local.accepted_max, 
                               error, (uint8_t*)msg, msg? strlen(msg):0);
-        status = nghttp2_session_send(session->ngh2);
-        if (status == APR_SUCCESS) {
-            status = h2_c1_io_assure_flushed(&session->io);
-        }
+        status = session_send_flushed(session);
         ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c1,
                       H2_SSSN_LOG(APLOGNO(03069), session, 
                                   "sent GOAWAY, err=%d, msg=%s"), error, msg? msg : "");
@@ -807,6 +921,7 @@ static apr_status_t session_cleanup(h2_session *session, const char *trigger)
     }
 
     transit(session, trigger, H2_SESSION_ST_CLEANUP);
+    h2_status_session_remove(session);
     h2_mplx_c1_destroy(session->mplx);
     session->mplx = NULL;
 
@@ -878,6 +993,15 @@ apr_status_t h2_session_create(h2_session **psession, conn_rec *c, request_rec *
     
     session->max_stream_count = h2_config_sgeti(s, H2_CONF_MAX_STREAMS);
     session->max_stream_mem = h2_config_sgeti(s, H2_CONF_STREAM_MAX_MEM);
+    session->idle_grace_max = h2_config_sgeti64(s, H2_CONF_IDLE_GRACE_MAX);
+    session->idle_grace_min = h2_config_sgeti64(s, H2_CONF_IDLE_GRACE_MIN);
+    session->idle_grace = session->idle_grace_max;
+    session->win_initial = h2_config_sgeti(s, H2_CONF_WIN_SIZE);
+#ifdef H2_NG2_LOCAL_WIN_SIZE
+    session->win_autotune = h2_config_sgeti(s, H2_CONF_WIN_AUTOTUNE);
+#endif
+    session->win_max = H2MAX(session->win_initial, h2_config_sgeti(s, H2_CONF_WIN_MAX));
+    session->win_budget = h2_config_sgeti64(s, H2_CONF_WIN_BUDGET);
     
     session->in_pending = h2_iq_create(session->pool, (int)session->max_stream_count);
     session->out_c1_blocked = h2_iq_create(session->pool, (int)session->max_stream_count);
@@ -945,7 +1069,8 @@ apr_status_t h2_session_create(h2_session **psession, conn_rec *c, request_rec *
     }
     
     n = h2_config_sgeti(s, H2_CONF_PUSH_DIARY_SIZE);
-    session->push_diary = h2_push_diary_create(session->pool, n);
+    session->push_diary = h2_push_diary_create(session->pool, 
+        (h2_push_digest_type)h2_config_sgeti(s, H2_CONF_PUSH_DIARY_DIGEST), n);
     
     if (APLOGcdebug(c)) {
         ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, 
@@ -962,6 +1087,7 @@ apr_status_t h2_session_create(h2_session **psession, conn_rec *c, request_rec *
     }
     
     apr_pool_pre_cleanup_register(pool, c, session_pool_cleanup);
+    h2_status_session_add(session);
         
     return APR_SUCCESS;
 }
@@ -1223,6 +1349,78 @@ int h2_session_push_enabled(h2_session *session)
                    NGHTTP2_SETTINGS_ENABLE_PUSH));
 }
 
+apr_interval_time_t h2_session_rtt_get(h2_session *session)
+{
+    apr_time_t now = apr_time_now();
+
+#ifdef H2_TCP_INFO
+    if (now - session->rtt_updated > apr_time_from_msec(100)) {
+        apr_socket_t *socket = ap_get_conn_socket(session->c1);
+        apr_os_sock_t fd;
+        struct tcp_info ti;
+        socklen_t len = sizeof(ti);
+
+        if (socket && APR_SUCCESS == apr_os_sock_get(&fd, socket)
+            && !getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len)
+            && ti.tcpi_rtt > 0) {
+            session->rtt = (apr_interval_time_t)ti.tcpi_rtt;
+            session->rtt_updated = now;
+            return session->rtt;
+        }
+    }
+    else {
+        return session->rtt;
+    }
+#endif
+    /* No kernel value, measure it ourself every 10 seconds */
+    if (!session->rtt_ping_sent
+        && now - session->rtt_updated > apr_time_from_sec(10)) {
+        uint8_t opaque[8];
+
+        memcpy(opaque, &now, sizeof(opaque));
+        if (!nghttp2_submit_ping(session->ngh2, NGHTTP2_FLAG_NONE, opaque)) {
+            session->rtt_ping_sent = now;
+        }
+    }
+    return session->rtt;
+}
+
+/* growth of stream windows in this child, in KB to fit an atomic */
+static volatile apr_uint32_t win_grown_child_kb;
+
+apr_int64_t h2_session_win_reserve(h2_session *session, apr_int64_t want)
+{
+    apr_int64_t budget_kb = h2_config_sgeti64(session->s, H2_CONF_WIN_BUDGET_CHILD) / 1024;
+    apr_uint32_t cur_kb, new_kb;
+    apr_int64_t kb;
+
+    /* reserve in whole KB from the child, without taking a lock */
+    want = H2MIN(want, session->win_budget - session->win_grown) / 1024;
+    if (want <= 0) {
+        return 0;
+    }
+    do {
+        cur_kb = apr_atomic_read32(&win_grown_child_kb);
+        kb = H2MIN(want, budget_kb - (apr_int64_t)cur_kb);
+        if (kb <= 0) {
+            return 0;
+        }
+        new_kb = cur_kb + (apr_uint32_t)kb;
+    } while (apr_atomic_cas32(&win_grown_child_kb, new_kb, cur_kb) != cur_kb);
+
+    want = kb * 1024;
+    session->win_grown += want;
+    return want;
+}
+
+void h2_session_win_release(h2_session *session, apr_int64_t bytes)
+{
+    if (bytes > 0) {
+        session->win_grown -= bytes;
+        apr_atomic_sub32(&win_grown_child_kb, (apr_uint32_t)(bytes / 1024));
+    }
+}
+
 static int h2_session_want_send(h2_session *session)
 {
     return nghttp2_session_want_write(session->ngh2)
@@ -1235,9 +1433,9 @@ static apr_status_t h2_session_send(h2_session *session)
     apr_status_t rv = APR_SUCCESS;
 
     while (nghttp2_session_want_write(session->ngh2)) {
-        ngrv = nghttp2_session_send(session->ngh2);
+        ngrv = session_mem_send(session);
         ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c1,
-                      "nghttp2_session_send: %d", (int)ngrv);
+                      "nghttp2_session_mem_send: %d", (int)ngrv);
 
         if (ngrv != 0 && ngrv != NGHTTP2_ERR_WOULDBLOCK) {
             if (nghttp2_is_fatal(ngrv)) {
@@ -1284,6 +1482,7 @@ static apr_status_t on_stream_input(void *ctx, h2_stream *stream)
             goto cleanup;
         }
         update_child_status(session, SERVER_BUSY_READ, "read", stream);
+        ++session->input_reports;
         h2_beam_report_consumption(stream->input);
         if (stream->state == H2_SS_CLOSED_R) {
             /* TODO: remove this stream from input polling */
@@ -1331,6 +1530,47 @@ const char *h2_session_state_str(h2_session_state state)
     return StateNames[state];
 }
 
+/* Learn how long this connection usually stays IDLE. The grace period
+ * to wait for the next request covers 3/4 of the IDLE durations seen,
+ * if that is within our bounds. Otherwise, waiting is not likely to pay
+ * off and the minimum is used. */
+static void idle_gap_add(h2_session *session, apr_interval_time_t gap)
+{
+    apr_uint32_t total = 0, sum = 0;
+    apr_int64_t ms = apr_time_as_msec(gap);
+    int i;
+
+    for (i = 0; ms > 0 && i < H2_IDLE_GAP_BUCKETS - 1; ++i) {
+        ms >>= 1;
+    }
+    if (++session->idle_gaps[i] >= 64) {
+        /* let older observations fade */
+        for (i = 0; i < H2_IDLE_GAP_BUCKETS; ++i) {
+            session->idle_gaps[i] /= 2;
+        }
+    }
+    for (i = 0; i < H2_IDLE_GAP_BUCKETS; ++i) {
+        total += session->idle_gaps[i];
+    }
+    if (total < 4) {
+        return;
+    }
+    for (i = 0; i < H2_IDLE_GAP_BUCKETS; ++i) {
+        sum += session->idle_gaps[i];
+        if (4 * sum >= 3 * total) {
+            break;
+        }
+    }
+    session->idle_grace = (i < H2_IDLE_GAP_BUCKETS - 1)?
+                          apr_time_from_msec(((apr_int64_t)1) << i) : -1;
+    if (session->idle_grace < 0 || session->idle_grace > session->idle_grace_max) {
+        session->idle_grace = session->idle_grace_min;
+    }
+    else if (session->idle_grace < session->idle_grace_min) {
+        session->idle_grace = session->idle_grace_min;
+    }
+}
+
 static void transit(h2_session *session, const char *action, h2_session_state nstate)
 {
     int ostate;
@@ -1344,6 +1584,18 @@ static void transit(h2_session *session, const char *action, h2_session_state ns
                       h2_session_state_str(ostate), action, 
                       h2_session_state_str(nstate));
         
+        if (nstate == H2_SESSION_ST_IDLE) {
+            session->idle_since = apr_time_now();
+            /* an idle connection, possibly back in the mpm, should
+             * not keep a large input buffer */
+            h2_c1_io_in_release(&session->io);
+        }
+        else if (ostate == H2_SESSION_ST_IDLE && session->idle_since
+                 && nstate != H2_SESSION_ST_DONE) {
+            idle_gap_add(session, apr_time_now() - session->idle_since);
+            session->idle_since = 0;
+        }
+
         switch (session->state) {
             case H2_SESSION_ST_IDLE:
                 if (!session->remote.emitted_count) {
@@ -1563,8 +1815,12 @@ static void ev_stream_open(h2_session *session, h2_stream *stream)
 
 static void ev_stream_closed(h2_session *session, h2_stream *stream)
 {
+    h2_conn_ctx_t *c2_ctx = stream->c2? h2_conn_ctx_get(stream->c2) : NULL;
     apr_bucket *b;
     
+    h2_vhost_stats_stream_closed((c2_ctx && c2_ctx->server)? c2_ctx->server : session->s,
+                                 stream->timing.closed - stream->timing.opened,
+                                 stream->out_data_octets, stream->rst_error != 0);
     if (H2_STREAM_CLIENT_INITIATED(stream->id)
         && (stream->id > session->local.completed_max)) {
         session->local.completed_max = stream->id;
@@ -1772,6 +2028,7 @@ apr_status_t h2_session_process(h2_session *session, int async)
         }
 
         session->status[0] = '\0';
+        update_status_values(session);
         
         if (h2_session_want_send(session)) {
             h2_session_send(session);
@@ -1824,8 +2081,9 @@ apr_status_t h2_session_process(h2_session *session, int async)
             if (!h2_session_want_send(session)) {
                 /* Give any new incoming request a short grace period to
                  * arrive while we are still hot and return to the mpm
-                 * connection handling when nothing really happened. */
-                h2_mplx_c1_poll(session->mplx, apr_time_from_msec(100),
+                 * connection handling when nothing really happened.
+                 * How long is learned from the connection's history. */
+                h2_mplx_c1_poll(session->mplx, session->idle_grace,
                                 on_stream_input, on_stream_output, session);
                 if (H2_SESSION_ST_IDLE == session->state) {
                     ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, c,
@@ -1857,6 +2115,23 @@ apr_status_t h2_session_process(h2_session *session, int async)
                 h2_session_dispatch_event(session, H2_SESSION_EV_CONN_ERROR, status, NULL);
                 break;
             }
+            if (session->suspended) {
+                /* The mpm resumed us, one of our c1/c2 sockets/pipes
+                 * is ready. */
+                session->suspended = 0;
+                status = h2_mplx_c1_poll(session->mplx, 0,
+                                         on_stream_input, on_stream_output, session);
+                if (APR_SUCCESS != status && !APR_STATUS_IS_TIMEUP(status)) {
+                    h2_session_dispatch_event(session, H2_SESSION_EV_CONN_ERROR, status, NULL);
+                }
+                break;
+            }
+            if (async && session->wait_suspend) {
+                /* Let the mpm watch our sockets/pipes and give up the
+                 * thread until something happens. */
+                session->suspended = 1;
+                goto leaving;
+            }
             /* No IO happening and input is exhausted. Make sure we have
              * flushed any possibly pending output and then wait with
              * the c1 connection timeout for sth to happen in our c1/c2 sockets/pipes */
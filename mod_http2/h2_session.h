@@ -39,6 +39,7 @@ struct h2_mplx;
 struct h2_priority;
 struct h2_push;
 struct h2_push_diary;
+struct h2_preload_ctx;
 struct h2_session;
 struct h2_stream;
 struct h2_stream_monitor;
@@ -61,6 +62,9 @@ typedef enum {
     H2_SESSION_EV_NO_MORE_STREAMS,  /* no more streams to process */
 } h2_session_event_t;
 
+/* IDLE durations are counted in buckets of [2^(i-1), 2^i) milliseconds */
+#define H2_IDLE_GAP_BUCKETS     16
+
 typedef struct h2_session {
     long id;                        /* identifier of this session, unique
                                      * inside a httpd process */
@@ -87,6 +91,7 @@ typedef struct h2_session {
     apr_interval_time_t  wait_us;   /* timeout during BUSY_WAIT state, micro secs */
     
     struct h2_push_diary *push_diary; /* remember pushes, avoid duplicates */
+    struct h2_preload_ctx *preload; /* last document for learning preloads */
     
     struct h2_stream_monitor *monitor;/* monitor callbacks for streams */
     int open_streams;               /* number of streams processing */
@@ -100,6 +105,13 @@ typedef struct h2_session {
     
     apr_size_t frames_received;     /* number of http/2 frames received */
     apr_size_t frames_sent;         /* number of http/2 frames sent */
+    apr_off_t hd_in_plain;          /* header octets received, decoded */
+    apr_off_t hd_in_wire;           /* header octets received, HPACK encoded */
+    apr_off_t hd_out_plain;         /* header octets sent, before encoding */
+    apr_off_t hd_out_wire;          /* header octets sent, HPACK encoded */
+    apr_off_t data_in;              /* DATA payload octets received */
+    apr_size_t win_updates_sent;    /* number of WINDOW_UPDATE frames sent */
+    apr_size_t input_reports;       /* c1 wakeups for consumed stream input */
     
     apr_size_t max_stream_count;    /* max number of open streams */
     apr_size_t max_stream_mem;      /* max buffer memory for a single stream */
@@ -110,6 +122,8 @@ typedef struct h2_session {
     apr_bucket_brigade *bbtmp;      /* brigade for keeping temporary data */
 
     char status[64];                /* status message for scoreboard */
+    apr_time_t status_updated;      /* last time the values below were updated */
+    apr_off_t status_beam_buffered; /* output buffered in stream beams */
     int last_status_code;           /* the one already reported */
     const char *last_status_msg;    /* the one already reported */
     
@@ -117,6 +131,24 @@ typedef struct h2_session {
     struct h2_iqueue *out_c1_blocked;  /* all streams with output blocked on c1 buffer full */
     struct h2_iqueue *ready_to_process;  /* all streams ready for processing */
 
+    int win_autotune;               /* adapt stream windows, H2WindowAutoTune */
+    int win_initial;                /* configured stream window size */
+    int win_max;                    /* max size of an adapted stream window */
+    apr_int64_t win_budget;         /* max growth of windows on this connection */
+    apr_int64_t win_grown;          /* current growth of windows on this connection */
+    apr_size_t win_grows;           /* number of times a stream window grew */
+    apr_interval_time_t idle_grace_min; /* bounds of the learned idle grace */
+    apr_interval_time_t idle_grace_max;
+    apr_interval_time_t idle_grace; /* how long to wait when IDLE before returning to mpm */
+    apr_time_t idle_since;          /* when the session last became IDLE */
+    apr_uint16_t idle_gaps[H2_IDLE_GAP_BUCKETS]; /* decaying histogram of IDLE durations */
+    apr_interval_time_t rtt;        /* last measured round trip time or 0 */
+    apr_time_t rtt_updated;         /* when rtt was last measured */
+    apr_time_t rtt_ping_sent;       /* when our PING to measure rtt was sent or 0 */
+    int wait_suspend;               /* may leave WAIT to the mpm, H2WaitSuspend */
+    int suspended;                  /* returned to the mpm in WAIT state */
+    apr_pool_t *suspend_pool;       /* for the mpm poll registration */
+
 } h2_session;
 
 const char *h2_session_state_str(h2_session_state state);
@@ -165,6 +197,29 @@ void h2_session_abort(h2_session *session, apr_status_t reason);
  */
 int h2_session_push_enabled(h2_session *session);
 
+/**
+ * Get the round trip time to the client, as measured by the kernel on the
+ * TCP connection if available, otherwise by a PING. If no value is known
+ * yet, 0 is returned and a PING may be submitted to get one.
+ * @param session the session
+ * @return the round trip time or 0 if unknown
+ */
+apr_interval_time_t h2_session_rtt_get(h2_session *session);
+
+/**
+ * Reserve bytes for growing a stream's receive window from the budgets of
+ * the connection and the child process.
+ * @param session the session the stream belongs to
+ * @param want the number of bytes the window should grow
+ * @return the number of bytes reserved, a multiple of 1024 between 0 and want
+ */
+apr_int64_t h2_session_win_reserve(h2_session *session, apr_int64_t want);
+
+/**
+ * Give back bytes reserved with h2_session_win_reserve().
+ */
+void h2_session_win_release(h2_session *session, apr_int64_t bytes);
+
 /**
  * Submit a push promise on the stream and schedule the new steam for
  * processing..
@@ -0,0 +1,480 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+#include <unistd.h>
+
+#include <apr_atomic.h>
+#include <apr_hash.h>
+#include <apr_optional.h>
+#include <apr_optional_hooks.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+
+#include <httpd.h>
+#include <http_core.h>
+#include <http_log.h>
+#include <http_protocol.h>
+#include <http_request.h>
+#include <mpm_common.h>
+#include <mod_status.h>
+
+#include "h2_private.h"
+#include "h2.h"
+#include "h2_bucket_beam.h"
+#include "h2_c2.h"
+#include "h2_locks.h"
+#include "h2_mplx.h"
+#include "h2_session.h"
+#include "h2_status.h"
+#include "h2_util.h"
+#include "h2_workers.h"
+
+typedef struct {
+    apr_thread_mutex_t *lock;
+    apr_hash_t *sessions;           /* session id -> session_status* */
+    h2_workers *workers;
+} status_registry;
+
+static status_registry *registry;
+
+/* A copy of a session's values, published by the session's thread
+ * and read under the registry lock */
+typedef struct {
+    long id;
+    const char *client;
+    const char *vhost;
+    const char *state;
+    int open_streams;
+    int streams_done;
+    int processing_count;
+    int processing_limit;
+    int processing_max;
+    apr_off_t beam_buffered;
+    apr_off_t c1_buffered;
+    apr_size_t frames_received;
+    apr_size_t frames_sent;
+    apr_off_t hd_in_plain;
+    apr_off_t hd_in_wire;
+    apr_off_t hd_out_plain;
+    apr_off_t hd_out_wire;
+    apr_off_t data_in;
+    apr_size_t win_updates_sent;
+    int win_autotune;
+    apr_size_t win_grows;
+    apr_size_t input_reports;
+    apr_interval_time_t idle_grace;
+} session_status;
+
+typedef struct {
+    int workers;
+    int workers_busy;
+    int workers_min;
+    int workers_max;
+    h2_beam_wait_stats beams;
+    apr_uint32_t mplx_pools;
+    apr_uint32_t c2_pools;
+    int nsessions;
+    session_status *sessions;
+} status_report;
+
+apr_status_t h2_status_child_init(apr_pool_t *pool, server_rec *s,
+                                  h2_workers *workers)
+{
+    status_registry *reg;
+    apr_status_t rv;
+
+    (void)s;
+    reg = apr_pcalloc(pool, sizeof(*reg));
+    rv = apr_thread_mutex_create(&reg->lock, APR_THREAD_MUTEX_DEFAULT, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    reg->sessions = apr_hash_make(pool);
+    reg->workers = workers;
+    registry = reg;
+    return APR_SUCCESS;
+}
+
+void h2_status_session_add(h2_session *session)
+{
+    session_status *st;
+
+    if (registry) {
+        st = apr_pcalloc(session->pool, sizeof(*st));
+        st->id = session->id;
+        st->client = session->c1->client_ip;
+        st->vhost = session->s->server_hostname;
+        st->state = h2_session_state_str(session->state);
+        apr_thread_mutex_lock(registry->lock);
+        apr_hash_set(registry->sessions, &st->id, sizeof(st->id), st);
+        apr_thread_mutex_unlock(registry->lock);
+    }
+}
+
+void h2_status_session_update(h2_session *session)
+{
+    session_status snap, *st;
+
+    if (!registry) {
+        return;
+    }
+    memset(&snap, 0, sizeof(snap));
+    snap.state = h2_session_state_str(session->state);
+    snap.open_streams = session->open_streams;
+    snap.streams_done = session->streams_done;
+    if (session->mplx) {
+        h2_mplx_c1_processing_get(session->mplx, &snap.processing_count,
+                                  &snap.processing_limit, &snap.processing_max);
+    }
+    snap.beam_buffered = session->status_beam_buffered;
+    snap.c1_buffered = session->io.buffered_len;
+    snap.frames_received = session->frames_received;
+    snap.frames_sent = session->frames_sent;
+    snap.hd_in_plain = session->hd_in_plain;
+    snap.hd_in_wire = session->hd_in_wire;
+    snap.hd_out_plain = session->hd_out_plain;
+    snap.hd_out_wire = session->hd_out_wire;
+    snap.data_in = session->data_in;
+    snap.win_updates_sent = session->win_updates_sent;
+    snap.win_autotune = session->win_autotune;
+    snap.win_grows = session->win_grows;
+    snap.input_reports = session->input_reports;
+    snap.idle_grace = session->idle_grace;
+
+    apr_thread_mutex_lock(registry->lock);
+    st = apr_hash_get(registry->sessions, &session->id, sizeof(session->id));
+    if (st) {
+        snap.id = st->id;
+        snap.client = st->client;
+        snap.vhost = st->vhost;
+        *st = snap;
+    }
+    apr_thread_mutex_unlock(registry->lock);
+}
+
+void h2_status_session_remove(h2_session *session)
+{
+    if (registry) {
+        apr_thread_mutex_lock(registry->lock);
+        apr_hash_set(registry->sessions, &session->id, sizeof(session->id), NULL);
+        apr_thread_mutex_unlock(registry->lock);
+    }
+}
+
+static double hd_ratio(apr_off_t plain, apr_off_t wire)
+{
+    return wire > 0? ((double)plain / (double)wire) : 0.0;
+}
+
+static void report_collect(status_report *report, apr_pool_t *p)
+{
+    apr_hash_index_t *hi;
+    int i = 0;
+
+    memset(report, 0, sizeof(*report));
+    if (!registry) {
+        return;
+    }
+    apr_thread_mutex_lock(registry->lock);
+    if (registry->workers) {
+        h2_workers *workers = registry->workers;
+        report->workers = (int)apr_atomic_read32(&workers->worker_count);
+        report->workers_busy = (int)apr_atomic_read32(&workers->busy_count);
+        report->workers_min = (int)workers->min_workers;
+        report->workers_max = (int)workers->max_workers;
+    }
+    h2_beam_wait_stats_get(&report->beams);
+    report->mplx_pools = h2_mplx_pool_count();
+    report->c2_pools = h2_c2_pool_count();
+    report->nsessions = (int)apr_hash_count(registry->sessions);
+    report->sessions = apr_pcalloc(p, (apr_size_t)(report->nsessions + 1) 
+                                      * sizeof(session_status));
+    for (hi = apr_hash_first(p, registry->sessions); 
+         hi && i < report->nsessions; hi = apr_hash_next(hi)) {
+        session_status *st = &report->sessions[i++];
+
+        *st = *(session_status *)apr_hash_this_val(hi);
+        st->client = apr_pstrdup(p, st->client);
+        st->vhost = apr_pstrdup(p, st->vhost);
+    }
+    report->nsessions = i;
+    apr_thread_mutex_unlock(registry->lock);
+}
+
+/* WINDOW_UPDATE frames sent for each MB of DATA received */
+static double per_mb(apr_size_t count, apr_off_t bytes)
+{
+    return bytes > 0? ((double)count * 1024 * 1024 / (double)bytes) : 0.0;
+}
+
+static void locks_short(request_rec *r)
+{
+    h2_lock_stats ls;
+    int i;
+
+    for (i = 0; i < H2_LOCK_CLASS_COUNT; ++i) {
+        h2_lock_stats_get((h2_lock_class)i, &ls);
+        ap_rprintf(r, "H2Lock_%s: acquired=%u contended=%u wait_p50=%u "
+                   "wait_p99=%u hold_p50=%u hold_p99=%u\n",
+                   h2_lock_class_name((h2_lock_class)i), ls.acquired, ls.contended,
+                   h2_lock_hist_percentile(ls.wait_hist, 50),
+                   h2_lock_hist_percentile(ls.wait_hist, 99),
+                   h2_lock_hist_percentile(ls.hold_hist, 50),
+                   h2_lock_hist_percentile(ls.hold_hist, 99));
+    }
+}
+
+static void locks_html(request_rec *r)
+{
+    h2_lock_stats ls;
+    int i;
+
+    ap_rputs("<table border=\"0\"><tr><th>Lock</th><th>Acquired</th>"
+             "<th>Contended</th><th>Wait p50</th><th>Wait p99</th>"
+             "<th>Hold p50</th><th>Hold p99</th></tr>\n", r);
+    for (i = 0; i < H2_LOCK_CLASS_COUNT; ++i) {
+        h2_lock_stats_get((h2_lock_class)i, &ls);
+        ap_rprintf(r, "<tr><td>%s</td><td>%u</td><td>%u</td><td>%u us</td>"
+                   "<td>%u us</td><td>%u us</td><td>%u us</td></tr>\n",
+                   h2_lock_class_name((h2_lock_class)i), ls.acquired, ls.contended,
+                   h2_lock_hist_percentile(ls.wait_hist, 50),
+                   h2_lock_hist_percentile(ls.wait_hist, 99),
+                   h2_lock_hist_percentile(ls.hold_hist, 50),
+                   h2_lock_hist_percentile(ls.hold_hist, 99));
+    }
+    ap_rputs("</table>\n", r);
+}
+
+static void json_hist(request_rec *r, const apr_uint32_t *hist)
+{
+    int i;
+
+    ap_rputs("[", r);
+    for (i = 0; i < H2_LOCK_HIST_BUCKETS; ++i) {
+        ap_rprintf(r, "%s%u", i? ", " : "", hist[i]);
+    }
+    ap_rputs("]", r);
+}
+
+static void locks_json(request_rec *r)
+{
+    h2_lock_stats ls;
+    int i;
+
+    ap_rputs("  \"locks\": {", r);
+    for (i = 0; i < H2_LOCK_CLASS_COUNT; ++i) {
+        h2_lock_stats_get((h2_lock_class)i, &ls);
+        ap_rprintf(r, "%s\n    \"%s\": { \"acquired\": %u, \"contended\": %u, "
+                   "\"wait_us_hist\": ", i? "," : "", 
+                   h2_lock_class_name((h2_lock_class)i), ls.acquired, ls.contended);
+        json_hist(r, ls.wait_hist);
+        ap_rputs(", \"hold_us_hist\": ", r);
+        json_hist(r, ls.hold_hist);
+        ap_rputs(" }", r);
+    }
+    ap_rputs("\n  },\n", r);
+}
+
+static int h2_status_hook(request_rec *r, int flags)
+{
+    status_report report;
+    int i;
+
+    report_collect(&report, r->pool);
+    if (flags & AP_STATUS_SHORT) {
+        ap_rprintf(r, "H2Pid: %" APR_PID_T_FMT "\n", getpid());
+        ap_rprintf(r, "H2Workers: %d\n", report.workers);
+        ap_rprintf(r, "H2WorkersBusy: %d\n", report.workers_busy);
+        ap_rprintf(r, "H2WorkersMax: %d\n", report.workers_max);
+        ap_rprintf(r, "H2BeamsBlocked: full=%u empty=%u\n", 
+                   report.beams.full_blocked, report.beams.empty_blocked);
+        ap_rprintf(r, "H2BeamWaits: full=%u empty=%u\n", 
+                   report.beams.full_waits, report.beams.empty_waits);
+        ap_rprintf(r, "H2Pools: mplx=%u c2=%u max_mem_free=%u\n", 
+                   report.mplx_pools, report.c2_pools, ap_max_mem_free);
+        if (h2_lock_stats_enabled()) {
+            locks_short(r);
+        }
+        ap_rprintf(r, "H2Sessions: %d\n", report.nsessions);
+        for (i = 0; i < report.nsessions; ++i) {
+            session_status *st = &report.sessions[i];
+            ap_rprintf(r, "H2Session%d: id=%ld client=%s state=%s streams=%d "
+                       "done=%d processing=%d/%d/%d beam_buffered=%" APR_OFF_T_FMT 
+                       " c1_buffered=%" APR_OFF_T_FMT " frames_in=%lu frames_out=%lu "
+                       "hpack_in=%.2f hpack_out=%.2f data_in=%" APR_OFF_T_FMT
+                       " win_updates=%lu (%.2f/MB) input_reports=%lu"
+                       " idle_grace_ms=%ld\n", 
+                       i, st->id, st->client, 
+                       st->state, st->open_streams, st->streams_done, 
+                       st->processing_count, st->processing_limit, 
+                       st->processing_max, st->beam_buffered, st->c1_buffered,
+                       (unsigned long)st->frames_received, 
+                       (unsigned long)st->frames_sent,
+                       hd_ratio(st->hd_in_plain, st->hd_in_wire),
+                       hd_ratio(st->hd_out_plain, st->hd_out_wire),
+                       st->data_in, (unsigned long)st->win_updates_sent,
+                       per_mb(st->win_updates_sent, st->data_in),
+                       (unsigned long)st->input_reports,
+                       (long)apr_time_as_msec(st->idle_grace));
+        }
+        return OK;
+    }
+
+    ap_rputs("<hr>\n<h2>HTTP/2</h2>\n", r);
+    ap_rprintf(r, "<dl><dt>Process %" APR_PID_T_FMT ": %d workers, %d busy, "
+               "min %d, max %d, %d sessions</dt>\n", getpid(), 
+               report.workers, report.workers_busy, report.workers_min, 
+               report.workers_max, report.nsessions);
+    ap_rprintf(r, "<dt>Beams: %u senders blocked on full, %u receivers on empty "
+               "(%u/%u waits total)</dt>\n", 
+               report.beams.full_blocked, report.beams.empty_blocked,
+               report.beams.full_waits, report.beams.empty_waits);
+    ap_rprintf(r, "<dt>Pools: %u multiplexer, %u stream connections, "
+               "max %u bytes kept free by each</dt></dl>\n", 
+               report.mplx_pools, report.c2_pools, ap_max_mem_free);
+    if (h2_lock_stats_enabled()) {
+        locks_html(r);
+    }
+    if (report.nsessions > 0) {
+        ap_rputs("<table border=\"0\"><tr><th>Session</th><th>Client</th>"
+                 "<th>VHost</th><th>State</th><th>Streams</th><th>Done</th>"
+                 "<th>Processing</th><th>Beam Buffered</th><th>C1 Buffered</th>"
+                 "<th>Frames In</th><th>Frames Out</th>"
+                 "<th>HPACK In</th><th>HPACK Out</th>"
+                 "<th>WINDOW_UPDATE/MB In</th></tr>\n", r);
+        for (i = 0; i < report.nsessions; ++i) {
+            session_status *st = &report.sessions[i];
+            ap_rprintf(r, "<tr><td>%ld</td><td>%s</td><td>%s</td><td>%s</td>"
+                       "<td>%d</td><td>%d</td><td>%d/%d/%d</td>"
+                       "<td>%" APR_OFF_T_FMT "</td><td>%" APR_OFF_T_FMT "</td>"
+                       "<td>%lu</td><td>%lu</td><td>%.2f</td><td>%.2f</td>"
+                       "<td>%.2f</td></tr>\n",
+                       st->id, ap_escape_html(r->pool, st->client), 
+                       ap_escape_html(r->pool, st->vhost), st->state,
+                       st->open_streams, st->streams_done, 
+                       st->processing_count, st->processing_limit, 
+                       st->processing_max, st->beam_buffered, st->c1_buffered,
+                       (unsigned long)st->frames_received, 
+                       (unsigned long)st->frames_sent,
+                       hd_ratio(st->hd_in_plain, st->hd_in_wire),
+                       hd_ratio(st->hd_out_plain, st->hd_out_wire),
+                       per_mb(st->win_updates_sent, st->data_in));
+        }
+        ap_rputs("</table>\n", r);
+    }
+    return OK;
+}
+
+static const char *json_str(apr_pool_t *p, const char *s)
+{
+    apr_size_t i, len = strlen(s);
+    char *d, *q;
+
+    d = q = apr_palloc(p, len * 6 + 3);
+    *q++ = '"';
+    for (i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            *q++ = '\\';
+            *q++ = (char)c;
+        }
+        else if (c < 0x20) {
+            apr_snprintf(q, 7, "\\u%04x", c);
+            q += 6;
+        }
+        else {
+            *q++ = (char)c;
+        }
+    }
+    *q++ = '"';
+    *q = '\0';
+    return d;
+}
+
+static int h2_status_handler(request_rec *r)
+{
+    status_report report;
+    int i;
+
+    if (!r->handler || strcmp(r->handler, "http2-server-status")) {
+        return DECLINED;
+    }
+    if (r->method_number != M_GET) {
+        return DECLINED;
+    }
+
+    report_collect(&report, r->pool);
+    ap_set_content_type(r, "application/json");
+    apr_table_setn(r->headers_out, "Cache-Control", "no-cache");
+    if (r->header_only) {
+        return OK;
+    }
+    ap_rprintf(r, "{\n  \"pid\": %" APR_PID_T_FMT ",\n", getpid());
+    ap_rprintf(r, "  \"workers\": { \"count\": %d, \"busy\": %d, "
+               "\"min\": %d, \"max\": %d },\n", report.workers, 
+               report.workers_busy, report.workers_min, report.workers_max);
+    ap_rprintf(r, "  \"beams\": { \"blocked_full\": %u, \"blocked_empty\": %u, "
+               "\"waits_full\": %u, \"waits_empty\": %u },\n", 
+               report.beams.full_blocked, report.beams.empty_blocked,
+               report.beams.full_waits, report.beams.empty_waits);
+    ap_rprintf(r, "  \"pools\": { \"mplx\": %u, \"c2\": %u, \"max_mem_free\": %u },\n", 
+               report.mplx_pools, report.c2_pools, ap_max_mem_free);
+    if (h2_lock_stats_enabled()) {
+        locks_json(r);
+    }
+    ap_rputs("  \"sessions\": [", r);
+    for (i = 0; i < report.nsessions; ++i) {
+        session_status *st = &report.sessions[i];
+        ap_rprintf(r, "%s\n    { \"id\": %ld, \"client\": %s, \"vhost\": %s, "
+                   "\"state\": \"%s\", \"streams\": %d, \"done\": %d, "
+                   "\"processing\": { \"count\": %d, \"limit\": %d, \"max\": %d }, "
+                   "\"beam_buffered\": %" APR_OFF_T_FMT ", "
+                   "\"c1_buffered\": %" APR_OFF_T_FMT ", "
+                   "\"frames_in\": %lu, \"frames_out\": %lu, "
+                   "\"hpack_in\": { \"plain\": %" APR_OFF_T_FMT ", \"wire\": %" 
+                   APR_OFF_T_FMT " }, "
+                   "\"hpack_out\": { \"plain\": %" APR_OFF_T_FMT ", \"wire\": %" 
+                   APR_OFF_T_FMT " }, "
+                   "\"data_in\": %" APR_OFF_T_FMT ", \"win_updates\": %lu, "
+                   "\"win_updates_per_mb\": %.2f, \"win_autotune\": %d, "
+                   "\"win_grows\": %lu, \"input_reports\": %lu, "
+                   "\"idle_grace_ms\": %ld }",
+                   i? "," : "", st->id, json_str(r->pool, st->client), 
+                   json_str(r->pool, st->vhost), st->state, 
+                   st->open_streams, st->streams_done, 
+                   st->processing_count, st->processing_limit, 
+                   st->processing_max, st->beam_buffered, st->c1_buffered,
+                   (unsigned long)st->frames_received, 
+                   (unsigned long)st->frames_sent,
+                   st->hd_in_plain, st->hd_in_wire, 
+                   st->hd_out_plain, st->hd_out_wire,
+                   st->data_in, (unsigned long)st->win_updates_sent,
+                   per_mb(st->win_updates_sent, st->data_in),
+                   st->win_autotune, (unsigned long)st->win_grows,
+                   (unsigned long)st->input_reports,
+                   (long)apr_time_as_msec(st->idle_grace));
+    }
+    ap_rputs(report.nsessions? "\n  ]\n}\n" : "]\n}\n", r);
+    return OK;
+}
+
+void h2_status_register_hooks(void)
+{
+    APR_OPTIONAL_HOOK(ap, status_hook, h2_status_hook, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_handler(h2_status_handler, NULL, NULL, APR_HOOK_MIDDLE);
+}
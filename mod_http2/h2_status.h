@@ -0,0 +1,66 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __mod_h2__h2_status__
+#define __mod_h2__h2_status__
+
+struct h2_session;
+struct h2_workers;
+
+/*******************************************************************************
+ * server status
+ *
+ * - Adds a HTTP/2 section to mod_status' 'server-status' page, also in its
+ *   '?auto' variant, and offers the same information as JSON via the
+ *   handler 'http2-server-status'.
+ * - Sessions are only known inside their child process. The report lists
+ *   the worker pool, the threads waiting on beams and HTTP/2 sessions of
+ *   the child that answers the status request.
+ * - Each session publishes a snapshot of its values from its own thread,
+ *   at most once per second. Reports only read these snapshots, so they
+ *   may lag behind by that much.
+ ******************************************************************************/
+
+/**
+ * Initialize the child process wide list of sessions.
+ */
+apr_status_t h2_status_child_init(apr_pool_t *pool, server_rec *s,
+                                  struct h2_workers *workers);
+
+/**
+ * Register the status hook and handler.
+ */
+void h2_status_register_hooks(void);
+
+/**
+ * Make the session visible in status reports.
+ */
+void h2_status_session_add(struct h2_session *session);
+
+/**
+ * Publish the current values of the session for status reports. Only
+ * to be called from the thread processing the session.
+ */
+void h2_status_session_update(struct h2_session *session);
+
+/**
+ * Remove the session from status reports. Must be called before the
+ * session's multiplexer is destroyed.
+ */
+void h2_status_session_remove(struct h2_session *session);
+
+#endif /* defined(__mod_h2__h2_status__) */
@@ -33,6 +33,7 @@
 #include "h2_config.h"
 #include "h2_protocol.h"
 #include "h2_mplx.h"
+#include "h2_preload.h"
 #include "h2_push.h"
 #include "h2_request.h"
 #include "h2_headers.h"
@@ -42,6 +43,7 @@
 #include "h2_conn_ctx.h"
 #include "h2_c2.h"
 #include "h2_util.h"
+#include "h2_probes.h"
 
 
 static const char *h2_ss_str(const h2_stream_state_t state)
@@ -310,6 +312,8 @@ static apr_status_t transit(h2_stream *stream, int new_state)
     
     ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, stream->session->c1,
                   H2_STRM_MSG(stream, "transit to [%s]"), h2_ss_str(new_state));
+    H2_PROBE4(stream_state, stream->session->id, stream->id,
+              (int)stream->state, new_state);
     stream->state = new_state;
     switch (new_state) {
         case H2_SS_IDLE:
@@ -327,6 +331,7 @@ static apr_status_t transit(h2_stream *stream, int new_state)
             close_input(stream);
             break;
         case H2_SS_CLOSED:
+            stream->timing.closed = apr_time_now();
             close_input(stream);
             if (stream->out_buffer) {
                 apr_brigade_cleanup(stream->out_buffer);
@@ -485,7 +490,6 @@ apr_status_t h2_stream_flush_input(h2_stream *stream)
         }
         status = h2_beam_send(stream->input, stream->session->c1,
                               stream->in_buffer, APR_BLOCK_READ, &written);
-        stream->in_last_write = apr_time_now();
         if (APR_SUCCESS != status && stream->state == H2_SS_CLOSED_L) {
             ap_log_cerror(APLOG_MARK, APLOG_TRACE2, status, stream->session->c1,
                           H2_STRM_MSG(stream, "send input error"));
@@ -528,6 +532,7 @@ h2_stream *h2_stream_create(int id, apr_pool_t *pool, h2_session *session,
     stream->id           = id;
     stream->initiated_on = initiated_on;
     stream->created      = apr_time_now();
+    stream->timing.opened = stream->created;
     stream->state        = H2_SS_IDLE;
     stream->pool         = pool;
     stream->session      = session;
@@ -538,6 +543,7 @@ h2_stream *h2_stream_create(int id, apr_pool_t *pool, h2_session *session,
         stream->in_window_size =
             nghttp2_session_get_stream_local_window_size(
                 stream->session->ngh2, stream->id);
+        stream->in_epoch_start = stream->created;
     }
 #endif
     ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c1,
@@ -556,6 +562,10 @@ void h2_stream_cleanup(h2_stream *stream)
     if (stream->out_buffer) {
         apr_brigade_cleanup(stream->out_buffer);
     }
+    if (stream->in_win_extra) {
+        h2_session_win_release(stream->session, stream->in_win_extra);
+        stream->in_win_extra = 0;
+    }
 }
 
 void h2_stream_destroy(h2_stream *stream)
@@ -772,6 +782,7 @@ apr_status_t h2_stream_end_headers(h2_stream *stream, int eos, size_t raw_bytes)
     
     status = h2_request_end_headers(stream->rtmp, stream->pool, eos, raw_bytes);
     if (APR_SUCCESS == status) {
+        stream->timing.headers_done = apr_time_now();
         set_policy_for(stream, stream->rtmp);
         stream->request = stream->rtmp;
         stream->rtmp = NULL;
@@ -790,6 +801,9 @@ apr_status_t h2_stream_end_headers(h2_stream *stream, int eos, size_t raw_bytes)
             /* keep on returning APR_SUCCESS, so that we send a HTTP response and
              * do not RST the stream. */
         }
+        else if (!stream->initiated_on) {
+            h2_preload_on_request(stream->session, stream->request);
+        }
     }
     return status;
 }
@@ -896,6 +910,16 @@ apr_status_t h2_stream_read_to(h2_stream *stream, apr_bucket_brigade *bb,
     return rv;
 }
 
+static void count_header_octets(h2_stream *stream, h2_ngheader *nh)
+{
+    apr_size_t i;
+
+    for (i = 0; i < nh->nvlen; ++i) {
+        stream->session->hd_out_plain += 
+            (apr_off_t)(nh->nv[i].namelen + nh->nv[i].valuelen);
+    }
+}
+
 static apr_status_t buffer_output_process_headers(h2_stream *stream)
 {
     conn_rec *c1 = stream->session->c1;
@@ -947,6 +971,7 @@ static apr_status_t buffer_output_process_headers(h2_stream *stream)
             goto cleanup;
         }
 
+        count_header_octets(stream, nh);
         ngrv = nghttp2_submit_trailer(stream->session->ngh2, stream->id, nh->nv, nh->nvlen);
     }
     else if (headers->status < 100) {
@@ -1004,6 +1029,9 @@ static apr_status_t buffer_output_process_headers(h2_stream *stream)
         }
         if (h2_headers_are_final_response(headers)) {
             stream->response = headers;
+            if (!stream->initiated_on && stream->request) {
+                h2_preload_on_response(stream->session, stream->request, headers);
+            }
         }
 
         /* Do we know if this stream has no response body? */
@@ -1035,6 +1063,7 @@ static apr_status_t buffer_output_process_headers(h2_stream *stream)
             h2_stream_rst(stream, NGHTTP2_PROTOCOL_ERROR);
             goto cleanup;
         }
+        count_header_octets(stream, nh);
         ngrv = nghttp2_submit_response(stream->session->ngh2, stream->id,
                                        nh->nv, nh->nvlen, pprovider);
         if (stream->initiated_on) {
@@ -1120,6 +1149,61 @@ int h2_stream_was_closed(const h2_stream *stream)
     }
 }
 
+#ifdef H2_NG2_LOCAL_WIN_SIZE
+/* An epoch ends when a stream's full receive window has been consumed.
+ * If the client managed that in less than 2 RTTs, the window most likely
+ * limits its upload rate and we grow it. If it took longer than 16 RTTs,
+ * the bottleneck is elsewhere and we give back what we had grown. Growth
+ * is limited by H2WindowMax and the budgets of connection and child.
+ */
+static void in_window_tune(h2_stream *stream, apr_off_t amount)
+{
+    h2_session *session = stream->session;
+    apr_interval_time_t rtt, elapsed;
+    apr_time_t now;
+    apr_int64_t delta;
+    int win = stream->in_window_size;
+
+    stream->in_epoch_bytes += amount;
+    if (stream->in_epoch_bytes < win) {
+        return;
+    }
+    now = apr_time_now();
+    elapsed = now - stream->in_epoch_start;
+    stream->in_epoch_start = now;
+    stream->in_epoch_bytes = 0;
+
+    rtt = h2_session_rtt_get(session);
+    if (rtt <= 0) {
+        return;
+    }
+    if (elapsed < 2 * rtt && win < session->win_max) {
+        delta = h2_session_win_reserve(session,
+                    H2MIN(win, session->win_max - win));
+        if (delta > 0) {
+            ++session->win_grows;
+        }
+        stream->in_win_extra += delta;
+        win += (int)delta;
+    }
+    else if (elapsed > 16 * rtt && stream->in_win_extra > 0) {
+        delta = H2MIN(stream->in_win_extra, (win / 2) & ~1023);
+        h2_session_win_release(session, delta);
+        stream->in_win_extra -= delta;
+        win -= (int)delta;
+    }
+
+    if (win != stream->in_window_size) {
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c1,
+                      H2_STRM_MSG(stream, "window %d -> %d, epoch=%ldus, rtt=%ldus"),
+                      stream->in_window_size, win, (long)elapsed, (long)rtt);
+        stream->in_window_size = win;
+        nghttp2_session_set_local_window_size(session->ngh2,
+                NGHTTP2_FLAG_NONE, stream->id, win);
+    }
+}
+#endif /* #ifdef H2_NG2_LOCAL_WIN_SIZE */
+
 apr_status_t h2_stream_in_consumed(h2_stream *stream, apr_off_t amount)
 {
     h2_session *session = stream->session;
@@ -1134,49 +1218,10 @@ apr_status_t h2_stream_in_consumed(h2_stream *stream, apr_off_t amount)
         }
 
 #ifdef H2_NG2_LOCAL_WIN_SIZE
-        if (1) {
-            int cur_size = nghttp2_session_get_stream_local_window_size(
-                session->ngh2, stream->id);
-            int win = stream->in_window_size;
-            int thigh = win * 8/10;
-            int tlow = win * 2/10;
-            const int win_max = 2*1024*1024;
-            const int win_min = 32*1024;
-            
-            /* Work in progress, probably should add directives for these
-             * values once this stabilizes somewhat. The general idea is
-             * to adapt stream window sizes if the input window changes
-             * a) very quickly (< good RTT) from full to empty
-             * b) only a little bit (> bad RTT)
-             * where in a) it grows and in b) it shrinks again.
-             */
-            if (cur_size > thigh && amount > thigh && win < win_max) {
-                /* almost empty again with one reported consumption, how
-                 * long did this take? */
-                long ms = apr_time_msec(apr_time_now() - stream->in_last_write);
-                if (ms < 40) {
-                    win = H2MIN(win_max, win + (64*1024));
-                }
-            }
-            else if (cur_size < tlow && amount < tlow && win > win_min) {
-                /* staying full, for how long already? */
-                long ms = apr_time_msec(apr_time_now() - stream->in_last_write);
-                if (ms > 700) {
-                    win = H2MAX(win_min, win - (32*1024));
-                }
-            }
-            
-            if (win != stream->in_window_size) {
-                stream->in_window_size = win;
-                nghttp2_session_set_local_window_size(session->ngh2, 
-                        NGHTTP2_FLAG_NONE, stream->id, win);
-            } 
-            ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c1,
-                          "h2_stream(%ld-%d): consumed %ld bytes, window now %d/%d",
-                          session->id, stream->id, (long)amount, 
-                          cur_size, stream->in_window_size);
+        if (session->win_autotune) {
+            in_window_tune(stream, amount);
         }
-#endif /* #ifdef H2_NG2_LOCAL_WIN_SIZE */
+#endif
     }
     return APR_SUCCESS;   
 }
@@ -69,6 +69,7 @@ struct h2_stream {
     h2_stream_state_t state;    /* state of this stream */
     
     apr_time_t created;         /* when stream was created */
+    h2_stream_timing timing;    /* when things happened on this stream */
     
     const struct h2_request *request; /* the request made in this stream */
     struct h2_request *rtmp;    /* request being assembled */
@@ -79,8 +80,10 @@ struct h2_stream {
 
     struct h2_bucket_beam *input;
     apr_bucket_brigade *in_buffer;
-    int in_window_size;
-    apr_time_t in_last_write;
+    int in_window_size;         /* current local window of the stream */
+    apr_int64_t in_win_extra;   /* window growth reserved from session budget */
+    apr_time_t in_epoch_start;  /* when consumption of the current window began */
+    apr_off_t in_epoch_bytes;   /* bytes consumed in the current window */
     
     struct h2_bucket_beam *output;
     apr_bucket_brigade *out_buffer;
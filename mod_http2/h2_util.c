@@ -28,6 +28,7 @@
 
 #include "h2.h"
 #include "h2_util.h"
+#include "h2_locks.h"
 
 /* h2_log2(n) iff n is a power of 2 */
 unsigned char h2_log2(int n)
@@ -227,6 +228,108 @@ const char *h2_util_base64url_encode(const char *data,
     return (char *)enc;
 }
 
+/*******************************************************************************
+ * fast 64 bit hash
+ ******************************************************************************/
+
+static const apr_uint64_t wy_secret[4] = {
+    APR_UINT64_C(0xa0761d6478bd642f), APR_UINT64_C(0xe7037ed1a0b428db),
+    APR_UINT64_C(0x8ebc6af09c88c6e3), APR_UINT64_C(0x589965cc75374cc3),
+};
+
+/* 64x64 -> 128 bit multiply, low half in *pa, high half in *pb */
+static void wy_mum(apr_uint64_t *pa, apr_uint64_t *pb)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = *pa;
+    r *= *pb;
+    *pa = (apr_uint64_t)r;
+    *pb = (apr_uint64_t)(r >> 64);
+#else
+    apr_uint64_t ha = *pa >> 32, hb = *pb >> 32;
+    apr_uint64_t la = (apr_uint32_t)*pa, lb = (apr_uint32_t)*pb, hi, lo;
+    apr_uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    apr_uint64_t t = rl + (rm0 << 32), c = t < rl;
+
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *pa = lo;
+    *pb = hi;
+#endif
+}
+
+static apr_uint64_t wy_mix(apr_uint64_t a, apr_uint64_t b)
+{
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+static apr_uint64_t wy_r8(const unsigned char *p)
+{
+    apr_uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static apr_uint64_t wy_r4(const unsigned char *p)
+{
+    apr_uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static apr_uint64_t wy_r3(const unsigned char *p, apr_size_t k)
+{
+    return (((apr_uint64_t)p[0]) << 16) | (((apr_uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+apr_uint64_t h2_util_hash64(const void *data, apr_size_t len, apr_uint64_t seed)
+{
+    const unsigned char *p = data;
+    apr_uint64_t a, b;
+
+    seed ^= wy_mix(seed ^ wy_secret[0], wy_secret[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+            b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0) {
+            a = wy_r3(p, len);
+            b = 0;
+        }
+        else {
+            a = b = 0;
+        }
+    }
+    else {
+        apr_size_t i = len;
+        if (i > 48) {
+            apr_uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wy_mix(wy_r8(p) ^ wy_secret[1], wy_r8(p + 8) ^ seed);
+                see1 = wy_mix(wy_r8(p + 16) ^ wy_secret[2], wy_r8(p + 24) ^ see1);
+                see2 = wy_mix(wy_r8(p + 32) ^ wy_secret[3], wy_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_r8(p) ^ wy_secret[1], wy_r8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wy_r8(p + i - 16);
+        b = wy_r8(p + i - 8);
+    }
+    a ^= wy_secret[1];
+    b ^= seed;
+    wy_mum(&a, &b);
+    return wy_mix(a ^ wy_secret[0] ^ len, b ^ wy_secret[1]);
+}
+
 /*******************************************************************************
  * ihash - hash for structs with int identifier
  ******************************************************************************/
@@ -549,6 +652,9 @@ struct h2_fifo {
     int count;
     int aborted;
     apr_thread_mutex_t *lock;
+#ifdef H2_LOCK_STATS
+    apr_time_t lock_since;          /* when lock was last acquired */
+#endif
     apr_thread_cond_t  *not_empty;
     apr_thread_cond_t  *not_full;
 };
@@ -634,11 +740,11 @@ apr_status_t h2_fifo_set_create(h2_fifo **pfifo, apr_pool_t *pool, int capacity)
 apr_status_t h2_fifo_term(h2_fifo *fifo)
 {
     apr_status_t rv;
-    if ((rv = apr_thread_mutex_lock(fifo->lock)) == APR_SUCCESS) {
+    if ((rv = H2_LOCK(fifo->lock, H2_LOCK_FIFO, &fifo->lock_since)) == APR_SUCCESS) {
         fifo->aborted = 1;
         apr_thread_cond_broadcast(fifo->not_empty);
         apr_thread_cond_broadcast(fifo->not_full);
-        apr_thread_mutex_unlock(fifo->lock);
+        H2_UNLOCK(fifo->lock, H2_LOCK_FIFO, &fifo->lock_since);
     }
     return rv;
 }
@@ -657,7 +763,8 @@ static apr_status_t check_not_empty(h2_fifo *fifo, int block)
         if (fifo->aborted) {
             return APR_EOF;
         }
-        apr_thread_cond_wait(fifo->not_empty, fifo->lock);
+        H2_COND_WAIT(fifo->not_empty, fifo->lock,
+                     H2_LOCK_FIFO, &fifo->lock_since);
     }
     return APR_SUCCESS;
 }
@@ -678,7 +785,8 @@ static apr_status_t fifo_push_int(h2_fifo *fifo, void *elem, int block)
                 if (fifo->aborted) {
                     return APR_EOF;
                 }
-                apr_thread_cond_wait(fifo->not_full, fifo->lock);
+                H2_COND_WAIT(fifo->not_full, fifo->lock,
+                             H2_LOCK_FIFO, &fifo->lock_since);
             }
         }
         else {
@@ -699,9 +807,9 @@ static apr_status_t fifo_push(h2_fifo *fifo, void *elem, int block)
 {
     apr_status_t rv;
     
-    if ((rv = apr_thread_mutex_lock(fifo->lock)) == APR_SUCCESS) {
+    if ((rv = H2_LOCK(fifo->lock, H2_LOCK_FIFO, &fifo->lock_since)) == APR_SUCCESS) {
         rv = fifo_push_int(fifo, elem, block);
-        apr_thread_mutex_unlock(fifo->lock);
+        H2_UNLOCK(fifo->lock, H2_LOCK_FIFO, &fifo->lock_since);
     }
     return rv;
 }
@@ -739,9 +847,9 @@ static apr_status_t fifo_pull(h2_fifo *fifo, void **pelem, int block)
 {
     apr_status_t rv;
     
-    if ((rv = apr_thread_mutex_lock(fifo->lock)) == APR_SUCCESS) {
+    if ((rv = H2_LOCK(fifo->lock, H2_LOCK_FIFO, &fifo->lock_since)) == APR_SUCCESS) {
         rv = pull_head(fifo, pelem, block);
-        apr_thread_mutex_unlock(fifo->lock);
+        H2_UNLOCK(fifo->lock, H2_LOCK_FIFO, &fifo->lock_since);
     }
     return rv;
 }
@@ -765,7 +873,7 @@ static apr_status_t fifo_peek(h2_fifo *fifo, h2_fifo_peek_fn *fn, void *ctx, int
         return APR_EOF;
     }
     
-    if (APR_SUCCESS == (rv = apr_thread_mutex_lock(fifo->lock))) {
+    if (APR_SUCCESS == (rv = H2_LOCK(fifo->lock, H2_LOCK_FIFO, &fifo->lock_since))) {
         if (APR_SUCCESS == (rv = pull_head(fifo, &elem, block))) {
             switch (fn(elem, ctx)) {
                 case H2_FIFO_OP_PULL:
@@ -775,7 +883,7 @@ static apr_status_t fifo_peek(h2_fifo *fifo, h2_fifo_peek_fn *fn, void *ctx, int
                     break;
             }
         }
-        apr_thread_mutex_unlock(fifo->lock);
+        H2_UNLOCK(fifo->lock, H2_LOCK_FIFO, &fifo->lock_since);
     }
     return rv;
 }
@@ -798,7 +906,7 @@ apr_status_t h2_fifo_remove(h2_fifo *fifo, void *elem)
         return APR_EOF;
     }
 
-    if ((rv = apr_thread_mutex_lock(fifo->lock)) == APR_SUCCESS) {
+    if ((rv = H2_LOCK(fifo->lock, H2_LOCK_FIFO, &fifo->lock_since)) == APR_SUCCESS) {
         int i, rc;
         void *e;
         
@@ -823,7 +931,7 @@ apr_status_t h2_fifo_remove(h2_fifo *fifo, void *elem)
             rv = APR_EAGAIN;
         }
         
-        apr_thread_mutex_unlock(fifo->lock);
+        H2_UNLOCK(fifo->lock, H2_LOCK_FIFO, &fifo->lock_since);
     }
     return rv;
 }
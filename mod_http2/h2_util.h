@@ -371,6 +371,21 @@ apr_size_t h2_util_base64url_decode(const char **decoded,
 const char *h2_util_base64url_encode(const char *data, 
                                      apr_size_t len, apr_pool_t *pool);
 
+/*******************************************************************************
+ * fast 64 bit hash
+ ******************************************************************************/
+/**
+ * Calculate a 64 bit hash value of the data, following the design of
+ * wyhash <https://github.com/wangyi-fudan/wyhash>. Not a cryptographic hash,
+ * but well distributed in all bits and fast on short strings. Values are
+ * the same on all platforms of the same byte order.
+ * @param data the bytes to hash
+ * @param len the number of bytes
+ * @param seed start value, e.g. the hash of a preceding part
+ * @return the hash value
+ */
+apr_uint64_t h2_util_hash64(const void *data, apr_size_t len, apr_uint64_t seed);
+
 /*******************************************************************************
  * nghttp2 helpers
  ******************************************************************************/
@@ -0,0 +1,278 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <assert.h>
+
+#include <apr_atomic.h>
+#include <apr_hash.h>
+#include <apr_shm.h>
+#include <apr_strings.h>
+
+#include <httpd.h>
+#include <http_core.h>
+#include <http_log.h>
+#include <http_protocol.h>
+#include <http_request.h>
+
+#include "h2_private.h"
+#include "h2_vhost_stats.h"
+
+/* log-linear buckets: values < 2^SUB_BITS have their own bucket, above,
+ * each power of 2 is split into 2^SUB_BITS sub-buckets. Values from
+ * 2^(MAX_MSB+1) on all land in the last bucket. */
+#define SUB_BITS        3
+#define SUB_COUNT       (1 << SUB_BITS)
+#define MAX_MSB         39
+#define HIST_BUCKETS    (SUB_COUNT + (MAX_MSB - SUB_BITS + 1) * SUB_COUNT)
+
+typedef enum {
+    H_DURATION,
+    H_QUEUE_WAIT,
+    H_HANDLER,
+    H_RESP_BYTES,
+    H_COUNT
+} hist_type;
+
+static const char *HistNames[] = {
+    "duration_us",
+    "queue_wait_us",
+    "handler_us",
+    "response_bytes",
+};
+
+typedef struct {
+    apr_uint32_t streams;
+    apr_uint32_t resets;
+    apr_uint32_t c2_done;
+    apr_uint32_t hist[H_COUNT][HIST_BUCKETS];
+} vhost_slot;
+
+static apr_shm_t *stats_shm;
+static vhost_slot *slots;
+static server_rec **slot_servers;
+static int slot_count;
+static apr_hash_t *slot_index;     /* server_rec* -> vhost_slot* */
+
+
+static int bucket_of(apr_int64_t v)
+{
+    int msb;
+
+    if (v < SUB_COUNT) {
+        return (v > 0)? (int)v : 0;
+    }
+    msb = SUB_BITS;
+    while (msb < 62 && (v >> (msb + 1))) {
+        ++msb;
+    }
+    if (msb > MAX_MSB) {
+        return HIST_BUCKETS - 1;
+    }
+    return SUB_COUNT + (msb - SUB_BITS) * SUB_COUNT
+           + (int)((v >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+static apr_int64_t bucket_lower(int i)
+{
+    int j;
+
+    if (i < SUB_COUNT) {
+        return i;
+    }
+    j = i - SUB_COUNT;
+    return ((apr_int64_t)(SUB_COUNT + (j % SUB_COUNT))) << (j / SUB_COUNT);
+}
+
+static apr_int64_t bucket_upper(int i)
+{
+    return (i + 1 < HIST_BUCKETS)? bucket_lower(i + 1) - 1 : bucket_lower(i);
+}
+
+apr_status_t h2_vhost_stats_post_config(apr_pool_t *pconf, server_rec *s)
+{
+    server_rec *sp;
+    apr_size_t size;
+    apr_status_t rv;
+    int i;
+
+    slots = NULL;
+    slot_count = 0;
+    for (sp = s; sp; sp = sp->next) {
+        ++slot_count;
+    }
+    size = sizeof(vhost_slot) * (apr_size_t)slot_count;
+    rv = apr_shm_create(&stats_shm, size, NULL, pconf);
+    if (APR_SUCCESS != rv) {
+        /* not fatal, we just do not have stats */
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s,
+                     "h2_vhost_stats: unable to create shared memory "
+                     "of %lu bytes, no vhost statistics available",
+                     (unsigned long)size);
+        slot_count = 0;
+        return APR_SUCCESS;
+    }
+    slots = apr_shm_baseaddr_get(stats_shm);
+    memset(slots, 0, size);
+
+    slot_servers = apr_pcalloc(pconf, sizeof(server_rec*) * (apr_size_t)slot_count);
+    slot_index = apr_hash_make(pconf);
+    for (i = 0, sp = s; sp; sp = sp->next, ++i) {
+        slot_servers[i] = sp;
+        apr_hash_set(slot_index, &slot_servers[i], sizeof(server_rec*), &slots[i]);
+    }
+    ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, s,
+                 "h2_vhost_stats: %d vhosts, %lu bytes shared memory",
+                 slot_count, (unsigned long)size);
+    return APR_SUCCESS;
+}
+
+static vhost_slot *slot_get(server_rec *s)
+{
+    if (!slots || !s) {
+        return NULL;
+    }
+    return apr_hash_get(slot_index, &s, sizeof(server_rec*));
+}
+
+void h2_vhost_stats_stream_closed(server_rec *s, apr_interval_time_t duration,
+                                  apr_off_t resp_bytes, int reset)
+{
+    vhost_slot *slot = slot_get(s);
+
+    if (slot) {
+        apr_atomic_inc32(&slot->streams);
+        if (reset) {
+            apr_atomic_inc32(&slot->resets);
+        }
+        apr_atomic_inc32(&slot->hist[H_DURATION][bucket_of(duration)]);
+        apr_atomic_inc32(&slot->hist[H_RESP_BYTES][bucket_of(resp_bytes)]);
+    }
+}
+
+void h2_vhost_stats_c2_done(server_rec *s, apr_interval_time_t queue_wait,
+                            apr_interval_time_t handler_time)
+{
+    vhost_slot *slot = slot_get(s);
+
+    if (slot) {
+        apr_atomic_inc32(&slot->c2_done);
+        if (queue_wait >= 0) {
+            apr_atomic_inc32(&slot->hist[H_QUEUE_WAIT][bucket_of(queue_wait)]);
+        }
+        apr_atomic_inc32(&slot->hist[H_HANDLER][bucket_of(handler_time)]);
+    }
+}
+
+static apr_uint32_t counter_get(apr_uint32_t *pc, int reset)
+{
+    return reset? apr_atomic_xchg32(pc, 0) : apr_atomic_read32(pc);
+}
+
+static apr_int64_t hist_percentile(const apr_uint32_t *hist, apr_uint64_t total,
+                                   int per_mille)
+{
+    apr_uint64_t sum = 0;
+    int i;
+
+    if (total == 0) {
+        return 0;
+    }
+    for (i = 0; i < HIST_BUCKETS; ++i) {
+        sum += hist[i];
+        if (sum * 1000 >= total * (apr_uint64_t)per_mille) {
+            break;
+        }
+    }
+    return bucket_upper(i < HIST_BUCKETS? i : HIST_BUCKETS - 1);
+}
+
+static void hist_json(request_rec *r, hist_type type, apr_uint32_t *shared,
+                      int reset)
+{
+    apr_uint32_t hist[HIST_BUCKETS];
+    apr_uint64_t total = 0;
+    int i, n = 0;
+
+    for (i = 0; i < HIST_BUCKETS; ++i) {
+        hist[i] = counter_get(&shared[i], reset);
+        total += hist[i];
+    }
+    ap_rprintf(r, "\"%s\": { \"count\": %" APR_UINT64_T_FMT ", "
+               "\"p50\": %" APR_INT64_T_FMT ", \"p90\": %" APR_INT64_T_FMT ", "
+               "\"p99\": %" APR_INT64_T_FMT ", \"p999\": %" APR_INT64_T_FMT ", "
+               "\"buckets\": [", HistNames[type], total,
+               hist_percentile(hist, total, 500), hist_percentile(hist, total, 900),
+               hist_percentile(hist, total, 990), hist_percentile(hist, total, 999));
+    for (i = 0; i < HIST_BUCKETS; ++i) {
+        if (hist[i]) {
+            ap_rprintf(r, "%s[%" APR_INT64_T_FMT ", %u]", n++? ", " : "",
+                       bucket_lower(i), hist[i]);
+        }
+    }
+    ap_rputs("] }", r);
+}
+
+static const char *json_str(apr_pool_t *p, const char *s)
+{
+    return apr_pstrcat(p, "\"", ap_escape_quotes(p, s? s : ""), "\"", NULL);
+}
+
+static int h2_vhost_stats_handler(request_rec *r)
+{
+    int i, j, reset;
+
+    if (!r->handler || strcmp(r->handler, "http2-vhost-stats")) {
+        return DECLINED;
+    }
+    if (r->method_number != M_GET) {
+        return DECLINED;
+    }
+
+    reset = (r->args && ap_strstr_c(r->args, "reset"));
+    ap_set_content_type(r, "application/json");
+    apr_table_setn(r->headers_out, "Cache-Control", "no-cache");
+    if (r->header_only) {
+        return OK;
+    }
+    ap_rprintf(r, "{\n  \"reset\": %s,\n  \"vhosts\": [", reset? "true" : "false");
+    for (i = 0; slots && i < slot_count; ++i) {
+        vhost_slot *slot = &slots[i];
+        server_rec *s = slot_servers[i];
+
+        ap_rprintf(r, "%s\n    { \"name\": %s, \"port\": %d, \"streams\": %u, "
+                   "\"resets\": %u, \"c2_done\": %u,\n      ", i? "," : "",
+                   json_str(r->pool, s->server_hostname),
+                   s->addrs? (int)s->addrs->host_port : (int)s->port,
+                   counter_get(&slot->streams, reset),
+                   counter_get(&slot->resets, reset),
+                   counter_get(&slot->c2_done, reset));
+        for (j = 0; j < H_COUNT; ++j) {
+            if (j) {
+                ap_rputs(",\n      ", r);
+            }
+            hist_json(r, (hist_type)j, slot->hist[j], reset);
+        }
+        ap_rputs(" }", r);
+    }
+    ap_rputs(slot_count? "\n  ]\n}\n" : "]\n}\n", r);
+    return OK;
+}
+
+void h2_vhost_stats_register_hooks(void)
+{
+    ap_hook_handler(h2_vhost_stats_handler, NULL, NULL, APR_HOOK_MIDDLE);
+}
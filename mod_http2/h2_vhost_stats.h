@@ -0,0 +1,69 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __mod_h2__h2_vhost_stats__
+#define __mod_h2__h2_vhost_stats__
+
+/*******************************************************************************
+ * vhost statistics
+ *
+ * HTTP/2 stream numbers per virtual host, kept in a shared memory segment
+ * created at post_config and inherited by all children. Counters are
+ * updated with atomic operations only, no locks.
+ *
+ * Per vhost, there are counts of closed streams, reset streams and finished
+ * c2 processings and histograms of
+ * - stream duration: from stream open until closed, in usecs
+ * - queue wait: from being scheduled until a worker started, in usecs
+ * - handler time: from worker start until processing was done, in usecs
+ * - response bytes: the DATA payload sent on a stream
+ *
+ * Histograms are log-linear in the manner of HdrHistogram: each power of 2
+ * has 8 sub-buckets, giving a relative error of at most 12.5%.
+ *
+ * The handler 'http2-vhost-stats' returns these as JSON. With query
+ * parameter 'reset', the counters are zeroed as they are read.
+ ******************************************************************************/
+
+/**
+ * Create the shared memory for the vhosts configured in the server list
+ * starting at s.
+ */
+apr_status_t h2_vhost_stats_post_config(apr_pool_t *pconf, server_rec *s);
+
+void h2_vhost_stats_register_hooks(void);
+
+/**
+ * Record a stream that has been closed.
+ * @param s the vhost of the stream
+ * @param duration usecs from stream open until closed
+ * @param resp_bytes the DATA payload sent
+ * @param reset != 0 if the stream was reset
+ */
+void h2_vhost_stats_stream_closed(server_rec *s, apr_interval_time_t duration,
+                                  apr_off_t resp_bytes, int reset);
+
+/**
+ * Record c2 processing of a stream that is done.
+ * @param s the vhost of the request
+ * @param queue_wait usecs the stream waited for a worker, < 0 if unknown
+ * @param handler_time usecs the worker took to process
+ */
+void h2_vhost_stats_c2_done(server_rec *s, apr_interval_time_t queue_wait,
+                            apr_interval_time_t handler_time);
+
+#endif /* defined(__mod_h2__h2_vhost_stats__) */
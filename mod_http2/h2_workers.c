@@ -30,6 +30,8 @@
 #include "h2_c2.h"
 #include "h2_workers.h"
 #include "h2_util.h"
+#include "h2_locks.h"
+#include "h2_probes.h"
 
 typedef struct h2_slot h2_slot;
 struct h2_slot {
@@ -39,6 +41,9 @@ struct h2_slot {
     conn_rec *connection;
     apr_thread_t *thread;
     apr_thread_mutex_t *lock;
+#ifdef H2_LOCK_STATS
+    apr_time_t lock_since;          /* when lock was last acquired */
+#endif
     apr_thread_cond_t *not_idle;
     volatile apr_uint32_t timed_out;
 };
@@ -80,7 +85,7 @@ static apr_status_t activate_slot(h2_workers *workers, h2_slot *slot)
     slot->workers = workers;
     slot->connection = NULL;
 
-    apr_thread_mutex_lock(workers->lock);
+    H2_LOCK(workers->lock, H2_LOCK_WORKERS, &workers->lock_since);
     if (!slot->lock) {
         rv = apr_thread_mutex_create(&slot->lock,
                                          APR_THREAD_MUTEX_DEFAULT,
@@ -107,7 +112,7 @@ static apr_status_t activate_slot(h2_workers *workers, h2_slot *slot)
     }
 
 cleanup:
-    apr_thread_mutex_unlock(workers->lock);
+    H2_UNLOCK(workers->lock, H2_LOCK_WORKERS, &workers->lock_since);
     if (rv != APR_SUCCESS) {
         push_slot(&workers->free, slot);
     }
@@ -128,12 +133,12 @@ static void wake_idle_worker(h2_workers *workers)
     h2_slot *slot = pop_slot(&workers->idle);
     if (slot) {
         int timed_out = 0;
-        apr_thread_mutex_lock(slot->lock);
+        H2_LOCK(slot->lock, H2_LOCK_SLOT, &slot->lock_since);
         timed_out = slot->timed_out;
         if (!timed_out) {
             apr_thread_cond_signal(slot->not_idle);
         }
-        apr_thread_mutex_unlock(slot->lock);
+        H2_UNLOCK(slot->lock, H2_LOCK_SLOT, &slot->lock_since);
         if (timed_out) {
             slot_done(slot);
             wake_idle_worker(workers);
@@ -207,22 +212,24 @@ static int get_next(h2_slot *slot)
         
         join_zombies(workers);
 
-        apr_thread_mutex_lock(slot->lock);
+        H2_LOCK(slot->lock, H2_LOCK_SLOT, &slot->lock_since);
         if (!workers->aborted) {
 
             push_slot(&workers->idle, slot);
             if (non_essential && workers->max_idle_duration) {
-                rv = apr_thread_cond_timedwait(slot->not_idle, slot->lock,
-                                               workers->max_idle_duration);
+                rv = H2_COND_TIMEDWAIT(slot->not_idle, slot->lock,
+                                       workers->max_idle_duration,
+                                       H2_LOCK_SLOT, &slot->lock_since);
                 if (APR_TIMEUP == rv) {
                     slot->timed_out = 1;
                 }
             }
             else {
-                apr_thread_cond_wait(slot->not_idle, slot->lock);
+                H2_COND_WAIT(slot->not_idle, slot->lock,
+                             H2_LOCK_SLOT, &slot->lock_since);
             }
         }
-        apr_thread_mutex_unlock(slot->lock);
+        H2_UNLOCK(slot->lock, H2_LOCK_SLOT, &slot->lock_since);
     }
 
     return 0;
@@ -238,9 +245,9 @@ static void slot_done(h2_slot *slot)
      * unblock workers_pool_cleanup().
      */
     if (!apr_atomic_dec32(&workers->worker_count) && workers->aborted) {
-        apr_thread_mutex_lock(workers->lock);
+        H2_LOCK(workers->lock, H2_LOCK_WORKERS, &workers->lock_since);
         apr_thread_cond_signal(workers->all_done);
-        apr_thread_mutex_unlock(workers->lock);
+        H2_UNLOCK(workers->lock, H2_LOCK_WORKERS, &workers->lock_since);
     }
 }
 
@@ -253,7 +260,13 @@ static void* APR_THREAD_FUNC slot_run(apr_thread_t *thread, void *wctx)
     while (get_next(slot)) {
         do {
             ap_assert(slot->connection != NULL);
+            apr_atomic_inc32(&slot->workers->busy_count);
+            H2_PROBE3(worker_start, slot->id, slot->connection->master->id,
+                      slot->connection->id);
             h2_c2_process(slot->connection, thread, slot->id);
+            H2_PROBE3(worker_done, slot->id, slot->connection->master->id,
+                      slot->connection->id);
+            apr_atomic_dec32(&slot->workers->busy_count);
             if (!slot->workers->aborted &&
                 apr_atomic_read32(&slot->workers->worker_count) < slot->workers->max_workers) {
                 h2_mplx_worker_c2_done(slot->connection, &slot->connection);
@@ -280,9 +293,9 @@ static void wake_non_essential_workers(h2_workers *workers)
     if ((slot = pop_slot(&workers->idle))) {
         wake_non_essential_workers(workers);
         if (slot->id > workers->min_workers) {
-            apr_thread_mutex_lock(slot->lock);
+            H2_LOCK(slot->lock, H2_LOCK_SLOT, &slot->lock_since);
             apr_thread_cond_signal(slot->not_idle);
-            apr_thread_mutex_unlock(slot->lock);
+            H2_UNLOCK(slot->lock, H2_LOCK_SLOT, &slot->lock_since);
         }
         else {
             push_slot(&workers->idle, slot);
@@ -300,9 +313,9 @@ static void workers_abort_idle(h2_workers *workers)
 
     /* abort all idle slots */
     while ((slot = pop_slot(&workers->idle))) {
-        apr_thread_mutex_lock(slot->lock);
+        H2_LOCK(slot->lock, H2_LOCK_SLOT, &slot->lock_since);
         apr_thread_cond_signal(slot->not_idle);
-        apr_thread_mutex_unlock(slot->lock);
+        H2_UNLOCK(slot->lock, H2_LOCK_SLOT, &slot->lock_since);
     }
 }
 
@@ -322,11 +335,12 @@ static apr_status_t workers_pool_cleanup(void *data)
      * this gets called after the mpm shuts down and all connections
      * have either been handled (graceful) or we are forced exiting
      * (ungrateful). Either way, we show limited patience. */
-    apr_thread_mutex_lock(workers->lock);
+    H2_LOCK(workers->lock, H2_LOCK_WORKERS, &workers->lock_since);
     end = apr_time_now() + apr_time_from_sec(wait_sec);
     while ((n = apr_atomic_read32(&workers->worker_count)) > 0
            && apr_time_now() < end) {
-        rv = apr_thread_cond_timedwait(workers->all_done, workers->lock, timeout);
+        rv = H2_COND_TIMEDWAIT(workers->all_done, workers->lock, timeout,
+                               H2_LOCK_WORKERS, &workers->lock_since);
         if (APR_TIMEUP == rv) {
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, workers->s,
                          APLOGNO(10290) "h2_workers: waiting for idle workers to close, "
@@ -341,7 +355,7 @@ static apr_status_t workers_pool_cleanup(void *data)
                      "did not exit after %d seconds.",
                      n, wait_sec);
     }
-    apr_thread_mutex_unlock(workers->lock);
+    H2_UNLOCK(workers->lock, H2_LOCK_WORKERS, &workers->lock_since);
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, workers->s,
                  "h2_workers: cleanup all workers terminated");
     join_zombies(workers);
@@ -50,6 +50,7 @@ struct h2_workers {
     struct h2_slot *slots;
     
     volatile apr_uint32_t worker_count;
+    volatile apr_uint32_t busy_count; /* workers processing a c2 */
     
     struct h2_slot *free;
     struct h2_slot *idle;
@@ -58,6 +59,9 @@ struct h2_workers {
     struct h2_fifo *mplxs;
     
     struct apr_thread_mutex_t *lock;
+#ifdef H2_LOCK_STATS
+    apr_time_t lock_since;          /* when lock was last acquired */
+#endif
     struct apr_thread_cond_t *all_done;
 };
 
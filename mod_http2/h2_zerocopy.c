@@ -0,0 +1,488 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include <apr_portable.h>
+#include <apr_time.h>
+
+#include "h2_zerocopy.h"
+
+int h2_zerocopy_can_send(apr_bucket_brigade *bb, apr_off_t *plen)
+{
+    apr_bucket *b;
+    apr_off_t len = 0;
+
+    *plen = 0;
+    for (b = APR_BRIGADE_FIRST(bb);
+         b != APR_BRIGADE_SENTINEL(bb);
+         b = APR_BUCKET_NEXT(b)) {
+        if (APR_BUCKET_IS_FLUSH(b)) {
+            if (APR_BUCKET_NEXT(b) != APR_BRIGADE_SENTINEL(bb)) {
+                return 0;
+            }
+        }
+        else if (APR_BUCKET_IS_HEAP(b) || APR_BUCKET_IS_IMMORTAL(b)) {
+            /* Only these keep their memory until destroyed. A pool bucket
+             * copies to the heap when its pool goes, freeing what the
+             * kernel may still send from. */
+            len += (apr_off_t)b->length;
+        }
+        else {
+            return 0;
+        }
+    }
+    *plen = len;
+    return 1;
+}
+
+#ifdef H2_ZEROCOPY
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY     60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY    0x4000000
+#endif
+
+#define ZC_IOV_MAX      64
+/* h2_zerocopy_send() calls whose buckets we hold */
+#define ZC_SENDS_MAX    64
+/* held bytes before we wait for completions to send more */
+#define ZC_HELD_MAX     (8 * 1024 * 1024)
+/* completions the kernel reported ahead of earlier ones */
+#define ZC_RANGES_MAX   16
+/* time a closing connection gives the client to acknowledge our sends */
+#define ZC_CLOSE_WAIT   apr_time_from_msec(100)
+/* time to wait for completions once the kernel dropped its queue */
+#define ZC_ABORT_WAIT   apr_time_from_sec(1)
+
+#define SEQ_GE(a, b)    ((apr_int32_t)((a) - (b)) >= 0)
+
+typedef struct {
+    apr_uint32_t seq_end;       /* seq_next after the last send using them */
+    int nbuckets;               /* buckets at the head of held */
+    apr_size_t len;             /* their bytes */
+} zc_send;
+
+struct h2_zerocopy {
+    int fd;                     /* our own dup, valid after c1 closes its */
+    apr_interval_time_t timeout;
+    apr_bucket_brigade *held;   /* sent buckets the kernel may still read */
+    apr_off_t held_len;
+    zc_send sends[ZC_SENDS_MAX]; /* ring of sends with buckets in held */
+    int sends_head;
+    int sends_len;
+    apr_uint32_t seq_next;      /* sequence number of our next send */
+    apr_uint32_t seq_done;      /* all sends before this have completed */
+    apr_uint32_t ranges[ZC_RANGES_MAX][2]; /* completed out of order, lo..hi */
+    int nranges;
+    apr_uint64_t nsends;
+    apr_uint64_t ncopied;
+};
+
+static void zc_release(h2_zerocopy *zc)
+{
+    zc_send *s;
+
+    while (zc->sends_len > 0) {
+        s = &zc->sends[zc->sends_head];
+        if (!SEQ_GE(zc->seq_done, s->seq_end)) {
+            break;
+        }
+        while (s->nbuckets-- > 0) {
+            apr_bucket_delete(APR_BRIGADE_FIRST(zc->held));
+        }
+        zc->held_len -= (apr_off_t)s->len;
+        zc->sends_head = (zc->sends_head + 1) % ZC_SENDS_MAX;
+        --zc->sends_len;
+    }
+}
+
+static void zc_completed(h2_zerocopy *zc, apr_uint32_t lo, apr_uint32_t hi)
+{
+    int i;
+
+    if (!SEQ_GE(zc->seq_done, lo) && zc->nranges < ZC_RANGES_MAX) {
+        /* earlier sends are still pending, remember this one */
+        zc->ranges[zc->nranges][0] = lo;
+        zc->ranges[zc->nranges][1] = hi;
+        ++zc->nranges;
+        return;
+    }
+    /* In order, which TCP does nearly always. Should we run out of room
+     * for out of order ones, we assume the earlier ones done as well. */
+    if (SEQ_GE(hi + 1, zc->seq_done)) {
+        zc->seq_done = hi + 1;
+    }
+    for (i = 0; i < zc->nranges; ++i) {
+        if (SEQ_GE(zc->seq_done, zc->ranges[i][0])) {
+            if (SEQ_GE(zc->ranges[i][1] + 1, zc->seq_done)) {
+                zc->seq_done = zc->ranges[i][1] + 1;
+            }
+            zc->ranges[i][0] = zc->ranges[--zc->nranges][0];
+            zc->ranges[i][1] = zc->ranges[zc->nranges][1];
+            i = -1; /* seq_done moved, look at all again */
+        }
+    }
+}
+
+static apr_status_t zc_read_errqueue(h2_zerocopy *zc)
+{
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(zc->fd, &msg, MSG_ERRQUEUE|MSG_DONTWAIT) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return APR_SUCCESS;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return APR_FROM_OS_ERROR(errno);
+        }
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                  || (cm->cmsg_level == SOL_IPV6
+                      && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0
+                || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zc->ncopied += (apr_uint32_t)(serr->ee_data - serr->ee_info) + 1;
+            }
+            zc_completed(zc, serr->ee_info, serr->ee_data);
+        }
+    }
+}
+
+apr_status_t h2_zerocopy_reap(h2_zerocopy *zc, apr_interval_time_t timeout)
+{
+    struct pollfd pfd;
+    apr_time_t end = (timeout > 0)? apr_time_now() + timeout : 0;
+    int pending = zc->sends_len;
+    apr_status_t rv;
+
+    for (;;) {
+        rv = zc_read_errqueue(zc);
+        zc_release(zc);
+        if (APR_SUCCESS != rv || timeout == 0
+            || zc->sends_len == 0 || zc->sends_len < pending) {
+            return rv;
+        }
+        if (timeout > 0) {
+            timeout = end - apr_time_now();
+            if (timeout <= 0) {
+                return APR_TIMEUP;
+            }
+        }
+        /* a non-empty error queue shows as POLLERR, whatever we ask for */
+        pfd.fd = zc->fd;
+        pfd.events = 0;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, (timeout < 0)? -1 : (int)apr_time_as_msec(timeout) + 1) < 0
+            && errno != EINTR) {
+            return APR_FROM_OS_ERROR(errno);
+        }
+        if ((pfd.revents & POLLHUP) && !(pfd.revents & POLLERR)) {
+            /* closed in both directions, poll returns at once while the
+             * kernel still has data queued. Do not spin. */
+            apr_sleep(apr_time_from_msec(10));
+        }
+    }
+}
+
+static apr_status_t zc_wait_writable(h2_zerocopy *zc)
+{
+    struct pollfd pfd;
+    int n;
+
+    pfd.fd = zc->fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    do {
+        n = poll(&pfd, 1, zc->timeout < 0? -1 : (int)apr_time_as_msec(zc->timeout));
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return APR_FROM_OS_ERROR(errno);
+    }
+    return (n == 0)? APR_TIMEUP : APR_SUCCESS;
+}
+
+static apr_status_t zc_reap_all(h2_zerocopy *zc, apr_interval_time_t timeout)
+{
+    apr_time_t end = apr_time_now() + timeout;
+    apr_status_t rv = APR_SUCCESS;
+
+    while (APR_SUCCESS == rv && zc->sends_len > 0) {
+        timeout = end - apr_time_now();
+        if (timeout <= 0) {
+            return APR_TIMEUP;
+        }
+        rv = h2_zerocopy_reap(zc, timeout);
+    }
+    return rv;
+}
+
+static apr_status_t zc_cleanup(void *data)
+{
+    h2_zerocopy *zc = data;
+    struct sockaddr sa;
+    apr_status_t rv = APR_SUCCESS;
+
+    /* The kernel transmits, and retransmits, from the pages of the held
+     * buckets until it reports a send complete. Freeing them earlier lets
+     * the allocator hand them out again, and their new content might go
+     * out on this connection. Completions come once the data is
+     * acknowledged. A client that does not acknowledge would keep this
+     * worker here, so after a short wait we reset the connection. The
+     * kernel then drops its queue and the completions follow at once. */
+    if (zc->sends_len > 0) {
+        rv = zc_reap_all(zc, ZC_CLOSE_WAIT);
+        if (APR_STATUS_IS_TIMEUP(rv)) {
+            /* connect() to AF_UNSPEC disconnects: RST, queues purged */
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_family = AF_UNSPEC;
+            connect(zc->fd, &sa, sizeof(sa));
+            rv = zc_reap_all(zc, ZC_ABORT_WAIT);
+        }
+    }
+    if (APR_SUCCESS == rv) {
+        apr_brigade_cleanup(zc->held);
+        zc->sends_len = 0;
+        zc->held_len = 0;
+    }
+    /* else: no completions after all, there is no telling when the kernel
+     * is done. The held buckets go with their allocator. */
+    close(zc->fd);
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_zerocopy_create(h2_zerocopy **pzc, apr_pool_t *pool,
+                                apr_socket_t *socket, apr_bucket_alloc_t *ba,
+                                apr_interval_time_t timeout)
+{
+    h2_zerocopy *zc;
+    apr_os_sock_t fd;
+    int one = 1;
+    apr_status_t rv;
+
+    *pzc = NULL;
+    rv = apr_os_sock_get(&fd, socket);
+    if (APR_SUCCESS != rv) return rv;
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        return APR_ENOTIMPL;
+    }
+    zc = apr_pcalloc(pool, sizeof(*zc));
+    /* The connection closes its socket before its pool is cleaned up.
+     * We need the socket for reading completions until then. */
+    zc->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (zc->fd < 0) {
+        return APR_FROM_OS_ERROR(errno);
+    }
+    zc->timeout = timeout;
+    zc->held = apr_brigade_create(pool, ba);
+    /* registered after the brigade's, so we run first */
+    apr_pool_cleanup_register(pool, zc, zc_cleanup, apr_pool_cleanup_null);
+    *pzc = zc;
+    return APR_SUCCESS;
+}
+
+apr_status_t h2_zerocopy_send(h2_zerocopy *zc, apr_bucket_brigade *bb,
+                              apr_size_t *pwritten)
+{
+    struct iovec iov[ZC_IOV_MAX];
+    struct msghdr msg;
+    apr_bucket *b, *e;
+    apr_size_t offset = 0, written = 0, len;
+    const char *data;
+    zc_send *s;
+    ssize_t n;
+    int niov, nbuckets = 0, flags = MSG_ZEROCOPY;
+    apr_status_t rv;
+
+    *pwritten = 0;
+    rv = zc_read_errqueue(zc);
+    zc_release(zc);
+    while (APR_SUCCESS == rv && (zc->sends_len >= ZC_SENDS_MAX
+                                 || zc->held_len >= ZC_HELD_MAX)) {
+        rv = h2_zerocopy_reap(zc, zc->timeout);
+    }
+    if (APR_SUCCESS != rv) {
+        apr_brigade_cleanup(bb);
+        return rv;
+    }
+
+    while (!APR_BRIGADE_EMPTY(bb)) {
+        /* the first bucket is partially sent up to offset */
+        niov = 0;
+        for (e = APR_BRIGADE_FIRST(bb);
+             e != APR_BRIGADE_SENTINEL(bb) && niov < ZC_IOV_MAX;
+             e = APR_BUCKET_NEXT(e)) {
+            if (APR_BUCKET_IS_METADATA(e) || e->length == 0) {
+                continue;
+            }
+            rv = apr_bucket_read(e, &data, &len, APR_BLOCK_READ);
+            if (APR_SUCCESS != rv) goto cleanup;
+            if (e == APR_BRIGADE_FIRST(bb)) {
+                data += offset;
+                len -= offset;
+            }
+            iov[niov].iov_base = (void *)data;
+            iov[niov].iov_len = len;
+            ++niov;
+        }
+
+        if (niov > 0) {
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = (size_t)niov;
+            n = sendmsg(zc->fd, &msg, flags);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    rv = zc_wait_writable(zc);
+                    if (APR_SUCCESS != rv) goto cleanup;
+                    continue;
+                }
+                if (errno == ENOBUFS && flags) {
+                    /* out of option memory for pinning pages, copy the rest */
+                    flags = 0;
+                    continue;
+                }
+                rv = APR_FROM_OS_ERROR(errno);
+                goto cleanup;
+            }
+            if (flags) {
+                ++zc->seq_next;
+                ++zc->nsends;
+            }
+            written += (apr_size_t)n;
+            len = offset + (apr_size_t)n;
+        }
+        else {
+            len = 0;
+        }
+
+        /* move what is completely sent to held */
+        while (!APR_BRIGADE_EMPTY(bb)) {
+            b = APR_BRIGADE_FIRST(bb);
+            if (APR_BUCKET_IS_METADATA(b)) {
+                apr_bucket_delete(b);
+                continue;
+            }
+            if (b->length > len) {
+                break;
+            }
+            len -= b->length;
+            APR_BUCKET_REMOVE(b);
+            APR_BRIGADE_INSERT_TAIL(zc->held, b);
+            ++nbuckets;
+        }
+        offset = len;
+    }
+
+cleanup:
+    /* anything left might be referenced by a send, keep it as well */
+    while (!APR_BRIGADE_EMPTY(bb)) {
+        b = APR_BRIGADE_FIRST(bb);
+        if (APR_BUCKET_IS_METADATA(b)) {
+            apr_bucket_delete(b);
+            continue;
+        }
+        APR_BUCKET_REMOVE(b);
+        APR_BRIGADE_INSERT_TAIL(zc->held, b);
+        ++nbuckets;
+    }
+    if (nbuckets > 0) {
+        assert(zc->sends_len < ZC_SENDS_MAX);
+        s = &zc->sends[(zc->sends_head + zc->sends_len) % ZC_SENDS_MAX];
+        s->seq_end = zc->seq_next;
+        s->nbuckets = nbuckets;
+        s->len = written;
+        ++zc->sends_len;
+        zc->held_len += (apr_off_t)written;
+        zc_release(zc);
+    }
+    *pwritten = written;
+    return rv;
+}
+
+void h2_zerocopy_stats(h2_zerocopy *zc, apr_uint64_t *psends,
+                       apr_uint64_t *pcopied, apr_off_t *pheld)
+{
+    *psends = zc->nsends;
+    *pcopied = zc->ncopied;
+    *pheld = zc->held_len;
+}
+
+#else /* defined(H2_ZEROCOPY) */
+
+apr_status_t h2_zerocopy_create(h2_zerocopy **pzc, apr_pool_t *pool,
+                                apr_socket_t *socket, apr_bucket_alloc_t *ba,
+                                apr_interval_time_t timeout)
+{
+    (void)pool; (void)socket; (void)ba; (void)timeout;
+    *pzc = NULL;
+    return APR_ENOTIMPL;
+}
+
+apr_status_t h2_zerocopy_send(h2_zerocopy *zc, apr_bucket_brigade *bb,
+                              apr_size_t *pwritten)
+{
+    (void)zc;
+    apr_brigade_cleanup(bb);
+    *pwritten = 0;
+    return APR_ENOTIMPL;
+}
+
+apr_status_t h2_zerocopy_reap(h2_zerocopy *zc, apr_interval_time_t timeout)
+{
+    (void)zc; (void)timeout;
+    return APR_ENOTIMPL;
+}
+
+void h2_zerocopy_stats(h2_zerocopy *zc, apr_uint64_t *psends,
+                       apr_uint64_t *pcopied, apr_off_t *pheld)
+{
+    (void)zc;
+    *psends = *pcopied = 0;
+    *pheld = 0;
+}
+
+#endif /* defined(H2_ZEROCOPY) */
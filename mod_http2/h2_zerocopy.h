@@ -0,0 +1,90 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __mod_h2__h2_zerocopy__
+#define __mod_h2__h2_zerocopy__
+
+#include <apr_buckets.h>
+#include <apr_network_io.h>
+
+/*******************************************************************************
+ * zero copy socket writes
+ *
+ * Sends the data of memory buckets with MSG_ZEROCOPY (Linux 4.14+), so the
+ * kernel transmits from our buffers instead of copying them into the socket
+ * buffer first. The buffers must stay untouched until the kernel reports
+ * their completion on the socket's error queue. Until then, the sent buckets
+ * are held here and only destroyed, giving their memory back to the bucket
+ * allocator, once all sends that used them have completed.
+ *
+ * Only available when compiled with H2_ZEROCOPY, otherwise creating one
+ * fails with APR_ENOTIMPL.
+ ******************************************************************************/
+
+typedef struct h2_zerocopy h2_zerocopy;
+
+/**
+ * Enable zero copy sends on the socket.
+ * @param pzc the created instance on success
+ * @param pool the pool to use. Its cleanup waits briefly for the kernel
+ *        to complete all sends, resets the connection if they are still
+ *        pending and then releases the held buckets. The bucket allocator
+ *        must outlive it.
+ * @param socket the socket to write to
+ * @param ba the bucket allocator for holding sent buckets
+ * @param timeout max time to wait for the socket to become writable
+ * @return APR_ENOTIMPL if the platform or socket does not support it
+ */
+apr_status_t h2_zerocopy_create(h2_zerocopy **pzc, apr_pool_t *pool,
+                                apr_socket_t *socket, apr_bucket_alloc_t *ba,
+                                apr_interval_time_t timeout);
+
+/**
+ * != 0 iff all data buckets in the brigade are heap or immortal buckets,
+ * whose memory stays valid until they are destroyed, and they are followed
+ * by nothing but a FLUSH. Their total length is returned in plen.
+ */
+int h2_zerocopy_can_send(apr_bucket_brigade *bb, apr_off_t *plen);
+
+/**
+ * Send all data in the brigade, blocking until the socket has taken all
+ * of it, at most for the timeout given at creation. The data buckets are
+ * moved into the held ones, metadata buckets are deleted. The brigade is
+ * empty afterwards, also on errors.
+ * @param zc the zero copy instance
+ * @param bb the brigade, h2_zerocopy_can_send() must be true for it
+ * @param pwritten the number of bytes written
+ */
+apr_status_t h2_zerocopy_send(h2_zerocopy *zc, apr_bucket_brigade *bb,
+                              apr_size_t *pwritten);
+
+/**
+ * Collect completions from the socket's error queue and destroy the held
+ * buckets that are no longer used by the kernel.
+ * @param zc the zero copy instance
+ * @param timeout how long to wait for completions, 0 for not waiting,
+ *        < 0 for no limit
+ */
+apr_status_t h2_zerocopy_reap(h2_zerocopy *zc, apr_interval_time_t timeout);
+
+/**
+ * Get the number of zero copy sends and how many of those the kernel
+ * did copy after all, e.g. for loopback connections.
+ */
+void h2_zerocopy_stats(h2_zerocopy *zc, apr_uint64_t *psends,
+                       apr_uint64_t *pcopied, apr_off_t *pheld);
+
+#endif /* defined(__mod_h2__h2_zerocopy__) */
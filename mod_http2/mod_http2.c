@@ -39,6 +39,8 @@
 #include "h2_mplx.h"
 #include "h2_push.h"
 #include "h2_request.h"
+#include "h2_status.h"
+#include "h2_vhost_stats.h"
 #include "h2_switch.h"
 #include "h2_version.h"
 #include "h2_bucket_beam.h"
@@ -60,6 +62,7 @@ AP_DECLARE_MODULE(http2) = {
 };
 
 static int h2_h2_fixups(request_rec *r);
+static int h2_h2_log_transaction(request_rec *r);
 
 typedef struct {
     unsigned int change_prio : 1;
@@ -161,6 +164,9 @@ static int h2_post_config(apr_pool_t *p, apr_pool_t *plog,
     if (status == APR_SUCCESS) {
         status = h2_switch_init(p, s);
     }
+    if (status == APR_SUCCESS) {
+        status = h2_vhost_stats_post_config(p, s);
+    }
 
     return status;
 }
@@ -235,10 +241,14 @@ static void h2_hooks(apr_pool_t *pool)
     h2_c1_register_hooks();
     h2_switch_register_hooks();
     h2_c2_register_hooks();
+    h2_status_register_hooks();
+    h2_vhost_stats_register_hooks();
 
     /* Setup subprocess env for certain variables
      */
     ap_hook_fixups(h2_h2_fixups, NULL,NULL, APR_HOOK_MIDDLE);
+    /* Before mod_log_config writes access logs */
+    ap_hook_log_transaction(h2_h2_log_transaction, NULL, NULL, APR_HOOK_REALLY_FIRST);
 }
 
 static const char *val_HTTP2(apr_pool_t *p, server_rec *s,
@@ -322,22 +332,119 @@ static const char *val_H2_STREAM_ID(apr_pool_t *p, server_rec *s,
     return NULL;
 }
 
+static const char *time_since(apr_pool_t *p, apr_time_t start, apr_time_t t)
+{
+    if (!start || !t || t < start) {
+        return "-";
+    }
+    return apr_psprintf(p, "%" APR_TIME_T_FMT, t - start);
+}
+
+static const char *val_H2_T_HEADERS(apr_pool_t *p, server_rec *s,
+                                    conn_rec *c, request_rec *r, h2_conn_ctx_t *ctx)
+{
+    return (r && ctx)? time_since(p, ctx->timing.opened, ctx->timing.headers_done) : "";
+}
+
+static const char *val_H2_T_QUEUED(apr_pool_t *p, server_rec *s,
+                                   conn_rec *c, request_rec *r, h2_conn_ctx_t *ctx)
+{
+    return (r && ctx)? time_since(p, ctx->timing.opened, ctx->timing.queued) : "";
+}
+
+static const char *val_H2_T_STARTED(apr_pool_t *p, server_rec *s,
+                                    conn_rec *c, request_rec *r, h2_conn_ctx_t *ctx)
+{
+    return (r && ctx)? time_since(p, ctx->timing.opened, ctx->started_at) : "";
+}
+
+static const char *val_H2_T_RESPONSE(apr_pool_t *p, server_rec *s,
+                                     conn_rec *c, request_rec *r, h2_conn_ctx_t *ctx)
+{
+    return (r && ctx)? time_since(p, ctx->timing.opened, ctx->response_at) : "";
+}
+
+static const char *val_H2_T_DONE(apr_pool_t *p, server_rec *s,
+                                 conn_rec *c, request_rec *r, h2_conn_ctx_t *ctx)
+{
+    return (r && ctx)? time_since(p, ctx->timing.opened, ctx->done_at) : "";
+}
+
+static const char *val_H2_T_FIRST_DATA(apr_pool_t *p, server_rec *s,
+                                       conn_rec *c, request_rec *r, h2_conn_ctx_t *ctx)
+{
+    return (r && ctx)? time_since(p, ctx->timing.opened, ctx->timing.first_data) : "";
+}
+
+static const char *val_H2_T_LAST_DATA(apr_pool_t *p, server_rec *s,
+                                      conn_rec *c, request_rec *r, h2_conn_ctx_t *ctx)
+{
+    return (r && ctx)? time_since(p, ctx->timing.opened, ctx->timing.last_data) : "";
+}
+
+static const char *val_H2_T_CLOSED(apr_pool_t *p, server_rec *s,
+                                   conn_rec *c, request_rec *r, h2_conn_ctx_t *ctx)
+{
+    return (r && ctx)? time_since(p, ctx->timing.opened, ctx->timing.closed) : "";
+}
+
+static const char *val_H2_QUEUE_WAIT(apr_pool_t *p, server_rec *s,
+                                     conn_rec *c, request_rec *r, h2_conn_ctx_t *ctx)
+{
+    return (r && ctx)? time_since(p, ctx->timing.queued, ctx->started_at) : "";
+}
+
+static const char *val_H2_HANDLER_TIME(apr_pool_t *p, server_rec *s,
+                                       conn_rec *c, request_rec *r, h2_conn_ctx_t *ctx)
+{
+    return (r && ctx)? time_since(p, ctx->started_at, ctx->done_at) : "";
+}
+
+static const char *val_H2_DRAIN_TIME(apr_pool_t *p, server_rec *s,
+                                     conn_rec *c, request_rec *r, h2_conn_ctx_t *ctx)
+{
+    /* time the client took to receive what was left after processing
+     * was done, 0 if the response was sent while processing */
+    if (r && ctx) {
+        if (ctx->done_at && ctx->timing.last_data
+            && ctx->timing.last_data <= ctx->done_at) {
+            return "0";
+        }
+        return time_since(p, ctx->done_at, ctx->timing.last_data);
+    }
+    return "";
+}
+
 typedef const char *h2_var_lookup(apr_pool_t *p, server_rec *s,
                                   conn_rec *c, request_rec *r, h2_conn_ctx_t *ctx);
 typedef struct h2_var_def {
     const char *name;
     h2_var_lookup *lookup;
     unsigned int  subprocess : 1;    /* should be set in r->subprocess_env */
+    unsigned int  logged : 1;        /* set in r->subprocess_env for logging */
 } h2_var_def;
 
+/* The H2_T_* values are microseconds since the stream was opened,
+ * the other timings are microsecond durations. "-" if unknown. */
 static h2_var_def H2_VARS[] = {
-    { "HTTP2",               val_HTTP2,  1 },
-    { "H2PUSH",              val_H2_PUSH, 1 },
-    { "H2_PUSH",             val_H2_PUSH, 1 },
-    { "H2_PUSHED",           val_H2_PUSHED, 1 },
-    { "H2_PUSHED_ON",        val_H2_PUSHED_ON, 1 },
-    { "H2_STREAM_ID",        val_H2_STREAM_ID, 1 },
-    { "H2_STREAM_TAG",       val_H2_STREAM_TAG, 1 },
+    { "HTTP2",               val_HTTP2,  1, 0 },
+    { "H2PUSH",              val_H2_PUSH, 1, 0 },
+    { "H2_PUSH",             val_H2_PUSH, 1, 0 },
+    { "H2_PUSHED",           val_H2_PUSHED, 1, 0 },
+    { "H2_PUSHED_ON",        val_H2_PUSHED_ON, 1, 0 },
+    { "H2_STREAM_ID",        val_H2_STREAM_ID, 1, 0 },
+    { "H2_STREAM_TAG",       val_H2_STREAM_TAG, 1, 0 },
+    { "H2_T_HEADERS",        val_H2_T_HEADERS, 0, 1 },
+    { "H2_T_QUEUED",         val_H2_T_QUEUED, 0, 1 },
+    { "H2_T_STARTED",        val_H2_T_STARTED, 0, 1 },
+    { "H2_T_RESPONSE",       val_H2_T_RESPONSE, 0, 1 },
+    { "H2_T_DONE",           val_H2_T_DONE, 0, 1 },
+    { "H2_T_FIRST_DATA",     val_H2_T_FIRST_DATA, 0, 1 },
+    { "H2_T_LAST_DATA",      val_H2_T_LAST_DATA, 0, 1 },
+    { "H2_T_CLOSED",         val_H2_T_CLOSED, 0, 1 },
+    { "H2_QUEUE_WAIT",       val_H2_QUEUE_WAIT, 0, 1 },
+    { "H2_HANDLER_TIME",     val_H2_HANDLER_TIME, 0, 1 },
+    { "H2_DRAIN_TIME",       val_H2_DRAIN_TIME, 0, 1 },
 };
 
 #ifndef H2_ALEN
@@ -388,3 +495,24 @@ static int h2_h2_fixups(request_rec *r)
     }
     return DECLINED;
 }
+
+/* Stream timings are only complete when the request is logged, which
+ * happens after the stream has been closed. Make them available to
+ * access logs as '%{H2_T_...}e'. */
+static int h2_h2_log_transaction(request_rec *r)
+{
+    if (r->connection->master) {
+        h2_conn_ctx_t *ctx = h2_conn_ctx_get(r->connection);
+        int i;
+
+        for (i = 0; ctx && i < H2_ALEN(H2_VARS); ++i) {
+            h2_var_def *vdef = &H2_VARS[i];
+            if (vdef->logged) {
+                apr_table_setn(r->subprocess_env, vdef->name,
+                               vdef->lookup(r->pool, r->server, r->connection,
+                                            r, ctx));
+            }
+        }
+    }
+    return DECLINED;
+}
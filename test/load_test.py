@@ -1,10 +1,17 @@
 import argparse
+import json
 import logging
+import math
 import os
 import re
+import resource
+import socket
+import ssl
 import statistics
+import subprocess
 import sys
 import time
+import urllib.request
 from datetime import timedelta, datetime
 from threading import Thread
 from typing import Dict, Tuple, Optional, List, Iterable
@@ -23,6 +30,63 @@ class LoadTestException(Exception):
     pass
 
 
+class LatencyHistogram:
+    """Histogram of latencies in microseconds, in the manner of HdrHistogram:
+       values below 2048 are counted exactly, larger ones in buckets of
+       1/1024th of their power of 2, keeping 3 significant digits. Percentiles
+       report the highest value equivalent to the bucket they fall into."""
+
+    SUB_BITS = 11
+    PERCENTILES = [50, 90, 99, 99.9]
+
+    def __init__(self):
+        self._counts = {}
+        self.count = 0
+        self.total = 0
+        self.min = None
+        self.max = None
+
+    @classmethod
+    def _lowest(cls, value: int) -> Tuple[int, int]:
+        shift = max(0, value.bit_length() - cls.SUB_BITS)
+        return (value >> shift) << shift, shift
+
+    def record(self, value: int, n: int = 1):
+        value = max(0, int(value))
+        lowest, shift = self._lowest(value)
+        self._counts[lowest] = self._counts.get(lowest, 0) + n
+        self.count += n
+        self.total += value * n
+        self.min = value if self.min is None else min(self.min, value)
+        self.max = value if self.max is None else max(self.max, value)
+
+    def percentile(self, p: float) -> int:
+        if self.count == 0:
+            return 0
+        target = max(1, math.ceil(self.count * p / 100.0))
+        seen = 0
+        for lowest in sorted(self._counts.keys()):
+            seen += self._counts[lowest]
+            if seen >= target:
+                _, shift = self._lowest(lowest)
+                return min(lowest + (1 << shift) - 1, self.max)
+        return self.max
+
+    @property
+    def mean(self) -> float:
+        return self.total / self.count if self.count else 0.0
+
+    def to_json(self) -> Dict:
+        return {
+            'count': self.count,
+            'min': self.min,
+            'max': self.max,
+            'mean': round(self.mean, 1),
+            'percentiles': {str(p): self.percentile(p) for p in self.PERCENTILES},
+            'buckets': [[k, self._counts[k]] for k in sorted(self._counts.keys())],
+        }
+
+
 class H2LoadLogSummary:
 
     @staticmethod
@@ -30,25 +94,32 @@ class H2LoadLogSummary:
         with open(fpath) as fd:
             return H2LoadLogSummary.from_lines(fd.readlines(), title=title, duration=duration)
 
+    @staticmethod
+    def parse_lines(lines: Iterable[str]) -> List[Tuple[int, int, int]]:
+        """Get the (start(us), status, duration(us)) of all h2load log lines."""
+        records = []
+        for line in lines:
+            parts = re.split(r'\s+', line)  # start(us), status(int), duration(us), tbd.
+            if len(parts) >= 3 and parts[0] and parts[1] and parts[2]:
+                records.append((int(parts[0]), int(parts[1]), int(parts[2])))
+            else:
+                sys.stderr.write("unrecognize log line: {0}".format(line))
+        return records
+
     @staticmethod
     def from_lines(lines: Iterable[str], title: str, duration: timedelta) -> 'H2LoadLogSummary':
         stati = {}
         count = 0
         durations = list()
         all_durations = timedelta(milliseconds=0)
-        for line in lines:
-            parts = re.split(r'\s+', line)  # start(us), status(int), duration(ms), tbd.
-            if len(parts) >= 3 and parts[0] and parts[1] and parts[2]:
-                count += 1
-                status = int(parts[1])
-                if status in stati:
-                    stati[status] += 1
-                else:
-                    stati[status] = 1
-                durations.append(int(parts[2]))
-                all_durations += timedelta(microseconds=int(parts[2]))
+        for start, status, rduration in H2LoadLogSummary.parse_lines(lines):
+            count += 1
+            if status in stati:
+                stati[status] += 1
             else:
-                sys.stderr.write("unrecognize log line: {0}".format(line))
+                stati[status] = 1
+            durations.append(rduration)
+            all_durations += timedelta(microseconds=rduration)
         mean_duration = statistics.mean(durations)
         return H2LoadLogSummary(title=title, total=count, stati=stati,
                                 duration=duration, all_durations=all_durations,
@@ -131,6 +202,101 @@ class H2LoadLogSummary:
                 note += " {0}={1}".format(status, self.response_stati[status])
         return note if len(note) else None
 
+    def to_json(self) -> Dict:
+        return {
+            'responses': self.response_count,
+            'expected': self.expected_responses,
+            'duration_s': self.duration.total_seconds(),
+            'mean_ms': round(self.mean_duration_ms, 3),
+            'stati': {str(k): v for k, v in self.response_stati.items()},
+        }
+
+
+class OpenLoopSummary(H2LoadLogSummary):
+    """Latencies of an open-loop run where each of `clients` connections
+       sent requests at the `schedule` offsets (ms). Latencies are measured
+       from the time a request was scheduled, not from when h2load got
+       around to send it, so delays in the client caused by a slow server
+       are not omitted (coordinated omission).
+       h2load does not log which connection sent a request, so the n-th
+       earliest request sent is matched to the n-th earliest scheduled one.
+       Requests scheduled in the first `skip_ms` are not counted, they
+       include the connection setups."""
+
+    @staticmethod
+    def from_log(fpath: str, title: str, duration: timedelta,
+                 schedule: List[float], clients: int, rate: float,
+                 skip_ms: float = 1000.0, lag_limit_ms: float = 100.0) -> 'OpenLoopSummary':
+        with open(fpath) as fd:
+            lines = fd.readlines()
+        base = H2LoadLogSummary.from_lines(lines, title=title, duration=duration)
+        summary = OpenLoopSummary(base, rate=rate, lag_limit_ms=lag_limit_ms)
+        records = sorted(H2LoadLogSummary.parse_lines(lines))
+        if not records:
+            return summary
+        t0 = records[0][0]
+        last_end = t0
+        for idx, (start, status, rduration) in enumerate(records):
+            slot = min(idx // clients, len(schedule) - 1)
+            scheduled = t0 + int(schedule[slot] * 1000)
+            end = start + rduration
+            last_end = max(last_end, end)
+            if schedule[slot] < skip_ms:
+                continue
+            summary.latency.record(max(rduration, end - scheduled))
+            summary.service.record(rduration)
+            summary.lag.record(max(0, start - scheduled))
+        summary.elapsed = timedelta(microseconds=last_end - t0)
+        return summary
+
+    def __init__(self, base: H2LoadLogSummary, rate: float, lag_limit_ms: float):
+        super().__init__(title=base.title, total=base.response_count,
+                         stati=base.response_stati, duration=base.duration,
+                         all_durations=base.response_durations,
+                         mean_duration=base._mean_duration)
+        self.rate = rate
+        self.lag_limit_ms = lag_limit_ms
+        self.elapsed = base.duration
+        self.latency = LatencyHistogram()
+        self.service = LatencyHistogram()
+        self.lag = LatencyHistogram()
+
+    @property
+    def achieved_rate(self) -> float:
+        secs = self.elapsed.total_seconds()
+        return self.response_count / secs if secs > 0 else 0.0
+
+    @property
+    def saturation(self) -> Optional[str]:
+        """Why the server could not keep up with the arrival rate, or None."""
+        if 0 < self.expected_responses and self.response_count < self.expected_responses:
+            return "missing responses"
+        if self.achieved_rate < 0.95 * self.rate:
+            return f"{self.achieved_rate:.0f} of {self.rate:.0f} req/s"
+        lag_ms = self.lag.percentile(99) / 1000.0
+        if lag_ms > self.lag_limit_ms:
+            return f"p99 send lag {lag_ms:.0f}ms"
+        return None
+
+    def get_footnote(self) -> Optional[str]:
+        note = super().get_footnote()
+        if self.saturation:
+            note = f"{note}, " if note else ""
+            note += f"saturated: {self.saturation}"
+        return note
+
+    def to_json(self) -> Dict:
+        d = super().to_json()
+        d.update({
+            'rate': self.rate,
+            'achieved_rate': round(self.achieved_rate, 1),
+            'saturated': self.saturation,
+            'latency_us': self.latency.to_json(),
+            'service_us': self.service.to_json(),
+            'send_lag_us': self.lag.to_json(),
+        })
+        return d
+
 
 class H2LoadMonitor:
 
@@ -215,10 +381,12 @@ class LoadTestCase:
         raise NotImplemented
 
     @staticmethod
-    def setup_base_conf(env: H2TestEnv, worker_count: int = 5000, extras=None) -> H2Conf:
+    def setup_base_conf(env: H2TestEnv, worker_count: int = 5000, extras=None,
+                        process_count: int = None) -> H2Conf:
         conf = H2Conf(env=env, extras=extras)
         # ylavic's formula
-        process_count = int(max(10, min(100, int(worker_count / 100))))
+        if process_count is None:
+            process_count = int(max(10, min(100, int(worker_count / 100))))
         thread_count = int(max(25, int(worker_count / process_count)))
         conf.add(f"""
         StartServers             1
@@ -270,6 +438,9 @@ class LoadTestCase:
             Protocols h2 http/1.1
             ProxyPass /proxy-h1/ https://127.0.0.1:{env.https_port}/
             ProxyPass /proxy-h2/ h2://127.0.0.1:{env.https_port}/
+            <Location /h2test/gen>
+                SetHandler h2test-gen
+            </Location>
             """
         conf = LoadTestCase.setup_base_conf(env=env, extras=extras)
         conf.add_vhost_test1()
@@ -410,6 +581,45 @@ class UrlsLoadTest(LoadTestCase):
         return r, summary.get_footnote()
 
 
+class GenLoadTest(UrlsLoadTest):
+    """Requests responses from the mod_h2test generator instead of files.
+       The 'file_sizes' (in KB) become the 'size' of the generated bodies,
+       'gen_args' are added to the query, e.g. 'bucket=file&chunk=16k'."""
+
+    def __init__(self, gen_args: str = '', **kwargs):
+        super().__init__(**kwargs)
+        self._gen_args = gen_args
+
+    @staticmethod
+    def from_scenario(scenario: Dict, env: H2TestEnv) -> 'GenLoadTest':
+        return GenLoadTest(
+            env=env,
+            location=scenario['location'],
+            clients=scenario['clients'], requests=scenario['requests'],
+            file_sizes=scenario['file_sizes'], file_count=scenario['file_count'],
+            protocol=scenario['protocol'], max_parallel=scenario['max_parallel'],
+            warmup=scenario['warmup'], measure=scenario['measure'],
+            gen_args=scenario.get('gen_args', '')
+        )
+
+    def next_scenario(self, scenario: Dict) -> 'GenLoadTest':
+        return GenLoadTest.from_scenario(scenario, env=self.env)
+
+    def _setup(self, cls, extras: Dict = None):
+        LoadTestCase.server_setup(env=self.env, extras=extras)
+        uris = []
+        for i in range(self._file_count):
+            fsize = self._file_sizes[i % len(self._file_sizes)]
+            query = f"size={fsize}k"
+            if self._gen_args:
+                query += f"&{self._gen_args}"
+            uris.append(f"{self._location}?{query}")
+        with open(self._url_file, 'w') as fd:
+            fd.write("\n".join(uris))
+            fd.write("\n")
+        self.start_server(env=self.env)
+
+
 class StressTest(LoadTestCase):
 
     SETUP_DONE = False
@@ -543,6 +753,623 @@ class StressTest(LoadTestCase):
         ), summary.get_footnote()
 
 
+class OpenLoopTest(LoadTestCase):
+    """Sends requests at a constant rate, independent of how fast responses
+       arrive, over `connections` with at most `streams` each. h2load follows
+       a timing script for every connection, so the total arrival rate is
+       `rate` and requests queue up in the client when the server falls behind.
+       Latencies are reported as percentiles of an HDR histogram."""
+
+    def __init__(self, env: H2TestEnv, location: str,
+                 rate: int, connections: int, streams: int,
+                 duration: int, file_count: int, file_sizes: List[int],
+                 measure: str = 'p99', protocol: str = 'h2',
+                 lag_limit_ms: float = 100.0, threads: int = None):
+        self.env = env
+        self._location = location
+        self._rate = rate
+        self._connections = connections
+        self._streams = streams
+        self._duration = duration
+        self._file_count = file_count
+        self._file_sizes = file_sizes
+        self._measure = measure
+        self._protocol = protocol
+        self._lag_limit_ms = lag_limit_ms
+        self._threads = threads if threads is not None else min(4, self._connections)
+        self._script_file = f"{self.env.gen_dir}/h2load-timing.txt"
+        self._schedule = []
+
+    @staticmethod
+    def from_scenario(scenario: Dict, env: H2TestEnv) -> 'OpenLoopTest':
+        return OpenLoopTest(
+            env=env,
+            location=scenario['location'],
+            rate=scenario['rate'], connections=scenario['connections'],
+            streams=scenario['streams'], duration=scenario['duration'],
+            file_sizes=scenario['file_sizes'], file_count=scenario['file_count'],
+            measure=scenario['measure'], protocol=scenario['protocol'],
+            lag_limit_ms=scenario.get('lag_limit_ms', 100.0)
+        )
+
+    def next_scenario(self, scenario: Dict) -> 'OpenLoopTest':
+        return OpenLoopTest.from_scenario(scenario, env=self.env)
+
+    def _setup(self):
+        LoadTestCase.server_setup(env=self.env)
+        docs_a = os.path.join(self.env.server_docs_dir, "test1")
+        uris = []
+        for i in range(self._file_count):
+            fsize = self._file_sizes[i % len(self._file_sizes)]
+            fname = "{0}-{1}k.txt".format(i, fsize)
+            fpath = os.path.join(docs_a, fname)
+            if not os.path.isfile(fpath):
+                mk_text_file(fpath, 8 * fsize)
+            uris.append(f"https://test1.{self.env.http_tld}:{self.env.https_port}"
+                        f"{self._location}{fname}")
+        # the same schedule for every connection, evenly spread
+        conn_rate = self._rate / self._connections
+        count = max(1, int(conn_rate * self._duration))
+        self._schedule = [i * 1000.0 / conn_rate for i in range(count)]
+        with open(self._script_file, 'w') as fd:
+            for i, offset in enumerate(self._schedule):
+                fd.write(f"{offset:.3f}\t{uris[i % len(uris)]}\n")
+        self.start_server(env=self.env)
+
+    def run(self) -> OpenLoopSummary:
+        self._setup()
+        monitor = None
+        try:
+            log_file = f"{self.env.gen_dir}/h2load.log"
+            if os.path.isfile(log_file):
+                os.remove(log_file)
+            expected = len(self._schedule) * self._connections
+            monitor = H2LoadMonitor(log_file, expected=expected,
+                                    title=f"{self._protocol}/{self._rate}r/"
+                                          f"{self._connections}c/{self._streams}m")
+            monitor.start()
+            args = [
+                'h2load',
+                f'--clients={self._connections}',
+                f'--threads={self._threads}',
+                f'--timing-script-file={self._script_file}',
+                f'--log-file={log_file}',
+                f'--connect-to=localhost:{self.env.https_port}',
+            ]
+            if self._protocol == 'h1' or self._protocol == 'http/1.1':
+                args.append('--h1')
+            elif self._protocol == 'h2':
+                args.extend(['-m', str(self._streams)])
+            else:
+                raise Exception(f"unknown protocol: {self._protocol}")
+            r = self.env.run(args)
+            if r.exit_code != 0:
+                raise LoadTestException("h2load returned {0}: {1}".format(r.exit_code, r.stderr))
+            monitor.get_summary(duration=r.duration)
+            summary = OpenLoopSummary.from_log(
+                log_file, title=f"{self._rate}r/{self._connections}c/{self._streams}m", duration=r.duration,
+                schedule=self._schedule, clients=self._connections,
+                rate=self._rate, lag_limit_ms=self._lag_limit_ms)
+            summary.set_expected_responses(expected)
+            summary.set_exec_result(r)
+            return summary
+        finally:
+            if monitor is not None:
+                monitor.stop()
+
+    def shutdown(self):
+        pass
+
+    def format_result(self, summary: OpenLoopSummary) -> Tuple[str, Optional[List[str]]]:
+        if self._measure.startswith('p'):
+            r = "{0:.1f}".format(summary.latency.percentile(float(self._measure[1:])) / 1000.0)
+        elif self._measure == 'req/s':
+            r = "{0:d}".format(round(summary.achieved_rate))
+        else:
+            raise Exception(f"measure '{self._measure}' not defined")
+        return r, summary.get_footnote()
+
+
+class StatusSampler:
+    """Polls the 'http2-server-status' of the server over HTTP/1.1, which
+       does not need a h2 worker, and records how many h2 workers are busy
+       and how many threads wait on full or empty beams. The status only
+       covers the child answering it, so tests using this run a single
+       child process."""
+
+    def __init__(self, env: H2TestEnv, interval: float = 0.25):
+        self.env = env
+        self._interval = interval
+        self._url = f"http://127.0.0.1:{env.http_port}/h2-status"
+        self._host = f"test1.{env.http_tld}"
+        self._running = False
+        self._thread = None
+        self.samples = []
+
+    def start(self):
+        self._running = True
+        self._thread = Thread(target=self._run)
+        self._thread.start()
+
+    def stop(self) -> 'StatusSampler':
+        self._running = False
+        if self._thread:
+            self._thread.join()
+        return self
+
+    def fetch(self) -> Dict:
+        req = urllib.request.Request(self._url, headers={'Host': self._host})
+        with urllib.request.urlopen(req, timeout=2) as resp:
+            return json.load(resp)
+
+    def _run(self):
+        while self._running:
+            try:
+                status = self.fetch()
+                self.samples.append({
+                    'time': time.time(),
+                    'busy': status['workers']['busy'],
+                    'workers': status['workers']['count'],
+                    'max': status['workers']['max'],
+                    'blocked_full': status['beams']['blocked_full'],
+                    'blocked_empty': status['beams']['blocked_empty'],
+                    'streams': sum([s['streams'] for s in status['sessions']]),
+                })
+            except (IOError, ValueError, KeyError) as ex:
+                log.debug(f"status sample failed: {ex}")
+            time.sleep(self._interval)
+
+    def to_json(self) -> Dict:
+        if not self.samples:
+            return {'samples': 0}
+        busy = [s['busy'] for s in self.samples]
+        wmax = max([s['max'] for s in self.samples])
+        return {
+            'samples': len(self.samples),
+            'workers_max': wmax,
+            'busy_max': max(busy),
+            'busy_mean': round(statistics.mean(busy), 1),
+            'exhausted': round(len([b for b in busy if b >= wmax]) / len(busy), 3),
+            'blocked_full_max': max([s['blocked_full'] for s in self.samples]),
+            'blocked_empty_max': max([s['blocked_empty'] for s in self.samples]),
+            'streams_max': max([s['streams'] for s in self.samples]),
+        }
+
+
+class OccupancySummary:
+    """Result of a run measuring worker occupancy, responses counted by
+       the client and the samples of the server status."""
+
+    def __init__(self, title: str, duration: timedelta, responses: int,
+                 expected: int, sampler: StatusSampler, errors: int = 0):
+        self.title = title
+        self.duration = duration
+        self.response_count = responses
+        self.expected_responses = expected
+        self.errors = errors
+        self.occupancy = sampler.to_json()
+
+    def get_footnote(self) -> Optional[str]:
+        notes = []
+        if self.response_count < self.expected_responses:
+            notes.append(f"{self.expected_responses - self.response_count}/"
+                         f"{self.expected_responses} missing")
+        if self.errors:
+            notes.append(f"{self.errors} client errors")
+        if self.occupancy['samples'] and self.occupancy['exhausted'] > 0:
+            notes.append(f"workers exhausted {self.occupancy['exhausted'] * 100:.0f}% "
+                         f"of the time, max {self.occupancy['blocked_full_max']} "
+                         f"blocked on full beams")
+        return ", ".join(notes) if notes else None
+
+    def to_json(self) -> Dict:
+        return {
+            'responses': self.response_count,
+            'expected': self.expected_responses,
+            'errors': self.errors,
+            'duration_s': self.duration.total_seconds(),
+            'occupancy': self.occupancy,
+        }
+
+
+class OccupancyTest(LoadTestCase):
+    """Base for tests that hold h2 workers with their clients and sample
+       the worker pool while doing so. The server runs one child with
+       `max_workers` h2 workers."""
+
+    def __init__(self, env: H2TestEnv, max_workers: int, measure: str):
+        self.env = env
+        self._max_workers = max_workers
+        self._measure = measure
+
+    def _server_setup(self):
+        conf = LoadTestCase.setup_base_conf(env=self.env, worker_count=512,
+                                            process_count=1, extras={
+            'base': f"""
+            LogLevel ssl:warn
+            Protocols h2 http/1.1
+            H2MinWorkers 1
+            H2MaxWorkers {self._max_workers}
+            """,
+            f"test1.{self.env.http_tld}": """
+            <Location /h2test/gen>
+                SetHandler h2test-gen
+            </Location>
+            <Location /h2-status>
+                SetHandler http2-server-status
+            </Location>
+            """,
+        })
+        conf.add_vhost_test1()
+        conf.install()
+        self.start_server(env=self.env)
+
+    def shutdown(self):
+        pass
+
+    def format_result(self, summary: OccupancySummary) -> Tuple[str, Optional[List[str]]]:
+        occ = summary.occupancy
+        if not occ['samples']:
+            r = "-"
+        elif self._measure == 'busy':
+            r = f"{occ['busy_max']}/{occ['workers_max']}"
+        elif self._measure == 'blocked':
+            r = f"{occ['blocked_full_max']}"
+        elif self._measure == 'req/s':
+            r = "{0:d}".format(round(summary.response_count / summary.duration.total_seconds()))
+        else:
+            raise Exception(f"measure '{self._measure}' not defined")
+        return r, summary.get_footnote()
+
+
+class SlowClientTest(OccupancyTest):
+    """Clients that read responses at a throttled rate. Each of `clients`
+       curl processes fetches `streams` responses of `size` KB in parallel
+       on one HTTP/2 connection, reading each one with at most `read_rate`
+       bytes/s (curl's --limit-rate). Responses are larger than the beam
+       buffers, so their workers stay busy until the client has read them."""
+
+    def __init__(self, env: H2TestEnv, clients: int, streams: int,
+                 read_rate: str, size: int, max_workers: int,
+                 measure: str = 'busy'):
+        super().__init__(env=env, max_workers=max_workers, measure=measure)
+        self._clients = clients
+        self._streams = streams
+        self._read_rate = read_rate
+        self._size = size
+
+    @staticmethod
+    def from_scenario(scenario: Dict, env: H2TestEnv) -> 'SlowClientTest':
+        return SlowClientTest(
+            env=env, clients=scenario['clients'], streams=scenario['streams'],
+            read_rate=scenario['read_rate'], size=scenario['size'],
+            max_workers=scenario['max_workers'], measure=scenario['measure']
+        )
+
+    def next_scenario(self, scenario: Dict) -> 'SlowClientTest':
+        return SlowClientTest.from_scenario(scenario, env=self.env)
+
+    def run(self) -> OccupancySummary:
+        self._server_setup()
+        url = f"https://test1.{self.env.http_tld}:{self.env.https_port}" \
+              f"/h2test/gen?size={self._size}k&chunk=16k"
+        urls = [url] * self._streams
+        sampler = StatusSampler(env=self.env)
+        procs = []
+        start = datetime.now()
+        sampler.start()
+        try:
+            for _ in range(self._clients):
+                args, _ = self.env.curl_complete_args(urls, options=[
+                    '--http2', '--parallel', '--parallel-max', str(self._streams),
+                    '--limit-rate', self._read_rate, '-w', '%{http_code}\n',
+                ] + ['-o', '/dev/null'] * len(urls))
+                procs.append(subprocess.Popen(args, stdout=subprocess.PIPE,
+                                              stderr=subprocess.DEVNULL))
+            responses = errors = 0
+            for p in procs:
+                out, _ = p.communicate()
+                responses += len([c for c in out.decode().split() if c == '200'])
+                if p.returncode != 0:
+                    errors += 1
+        finally:
+            for p in procs:
+                if p.poll() is None:
+                    p.kill()
+            sampler.stop()
+        return OccupancySummary(title=f"{self._clients}c/{self._streams}s/{self._read_rate}",
+                                duration=datetime.now() - start, responses=responses,
+                                expected=self._clients * self._streams,
+                                sampler=sampler, errors=errors)
+
+
+class FanoutTest(OccupancyTest):
+    """Connections that open `streams` concurrent requests each, as pages
+       with many resources do. Responses are produced at a limited pace by
+       the mod_h2test generator, `interval` microseconds between chunks,
+       so requests hold on to their workers."""
+
+    def __init__(self, env: H2TestEnv, clients: int, streams: int,
+                 requests: int, size: int, interval: int, max_workers: int,
+                 measure: str = 'busy'):
+        super().__init__(env=env, max_workers=max_workers, measure=measure)
+        self._clients = clients
+        self._streams = streams
+        self._requests = requests
+        self._size = size
+        self._interval = interval
+        self._url_file = f"{self.env.gen_dir}/h2load-fanout.txt"
+
+    @staticmethod
+    def from_scenario(scenario: Dict, env: H2TestEnv) -> 'FanoutTest':
+        return FanoutTest(
+            env=env, clients=scenario['clients'], streams=scenario['streams'],
+            requests=scenario['requests'], size=scenario['size'],
+            interval=scenario['interval'], max_workers=scenario['max_workers'],
+            measure=scenario['measure']
+        )
+
+    def next_scenario(self, scenario: Dict) -> 'FanoutTest':
+        return FanoutTest.from_scenario(scenario, env=self.env)
+
+    def run(self) -> OccupancySummary:
+        self._server_setup()
+        with open(self._url_file, 'w') as fd:
+            fd.write(f"/h2test/gen?size={self._size}k&chunk=4k&interval={self._interval}\n")
+        log_file = f"{self.env.gen_dir}/h2load.log"
+        if os.path.isfile(log_file):
+            os.remove(log_file)
+        sampler = StatusSampler(env=self.env)
+        sampler.start()
+        try:
+            r = self.env.run([
+                'h2load',
+                f'--clients={self._clients}',
+                f'--threads={min(4, self._clients)}',
+                f'--requests={self._requests}',
+                f'--input-file={self._url_file}',
+                f'--log-file={log_file}',
+                f'--connect-to=localhost:{self.env.https_port}',
+                '-m', str(self._streams),
+                f'--base-uri=https://test1.{self.env.http_tld}:{self.env.https_port}/',
+            ])
+        finally:
+            sampler.stop()
+        if r.exit_code != 0:
+            raise LoadTestException("h2load returned {0}: {1}".format(r.exit_code, r.stderr))
+        with open(log_file) as fd:
+            records = H2LoadLogSummary.parse_lines(fd.readlines())
+        return OccupancySummary(title=f"{self._clients}c/{self._streams}m",
+                                duration=r.duration,
+                                responses=len([x for x in records if x[1] == 200]),
+                                expected=self._requests, sampler=sampler,
+                                errors=len([x for x in records if x[1] != 200]))
+
+
+class MemorySoakSummary:
+    """RSS of the server child while holding idle and active connections,
+       over several rounds."""
+
+    def __init__(self, title: str, connections: int, active: int, streams: int):
+        self.title = title
+        self.connections = connections
+        self.active = active
+        self.streams = streams
+        self.rounds = []
+        self.duration = timedelta(seconds=0)
+        self.growth_limit = 0.05
+
+    def add_round(self, base_rss: int, idle_rss: int, active_rss: int,
+                  after_rss: int, pools: Dict):
+        self.rounds.append({
+            'base_rss': base_rss,
+            'idle_rss': idle_rss,
+            'active_rss': active_rss,
+            'after_rss': after_rss,
+            'pools': pools,
+        })
+
+    @property
+    def bytes_per_conn(self) -> int:
+        r = self.rounds[-1]
+        return int((r['idle_rss'] - r['base_rss']) / max(1, self.connections))
+
+    @property
+    def bytes_per_stream(self) -> int:
+        r = self.rounds[-1]
+        return int((r['active_rss'] - r['idle_rss']) / max(1, self.active * self.streams))
+
+    @property
+    def growth(self) -> float:
+        """Relative growth of the RSS after connections were closed, from
+           the first to the last round."""
+        if len(self.rounds) < 2 or not self.rounds[0]['after_rss']:
+            return 0.0
+        return (self.rounds[-1]['after_rss'] - self.rounds[0]['after_rss']) \
+            / self.rounds[0]['after_rss']
+
+    def get_footnote(self) -> Optional[str]:
+        if self.growth > self.growth_limit:
+            return f"{self.title}: RSS grew {self.growth * 100:.0f}% over " \
+                   f"{len(self.rounds)} rounds"
+        return None
+
+    def to_json(self) -> Dict:
+        return {
+            'connections': self.connections,
+            'active': self.active,
+            'streams': self.streams,
+            'bytes_per_conn': self.bytes_per_conn if self.rounds else None,
+            'bytes_per_stream': self.bytes_per_stream if self.rounds else None,
+            'growth': round(self.growth, 4),
+            'rounds': self.rounds,
+            'duration_s': self.duration.total_seconds(),
+        }
+
+
+class MemorySoakTest(LoadTestCase):
+    """Measures the memory a HTTP/2 connection costs the server. A single
+       child is started, `connections` TLS connections are opened that only
+       exchange the HTTP/2 preface and SETTINGS, then `active` connections
+       run `streams` concurrent, slowly produced responses each. The RSS of
+       the child is read from /proc at each step, all connections are
+       closed again and this is repeated for `rounds`. The RSS remaining
+       after each round shows leaks or memory kept by allocators."""
+
+    PREFACE = b'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n'
+    SETTINGS = b'\x00\x00\x00\x04\x00\x00\x00\x00\x00'
+    SETTINGS_ACK = b'\x00\x00\x00\x04\x01\x00\x00\x00\x00'
+
+    def __init__(self, env: H2TestEnv, connections: int, active: int,
+                 streams: int, rounds: int, measure: str = 'conn'):
+        self.env = env
+        self._connections = connections
+        self._active = active
+        self._streams = streams
+        self._rounds = rounds
+        self._measure = measure
+        self._url_file = f"{self.env.gen_dir}/h2load-soak.txt"
+        self._sampler = StatusSampler(env=env)
+
+    @staticmethod
+    def from_scenario(scenario: Dict, env: H2TestEnv) -> 'MemorySoakTest':
+        return MemorySoakTest(
+            env=env, connections=scenario['connections'], active=scenario['active'],
+            streams=scenario['streams'], rounds=scenario['rounds'],
+            measure=scenario['measure']
+        )
+
+    def next_scenario(self, scenario: Dict) -> 'MemorySoakTest':
+        return MemorySoakTest.from_scenario(scenario, env=self.env)
+
+    def _setup(self):
+        # server and client need a file descriptor per connection
+        soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+        if hard == resource.RLIM_INFINITY or hard > soft:
+            resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+        conf = H2Conf(env=self.env, extras={
+            'base': """
+            LogLevel ssl:warn
+            Protocols h2 http/1.1
+            H2MinWorkers 16
+            H2MaxWorkers 128
+            """,
+            f"test1.{self.env.http_tld}": """
+            <Location /h2test/gen>
+                SetHandler h2test-gen
+            </Location>
+            <Location /h2-status>
+                SetHandler http2-server-status
+            </Location>
+            """,
+        })
+        conf.add("""
+        StartServers             1
+        ServerLimit              1
+        ThreadLimit              256
+        ThreadsPerChild          256
+        MinSpareThreads          1
+        MaxSpareThreads          256
+        MaxRequestWorkers        256
+        AsyncRequestWorkerFactor 200
+        MaxConnectionsPerChild   0
+        ListenBacklog            4096
+        KeepAliveTimeout         600
+        MaxKeepAliveRequests     0
+        Timeout                  600
+        """)
+        conf.add_vhost_test1()
+        conf.install()
+        with open(self._url_file, 'w') as fd:
+            fd.write("/h2test/gen?size=64k&chunk=4k&interval=20000\n")
+        self.start_server(env=self.env)
+
+    def _child_rss(self) -> Tuple[int, Dict]:
+        # let the server settle before reading
+        time.sleep(1)
+        status = self._sampler.fetch()
+        with open(f"/proc/{status['pid']}/status") as fd:
+            for line in fd:
+                m = re.match(r'VmRSS:\s+(\d+)\s+kB', line)
+                if m:
+                    return int(m.group(1)) * 1024, status.get('pools', {})
+        raise LoadTestException(f"no VmRSS for child {status['pid']}")
+
+    def _open_idle(self) -> List[socket.socket]:
+        ctx = ssl.create_default_context(cafile=self.env.ca.cert_file)
+        ctx.set_alpn_protocols(['h2'])
+        conns = []
+        with tqdm(desc="idle connections", total=self._connections,
+                  unit="conn", leave=False) as t:
+            for _ in range(self._connections):
+                sock = socket.create_connection(('127.0.0.1', self.env.https_port))
+                conn = ctx.wrap_socket(sock, server_hostname=f"test1.{self.env.http_tld}")
+                if conn.selected_alpn_protocol() != 'h2':
+                    conn.close()
+                    raise LoadTestException("server did not select h2")
+                conn.sendall(self.PREFACE + self.SETTINGS + self.SETTINGS_ACK)
+                conns.append(conn)
+                t.update()
+        return conns
+
+    def _run_active(self) -> int:
+        """Run the active connections, return the max RSS seen meanwhile."""
+        requests = self._active * self._streams * 4
+        proc = subprocess.Popen([
+            'h2load',
+            f'--clients={self._active}',
+            f'--threads={min(4, self._active)}',
+            f'--requests={requests}',
+            f'--input-file={self._url_file}',
+            f'--connect-to=localhost:{self.env.https_port}',
+            '-m', str(self._streams),
+            f'--base-uri=https://test1.{self.env.http_tld}:{self.env.https_port}/',
+        ], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        max_rss = 0
+        while proc.poll() is None:
+            rss, _ = self._child_rss()
+            max_rss = max(max_rss, rss)
+        if proc.returncode != 0:
+            raise LoadTestException(f"h2load returned {proc.returncode}")
+        return max_rss
+
+    def run(self) -> MemorySoakSummary:
+        self._setup()
+        start = datetime.now()
+        summary = MemorySoakSummary(
+            title=f"{self._connections}c/{self._active}a/{self._streams}s",
+            connections=self._connections, active=self._active,
+            streams=self._streams)
+        for _ in range(self._rounds):
+            base_rss, _ = self._child_rss()
+            conns = self._open_idle()
+            try:
+                idle_rss, _ = self._child_rss()
+                active_rss = self._run_active() if self._active > 0 else idle_rss
+                _, pools = self._child_rss()
+            finally:
+                for conn in conns:
+                    conn.close()
+            after_rss, _ = self._child_rss()
+            summary.add_round(base_rss=base_rss, idle_rss=idle_rss,
+                              active_rss=active_rss, after_rss=after_rss,
+                              pools=pools)
+        summary.duration = datetime.now() - start
+        return summary
+
+    def shutdown(self):
+        pass
+
+    def format_result(self, summary: MemorySoakSummary) -> Tuple[str, Optional[List[str]]]:
+        if self._measure == 'conn':
+            r = f"{summary.bytes_per_conn}"
+        elif self._measure == 'stream':
+            r = f"{summary.bytes_per_stream}"
+        else:
+            raise Exception(f"measure '{self._measure}' not defined")
+        return r, summary.get_footnote()
+
+
 class LoadTest:
 
     @staticmethod
@@ -575,8 +1402,18 @@ class LoadTest:
                             help="which protocols to test, defaults to all")
         parser.add_argument("-v", "--verbose", action='count', default=0,
                             help="log more output on stderr")
+        parser.add_argument("--json", type=str, default=None,
+                            help="write the results as JSON to this file")
+        parser.add_argument("--compare", type=str, nargs=2, default=None,
+                            metavar=('BASELINE', 'RESULTS'),
+                            help="compare two JSON result files and exit, fails on regressions")
+        parser.add_argument("--threshold", type=float, default=10.0,
+                            help="percent increase of a latency percentile counting "
+                                 "as regression in --compare, default 10")
         parser.add_argument("names", nargs='*', help="Name(s) of scenarios to run")
         args = parser.parse_args()
+        if args.compare:
+            sys.exit(cls.compare(args.compare[0], args.compare[1], args.threshold))
 
         if args.verbose > 0:
             console = logging.StreamHandler()
@@ -710,6 +1547,136 @@ class LoadTest:
                     {"file_sizes": [10000], "requests": 5000},
                 ],
             },
+            "gen": {
+                "title": "generated responses, by bucket type and KB size, (MB/s)",
+                "class": GenLoadTest,
+                "location": "/h2test/gen",
+                "file_count": 1,
+                "file_sizes": [10],
+                "requests": 10000,
+                "clients": 1,
+                "warmup": False,
+                "measure": "mb/s",
+                "protocol": 'h2',
+                "max_parallel": 6,
+                "gen_args": "bucket=heap",
+                "row0_title": "bucket",
+                "row_title": "{gen_args}",
+                "rows": [
+                    {"gen_args": "bucket=heap"},
+                    {"gen_args": "bucket=transient"},
+                    {"gen_args": "bucket=file"},
+                    {"gen_args": "bucket=mmap"},
+                    {"gen_args": "bucket=pipe"},
+                ],
+                "col_title": "{file_sizes}",
+                "columns": [
+                    {"file_sizes": [10], "requests": 100000},
+                    {"file_sizes": [100], "requests": 50000},
+                    {"file_sizes": [1000], "requests": 20000},
+                    {"file_sizes": [10000], "requests": 5000},
+                ],
+            },
+            "open-loop": {
+                "title": "open loop, 100 files 1k-100k, {duration}s, {protocol} ({measure} ms)",
+                "class": OpenLoopTest,
+                "location": "/",
+                "file_count": 100,
+                "file_sizes": [1, 2, 5, 10, 20, 50, 100],
+                "duration": 20,
+                "measure": "p99",
+                "protocol": 'h2',
+                "rate": 1000,
+                "connections": 8,
+                "streams": 10,
+                "row0_title": "req/s",
+                "row_title": "{rate}",
+                "rows": [
+                    {"rate": 500},
+                    {"rate": 1000},
+                    {"rate": 2000},
+                    {"rate": 4000},
+                    {"rate": 8000},
+                ],
+                "col_title": "{connections}c/{streams}m",
+                "columns": [
+                    {"connections": 8, "streams": 1},
+                    {"connections": 8, "streams": 10},
+                    {"connections": 32, "streams": 10},
+                    {"connections": 128, "streams": 1},
+                ],
+            },
+            "slow-clients": {
+                "title": "slow readers, {size}KB responses, {max_workers} workers ({measure})",
+                "class": SlowClientTest,
+                "size": 1024,
+                "max_workers": 64,
+                "measure": "busy",
+                "protocol": 'h2',
+                "clients": 4,
+                "streams": 10,
+                "read_rate": "64k",
+                "row0_title": "read/s",
+                "row_title": "{read_rate}",
+                "rows": [
+                    {"read_rate": "1m"},
+                    {"read_rate": "256k"},
+                    {"read_rate": "64k"},
+                ],
+                "col_title": "{clients}c/{streams}s",
+                "columns": [
+                    {"clients": 1, "streams": 10},
+                    {"clients": 4, "streams": 10},
+                    {"clients": 8, "streams": 20},
+                ],
+            },
+            "fanout": {
+                "title": "fan-out, {size}KB paced responses, {max_workers} workers ({measure})",
+                "class": FanoutTest,
+                "size": 64,
+                "interval": 10000,
+                "max_workers": 64,
+                "measure": "busy",
+                "protocol": 'h2',
+                "clients": 1,
+                "streams": 200,
+                "requests": 2000,
+                "row0_title": "streams",
+                "row_title": "{streams}",
+                "rows": [
+                    {"streams": 50},
+                    {"streams": 100},
+                    {"streams": 200},
+                ],
+                "col_title": "{clients}c",
+                "columns": [
+                    {"clients": 1, "requests": 1000},
+                    {"clients": 4, "requests": 4000},
+                    {"clients": 16, "requests": 16000},
+                ],
+            },
+            "memory": {
+                "title": "server memory, bytes per {measure}, {rounds} rounds",
+                "class": MemorySoakTest,
+                "connections": 1000,
+                "active": 10,
+                "streams": 10,
+                "rounds": 3,
+                "measure": "conn",
+                "protocol": 'h2',
+                "row0_title": "measure",
+                "row_title": "{measure}",
+                "rows": [
+                    {"measure": "conn"},
+                    {"measure": "stream"},
+                ],
+                "col_title": "{connections}c/{active}x{streams}",
+                "columns": [
+                    {"connections": 1000, "active": 10, "streams": 1},
+                    {"connections": 10000, "active": 10, "streams": 10},
+                    {"connections": 20000, "active": 10, "streams": 100},
+                ],
+            },
             "bursty": {
                 "title": "1k files, {clients} clients, {requests} request, (req/s)",
                 "class": StressTest,
@@ -788,6 +1755,7 @@ class LoadTest:
         env.setup_httpd(setup=setup)
 
         rv = 0
+        results = {}
         try:
             log.debug("starting tests")
             names = args.names if len(args.names) else sorted(scenarios.keys())
@@ -795,6 +1763,10 @@ class LoadTest:
                 if name not in scenarios:
                     raise LoadTestException(f"unknown test scenario: {name}")
                 scenario = scenarios[name]
+                results[name] = {
+                    'title': scenario['title'].format(**scenario),
+                    'runs': [],
+                }
                 table = [
                     [scenario['title'].format(**scenario)],
                 ]
@@ -806,7 +1778,8 @@ class LoadTest:
                 cls.print_table(table)
                 test = scenario['class'].from_scenario(scenario, env=env)
                 for row in scenario['rows']:
-                    if args.protocol is not None and row['protocol'] != args.protocol:
+                    if args.protocol is not None and \
+                            row.get('protocol', scenario.get('protocol')) != args.protocol:
                         continue
                     row_line = [scenario['row_title'].format(**row)]
                     table.append(row_line)
@@ -818,6 +1791,13 @@ class LoadTest:
                         env.httpd_error_log.clear_log()
                         summary = test.run()
                         result, fnote = test.format_result(summary)
+                        results[name]['runs'].append({
+                            'row': scenario['row_title'].format(**row),
+                            'col': scenario['col_title'].format(**col),
+                            'result': result,
+                            'note': fnote,
+                            'summary': summary.to_json(),
+                        })
                         if fnote:
                             foot_notes.append(fnote)
                         row_line.append("{0}{1}".format(result,
@@ -832,9 +1812,61 @@ class LoadTest:
             sys.stderr.write(f"ERROR: {str(ex)}\n")
             rv = 1
 
+        if args.json:
+            with open(args.json, 'w') as fd:
+                json.dump({
+                    'date': datetime.now().isoformat(),
+                    'scenarios': results,
+                }, fd, indent=2)
         env.apache_stop()
         sys.exit(rv)
 
+    @classmethod
+    def compare(cls, base_file: str, new_file: str, threshold: float) -> int:
+        """Print the latency percentiles of runs present in both files and
+           their change. Returns 1 if any got worse by more than threshold
+           percent or became saturated."""
+        with open(base_file) as fd:
+            base = json.load(fd)['scenarios']
+        with open(new_file) as fd:
+            new = json.load(fd)['scenarios']
+        rv = 0
+        for name in [n for n in new.keys() if n in base]:
+            base_runs = {(r['row'], r['col']): r for r in base[name]['runs']}
+            table = [[new[name]['title']], ['run']]
+            foot_notes = []
+            for run in new[name]['runs']:
+                key = (run['row'], run['col'])
+                if key not in base_runs:
+                    continue
+                b, n = base_runs[key]['summary'], run['summary']
+                row = [f"{key[0]} {key[1]}"]
+                if 'latency_us' in n and 'latency_us' in b:
+                    bp = b['latency_us']['percentiles']
+                    np = n['latency_us']['percentiles']
+                    for p in np.keys():
+                        if p not in bp:
+                            continue
+                        if len(table[1]) <= len(row):
+                            table[1].append(f"p{p} ms")
+                        change = (np[p] - bp[p]) * 100.0 / bp[p] if bp[p] else 0.0
+                        mark = ""
+                        if change > threshold:
+                            mark = "!"
+                            rv = 1
+                        row.append(f"{bp[p]/1000.0:.1f}->{np[p]/1000.0:.1f} "
+                                   f"({change:+.0f}%){mark}")
+                    if n.get('saturated') and not b.get('saturated'):
+                        foot_notes.append(f"{row[0]}: now saturated, {n['saturated']}")
+                        rv = 1
+                else:
+                    if len(table[1]) <= len(row):
+                        table[1].append("result")
+                    row.append(f"{base_runs[key]['result']}->{run['result']}")
+                table.append(row)
+            cls.print_table(table, foot_notes)
+        return rv
+
 
 if __name__ == "__main__":
     LoadTest.main()
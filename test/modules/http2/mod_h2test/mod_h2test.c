@@ -14,10 +14,15 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+
 #include <apr_optional.h>
 #include <apr_optional_hooks.h>
 #include <apr_strings.h>
 #include <apr_cstr.h>
+#include <apr_file_io.h>
+#include <apr_mmap.h>
+#include <apr_thread_proc.h>
 #include <apr_time.h>
 #include <apr_want.h>
 
@@ -44,11 +49,51 @@ AP_DECLARE_MODULE(h2test) = {
 };
 
 
+/* Source of the generator's response data, every response body is this
+ * line repeated, no matter which buckets it was produced with. */
+#define GEN_LINE        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!\n"
+#define GEN_LINE_LEN    64
+#define GEN_DATA_LEN    (64 * 1024)
+#define GEN_FILE_LEN    (1024 * 1024)
+#define GEN_MIN(a,b)    (((a) < (b))? (a) : (b))
+
+static char gen_data[GEN_DATA_LEN];
+static const char *gen_fname;
+
+static apr_status_t gen_setup(apr_pool_t *p)
+{
+    apr_file_t *f;
+    const char *tmpdir;
+    char *fname;
+    apr_status_t rv;
+    int i;
+
+    for (i = 0; i < GEN_DATA_LEN; i += GEN_LINE_LEN) {
+        memcpy(gen_data + i, GEN_LINE, GEN_LINE_LEN);
+    }
+    rv = apr_temp_dir_get(&tmpdir, p);
+    if (APR_SUCCESS != rv) goto cleanup;
+    fname = apr_pstrcat(p, tmpdir, "/h2test-gen.XXXXXX", NULL);
+    rv = apr_file_mktemp(&f, fname, APR_FOPEN_CREATE|APR_FOPEN_READ|APR_FOPEN_WRITE
+                         |APR_FOPEN_EXCL|APR_FOPEN_DELONCLOSE, p);
+    if (APR_SUCCESS != rv) goto cleanup;
+    for (i = 0; i < GEN_FILE_LEN && APR_SUCCESS == rv; i += GEN_DATA_LEN) {
+        rv = apr_file_write_full(f, gen_data, GEN_DATA_LEN, NULL);
+    }
+    if (APR_SUCCESS != rv) goto cleanup;
+    rv = apr_file_flush(f);
+    /* kept open in p, so it gets removed again on restarts */
+    gen_fname = fname;
+cleanup:
+    return rv;
+}
+
 static int h2test_post_config(apr_pool_t *p, apr_pool_t *plog,
                               apr_pool_t *ptemp, server_rec *s)
 {
     void *data = NULL;
     const char *mod_h2_init_key = "mod_h2test_init_counter";
+    apr_status_t rv;
     
     (void)plog;(void)ptemp;
 
@@ -60,7 +105,11 @@ static int h2test_post_config(apr_pool_t *p, apr_pool_t *plog,
         return APR_SUCCESS;
     }
     
-    
+    rv = gen_setup(p);
+    if (APR_SUCCESS != rv) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, "h2test: setup of generator file failed");
+        return !OK;
+    }
     return APR_SUCCESS;
 }
 
@@ -230,6 +279,368 @@ cleanup:
     return AP_FILTER_ERROR;
 }
 
+/*
+ * h2test-gen: produces a response as configured by the query parameters:
+ *   size=N       length of the response body, default 1k
+ *   chunk=N      bytes passed to the output filters at a time, default 8k
+ *   interval=N   microseconds to sleep between chunks
+ *   bucket=T     type of data buckets: heap, transient, file, mmap or pipe
+ *   flush=N      add a FLUSH bucket after every N-th chunk, not with pipe
+ *   trailers=N   number of response trailers to send
+ *   interim=N    number of 103 interim responses before the final one
+ *   burn=N       rounds of cpu work (xorshift) for every chunk
+ *   cl=0|1       announce the content-length, default 1
+ * Sizes accept a k, m or g suffix. With bucket=pipe, a thread writes the
+ * chunks into a pipe which is passed as a single pipe bucket, as CGI
+ * responses are. The body is always GEN_LINE repeated, cut at size.
+ */
+typedef enum {
+    GEN_HEAP,
+    GEN_TRANSIENT,
+    GEN_FILE,
+    GEN_MMAP,
+    GEN_PIPE,
+} gen_bucket_t;
+
+typedef struct {
+    request_rec *r;
+    apr_off_t size;
+    apr_off_t chunk;
+    apr_interval_time_t interval;
+    gen_bucket_t btype;
+    int flush;
+    int trailers;
+    int interim;
+    int burn;
+    int cl;
+
+    apr_file_t *fd;              /* for file and mmap buckets */
+    apr_file_t *pipe_in;         /* for pipe buckets, read end */
+    apr_file_t *pipe_out;        /* for pipe buckets, write end */
+    apr_uint32_t burn_sum;
+} gen_ctx;
+
+static apr_status_t gen_parse_size(const char *s, apr_off_t *pv)
+{
+    char *end;
+    apr_int64_t n;
+
+    errno = 0;
+    n = apr_strtoi64(s, &end, 10);
+    if (errno || end == s || n < 0) return APR_EINVAL;
+    switch (*end) {
+        case 'g': case 'G': n *= 1024; /* fall through */
+        case 'm': case 'M': n *= 1024; /* fall through */
+        case 'k': case 'K': n *= 1024; ++end; break;
+        default: break;
+    }
+    if (*end) return APR_EINVAL;
+    *pv = (apr_off_t)n;
+    return APR_SUCCESS;
+}
+
+static apr_status_t gen_parse_int(const char *s, int *pv)
+{
+    apr_status_t rv = apr_cstr_atoi(pv, s);
+    return (APR_SUCCESS == rv && *pv < 0)? APR_EINVAL : rv;
+}
+
+static apr_status_t gen_parse_args(gen_ctx *ctx, const char *args)
+{
+    request_rec *r = ctx->r;
+    char *s, *pair, *last, *val;
+    apr_off_t n;
+    apr_status_t rv = APR_SUCCESS;
+
+    ctx->size = 1024;
+    ctx->chunk = 8192;
+    ctx->btype = GEN_HEAP;
+    ctx->cl = 1;
+    if (!args) return APR_SUCCESS;
+
+    s = apr_pstrdup(r->pool, args);
+    for (pair = apr_strtok(s, "&", &last); pair && APR_SUCCESS == rv;
+         pair = apr_strtok(NULL, "&", &last)) {
+        val = strchr(pair, '=');
+        if (!val) {
+            rv = APR_EINVAL;
+            break;
+        }
+        *val++ = '\0';
+        if (!strcmp("size", pair)) {
+            rv = gen_parse_size(val, &ctx->size);
+        }
+        else if (!strcmp("chunk", pair)) {
+            rv = gen_parse_size(val, &ctx->chunk);
+            if (APR_SUCCESS == rv && ctx->chunk <= 0) rv = APR_EINVAL;
+        }
+        else if (!strcmp("interval", pair)) {
+            rv = gen_parse_size(val, &n);
+            ctx->interval = (apr_interval_time_t)n;
+        }
+        else if (!strcmp("bucket", pair)) {
+            if (!strcmp("heap", val)) ctx->btype = GEN_HEAP;
+            else if (!strcmp("transient", val)) ctx->btype = GEN_TRANSIENT;
+            else if (!strcmp("file", val)) ctx->btype = GEN_FILE;
+#if APR_HAS_MMAP
+            else if (!strcmp("mmap", val)) ctx->btype = GEN_MMAP;
+#endif
+            else if (!strcmp("pipe", val)) ctx->btype = GEN_PIPE;
+            else rv = APR_EINVAL;
+        }
+        else if (!strcmp("flush", pair)) {
+            rv = gen_parse_int(val, &ctx->flush);
+        }
+        else if (!strcmp("trailers", pair)) {
+            rv = gen_parse_int(val, &ctx->trailers);
+        }
+        else if (!strcmp("interim", pair)) {
+            rv = gen_parse_int(val, &ctx->interim);
+        }
+        else if (!strcmp("burn", pair)) {
+            rv = gen_parse_int(val, &ctx->burn);
+        }
+        else if (!strcmp("cl", pair)) {
+            rv = gen_parse_int(val, &ctx->cl);
+        }
+        else {
+            rv = APR_EINVAL;
+        }
+    }
+    if (APR_SUCCESS == rv && ctx->btype == GEN_PIPE && ctx->flush) {
+        /* the pipe bucket is passed once, there is nothing to flush */
+        rv = APR_EINVAL;
+        pair = NULL;
+    }
+    if (APR_SUCCESS != rv) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r,
+                      "gen_handler: invalid argument '%s'", pair? pair : args);
+    }
+    return rv;
+}
+
+static void gen_burn(gen_ctx *ctx)
+{
+    apr_uint32_t x = ctx->burn_sum | 1;
+    int i;
+
+    for (i = 0; i < ctx->burn; ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    ctx->burn_sum = x;
+}
+
+/* Append len bytes of body data, starting at body offset pos. For pipe
+ * buckets, the data is written to the pipe instead and bb is not used. */
+static apr_status_t gen_append(gen_ctx *ctx, apr_bucket_brigade *bb,
+                               apr_off_t pos, apr_off_t len)
+{
+    apr_bucket_alloc_t *ba = bb? bb->bucket_alloc : NULL;
+    apr_bucket *b;
+    apr_size_t start, n, max;
+#if APR_HAS_MMAP
+    apr_mmap_t *mm;
+#endif
+    apr_status_t rv = APR_SUCCESS;
+
+    max = (ctx->btype == GEN_FILE || ctx->btype == GEN_MMAP)?
+          GEN_FILE_LEN : GEN_DATA_LEN;
+    while (len > 0 && APR_SUCCESS == rv) {
+        start = (apr_size_t)(pos % GEN_LINE_LEN);
+        n = (apr_size_t)GEN_MIN(len, (apr_off_t)(max - start));
+        switch (ctx->btype) {
+            case GEN_TRANSIENT:
+                b = apr_bucket_transient_create(gen_data + start, n, ba);
+                APR_BRIGADE_INSERT_TAIL(bb, b);
+                break;
+            case GEN_FILE:
+                apr_brigade_insert_file(bb, ctx->fd, (apr_off_t)start,
+                                        (apr_off_t)n, ctx->r->pool);
+                break;
+#if APR_HAS_MMAP
+            case GEN_MMAP:
+                /* one mapping per bucket, deleting the bucket unmaps it */
+                rv = apr_mmap_create(&mm, ctx->fd, 0, start + n,
+                                     APR_MMAP_READ, ctx->r->pool);
+                if (APR_SUCCESS != rv) break;
+                b = apr_bucket_mmap_create(mm, (apr_off_t)start, n, ba);
+                APR_BRIGADE_INSERT_TAIL(bb, b);
+                break;
+#endif
+            case GEN_PIPE:
+                rv = apr_file_write_full(ctx->pipe_out, gen_data + start, n, NULL);
+                break;
+            default:
+                b = apr_bucket_heap_create(gen_data + start, n, NULL, ba);
+                APR_BRIGADE_INSERT_TAIL(bb, b);
+                break;
+        }
+        pos += (apr_off_t)n;
+        len -= (apr_off_t)n;
+    }
+    return rv;
+}
+
+static void * APR_THREAD_FUNC gen_pipe_writer(apr_thread_t *thread, void *data)
+{
+    gen_ctx *ctx = data;
+    apr_off_t pos, len;
+    apr_status_t rv = APR_SUCCESS;
+
+    for (pos = 0; pos < ctx->size && APR_SUCCESS == rv; pos += len) {
+        len = GEN_MIN(ctx->chunk, ctx->size - pos);
+        if (ctx->burn) gen_burn(ctx);
+        rv = gen_append(ctx, NULL, pos, len);
+        if (APR_SUCCESS == rv && ctx->interval && pos + len < ctx->size) {
+            apr_sleep(ctx->interval);
+        }
+    }
+    /* EOF for the reading pipe bucket */
+    apr_file_close(ctx->pipe_out);
+    apr_thread_exit(thread, rv);
+    return NULL;
+}
+
+static apr_status_t gen_body(gen_ctx *ctx, apr_bucket_brigade *bb)
+{
+    request_rec *r = ctx->r;
+    apr_bucket_alloc_t *ba = bb->bucket_alloc;
+    apr_thread_t *writer = NULL;
+    apr_status_t rv = APR_SUCCESS, trv;
+    apr_off_t pos, len;
+    int i, chunks = 0;
+
+    if (ctx->btype == GEN_FILE || ctx->btype == GEN_MMAP) {
+        rv = apr_file_open(&ctx->fd, gen_fname, APR_FOPEN_READ|APR_FOPEN_SENDFILE_ENABLED,
+                           APR_FPROT_OS_DEFAULT, r->pool);
+        if (APR_SUCCESS != rv) goto cleanup;
+    }
+    else if (ctx->btype == GEN_PIPE && ctx->size > 0) {
+        rv = apr_file_pipe_create_ex(&ctx->pipe_in, &ctx->pipe_out,
+                                     APR_FULL_BLOCK, r->pool);
+        if (APR_SUCCESS != rv) goto cleanup;
+        rv = apr_thread_create(&writer, NULL, gen_pipe_writer, ctx, r->pool);
+        if (APR_SUCCESS != rv) goto cleanup;
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_pipe_create(ctx->pipe_in, ba));
+    }
+
+    if (ctx->btype != GEN_PIPE) {
+        for (pos = 0; pos < ctx->size; pos += len) {
+            len = GEN_MIN(ctx->chunk, ctx->size - pos);
+            if (ctx->burn) gen_burn(ctx);
+            rv = gen_append(ctx, bb, pos, len);
+            if (APR_SUCCESS != rv) goto cleanup;
+            if (ctx->flush && (++chunks % ctx->flush) == 0) {
+                APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_flush_create(ba));
+            }
+            rv = ap_pass_brigade(r->output_filters, bb);
+            if (APR_SUCCESS != rv) goto cleanup;
+            if (ctx->interval && pos + len < ctx->size) {
+                apr_sleep(ctx->interval);
+            }
+        }
+    }
+
+    for (i = 0; i < ctx->trailers; ++i) {
+        apr_table_setn(r->trailers_out, apr_psprintf(r->pool, "h2test-trailer-%d", i+1),
+                       apr_psprintf(r->pool, "%d", i+1));
+    }
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(ba));
+    rv = ap_pass_brigade(r->output_filters, bb);
+
+cleanup:
+    apr_brigade_cleanup(bb);
+    if (writer) {
+        if (APR_SUCCESS != rv) {
+            /* let the writer fail on a broken pipe */
+            apr_file_close(ctx->pipe_in);
+        }
+        apr_thread_join(&trv, writer);
+        if (APR_SUCCESS == rv) rv = trv;
+    }
+    return rv;
+}
+
+static int h2test_gen_handler(request_rec *r)
+{
+    conn_rec *c = r->connection;
+    apr_bucket_brigade *bb;
+    apr_status_t rv;
+    gen_ctx ctx;
+    char buffer[8192];
+    int i;
+    long l;
+
+    if (strcmp(r->handler, "h2test-gen")) {
+        return DECLINED;
+    }
+    if (r->method_number != M_GET && r->method_number != M_POST) {
+        return DECLINED;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.r = r;
+    if (APR_SUCCESS != gen_parse_args(&ctx, r->args)) {
+        return HTTP_BAD_REQUEST;
+    }
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "gen_handler: processing request, size=%" APR_OFF_T_FMT
+                  ", chunk=%" APR_OFF_T_FMT, ctx.size, ctx.chunk);
+
+    /* discard any request body */
+    if ((rv = ap_setup_client_block(r, REQUEST_CHUNKED_DECHUNK))) return rv;
+    if (ap_should_client_block(r)) {
+        do {
+            l = ap_get_client_block(r, &buffer[0], sizeof(buffer));
+        } while (l > 0);
+        if (l < 0) {
+            return AP_FILTER_ERROR;
+        }
+    }
+
+    for (i = 0; i < ctx.interim; ++i) {
+        r->status = 103;
+        apr_table_setn(r->headers_out, "h2test-interim", apr_itoa(r->pool, i+1));
+        ap_send_interim_response(r, 1);
+    }
+    apr_table_unset(r->headers_out, "h2test-interim");
+
+    r->status = 200;
+    if (ctx.cl) {
+        ap_set_content_length(r, ctx.size);
+    }
+    else {
+        r->clength = -1;
+        r->chunked = 1;
+        apr_table_unset(r->headers_out, "Content-Length");
+    }
+    /* Discourage content-encodings */
+    apr_table_unset(r->headers_out, "Content-Encoding");
+    apr_table_setn(r->subprocess_env, "no-brotli", "1");
+    apr_table_setn(r->subprocess_env, "no-gzip", "1");
+    ap_set_content_type(r, "text/plain");
+
+    bb = apr_brigade_create(r->pool, c->bucket_alloc);
+    if (r->header_only) {
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(c->bucket_alloc));
+        rv = ap_pass_brigade(r->output_filters, bb);
+    }
+    else {
+        rv = gen_body(&ctx, bb);
+    }
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, rv, r,
+                  "gen_handler: request done, burn=%u", (unsigned)ctx.burn_sum);
+
+    if (rv == APR_SUCCESS
+        || r->status != HTTP_OK
+        || c->aborted) {
+        return OK;
+    }
+    return AP_FILTER_ERROR;
+}
+
 /* Install this module into the apache2 infrastructure.
  */
 static void h2test_hooks(apr_pool_t *pool)
@@ -249,5 +660,6 @@ static void h2test_hooks(apr_pool_t *pool)
     /* test h2 handlers */
     ap_hook_handler(h2test_echo_handler, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_handler(h2test_delay_handler, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_handler(h2test_gen_handler, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
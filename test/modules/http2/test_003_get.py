@@ -1,4 +1,6 @@
+import os
 import re
+import time
 import pytest
 
 from .env import H2Conf
@@ -211,3 +213,24 @@ content-type: text/html
         assert 1024 == len(r.response["body"])
         assert "content-length" in h
         assert clen == h["content-length"]
+
+    # stream timings are available to access logs
+    def test_h2_003_60(self, env):
+        logfile = os.path.join(env.server_logs_dir, "test_003_60")
+        if os.path.isfile(logfile):
+            os.remove(logfile)
+        H2Conf(env).add("""
+LogFormat "%r %{H2_T_HEADERS}e %{H2_T_STARTED}e %{H2_T_CLOSED}e %{H2_QUEUE_WAIT}e %{H2_HANDLER_TIME}e" h2timing
+CustomLog logs/test_003_60 h2timing
+        """).add_vhost_test1().install()
+        assert env.apache_restart() == 0
+        url = env.mkurl("https", "test1", "/index.html")
+        r = env.curl_get(url, 5)
+        assert r.response["status"] == 200
+        # the request is logged when its stream has been cleaned up
+        time.sleep(1)
+        lines = open(logfile).readlines()
+        assert len(lines) == 1
+        m = re.match(r'GET /index.html HTTP/2.0 (\d+) (\d+) (\d+) (\d+) (\d+)', lines[0])
+        assert m, f"{lines[0]}"
+        assert int(m.group(1)) <= int(m.group(2)) <= int(m.group(3))
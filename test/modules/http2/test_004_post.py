@@ -5,6 +5,7 @@ import json
 import os
 import re
 import sys
+from urllib.parse import urlparse
 
 import pytest
 
@@ -213,3 +214,42 @@ CustomLog logs/test_004_30 issue_203
             assert src == filepart.get_payload(decode=True)
         
         post_and_verify("data-1k", [])
+
+    # upload through small stream windows that autotuning grows. The
+    # delay handler reads the body and then answers slowly, so the session
+    # updates its status. The status is then read on the same connection.
+    @pytest.mark.parametrize("scheme", ["https", "http"])
+    def test_h2_004_50(self, env, scheme):
+        H2Conf(env, extras={
+            'base': [
+                "H2WindowSize 16384",
+                "H2WindowAutoTune on",
+                "H2WindowMax 1048576",
+                "<Location /h2-status>",
+                "  SetHandler http2-server-status",
+                "</Location>",
+            ]
+        }).add_vhost_cgi().install()
+        assert env.apache_restart() == 0
+        fpath = os.path.join(env.gen_dir, "data-1m")
+        url = env.mkurl(scheme, "cgi", "/h2test/delay?1")
+        status_url = env.mkurl(scheme, "cgi", "/h2-status")
+        proto = "--http2-prior-knowledge" if scheme == "http" else "--http2"
+        host = urlparse(status_url)
+        # options are reset by --next, give them again for the status
+        next_opts = [proto, "--resolve",
+                     f"{host.hostname}:{host.port}:{env.http_addr}"]
+        if scheme == "https":
+            next_opts.extend(["--cacert", env.get_ca_pem_file(host.hostname)])
+        r = env.curl_raw([status_url], timeout=10, options=[
+            proto, "--data-binary", f"@{fpath}", "-o", "/dev/null", url,
+            "--next", *next_opts
+        ])
+        assert r.exit_code == 0, f"{r}"
+        assert r.response["status"] == 200
+        sessions = [s for s in r.json["sessions"]
+                    if s["data_in"] >= os.path.getsize(fpath)]
+        assert len(sessions) == 1, f"{r.json}"
+        if not sessions[0]["win_autotune"]:
+            pytest.skip("nghttp2 has no nghttp2_session_get_stream_local_window_size")
+        assert sessions[0]["win_grows"] > 0, f"{sessions[0]}"
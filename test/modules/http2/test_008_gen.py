@@ -0,0 +1,70 @@
+import pytest
+
+from .env import H2Conf
+
+
+GEN_LINE = b"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!\n"
+
+
+def gen_body(size: int) -> bytes:
+    n = int(size / len(GEN_LINE)) + 1
+    return (GEN_LINE * n)[0:size]
+
+
+# responses produced by the mod_h2test "h2test-gen" handler
+class TestGenerator:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        H2Conf(env).add_vhost_cgi().install()
+        assert env.apache_restart() == 0
+
+    # body length and content for all bucket types, with and without chunking
+    @pytest.mark.parametrize("bucket", ["heap", "transient", "file", "mmap", "pipe"])
+    @pytest.mark.parametrize("size", [0, 1, 1000, 65536, 300000])
+    def test_h2_008_01(self, env, bucket, size):
+        url = env.mkurl("https", "cgi", f"/h2test/gen?size={size}&bucket={bucket}&chunk=7000")
+        r = env.curl_get(url, 5)
+        assert r.exit_code == 0, f"{r}"
+        assert r.response["status"] == 200
+        assert r.response["body"] == gen_body(size)
+
+    # sizes with suffix, no content-length, flushes and cpu burn
+    def test_h2_008_02(self, env):
+        url = env.mkurl("https", "cgi", "/h2test/gen?size=1m&chunk=1k&flush=4&burn=100&cl=0")
+        r = env.curl_get(url, 5)
+        assert r.response["status"] == 200
+        assert "content-length" not in r.response["header"]
+        assert r.response["body"] == gen_body(1024*1024)
+
+    # invalid arguments are refused
+    @pytest.mark.parametrize("args", [
+        "size=-1", "size=1x", "chunk=0", "bucket=none", "flush=abc", "unknown=1", "size",
+        "bucket=pipe&flush=1"
+    ])
+    def test_h2_008_03(self, env, args):
+        url = env.mkurl("https", "cgi", f"/h2test/gen?{args}")
+        r = env.curl_get(url, 5)
+        assert r.response["status"] == 400
+
+    # trailers, only nghttp shows them to us
+    def test_h2_008_04(self, env):
+        url = env.mkurl("https", "cgi", "/h2test/gen?size=10k&trailers=3")
+        r = env.nghttp().get(url)
+        assert r.response["status"] == 200
+        assert len(r.response["body"]) == 10*1024
+        assert "trailer" in r.response
+        for i in range(1, 4):
+            assert r.response["trailer"][f"h2test-trailer-{i}"] == f"{i}"
+
+    # interim responses before the final one
+    def test_h2_008_05(self, env):
+        url = env.mkurl("https", "cgi", "/h2test/gen?size=100&interim=2")
+        r = env.nghttp().get(url)
+        assert r.response["status"] == 200
+        assert "previous" in r.response
+        prev = r.response["previous"]
+        assert prev["header"][":status"] == "103"
+        assert prev["header"]["h2test-interim"] == "2"
+        assert prev["previous"]["header"]["h2test-interim"] == "1"
+        assert "h2test-interim" not in r.response["header"]
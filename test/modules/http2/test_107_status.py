@@ -0,0 +1,58 @@
+import pytest
+
+from .env import H2Conf
+
+
+class TestStatus:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        H2Conf(env).start_vhost(domains=[f"status.{env.http_tld}"],
+                                port=env.https_port, doc_root="htdocs/test1"
+        ).add("""
+        <Location /server-status>
+            SetHandler server-status
+        </Location>
+        <Location /h2-status>
+            SetHandler http2-server-status
+        </Location>
+        <Location /h2-vhost-stats>
+            SetHandler http2-vhost-stats
+        </Location>
+        """).end_vhost(
+        ).install()
+        assert env.apache_restart() == 0
+
+    # the machine readable server-status carries the HTTP/2 section
+    def test_h2_107_01(self, env):
+        url = env.mkurl("https", "status", "/server-status?auto")
+        r = env.curl_get(url, 5)
+        assert r.response["status"] == 200
+        assert "H2Workers: " in r.stdout
+        assert "H2Sessions: " in r.stdout
+
+    # the JSON handler lists at least the session asking for it
+    def test_h2_107_02(self, env):
+        url = env.mkurl("https", "status", "/h2-status")
+        r = env.curl_get(url, 5)
+        assert r.response["status"] == 200
+        assert r.response["json"]["workers"]["max"] > 0
+        assert r.response["json"]["beams"]["blocked_full"] >= 0
+        assert r.response["json"]["pools"]["mplx"] >= 1
+        sessions = r.response["json"]["sessions"]
+        assert len(sessions) >= 1
+
+    # vhost statistics count closed streams, reset on read when asked
+    def test_h2_107_03(self, env):
+        url = env.mkurl("https", "status", "/index.html")
+        r = env.curl_get(url, 5)
+        assert r.response["status"] == 200
+        url = env.mkurl("https", "status", "/h2-vhost-stats?reset")
+        r = env.curl_get(url, 5)
+        assert r.response["status"] == 200
+        vhosts = [v for v in r.response["json"]["vhosts"]
+                  if v["name"] == f"status.{env.http_tld}"]
+        assert len(vhosts) == 1
+        assert vhosts[0]["streams"] >= 1
+        assert vhosts[0]["duration_us"]["count"] >= 1
+        assert vhosts[0]["response_bytes"]["p50"] > 0
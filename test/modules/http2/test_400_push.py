@@ -197,3 +197,37 @@ class TestPush:
         assert r.response["status"] == 200
         promises = r.results["streams"][r.response["id"]]["promises"]
         assert 1 == len(promises)
+
+    ############################
+    # Link: headers parsed once are cached per child, results must not change
+
+    # same response twice, the second one uses the cached links
+    @pytest.mark.parametrize("path, pushed", [
+        ["/006-push.html", '/006/006.css'],
+        ["/006-push2.html", '/006/006.js'],
+    ])
+    def test_h2_400_60(self, env, path, pushed):
+        url = env.mkurl("https", "push", path)
+        paths = []
+        for i in range(2):
+            r = env.nghttp().get(url)
+            assert r.response["status"] == 200
+            promises = r.results["streams"][r.response["id"]]["promises"]
+            assert 1 == len(promises)
+            paths.append(promises[0]["request"]["header"][":path"])
+        assert [pushed, pushed] == paths
+
+    # the push policy of a request is not taken from the cache
+    def test_h2_400_61(self, env):
+        url = env.mkurl("https", "push", "/006-push.html")
+        r = env.nghttp().get(url, options=['-H', 'accept-push-policy: default'])
+        assert r.response["status"] == 200
+        promises = r.results["streams"][r.response["id"]]["promises"]
+        assert 1 == len(promises)
+        assert 0 < len(promises[0]["response"]["body"])
+        r = env.nghttp().get(url, options=['-H', 'accept-push-policy: head'])
+        assert r.response["status"] == 200
+        promises = r.results["streams"][r.response["id"]]["promises"]
+        assert 1 == len(promises)
+        assert '/006/006.css' == promises[0]["request"]["header"][":path"]
+        assert 0 == len(promises[0]["response"]["body"])
@@ -0,0 +1,68 @@
+import pytest
+
+from .env import H2Conf
+
+
+# The tests depend on "nghttp"
+class TestPreloadLearning:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        # learned preloads are kept per child, use only one
+        H2Conf(env, extras={
+            'base': [
+                "ServerLimit 1",
+                "StartServers 1",
+            ]
+        }).start_vhost(domains=[f"learn.{env.http_tld}"],
+                       port=env.https_port, doc_root="htdocs/test1"
+        ).add("""
+        RewriteEngine on
+        RewriteRule ^/006-(.*)?\\.html$ /006.html
+        H2EarlyHints on
+        H2PreloadLearning on
+        H2PreloadLearningMax 1
+        """).end_vhost(
+        ).install()
+        assert env.apache_restart() == 0
+
+    # nothing learned, no 103 response
+    def test_h2_402_01(self, env):
+        url = env.mkurl("https", "learn", "/006.html")
+        r = env.nghttp().get(url)
+        assert r.response["status"] == 200
+        assert "previous" not in r.response
+
+    # load the document with its assets a few times, then expect the
+    # learned preload to be announced. nghttp sends the header on all
+    # requests, the document is recognized by its content type.
+    def test_h2_402_02(self, env):
+        url = env.mkurl("https", "learn", "/006.html")
+        for i in range(3):
+            r = env.nghttp().assets(url, options=["-H", "sec-fetch-dest: script"])
+            assert 0 == r.exit_code
+            assert 3 == len(r.assets), f"{r.assets}"
+        r = env.nghttp().get(url)
+        assert r.response["status"] == 200
+        early = r.response["previous"]
+        assert early
+        assert 103 == int(early["header"][":status"])
+        link = early["header"]["link"]
+        assert link.startswith("</006/006.")
+        assert "rel=preload" in link
+        assert "as=script" in link
+        assert "nopush" in link
+        promises = r.results["streams"][r.response["id"]]["promises"]
+        assert 0 == len(promises)
+
+    # assets requested without a known 'sec-fetch-dest', as API calls are,
+    # are not learned
+    def test_h2_402_03(self, env):
+        url = env.mkurl("https", "learn", "/006-noas.html")
+        for i in range(3):
+            r = env.nghttp().assets(url)
+            assert 0 == r.exit_code
+            assert 3 == len(r.assets), f"{r.assets}"
+        r = env.nghttp().get(url)
+        assert r.response["status"] == 200
+        assert "previous" not in r.response
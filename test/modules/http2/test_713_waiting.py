@@ -0,0 +1,155 @@
+import pytest
+
+from .env import H2Conf
+
+
+class TestWaitSuspend:
+
+    # with 'H2WaitSuspend on' and the event MPM, sessions waiting for their
+    # streams are suspended and resumed by the MPM. Results must not change.
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        conf = H2Conf(env, extras={
+            'base': [
+                "H2WaitSuspend on",
+                "Timeout 10",
+            ]
+        })
+        conf.add_vhost_cgi().add_vhost_test1()
+        conf.install()
+        assert env.apache_restart() == 0
+
+    def check_h2load_ok(self, env, r, n):
+        assert 0 == r.exit_code
+        r = env.h2load_status(r)
+        assert n == r.results["h2load"]["requests"]["done"]
+        assert n == r.results["h2load"]["requests"]["succeeded"]
+        assert n == r.results["h2load"]["status"]["2xx"]
+
+    # concurrent streams that pause between their response chunks,
+    # the session waits (and suspends) several times per stream
+    @pytest.mark.parametrize("scheme", ["https", "http"])
+    def test_h2_713_01(self, env, scheme):
+        n = 20
+        args = [env.h2load, "-n", f"{n}", "-c", "1", "-m", "10",
+                env.mkurl(scheme, "cgi", "/h2test/delay?1")]
+        r = env.run(args)
+        self.check_h2load_ok(env, r, n)
+
+    # the same, spread over several connections
+    def test_h2_713_02(self, env):
+        n = 64
+        args = [env.h2load, "-n", f"{n}", "-c", "8", "-m", "8",
+                env.mkurl("https", "cgi", "/h2test/delay?1")]
+        r = env.run(args)
+        self.check_h2load_ok(env, r, n)
+
+    # responses are complete when several are requested on one connection
+    def test_h2_713_03(self, env):
+        url = env.mkurl("https", "cgi", "/h2test/delay?1")
+        r = env.curl_get(url, 5, options=[url, url])
+        assert r.exit_code == 0, f"{r}"
+        assert len(r.outraw) == 3 * 3 * 8192
+
+    # an upload where the handler waits for the body
+    def test_h2_713_04(self, env):
+        fpath = env.gen_dir + "/data-100k"
+        url = env.mkurl("https", "cgi", "/h2test/echo")
+        r = env.curl_raw([url], options=[
+            "--data-binary", f"@{fpath}", "--limit-rate", "40k"
+        ])
+        assert r.exit_code == 0, f"{r}"
+        assert r.response["status"] == 200
+        with open(fpath, 'rb') as fd:
+            assert r.outraw == fd.read()
+
+
+class TestSharedPoll:
+
+    # with 'H2SharedPoll', waiting sessions are watched by the poller
+    # threads of the child and woken by their streams.
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        conf = H2Conf(env, extras={
+            'base': [
+                "H2SharedPoll 2",
+                "Timeout 10",
+            ]
+        })
+        conf.add_vhost_cgi().add_vhost_test1()
+        conf.install()
+        assert env.apache_restart() == 0
+
+    def check_h2load_ok(self, env, r, n):
+        assert 0 == r.exit_code
+        r = env.h2load_status(r)
+        assert n == r.results["h2load"]["requests"]["done"]
+        assert n == r.results["h2load"]["requests"]["succeeded"]
+        assert n == r.results["h2load"]["status"]["2xx"]
+
+    # streams pausing between response chunks, on h2 and h2c
+    @pytest.mark.parametrize("scheme", ["https", "http"])
+    def test_h2_713_10(self, env, scheme):
+        n = 20
+        args = [env.h2load, "-n", f"{n}", "-c", "1", "-m", "10",
+                env.mkurl(scheme, "cgi", "/h2test/delay?1")]
+        r = env.run(args)
+        self.check_h2load_ok(env, r, n)
+
+    # many connections, more than one per poller thread
+    def test_h2_713_11(self, env):
+        n = 128
+        args = [env.h2load, "-n", f"{n}", "-c", "16", "-m", "8",
+                env.mkurl("https", "cgi", "/h2test/delay?1")]
+        r = env.run(args)
+        self.check_h2load_ok(env, r, n)
+
+    # many short requests, sessions mostly poll without waiting
+    def test_h2_713_12(self, env):
+        n = 1000
+        args = [env.h2load, "-n", f"{n}", "-c", "4", "-m", "20",
+                env.mkurl("https", "test1", "/index.html")]
+        r = env.run(args)
+        self.check_h2load_ok(env, r, n)
+
+    # an upload, the session is woken when the handler consumed input
+    def test_h2_713_13(self, env):
+        fpath = env.gen_dir + "/data-1m"
+        url = env.mkurl("https", "cgi", "/h2test/echo")
+        r = env.curl_raw([url], options=["--data-binary", f"@{fpath}"])
+        assert r.exit_code == 0, f"{r}"
+        assert r.response["status"] == 200
+        with open(fpath, 'rb') as fd:
+            assert r.outraw == fd.read()
+
+
+class TestWaitSuspendQueued:
+
+    # with a single worker, streams wait in the queue while the session
+    # waits. A stream started later must still wake the session.
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        conf = H2Conf(env, extras={
+            'base': [
+                "H2WaitSuspend on",
+                "H2MinWorkers 1",
+                "H2MaxWorkers 1",
+                "Timeout 5",
+            ]
+        })
+        conf.add_vhost_cgi()
+        conf.install()
+        assert env.apache_restart() == 0
+
+    # 3 streams taking 3 seconds each, run one after the other
+    @pytest.mark.parametrize("scheme", ["https", "http"])
+    def test_h2_713_20(self, env, scheme):
+        n = 3
+        args = [env.h2load, "-n", f"{n}", "-c", "1", "-m", f"{n}",
+                env.mkurl(scheme, "cgi", "/h2test/delay?1")]
+        r = env.run(args)
+        assert 0 == r.exit_code
+        r = env.h2load_status(r)
+        assert n == r.results["h2load"]["requests"]["done"]
+        assert n == r.results["h2load"]["requests"]["succeeded"]
+        assert n == r.results["h2load"]["status"]["2xx"]
@@ -143,6 +143,9 @@ class HttpdConf(object):
         self.add("<Location \"/h2test/delay\">")
         self.add("    SetHandler h2test-delay")
         self.add("</Location>")
+        self.add("<Location \"/h2test/gen\">")
+        self.add("    SetHandler h2test-gen")
+        self.add("</Location>")
         if domain in self._extras:
             self.add(self._extras[domain])
         self.end_vhost()
@@ -0,0 +1,576 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Throughput and latency benchmark of h2_bucket_beam. A sender thread
+ * passes buckets with h2_beam_send() to a receiver thread calling
+ * h2_beam_receive(), the way a c2 worker hands response data to c1.
+ *
+ * Per run it reports:
+ * - gb_per_s: payload bytes received per second
+ * - wakeups_per_mb: how often the receiver (rx) or the sender (tx) had to
+ *   wait on the beam, i.e. was woken up by the other side, per MB
+ * - spins_per_mb: APR_EAGAIN returns per MB in non-blocking mode
+ * - was_empty_per_mb: was_empty notifications per MB, which mod_http2
+ *   turns into writes on the c1 notification pipe
+ * - lat_*_us: time from handing a bucket to h2_beam_send() until the
+ *   receiver has all of its data
+ *
+ * Without arguments, a matrix of bucket types, sizes, buffer sizes and
+ * modes is run. Options select a single run instead:
+ *   -t heap|transient|file|mmap|metadata   bucket type
+ *   -s bytes      bucket size
+ *   -b bytes      max_buf_size of the beam, 0 for unlimited
+ *   -r bytes      readbytes for each h2_beam_receive(), 0 for unlimited
+ *   -m block|nonblock
+ *   -M mbytes     amount of data to transfer
+ *
+ * Output is one JSON object per line on stdout. Run via 'make bench'.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <apr.h>
+#include <apr_general.h>
+#include <apr_getopt.h>
+#include <apr_buckets.h>
+#include <apr_file_io.h>
+#include <apr_mmap.h>
+#include <apr_strings.h>
+#include <apr_thread_proc.h>
+#include <apr_time.h>
+
+#include <httpd.h>
+#include <http_config.h>
+#include <http_log.h>
+
+#include "h2.h"
+#include "h2_conn_ctx.h"
+#include "h2_bucket_beam.h"
+
+#define BENCH_DEF_MBYTES    256
+#define BENCH_FILE_SIZE     (4 * 1024 * 1024)
+
+typedef enum {
+    BT_HEAP,
+    BT_TRANSIENT,
+    BT_FILE,
+    BT_MMAP,
+    BT_METADATA,
+} beam_btype;
+
+static const char *btype_names[] = {
+    "heap", "transient", "file", "mmap", "metadata",
+};
+
+typedef struct {
+    beam_btype btype;
+    apr_size_t bsize;         /* bytes per bucket */
+    apr_size_t max_buf;       /* beam buffer size */
+    apr_off_t readbytes;      /* max bytes per receive, 0 for unlimited */
+    int block;                /* blocking send/receive */
+    int mbytes;               /* data to transfer */
+} beam_params;
+
+typedef struct {
+    beam_params prm;
+    int nitems;               /* number of buckets to send */
+    apr_uint64_t *sent_ns;    /* when item i was handed to the beam */
+    apr_uint64_t *lat_ns;     /* latency of item i */
+
+    h2_bucket_beam *beam;
+    conn_rec c_from;
+    conn_rec c_to;
+    void *from_config[1];
+    h2_conn_ctx_t from_ctx;
+    server_rec s;
+
+    char *data;               /* source for heap/transient buckets */
+    const char *fname;        /* source for file/mmap buckets */
+    apr_file_t *file;         /* opened for this run only */
+    apr_pool_t *tx_pool;      /* sender thread only, owns the beam */
+    apr_pool_t *rx_pool;      /* receiver thread only */
+
+    apr_size_t tx_waits;
+    apr_size_t tx_spins;
+    apr_size_t rx_waits;
+    apr_size_t rx_spins;
+    apr_size_t was_empty;
+    apr_uint64_t start_ns;
+    apr_uint64_t end_ns;
+    apr_status_t tx_rv;
+    apr_status_t rx_rv;
+} beam_bench;
+
+static apr_uint64_t bench_now_ns(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (apr_uint64_t)ts.tv_sec * 1000000000 + (apr_uint64_t)ts.tv_nsec;
+#else
+    return (apr_uint64_t)apr_time_now() * 1000;
+#endif
+}
+
+static apr_pool_t *own_pool(void)
+{
+    apr_allocator_t *allocator;
+    apr_pool_t *pool;
+
+    /* sender and receiver must not share an allocator */
+    apr_allocator_create(&allocator);
+    apr_pool_create_ex(&pool, NULL, NULL, allocator);
+    apr_allocator_owner_set(allocator, pool);
+    return pool;
+}
+
+static void on_was_empty(void *ctx, h2_bucket_beam *beam)
+{
+    (void)beam;
+    ++((beam_bench*)ctx)->was_empty;
+}
+
+static apr_bucket *make_bucket(beam_bench *bb, int i, apr_bucket_alloc_t *ba)
+{
+    apr_size_t size = bb->prm.bsize;
+    apr_off_t offset = (apr_off_t)(((apr_size_t)i * size) % (BENCH_FILE_SIZE - size + 1));
+#if APR_HAS_MMAP
+    apr_mmap_t *mm;
+#endif
+
+    switch (bb->prm.btype) {
+        case BT_HEAP:
+            return apr_bucket_heap_create(bb->data + offset, size, NULL, ba);
+        case BT_TRANSIENT:
+            return apr_bucket_transient_create(bb->data + offset, size, ba);
+        case BT_FILE:
+            return apr_bucket_file_create(bb->file, offset, size, bb->tx_pool, ba);
+#if APR_HAS_MMAP
+        case BT_MMAP:
+            /* one mapping per bucket, as a file bucket read would do.
+             * Deleting the bucket unmaps it. */
+            if (apr_mmap_create(&mm, bb->file, 0, size, APR_MMAP_READ,
+                                bb->tx_pool) != APR_SUCCESS) {
+                return NULL;
+            }
+            return apr_bucket_mmap_create(mm, 0, size, ba);
+#endif
+        default:
+            return apr_bucket_flush_create(ba);
+    }
+}
+
+static apr_status_t send_brigade(beam_bench *bb, apr_bucket_brigade *tx)
+{
+    apr_status_t rv;
+    apr_off_t written;
+
+    while (1) {
+        /* try without blocking first, so we know when we had to wait */
+        rv = h2_beam_send(bb->beam, &bb->c_from, tx, APR_NONBLOCK_READ, &written);
+        if (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(tx)) {
+            return APR_SUCCESS;
+        }
+        if (rv != APR_SUCCESS && !APR_STATUS_IS_EAGAIN(rv)) {
+            return rv;
+        }
+        if (bb->prm.block) {
+            ++bb->tx_waits;
+            rv = h2_beam_send(bb->beam, &bb->c_from, tx, APR_BLOCK_READ, &written);
+            if (rv != APR_SUCCESS || APR_BRIGADE_EMPTY(tx)) {
+                return rv;
+            }
+        }
+        else {
+            ++bb->tx_spins;
+            apr_thread_yield();
+        }
+    }
+}
+
+static void * APR_THREAD_FUNC sender_run(apr_thread_t *thread, void *arg)
+{
+    beam_bench *bb = arg;
+    apr_bucket_alloc_t *ba;
+    apr_bucket_brigade *tx;
+    apr_bucket *b;
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    ba = apr_bucket_alloc_create(bb->tx_pool);
+    tx = apr_brigade_create(bb->tx_pool, ba);
+    for (i = 0; i < bb->nitems && rv == APR_SUCCESS; ++i) {
+        b = make_bucket(bb, i, ba);
+        if (!b) {
+            rv = APR_ENOMEM;
+            break;
+        }
+        APR_BRIGADE_INSERT_TAIL(tx, b);
+        bb->sent_ns[i] = bench_now_ns();
+        rv = send_brigade(bb, tx);
+    }
+    if (rv == APR_SUCCESS) {
+        APR_BRIGADE_INSERT_TAIL(tx, apr_bucket_eos_create(ba));
+        rv = send_brigade(bb, tx);
+    }
+    if (rv != APR_SUCCESS) h2_beam_abort(bb->beam, &bb->c_from);
+    bb->tx_rv = rv;
+    apr_thread_exit(thread, rv);
+    return NULL;
+}
+
+static void rx_cleanup(apr_bucket_brigade *rx)
+{
+    apr_bucket *b;
+#if APR_HAS_MMAP
+    apr_bucket_mmap *m;
+#endif
+
+    while (!APR_BRIGADE_EMPTY(rx)) {
+        b = APR_BRIGADE_FIRST(rx);
+#if APR_HAS_MMAP
+        if (APR_BUCKET_IS_MMAP(b)) {
+            /* The beam gave us an apr_mmap_dup() of the sender's mapping,
+             * which the sender unmaps when it purges its bucket. Do not
+             * unmap it a second time when the last of our buckets on it
+             * goes, the sender may already have a new mapping there. */
+            m = b->data;
+            if (m->refcount.refcount == 1) {
+                m->mmap->mm = (void*)-1;
+            }
+        }
+#endif
+        apr_bucket_delete(b);
+    }
+}
+
+static void * APR_THREAD_FUNC receiver_run(apr_thread_t *thread, void *arg)
+{
+    beam_bench *bb = arg;
+    apr_bucket_alloc_t *ba;
+    apr_bucket_brigade *rx;
+    apr_bucket *b;
+    apr_status_t rv = APR_SUCCESS;
+    apr_uint64_t now;
+    apr_off_t received = 0;
+    const char *data;
+    apr_size_t len;
+    int item = 0, eos = 0;
+
+    ba = apr_bucket_alloc_create(bb->rx_pool);
+    rx = apr_brigade_create(bb->rx_pool, ba);
+    while (!eos) {
+        rv = h2_beam_receive(bb->beam, &bb->c_to, rx, APR_NONBLOCK_READ,
+                             bb->prm.readbytes);
+        if (APR_STATUS_IS_EAGAIN(rv)) {
+            if (bb->prm.block) {
+                ++bb->rx_waits;
+                rv = h2_beam_receive(bb->beam, &bb->c_to, rx, APR_BLOCK_READ,
+                                     bb->prm.readbytes);
+            }
+            else {
+                ++bb->rx_spins;
+                apr_thread_yield();
+                continue;
+            }
+        }
+        if (rv != APR_SUCCESS) break;
+
+        now = bench_now_ns();
+        for (b = APR_BRIGADE_FIRST(rx);
+             b != APR_BRIGADE_SENTINEL(rx);
+             b = APR_BUCKET_NEXT(b)) {
+            if (APR_BUCKET_IS_EOS(b)) {
+                eos = 1;
+                break;
+            }
+            else if (APR_BUCKET_IS_FLUSH(b)) {
+                if (item < bb->nitems) {
+                    bb->lat_ns[item] = now - bb->sent_ns[item];
+                    ++item;
+                }
+            }
+            else if (b->length > 0) {
+                /* touch the data, as c1 would when writing it out */
+                rv = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+                if (rv != APR_SUCCESS) goto leave;
+                received += (apr_off_t)len;
+                while (item < bb->nitems
+                       && received >= (apr_off_t)((item + 1) * bb->prm.bsize)) {
+                    bb->lat_ns[item] = now - bb->sent_ns[item];
+                    ++item;
+                }
+            }
+        }
+        rx_cleanup(rx);
+    }
+    bb->end_ns = bench_now_ns();
+
+leave:
+    if (rv != APR_SUCCESS) h2_beam_abort(bb->beam, &bb->c_to);
+    bb->rx_rv = rv;
+    apr_thread_exit(thread, rv);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    apr_uint64_t u1 = *(const apr_uint64_t*)a, u2 = *(const apr_uint64_t*)b;
+    return (u1 < u2)? -1 : ((u1 > u2)? 1 : 0);
+}
+
+static double percentile_us(apr_uint64_t *sorted, int n, double p)
+{
+    int i = (int)(p * (double)(n - 1));
+    return n? (double)sorted[i] / 1000.0 : 0.0;
+}
+
+static apr_status_t setup_sources(beam_bench *bb, apr_pool_t *p)
+{
+    apr_status_t rv;
+    apr_size_t i, len;
+    char *fname;
+    apr_file_t *f;
+
+    bb->data = apr_palloc(p, BENCH_FILE_SIZE);
+    for (i = 0; i < BENCH_FILE_SIZE; ++i) {
+        bb->data[i] = (char)('a' + (i % 26));
+    }
+    fname = apr_pstrdup(p, "/tmp/h2_bench_beam.XXXXXX");
+    /* kept open until the end, so it gets removed then */
+    rv = apr_file_mktemp(&f, fname, APR_FOPEN_CREATE|APR_FOPEN_READ
+                         |APR_FOPEN_WRITE|APR_FOPEN_EXCL|APR_FOPEN_DELONCLOSE, p);
+    if (rv != APR_SUCCESS) return rv;
+    len = BENCH_FILE_SIZE;
+    rv = apr_file_write_full(f, bb->data, len, NULL);
+    if (rv != APR_SUCCESS) return rv;
+    bb->fname = fname;
+    return apr_file_flush(f);
+}
+
+static void bench_beam(beam_bench *src, const beam_params *prm, apr_pool_t *p)
+{
+    beam_bench *bb;
+    apr_thread_t *tx_thread, *rx_thread;
+    apr_status_t rv;
+    apr_uint64_t *sorted;
+    double secs, mb;
+
+#if !APR_HAS_MMAP
+    if (prm->btype == BT_MMAP) return;
+#endif
+    bb = apr_pcalloc(p, sizeof(*bb));
+    bb->prm = *prm;
+    bb->data = src->data;
+    bb->fname = src->fname;
+    bb->nitems = (int)(((apr_uint64_t)prm->mbytes * 1024 * 1024) / prm->bsize);
+    bb->sent_ns = apr_pcalloc(p, sizeof(apr_uint64_t) * (apr_size_t)bb->nitems);
+    bb->lat_ns = apr_pcalloc(p, sizeof(apr_uint64_t) * (apr_size_t)bb->nitems);
+
+    bb->s.log.level = APLOG_WARNING;
+    bb->from_ctx.id = "bench";
+    bb->from_config[0] = &bb->from_ctx;
+    bb->c_from.conn_config = (struct ap_conf_vector_t*)bb->from_config;
+    bb->c_from.base_server = &bb->s;
+    bb->c_to.base_server = &bb->s;
+
+    bb->tx_pool = own_pool();
+    bb->rx_pool = own_pool();
+    if (prm->btype == BT_FILE || prm->btype == BT_MMAP) {
+        /* The receiver sets the file aside into its own pool, which
+         * closes it when destroyed. Use a handle for this run only. */
+        rv = apr_file_open(&bb->file, bb->fname, APR_FOPEN_READ,
+                           APR_FPROT_OS_DEFAULT, bb->tx_pool);
+        if (rv != APR_SUCCESS) goto leave;
+    }
+    rv = h2_beam_create(&bb->beam, &bb->c_from, bb->tx_pool, 1, "bench",
+                        prm->max_buf, 0);
+    if (rv != APR_SUCCESS) goto leave;
+    h2_beam_on_was_empty(bb->beam, on_was_empty, bb);
+
+    bb->start_ns = bench_now_ns();
+    apr_thread_create(&rx_thread, NULL, receiver_run, bb, p);
+    apr_thread_create(&tx_thread, NULL, sender_run, bb, p);
+    apr_thread_join(&rv, tx_thread);
+    apr_thread_join(&rv, rx_thread);
+    if (bb->tx_rv != APR_SUCCESS || bb->rx_rv != APR_SUCCESS) {
+        rv = (bb->tx_rv != APR_SUCCESS)? bb->tx_rv : bb->rx_rv;
+        goto leave;
+    }
+
+    secs = (double)(bb->end_ns - bb->start_ns) / 1e9;
+    mb = (double)bb->nitems * (double)prm->bsize / (1024.0 * 1024.0);
+    sorted = bb->lat_ns;
+    qsort(sorted, (apr_size_t)bb->nitems, sizeof(apr_uint64_t), cmp_u64);
+    printf("{\"bench\": \"beam\", \"type\": \"%s\", \"size\": %" APR_SIZE_T_FMT
+           ", \"max_buf\": %" APR_SIZE_T_FMT ", \"readbytes\": %" APR_OFF_T_FMT
+           ", \"mode\": \"%s\", \"items\": %d, \"secs\": %.3f"
+           ", \"gb_per_s\": %.3f, \"items_per_s\": %.0f"
+           ", \"wakeups_per_mb\": {\"rx\": %.2f, \"tx\": %.2f}"
+           ", \"spins_per_mb\": %.2f, \"was_empty_per_mb\": %.2f"
+           ", \"lat_p50_us\": %.1f, \"lat_p99_us\": %.1f, \"lat_max_us\": %.1f}\n",
+           btype_names[prm->btype], prm->bsize, prm->max_buf, prm->readbytes,
+           prm->block? "block" : "nonblock", bb->nitems, secs,
+           (prm->btype == BT_METADATA)? 0.0 : mb / 1024.0 / secs,
+           (double)bb->nitems / secs,
+           (double)bb->rx_waits / mb, (double)bb->tx_waits / mb,
+           (double)(bb->rx_spins + bb->tx_spins) / mb,
+           (double)bb->was_empty / mb,
+           percentile_us(sorted, bb->nitems, 0.5),
+           percentile_us(sorted, bb->nitems, 0.99),
+           percentile_us(sorted, bb->nitems, 1.0));
+    fflush(stdout);
+
+leave:
+    if (rv != APR_SUCCESS) {
+        char buffer[256];
+        fprintf(stderr, "beam %s/%" APR_SIZE_T_FMT ": %s\n",
+                btype_names[prm->btype], prm->bsize,
+                apr_strerror(rv, buffer, sizeof(buffer)));
+    }
+    if (bb->beam) h2_beam_destroy(bb->beam, &bb->c_from);
+    apr_pool_destroy(bb->rx_pool);
+    apr_pool_destroy(bb->tx_pool);
+}
+
+static void bench_matrix(beam_bench *src, int mbytes, apr_pool_t *pool)
+{
+    static const apr_size_t sizes[] = { 1024, 16 * 1024, 64 * 1024 };
+    static const apr_size_t bufs[] = { 64 * 1024, 1024 * 1024 };
+    beam_params prm;
+    apr_pool_t *p;
+    int t, s, b, m;
+
+    memset(&prm, 0, sizeof(prm));
+    prm.mbytes = mbytes;
+    for (t = BT_HEAP; t <= BT_METADATA; ++t) {
+        for (s = 0; s < (int)(sizeof(sizes)/sizeof(sizes[0])); ++s) {
+            for (b = 0; b < (int)(sizeof(bufs)/sizeof(bufs[0])); ++b) {
+                for (m = 1; m >= 0; --m) {
+                    prm.btype = (beam_btype)t;
+                    prm.bsize = sizes[s];
+                    prm.max_buf = bufs[b];
+                    prm.block = m;
+                    if (t == BT_METADATA) {
+                        /* no payload, transfer as many buckets as 1k data would */
+                        if (s > 0) continue;
+                        prm.mbytes = mbytes / 16;
+                    }
+                    apr_pool_create(&p, pool);
+                    bench_beam(src, &prm, p);
+                    apr_pool_destroy(p);
+                    prm.mbytes = mbytes;
+                }
+            }
+        }
+    }
+}
+
+static int parse_btype(const char *s)
+{
+    int i;
+
+    for (i = BT_HEAP; i <= BT_METADATA; ++i) {
+        if (!strcmp(s, btype_names[i])) return i;
+    }
+    return -1;
+}
+
+static void usage(const char *msg)
+{
+    if (msg) fprintf(stderr, "%s\n", msg);
+    fprintf(stderr, "usage: bench_beam [-t heap|transient|file|mmap|metadata] "
+            "[-s size] [-b max_buf] [-r readbytes] [-m block|nonblock] "
+            "[-M mbytes]\n");
+    exit(1);
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_pool_t *pool;
+    apr_getopt_t *opt;
+    apr_status_t rv;
+    beam_bench src;
+    beam_params prm;
+    const char *arg;
+    char c;
+    int single = 0;
+
+    apr_app_initialize(&argc, &argv, NULL);
+    apr_pool_create(&pool, NULL);
+
+    memset(&prm, 0, sizeof(prm));
+    prm.btype = BT_HEAP;
+    prm.bsize = 16 * 1024;
+    prm.max_buf = 64 * 1024;
+    prm.block = 1;
+    prm.mbytes = BENCH_DEF_MBYTES;
+
+    apr_getopt_init(&opt, pool, argc, argv);
+    while ((rv = apr_getopt(opt, "t:s:b:r:m:M:", &c, &arg)) == APR_SUCCESS) {
+        single = 1;
+        switch (c) {
+            case 't':
+                if (parse_btype(arg) < 0) usage("unknown bucket type");
+                prm.btype = (beam_btype)parse_btype(arg);
+                break;
+            case 's':
+                prm.bsize = (apr_size_t)apr_atoi64(arg);
+                break;
+            case 'b':
+                prm.max_buf = (apr_size_t)apr_atoi64(arg);
+                break;
+            case 'r':
+                prm.readbytes = (apr_off_t)apr_atoi64(arg);
+                break;
+            case 'm':
+                if (strcmp(arg, "block") && strcmp(arg, "nonblock")) {
+                    usage("mode must be 'block' or 'nonblock'");
+                }
+                prm.block = !strcmp(arg, "block");
+                break;
+            case 'M':
+                prm.mbytes = (int)apr_atoi64(arg);
+                break;
+        }
+    }
+    if (rv != APR_EOF) usage(NULL);
+    if (prm.bsize == 0 || prm.bsize > BENCH_FILE_SIZE) {
+        usage("bucket size must be > 0 and <= 4MB");
+    }
+    if (prm.mbytes <= 0) usage("mbytes must be > 0");
+
+    memset(&src, 0, sizeof(src));
+    rv = setup_sources(&src, pool);
+    if (rv != APR_SUCCESS) {
+        fprintf(stderr, "bench_beam: unable to create source file\n");
+        return 1;
+    }
+
+    if (single) {
+        bench_beam(&src, &prm, pool);
+    }
+    else {
+        bench_matrix(&src, prm.mbytes, pool);
+    }
+
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}
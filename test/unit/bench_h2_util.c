@@ -0,0 +1,843 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmarks of the data structures in h2_util.c and the push diary.
+ *
+ * Each measurement runs batches of operations until at least BENCH_MIN_USEC
+ * have been spent, repeats this BENCH_REPEAT times and reports the minimum
+ * and median nanoseconds per operation. Only the operations themselves are
+ * timed, setup of a batch (filling a queue before shifting it, etc.) is not.
+ * Input data comes from a fixed seed, so runs are comparable.
+ *
+ * Output is one JSON object per line on stdout. Arguments, if given, select
+ * the suites to run: iqueue ihash fifo ififo headers base64url diary
+ *
+ * Run via 'make bench' in test/.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <apr.h>
+#include <apr_general.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+#include <apr_time.h>
+
+#include <httpd.h>
+#include <http_log.h>
+
+#include "h2.h"
+#include "h2_util.h"
+#include "h2_push.h"
+#include "h2_session.h"
+
+#define BENCH_MIN_USEC      (100 * 1000)
+#define BENCH_REPEAT        5
+
+#define BENCH_FIFO_ITEMS    (100 * 1000)
+#define BENCH_FIFO_CAPACITY 128
+
+#define BENCH_DIARY_URLS    (16 * 1024)
+#define BENCH_DIARY_BATCH   64
+
+typedef struct bench_ctx bench_ctx;
+
+/* Runs one batch, returns the number of operations done. The timed part
+ * is bracketed by bench_start()/bench_stop(). */
+typedef apr_size_t bench_batch_fn(bench_ctx *ctx);
+
+struct bench_ctx {
+    apr_pool_t *pool;     /* cleared before each batch */
+    int n;                /* number of elements/ids/bytes */
+    int threads;          /* number of threads, where it applies */
+    int *ids;             /* n shuffled ids, 1..n */
+    apr_uint64_t timed_ns;
+    apr_uint64_t started_ns;
+    void *data;           /* suite specific */
+};
+
+static volatile apr_size_t bench_sink;
+static unsigned int bench_seed;
+
+static apr_uint64_t bench_now_ns(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (apr_uint64_t)ts.tv_sec * 1000000000 + (apr_uint64_t)ts.tv_nsec;
+#else
+    return (apr_uint64_t)apr_time_now() * 1000;
+#endif
+}
+
+static void bench_start(bench_ctx *ctx)
+{
+    ctx->started_ns = bench_now_ns();
+}
+
+static void bench_stop(bench_ctx *ctx)
+{
+    ctx->timed_ns += bench_now_ns() - ctx->started_ns;
+}
+
+/* xorshift32, good enough to shuffle test input reproducibly */
+static unsigned int bench_rand(void)
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+static int *bench_shuffled_ids(apr_pool_t *p, int n)
+{
+    int *ids = apr_palloc(p, sizeof(int) * (apr_size_t)n);
+    int i, j, t;
+
+    for (i = 0; i < n; ++i) {
+        ids[i] = i + 1;
+    }
+    for (i = n - 1; i > 0; --i) {
+        j = (int)(bench_rand() % (unsigned int)(i + 1));
+        t = ids[i]; ids[i] = ids[j]; ids[j] = t;
+    }
+    return ids;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double d1 = *(const double*)a, d2 = *(const double*)b;
+    return (d1 < d2)? -1 : ((d1 > d2)? 1 : 0);
+}
+
+static void bench_run(const char *bench, const char *op, bench_ctx *ctx,
+                      bench_batch_fn *fn)
+{
+    double ns_per_op[BENCH_REPEAT];
+    apr_uint64_t wall_start;
+    apr_size_t ops, total_ops = 0;
+    int r;
+
+    for (r = 0; r < BENCH_REPEAT; ++r) {
+        ops = 0;
+        ctx->timed_ns = 0;
+        wall_start = bench_now_ns();
+        do {
+            apr_pool_clear(ctx->pool);
+            ops += fn(ctx);
+        } while ((bench_now_ns() - wall_start) < BENCH_MIN_USEC * 1000);
+        ns_per_op[r] = ops? (double)ctx->timed_ns / (double)ops : 0.0;
+        total_ops += ops;
+    }
+    qsort(ns_per_op, BENCH_REPEAT, sizeof(double), cmp_double);
+    printf("{\"bench\": \"%s\", \"op\": \"%s\", \"n\": %d, \"threads\": %d, "
+           "\"ops\": %" APR_SIZE_T_FMT ", \"ns_per_op_min\": %.1f, "
+           "\"ns_per_op_median\": %.1f}\n",
+           bench, op, ctx->n, ctx->threads, total_ops,
+           ns_per_op[0], ns_per_op[BENCH_REPEAT / 2]);
+    fflush(stdout);
+}
+
+/*******************************************************************************
+ * h2_iqueue
+ ******************************************************************************/
+
+static int iq_cmp_id(int i1, int i2, void *ctx)
+{
+    (void)ctx;
+    return i1 - i2;
+}
+
+static apr_size_t iq_add(bench_ctx *ctx)
+{
+    h2_iqueue *q = h2_iq_create(ctx->pool, 16);
+    int i;
+
+    bench_start(ctx);
+    for (i = 0; i < ctx->n; ++i) {
+        h2_iq_add(q, ctx->ids[i], iq_cmp_id, NULL);
+    }
+    bench_stop(ctx);
+    return (apr_size_t)ctx->n;
+}
+
+static apr_size_t iq_append_sort(bench_ctx *ctx)
+{
+    h2_iqueue *q = h2_iq_create(ctx->pool, 16);
+    int i;
+
+    bench_start(ctx);
+    for (i = 0; i < ctx->n; ++i) {
+        h2_iq_append(q, ctx->ids[i]);
+    }
+    h2_iq_sort(q, iq_cmp_id, NULL);
+    bench_stop(ctx);
+    return (apr_size_t)ctx->n;
+}
+
+static h2_iqueue *iq_filled(bench_ctx *ctx)
+{
+    h2_iqueue *q = h2_iq_create(ctx->pool, ctx->n);
+    int i;
+
+    for (i = 0; i < ctx->n; ++i) {
+        h2_iq_append(q, ctx->ids[i]);
+    }
+    return q;
+}
+
+static apr_size_t iq_shift(bench_ctx *ctx)
+{
+    h2_iqueue *q = iq_filled(ctx);
+    apr_size_t sum = 0;
+    int i;
+
+    bench_start(ctx);
+    for (i = 0; i < ctx->n; ++i) {
+        sum += (apr_size_t)h2_iq_shift(q);
+    }
+    bench_stop(ctx);
+    bench_sink += sum;
+    return (apr_size_t)ctx->n;
+}
+
+static apr_size_t iq_remove(bench_ctx *ctx)
+{
+    h2_iqueue *q = iq_filled(ctx);
+    int i;
+
+    bench_start(ctx);
+    /* filled in shuffled order, removed in id order */
+    for (i = 0; i < ctx->n; ++i) {
+        h2_iq_remove(q, i + 1);
+    }
+    bench_stop(ctx);
+    return (apr_size_t)ctx->n;
+}
+
+static void bench_iqueue(bench_ctx *ctx)
+{
+    static const int sizes[] = { 10, 100, 1000, 10000 };
+    int i;
+
+    for (i = 0; i < (int)(sizeof(sizes)/sizeof(sizes[0])); ++i) {
+        ctx->n = sizes[i];
+        ctx->ids = bench_shuffled_ids(ctx->data, ctx->n);
+        bench_run("iqueue", "add", ctx, iq_add);
+        bench_run("iqueue", "append_sort", ctx, iq_append_sort);
+        bench_run("iqueue", "shift", ctx, iq_shift);
+        bench_run("iqueue", "remove", ctx, iq_remove);
+    }
+}
+
+/*******************************************************************************
+ * h2_ihash
+ ******************************************************************************/
+
+typedef struct {
+    int id;
+    void *payload;
+} ih_entry;
+
+static h2_ihash_t *ih_filled(bench_ctx *ctx, ih_entry *entries)
+{
+    h2_ihash_t *ih = h2_ihash_create(ctx->pool, offsetof(ih_entry, id));
+    int i;
+
+    for (i = 0; i < ctx->n; ++i) {
+        h2_ihash_add(ih, &entries[i]);
+    }
+    return ih;
+}
+
+static apr_size_t ih_add(bench_ctx *ctx)
+{
+    ih_entry *entries = ctx->data;
+    h2_ihash_t *ih = h2_ihash_create(ctx->pool, offsetof(ih_entry, id));
+    int i;
+
+    bench_start(ctx);
+    for (i = 0; i < ctx->n; ++i) {
+        h2_ihash_add(ih, &entries[i]);
+    }
+    bench_stop(ctx);
+    return (apr_size_t)ctx->n;
+}
+
+static apr_size_t ih_get(bench_ctx *ctx)
+{
+    h2_ihash_t *ih = ih_filled(ctx, ctx->data);
+    apr_size_t found = 0;
+    int i;
+
+    bench_start(ctx);
+    for (i = 0; i < ctx->n; ++i) {
+        if (h2_ihash_get(ih, ctx->ids[i])) ++found;
+    }
+    bench_stop(ctx);
+    bench_sink += found;
+    return (apr_size_t)ctx->n;
+}
+
+static apr_size_t ih_remove(bench_ctx *ctx)
+{
+    h2_ihash_t *ih = ih_filled(ctx, ctx->data);
+    int i;
+
+    bench_start(ctx);
+    for (i = 0; i < ctx->n; ++i) {
+        h2_ihash_remove(ih, ctx->ids[i]);
+    }
+    bench_stop(ctx);
+    return (apr_size_t)ctx->n;
+}
+
+static int ih_iter_count(void *ctx, void *val)
+{
+    (void)val;
+    ++(*(apr_size_t*)ctx);
+    return 1;
+}
+
+static apr_size_t ih_iter(bench_ctx *ctx)
+{
+    h2_ihash_t *ih = ih_filled(ctx, ctx->data);
+    apr_size_t count = 0;
+
+    bench_start(ctx);
+    h2_ihash_iter(ih, ih_iter_count, &count);
+    bench_stop(ctx);
+    bench_sink += count;
+    return (apr_size_t)ctx->n;
+}
+
+static void bench_ihash(bench_ctx *ctx)
+{
+    static const int sizes[] = { 10, 100, 1000, 10000 };
+    apr_pool_t *p = ctx->data;
+    ih_entry *entries;
+    int i, j;
+
+    for (i = 0; i < (int)(sizeof(sizes)/sizeof(sizes[0])); ++i) {
+        ctx->n = sizes[i];
+        ctx->ids = bench_shuffled_ids(p, ctx->n);
+        entries = apr_pcalloc(p, sizeof(*entries) * (apr_size_t)ctx->n);
+        for (j = 0; j < ctx->n; ++j) {
+            /* stream ids, as the client would open them */
+            entries[j].id = ctx->ids[j];
+        }
+        ctx->data = entries;
+        bench_run("ihash", "add", ctx, ih_add);
+        bench_run("ihash", "get", ctx, ih_get);
+        bench_run("ihash", "remove", ctx, ih_remove);
+        bench_run("ihash", "iter", ctx, ih_iter);
+        ctx->data = p;
+    }
+}
+
+/*******************************************************************************
+ * h2_fifo and h2_ififo, producers and consumers on separate threads
+ ******************************************************************************/
+
+typedef struct {
+    int use_ififo;
+    h2_fifo *fifo;
+    h2_ififo *ififo;
+    apr_thread_mutex_t *lock;
+    apr_thread_cond_t *go_cond;
+    int go;
+} fifo_bench;
+
+typedef struct {
+    fifo_bench *fb;
+    int count;
+    int produce;
+} fifo_worker;
+
+static void fifo_wait_go(fifo_bench *fb)
+{
+    apr_thread_mutex_lock(fb->lock);
+    while (!fb->go) {
+        apr_thread_cond_wait(fb->go_cond, fb->lock);
+    }
+    apr_thread_mutex_unlock(fb->lock);
+}
+
+static void * APR_THREAD_FUNC fifo_worker_run(apr_thread_t *thread, void *arg)
+{
+    fifo_worker *w = arg;
+    fifo_bench *fb = w->fb;
+    void *elem;
+    int i, id;
+
+    fifo_wait_go(fb);
+    for (i = 0; i < w->count; ++i) {
+        if (w->produce) {
+            if (fb->use_ififo) h2_ififo_push(fb->ififo, i + 1);
+            else h2_fifo_push(fb->fifo, w);
+        }
+        else {
+            if (fb->use_ififo) h2_ififo_pull(fb->ififo, &id);
+            else h2_fifo_pull(fb->fifo, &elem);
+        }
+    }
+    apr_thread_exit(thread, APR_SUCCESS);
+    return NULL;
+}
+
+static apr_size_t fifo_single(bench_ctx *ctx, fifo_bench *fb)
+{
+    void *elem;
+    int i, j, id;
+
+    bench_start(ctx);
+    for (i = 0; i < BENCH_FIFO_ITEMS; i += BENCH_FIFO_CAPACITY) {
+        for (j = 0; j < BENCH_FIFO_CAPACITY; ++j) {
+            if (fb->use_ififo) h2_ififo_push(fb->ififo, j + 1);
+            else h2_fifo_push(fb->fifo, fb);
+        }
+        for (j = 0; j < BENCH_FIFO_CAPACITY; ++j) {
+            if (fb->use_ififo) h2_ififo_pull(fb->ififo, &id);
+            else h2_fifo_pull(fb->fifo, &elem);
+        }
+    }
+    bench_stop(ctx);
+    return (apr_size_t)i;
+}
+
+static apr_size_t fifo_threaded(bench_ctx *ctx)
+{
+    fifo_bench *fb = ctx->data;
+    apr_thread_t **threads;
+    fifo_worker *workers;
+    apr_status_t rv;
+    int i, nprod, ncons, per_prod, total;
+
+    if (fb->use_ififo) h2_ififo_create(&fb->ififo, ctx->pool, BENCH_FIFO_CAPACITY);
+    else h2_fifo_create(&fb->fifo, ctx->pool, BENCH_FIFO_CAPACITY);
+
+    if (ctx->threads == 1) {
+        return fifo_single(ctx, fb);
+    }
+
+    nprod = ctx->threads / 2;
+    ncons = ctx->threads - nprod;
+    per_prod = BENCH_FIFO_ITEMS / nprod;
+    total = per_prod * nprod;
+
+    fb->go = 0;
+    apr_thread_mutex_create(&fb->lock, APR_THREAD_MUTEX_DEFAULT, ctx->pool);
+    apr_thread_cond_create(&fb->go_cond, ctx->pool);
+    threads = apr_pcalloc(ctx->pool, sizeof(*threads) * (apr_size_t)ctx->threads);
+    workers = apr_pcalloc(ctx->pool, sizeof(*workers) * (apr_size_t)ctx->threads);
+    for (i = 0; i < ctx->threads; ++i) {
+        workers[i].fb = fb;
+        workers[i].produce = (i < nprod);
+        if (workers[i].produce) {
+            workers[i].count = per_prod;
+        }
+        else {
+            /* consumers pull exactly what the producers push */
+            workers[i].count = total / ncons + ((i - nprod) < (total % ncons));
+        }
+        apr_thread_create(&threads[i], NULL, fifo_worker_run, &workers[i], ctx->pool);
+    }
+
+    apr_thread_mutex_lock(fb->lock);
+    bench_start(ctx);
+    fb->go = 1;
+    apr_thread_cond_broadcast(fb->go_cond);
+    apr_thread_mutex_unlock(fb->lock);
+    for (i = 0; i < ctx->threads; ++i) {
+        apr_thread_join(&rv, threads[i]);
+    }
+    bench_stop(ctx);
+    return (apr_size_t)total;
+}
+
+static void bench_fifos(bench_ctx *ctx, int use_ififo)
+{
+    static const int nthreads[] = { 1, 2, 4, 8, 16, 32, 64 };
+    apr_pool_t *p = ctx->data;
+    fifo_bench fb;
+    int i;
+
+    memset(&fb, 0, sizeof(fb));
+    fb.use_ififo = use_ififo;
+    ctx->data = &fb;
+    ctx->n = BENCH_FIFO_CAPACITY;
+    for (i = 0; i < (int)(sizeof(nthreads)/sizeof(nthreads[0])); ++i) {
+        ctx->threads = nthreads[i];
+        bench_run(use_ififo? "ififo" : "fifo", "push_pull", ctx, fifo_threaded);
+    }
+    ctx->threads = 1;
+    ctx->data = p;
+}
+
+static void bench_fifo(bench_ctx *ctx)
+{
+    bench_fifos(ctx, 0);
+}
+
+static void bench_ififo(bench_ctx *ctx)
+{
+    bench_fifos(ctx, 1);
+}
+
+/*******************************************************************************
+ * header classification
+ ******************************************************************************/
+
+static const char *header_names[] = {
+    "accept", "accept-encoding", "accept-language", "authorization",
+    "cache-control", "connection", "content-length", "content-type",
+    "cookie", "host", "if-modified-since", "if-none-match", "keep-alive",
+    "proxy-connection", "referer", "te", "transfer-encoding", "upgrade",
+    "user-agent", "x-forwarded-for", "X-Requested-With", "HTTP2-Settings",
+};
+#define HEADER_COUNT    ((int)(sizeof(header_names)/sizeof(header_names[0])))
+#define HEADER_ROUNDS   1000
+
+typedef int header_classify_fn(const char *name, size_t len);
+
+static apr_size_t header_run(bench_ctx *ctx, header_classify_fn *fn)
+{
+    size_t lens[HEADER_COUNT];
+    apr_size_t hits = 0;
+    int i, r;
+
+    for (i = 0; i < HEADER_COUNT; ++i) {
+        lens[i] = strlen(header_names[i]);
+    }
+    bench_start(ctx);
+    for (r = 0; r < HEADER_ROUNDS; ++r) {
+        for (i = 0; i < HEADER_COUNT; ++i) {
+            hits += (apr_size_t)fn(header_names[i], lens[i]);
+        }
+    }
+    bench_stop(ctx);
+    bench_sink += hits;
+    return (apr_size_t)(HEADER_ROUNDS * HEADER_COUNT);
+}
+
+static apr_size_t hd_req_ignore_header(bench_ctx *ctx)
+{
+    return header_run(ctx, h2_req_ignore_header);
+}
+
+static apr_size_t hd_req_ignore_trailer(bench_ctx *ctx)
+{
+    return header_run(ctx, h2_req_ignore_trailer);
+}
+
+static apr_size_t hd_res_ignore_trailer(bench_ctx *ctx)
+{
+    return header_run(ctx, h2_res_ignore_trailer);
+}
+
+static void bench_headers(bench_ctx *ctx)
+{
+    ctx->n = HEADER_COUNT;
+    bench_run("headers", "req_ignore_header", ctx, hd_req_ignore_header);
+    bench_run("headers", "req_ignore_trailer", ctx, hd_req_ignore_trailer);
+    bench_run("headers", "res_ignore_trailer", ctx, hd_res_ignore_trailer);
+}
+
+/*******************************************************************************
+ * base64url
+ ******************************************************************************/
+
+#define B64_ROUNDS      256
+
+typedef struct {
+    const char *raw;
+    const char *encoded;
+} b64_data;
+
+static apr_size_t b64_encode(bench_ctx *ctx)
+{
+    b64_data *d = ctx->data;
+    apr_size_t len = 0;
+    int r;
+
+    bench_start(ctx);
+    for (r = 0; r < B64_ROUNDS; ++r) {
+        len += strlen(h2_util_base64url_encode(d->raw, (apr_size_t)ctx->n,
+                                               ctx->pool));
+    }
+    bench_stop(ctx);
+    bench_sink += len;
+    return B64_ROUNDS;
+}
+
+static apr_size_t b64_decode(bench_ctx *ctx)
+{
+    b64_data *d = ctx->data;
+    const char *decoded;
+    apr_size_t len = 0;
+    int r;
+
+    bench_start(ctx);
+    for (r = 0; r < B64_ROUNDS; ++r) {
+        len += h2_util_base64url_decode(&decoded, d->encoded, ctx->pool);
+    }
+    bench_stop(ctx);
+    bench_sink += len;
+    return B64_ROUNDS;
+}
+
+static void bench_base64url(bench_ctx *ctx)
+{
+    static const int sizes[] = { 16, 256, 4096 };
+    apr_pool_t *p = ctx->data;
+    b64_data d;
+    char *raw;
+    int i, j;
+
+    for (i = 0; i < (int)(sizeof(sizes)/sizeof(sizes[0])); ++i) {
+        ctx->n = sizes[i];
+        raw = apr_palloc(p, (apr_size_t)ctx->n);
+        for (j = 0; j < ctx->n; ++j) {
+            raw[j] = (char)bench_rand();
+        }
+        d.raw = raw;
+        d.encoded = h2_util_base64url_encode(raw, (apr_size_t)ctx->n, p);
+        ctx->data = &d;
+        bench_run("base64url", "encode", ctx, b64_encode);
+        bench_run("base64url", "decode", ctx, b64_decode);
+        ctx->data = p;
+    }
+}
+
+/*******************************************************************************
+ * push diary, driven through h2_push_diary_update() as a session would
+ ******************************************************************************/
+
+typedef struct {
+    h2_session session;
+    conn_rec c1;
+    server_rec s;
+    struct ap_logconf log;
+    h2_push_digest_type dtype;
+    h2_push *pushes;      /* BENCH_DIARY_URLS distinct resources */
+} diary_bench;
+
+static apr_size_t diary_update(bench_ctx *ctx, diary_bench *db,
+                               int first, int count, int wrap, int timed)
+{
+    apr_array_header_t *batch;
+    int i, j;
+
+    batch = apr_array_make(ctx->pool, BENCH_DIARY_BATCH, sizeof(h2_push*));
+    for (i = 0; i < count; i += BENCH_DIARY_BATCH) {
+        apr_array_clear(batch);
+        for (j = i; j < count && j < i + BENCH_DIARY_BATCH; ++j) {
+            APR_ARRAY_PUSH(batch, h2_push*) =
+                &db->pushes[(first + j) % wrap];
+        }
+        if (timed) bench_start(ctx);
+        h2_push_diary_update(&db->session, batch);
+        if (timed) bench_stop(ctx);
+    }
+    return (apr_size_t)count;
+}
+
+static void diary_new(bench_ctx *ctx, diary_bench *db)
+{
+    db->session.push_diary = h2_push_diary_create(ctx->pool, db->dtype, ctx->n);
+}
+
+static apr_size_t diary_miss(bench_ctx *ctx)
+{
+    diary_bench *db = ctx->data;
+
+    /* every resource is new, once full each update evicts the oldest */
+    diary_new(ctx, db);
+    return diary_update(ctx, db, 0, BENCH_DIARY_URLS, BENCH_DIARY_URLS, 1);
+}
+
+static apr_size_t diary_hit(bench_ctx *ctx)
+{
+    diary_bench *db = ctx->data;
+    int known = ctx->n / 2;
+
+    /* half the diary's size in known resources, all updates are hits */
+    diary_new(ctx, db);
+    diary_update(ctx, db, 0, known, BENCH_DIARY_URLS, 0);
+    return diary_update(ctx, db, 0, BENCH_DIARY_URLS, known, 1);
+}
+
+static apr_size_t diary_digest(bench_ctx *ctx)
+{
+    diary_bench *db = ctx->data;
+    const char *data;
+    apr_size_t len;
+
+    diary_new(ctx, db);
+    diary_update(ctx, db, 0, ctx->n, BENCH_DIARY_URLS, 0);
+    bench_start(ctx);
+    h2_push_diary_digest_get(db->session.push_diary, ctx->pool, 256, "*",
+                             &data, &len);
+    bench_stop(ctx);
+    bench_sink += len;
+    return 1;
+}
+
+static apr_size_t diary_digest_incr(bench_ctx *ctx)
+{
+    diary_bench *db = ctx->data;
+    const char *data;
+    apr_size_t len;
+    int i;
+
+    /* a digest after some pushes, as a session would ask repeatedly */
+    diary_new(ctx, db);
+    diary_update(ctx, db, 0, ctx->n, BENCH_DIARY_URLS, 0);
+    h2_push_diary_digest_get(db->session.push_diary, ctx->pool, 256, "*",
+                             &data, &len);
+    for (i = 0; i < 32; ++i) {
+        diary_update(ctx, db, ctx->n + (i * 16), 16, BENCH_DIARY_URLS, 0);
+        bench_start(ctx);
+        h2_push_diary_digest_get(db->session.push_diary, ctx->pool, 256, "*",
+                                 &data, &len);
+        bench_stop(ctx);
+        bench_sink += len;
+    }
+    return 32;
+}
+
+static void bench_diary(bench_ctx *ctx)
+{
+    static const int sizes[] = { 256, 4096 };
+    static const struct {
+        const char *name;
+        h2_push_digest_type dtype;
+    } digests[] = {
+        { "fast", H2_PUSH_DIGEST_FAST },
+        { "apr", H2_PUSH_DIGEST_APR_HASH },
+#ifdef H2_OPENSSL
+        { "sha256", H2_PUSH_DIGEST_SHA256 },
+#endif
+    };
+    apr_pool_t *p = ctx->data;
+    diary_bench *db;
+    h2_request *req;
+    char op[64];
+    int i, j;
+
+    db = apr_pcalloc(p, sizeof(*db));
+    db->log.level = APLOG_WARNING;
+    db->s.log = db->log;
+    db->c1.base_server = &db->s;
+    db->c1.log = &db->log;
+    db->session.c1 = &db->c1;
+    db->session.s = &db->s;
+    db->pushes = apr_pcalloc(p, sizeof(h2_push) * BENCH_DIARY_URLS);
+    for (i = 0; i < BENCH_DIARY_URLS; ++i) {
+        req = apr_pcalloc(p, sizeof(*req));
+        req->method = "GET";
+        req->scheme = "https";
+        req->authority = "www.example.org";
+        req->path = apr_psprintf(p, "/assets/%x/app-%d.min.js?v=%u",
+                                 bench_rand() & 0xff, i, bench_rand());
+        db->pushes[i].req = req;
+    }
+    ctx->data = db;
+
+    for (j = 0; j < (int)(sizeof(digests)/sizeof(digests[0])); ++j) {
+        db->dtype = digests[j].dtype;
+        for (i = 0; i < (int)(sizeof(sizes)/sizeof(sizes[0])); ++i) {
+            ctx->n = sizes[i];
+            apr_snprintf(op, sizeof(op), "update_miss_%s", digests[j].name);
+            bench_run("diary", op, ctx, diary_miss);
+            apr_snprintf(op, sizeof(op), "update_hit_%s", digests[j].name);
+            bench_run("diary", op, ctx, diary_hit);
+        }
+    }
+    db->dtype = H2_PUSH_DIGEST_FAST;
+    for (i = 0; i < (int)(sizeof(sizes)/sizeof(sizes[0])); ++i) {
+        ctx->n = sizes[i];
+        bench_run("diary", "digest", ctx, diary_digest);
+        bench_run("diary", "digest_incr", ctx, diary_digest_incr);
+    }
+    ctx->data = p;
+}
+
+/*******************************************************************************
+ * main
+ ******************************************************************************/
+
+typedef void bench_suite_fn(bench_ctx *ctx);
+
+static const struct {
+    const char *name;
+    bench_suite_fn *fn;
+} suites[] = {
+    { "iqueue", bench_iqueue },
+    { "ihash", bench_ihash },
+    { "fifo", bench_fifo },
+    { "ififo", bench_ififo },
+    { "headers", bench_headers },
+    { "base64url", bench_base64url },
+    { "diary", bench_diary },
+};
+
+static int suite_selected(const char *name, int argc, const char * const argv[])
+{
+    int i;
+
+    if (argc <= 1) return 1;
+    for (i = 1; i < argc; ++i) {
+        if (!strcmp(name, argv[i])) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_pool_t *pool, *suite_pool;
+    bench_ctx ctx;
+    int i;
+
+    apr_app_initialize(&argc, &argv, NULL);
+    apr_pool_create(&pool, NULL);
+    printf("{\"bench\": \"meta\", \"min_usec\": %d, \"repeat\": %d, "
+           "\"time\": %" APR_TIME_T_FMT "}\n",
+           BENCH_MIN_USEC, BENCH_REPEAT, apr_time_sec(apr_time_now()));
+
+    for (i = 0; i < (int)(sizeof(suites)/sizeof(suites[0])); ++i) {
+        if (!suite_selected(suites[i].name, argc, argv)) continue;
+        bench_seed = 0x2f6b4e1d;
+        apr_pool_create(&suite_pool, pool);
+        memset(&ctx, 0, sizeof(ctx));
+        apr_pool_create(&ctx.pool, suite_pool);
+        ctx.threads = 1;
+        ctx.data = suite_pool;
+        suites[i].fn(&ctx);
+        apr_pool_destroy(suite_pool);
+    }
+
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}
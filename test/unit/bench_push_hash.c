@@ -0,0 +1,126 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmark of the push diary hash functions. Measures the time
+ * spent per push candidate to calculate its diary entry, the same way
+ * h2_push.c does for 'H2PushDiaryDigest SHA256' and 'fast'.
+ *
+ * Built and run by 'make bench' in test/, together with bench_h2_util.c.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <apr.h>
+#include <apr_general.h>
+#include <apr_hash.h>
+#include <apr_time.h>
+
+#ifdef H2_OPENSSL
+#include <openssl/evp.h>
+#endif
+
+#include "h2_util.h"
+
+#define BENCH_ROUNDS    (1000 * 1000)
+
+static const char *paths[] = {
+    "/",
+    "/style.css",
+    "/js/app.min.js?v=20220112",
+    "/assets/fonts/roboto-regular-webfont.woff2",
+    "/images/gallery/2022/01/a-rather-long-image-file-name-for-testing.jpg",
+};
+
+typedef apr_uint64_t bench_hash_fn(const char *scheme, const char *authority,
+                                   const char *path);
+
+#ifdef H2_OPENSSL
+static apr_uint64_t hash_sha256(const char *scheme, const char *authority,
+                                const char *path)
+{
+    EVP_MD_CTX *md;
+    apr_uint64_t val;
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int len, i;
+
+    md = EVP_MD_CTX_create();
+    EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+    EVP_DigestUpdate(md, scheme, strlen(scheme));
+    EVP_DigestUpdate(md, "://", 3);
+    EVP_DigestUpdate(md, authority, strlen(authority));
+    EVP_DigestUpdate(md, path, strlen(path));
+    EVP_DigestFinal(md, hash, &len);
+    EVP_MD_CTX_destroy(md);
+
+    val = 0;
+    for (i = 0; i != len; ++i)
+        val = val * 256 + hash[i];
+    return val;
+}
+#endif
+
+static apr_uint64_t hash_fast(const char *scheme, const char *authority,
+                              const char *path)
+{
+    apr_uint64_t val;
+
+    val = h2_util_hash64(scheme, strlen(scheme), 0);
+    val = h2_util_hash64(authority, strlen(authority), val);
+    return h2_util_hash64(path, strlen(path), val);
+}
+
+static apr_uint64_t hash_apr(const char *scheme, const char *authority,
+                             const char *path)
+{
+    apr_ssize_t l1 = (apr_ssize_t)strlen(scheme);
+    apr_ssize_t l2 = (apr_ssize_t)strlen(authority);
+    apr_ssize_t l3 = (apr_ssize_t)strlen(path);
+    apr_uint64_t val;
+
+    val = ((apr_uint64_t)apr_hashfunc_default(scheme, &l1)) << 32;
+    val ^= ((apr_uint64_t)apr_hashfunc_default(authority, &l2)) << 16;
+    return val ^ apr_hashfunc_default(path, &l3);
+}
+
+static void bench(const char *name, bench_hash_fn *fn)
+{
+    apr_time_t start, end;
+    apr_uint64_t sum = 0;
+    int i, npaths = (int)(sizeof(paths)/sizeof(paths[0]));
+    double ns;
+
+    start = apr_time_now();
+    for (i = 0; i < BENCH_ROUNDS; ++i) {
+        sum += fn("https", "www.example.org", paths[i % npaths]);
+    }
+    end = apr_time_now();
+    ns = (double)(end - start) * 1000.0 / BENCH_ROUNDS;
+    printf("{\"bench\": \"push_hash\", \"hash\": \"%s\", \"rounds\": %d, "
+           "\"ns_per_push\": %.1f, \"check\": \"%016" APR_UINT64_T_HEX_FMT "\"}\n",
+           name, BENCH_ROUNDS, ns, sum);
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_app_initialize(&argc, &argv, NULL);
+#ifdef H2_OPENSSL
+    bench("SHA256", hash_sha256);
+#endif
+    bench("fast", hash_fast);
+    bench("apr", hash_apr);
+    apr_terminate();
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Minimal replacements for the httpd and mod_http2 functions that
+ * h2_util.c, h2_push.c and h2_bucket_beam.c reference, so that the benchmarks can be
+ * linked without a running server. Logging is discarded, everything
+ * the benchmarks are not supposed to reach aborts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <apr.h>
+#include <apr_lib.h>
+
+#include <httpd.h>
+#include <http_config.h>
+#include <http_log.h>
+#include <http_protocol.h>
+
+#include "h2_private.h"
+#include "h2_config.h"
+#include "h2.h"
+#include "h2_request.h"
+
+module AP_MODULE_DECLARE_DATA http2_module;
+
+static void bench_unreachable(const char *what)
+{
+    fprintf(stderr, "bench: %s called, not available in benchmarks\n", what);
+    abort();
+}
+
+AP_DECLARE(void) ap_log_assert(const char *szExp, const char *szFile,
+                               int nLine)
+{
+    fprintf(stderr, "bench: assertion \"%s\" failed at %s:%d\n",
+            szExp, szFile, nLine);
+    abort();
+}
+
+AP_DECLARE(void) ap_log_perror_(const char *file, int line, int module_index,
+                                int level, apr_status_t status, apr_pool_t *p,
+                                const char *fmt, ...)
+{
+    (void)file; (void)line; (void)module_index; (void)level;
+    (void)status; (void)p; (void)fmt;
+}
+
+AP_DECLARE(void) ap_log_cerror_(const char *file, int line, int module_index,
+                                int level, apr_status_t status,
+                                const conn_rec *c, const char *fmt, ...)
+{
+    (void)file; (void)line; (void)module_index; (void)level;
+    (void)status; (void)c; (void)fmt;
+}
+
+AP_DECLARE(void *) ap_malloc(size_t size)
+{
+    void *p = malloc(size);
+    if (p == NULL && size != 0) {
+        bench_unreachable("ap_malloc (out of memory)");
+    }
+    return p;
+}
+
+/* RFC 7230 tchar */
+static int is_token_char(int c)
+{
+    return apr_isalnum(c) || (c && strchr("!#$%&'*+-.^_`|~", c));
+}
+
+AP_DECLARE(const char *) ap_scan_http_token(const char *ptr)
+{
+    while (is_token_char((unsigned char)*ptr)) {
+        ++ptr;
+    }
+    return ptr;
+}
+
+AP_DECLARE(const char *) ap_scan_http_field_content(const char *ptr)
+{
+    while (*ptr && (*ptr == '\t' || !apr_iscntrl(*ptr))) {
+        ++ptr;
+    }
+    return ptr;
+}
+
+/* only compared against, the benchmarks never send error buckets */
+AP_DECLARE_DATA const apr_bucket_type_t ap_bucket_type_error = {
+    "ERROR", 5, APR_BUCKET_METADATA, NULL, NULL, NULL, NULL, NULL
+};
+
+AP_DECLARE(apr_bucket *) ap_bucket_error_create(int error, const char *buf,
+                                                apr_pool_t *p,
+                                                apr_bucket_alloc_t *list)
+{
+    (void)error; (void)buf; (void)p; (void)list;
+    bench_unreachable("ap_bucket_error_create");
+    return NULL;
+}
+
+int h2_config_sgeti(server_rec *s, h2_config_var_t var)
+{
+    (void)s; (void)var;
+    return 0;
+}
+
+h2_request *h2_request_create(int id, apr_pool_t *pool, const char *method,
+                              const char *scheme, const char *authority,
+                              const char *path, apr_table_t *header)
+{
+    (void)id; (void)pool; (void)method; (void)scheme;
+    (void)authority; (void)path; (void)header;
+    bench_unreachable("h2_request_create");
+    return NULL;
+}
+
+apr_status_t h2_request_end_headers(h2_request *req, apr_pool_t *pool,
+                                    int eos, size_t raw_bytes)
+{
+    (void)req; (void)pool; (void)eos; (void)raw_bytes;
+    bench_unreachable("h2_request_end_headers");
+    return APR_ENOTIMPL;
+}
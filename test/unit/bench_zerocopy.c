@@ -0,0 +1,416 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * CPU cost of writing bulk data to a TCP socket, with writev as the core
+ * output filter does it ('copy') and with h2_zerocopy_send() as h2_c1_io
+ * does for 'H2ZeroCopySize' ('zerocopy'). Each write is a brigade of
+ * 16KB buckets, like DATA frames of a large response.
+ *
+ * Per run it reports:
+ * - gb_per_s: bytes written per second
+ * - tx_cpu_s_per_gb: user+system CPU seconds of the sending thread per GB
+ * - zc_sends, zc_copied: sendmsg() calls with MSG_ZEROCOPY and how many of
+ *   those the kernel copied anyway
+ *
+ * By default, data goes to a receiver thread over loopback. Linux copies
+ * zero copy sends to local sockets, so this shows the overhead, not the
+ * gain. For real numbers, send to a sink on another host with '-c', e.g.
+ * one running 'nc -lk 9999 >/dev/null'.
+ *
+ * Without arguments, a matrix of write sizes and modes is run. Options
+ * select a single run instead:
+ *   -s bytes      bytes per write
+ *   -m copy|zerocopy
+ *   -M mbytes     amount of data to transfer
+ *   -c host:port  connect to this sink instead of the local receiver
+ *
+ * Output is one JSON object per line on stdout. Run via 'make bench-zerocopy'.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <apr.h>
+#include <apr_general.h>
+#include <apr_getopt.h>
+#include <apr_buckets.h>
+#include <apr_network_io.h>
+#include <apr_strings.h>
+#include <apr_thread_proc.h>
+#include <apr_time.h>
+
+#include "h2_zerocopy.h"
+
+#define BENCH_DEF_MBYTES    2048
+#define BENCH_CHUNK         (16 * 1024)
+#define BENCH_DATA_SIZE     (4 * 1024 * 1024)
+#define BENCH_IOV_MAX       64
+
+static char bench_data[BENCH_DATA_SIZE];
+
+typedef struct {
+    apr_size_t wsize;
+    int zerocopy;
+    int mbytes;
+    const char *sink;           /* host:port or NULL for the local receiver */
+} zc_params;
+
+typedef struct {
+    const zc_params *prm;
+    apr_socket_t *listener;
+    apr_socket_t *tx;
+    apr_status_t tx_rv;
+    apr_status_t rx_rv;
+    apr_off_t rx_bytes;
+    double tx_cpu_secs;
+    apr_time_t start;
+    apr_time_t end;
+    apr_uint64_t zc_sends;
+    apr_uint64_t zc_copied;
+} zc_bench;
+
+static double thread_cpu_secs(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_THREAD, &ru);
+    return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)
+           + (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void *APR_THREAD_FUNC receiver_run(apr_thread_t *thread, void *data)
+{
+    zc_bench *zb = data;
+    apr_socket_t *s;
+    apr_pool_t *p;
+    static char buffer[256 * 1024];
+    apr_size_t len;
+    apr_status_t rv;
+
+    apr_pool_create(&p, NULL);
+    rv = apr_socket_accept(&s, zb->listener, p);
+    if (rv == APR_SUCCESS) {
+        apr_socket_timeout_set(s, -1);
+        do {
+            len = sizeof(buffer);
+            rv = apr_socket_recv(s, buffer, &len);
+            zb->rx_bytes += (apr_off_t)len;
+        } while (rv == APR_SUCCESS);
+        if (APR_STATUS_IS_EOF(rv)) rv = APR_SUCCESS;
+        apr_socket_close(s);
+    }
+    zb->rx_rv = rv;
+    apr_pool_destroy(p);
+    apr_thread_exit(thread, APR_SUCCESS);
+    return NULL;
+}
+
+static void add_write(apr_bucket_brigade *bb, apr_size_t wsize, apr_off_t *poffset)
+{
+    apr_size_t len;
+
+    while (wsize > 0) {
+        len = (wsize > BENCH_CHUNK)? BENCH_CHUNK : wsize;
+        if (*poffset + (apr_off_t)len > BENCH_DATA_SIZE) {
+            *poffset = 0;
+        }
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_immortal_create(
+            bench_data + *poffset, len, bb->bucket_alloc));
+        *poffset += (apr_off_t)len;
+        wsize -= len;
+    }
+}
+
+/* what the core output filter does, minus the non-blocking handling */
+static apr_status_t send_copy(apr_socket_t *s, apr_bucket_brigade *bb)
+{
+    struct iovec iov[BENCH_IOV_MAX];
+    apr_bucket *b;
+    const char *data;
+    apr_size_t len, written;
+    apr_int32_t niov, i;
+    apr_status_t rv = APR_SUCCESS;
+
+    while (!APR_BRIGADE_EMPTY(bb) && rv == APR_SUCCESS) {
+        niov = 0;
+        for (b = APR_BRIGADE_FIRST(bb);
+             b != APR_BRIGADE_SENTINEL(bb) && niov < BENCH_IOV_MAX;
+             b = APR_BUCKET_NEXT(b)) {
+            apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+            iov[niov].iov_base = (void *)data;
+            iov[niov].iov_len = len;
+            ++niov;
+        }
+        i = 0;
+        while (i < niov) {
+            rv = apr_socket_sendv(s, iov + i, niov - i, &written);
+            if (rv != APR_SUCCESS) break;
+            while (i < niov && written >= iov[i].iov_len) {
+                written -= iov[i].iov_len;
+                apr_bucket_delete(APR_BRIGADE_FIRST(bb));
+                ++i;
+            }
+            if (i < niov) {
+                iov[i].iov_base = (char *)iov[i].iov_base + written;
+                iov[i].iov_len -= written;
+            }
+        }
+    }
+    apr_brigade_cleanup(bb);
+    return rv;
+}
+
+static void *APR_THREAD_FUNC sender_run(apr_thread_t *thread, void *data)
+{
+    zc_bench *zb = data;
+    const zc_params *prm = zb->prm;
+    apr_pool_t *p;
+    apr_bucket_alloc_t *ba;
+    apr_bucket_brigade *bb;
+    h2_zerocopy *zc = NULL;
+    apr_off_t total, sent = 0, offset = 0;
+    apr_size_t written;
+    apr_off_t held;
+    double cpu_start;
+    apr_status_t rv = APR_SUCCESS;
+
+    apr_pool_create(&p, NULL);
+    ba = apr_bucket_alloc_create(p);
+    bb = apr_brigade_create(p, ba);
+    total = (apr_off_t)prm->mbytes * 1024 * 1024;
+
+    if (prm->zerocopy) {
+        rv = h2_zerocopy_create(&zc, p, zb->tx, ba, apr_time_from_sec(10));
+        if (rv != APR_SUCCESS) goto leave;
+    }
+
+    cpu_start = thread_cpu_secs();
+    zb->start = apr_time_now();
+    while (sent < total && rv == APR_SUCCESS) {
+        add_write(bb, prm->wsize, &offset);
+        if (zc) {
+            rv = h2_zerocopy_send(zc, bb, &written);
+        }
+        else {
+            rv = send_copy(zb->tx, bb);
+        }
+        sent += (apr_off_t)prm->wsize;
+    }
+    if (zc && rv == APR_SUCCESS) {
+        /* collecting completions is part of the cost */
+        while (h2_zerocopy_reap(zc, apr_time_from_sec(1)) == APR_SUCCESS) {
+            h2_zerocopy_stats(zc, &zb->zc_sends, &zb->zc_copied, &held);
+            if (held == 0) break;
+        }
+    }
+    zb->end = apr_time_now();
+    zb->tx_cpu_secs = thread_cpu_secs() - cpu_start;
+    if (zc) {
+        h2_zerocopy_stats(zc, &zb->zc_sends, &zb->zc_copied, &held);
+    }
+
+leave:
+    apr_socket_shutdown(zb->tx, APR_SHUTDOWN_WRITE);
+    zb->tx_rv = rv;
+    apr_pool_destroy(p);
+    apr_thread_exit(thread, APR_SUCCESS);
+    return NULL;
+}
+
+static apr_status_t connect_to(apr_socket_t **ps, const char *hostport,
+                               apr_pool_t *p)
+{
+    apr_sockaddr_t *sa;
+    char *host, *scope;
+    apr_port_t port;
+    apr_status_t rv;
+
+    rv = apr_parse_addr_port(&host, &scope, &port, hostport, p);
+    if (rv != APR_SUCCESS) return rv;
+    if (!host || !port) return APR_EINVAL;
+    rv = apr_sockaddr_info_get(&sa, host, APR_UNSPEC, port, 0, p);
+    if (rv != APR_SUCCESS) return rv;
+    rv = apr_socket_create(ps, sa->family, SOCK_STREAM, APR_PROTO_TCP, p);
+    if (rv != APR_SUCCESS) return rv;
+    apr_socket_timeout_set(*ps, -1);
+    return apr_socket_connect(*ps, sa);
+}
+
+static void bench_zerocopy(const zc_params *prm, apr_pool_t *p)
+{
+    zc_bench zb;
+    apr_sockaddr_t *sa;
+    apr_thread_t *rx_thread = NULL, *tx_thread;
+    double secs, gb;
+    apr_status_t rv;
+
+    memset(&zb, 0, sizeof(zb));
+    zb.prm = prm;
+    if (prm->sink) {
+        rv = connect_to(&zb.tx, prm->sink, p);
+        if (rv != APR_SUCCESS) goto leave;
+    }
+    else {
+        rv = apr_sockaddr_info_get(&sa, "127.0.0.1", APR_INET, 0, 0, p);
+        if (rv != APR_SUCCESS) goto leave;
+        rv = apr_socket_create(&zb.listener, APR_INET, SOCK_STREAM,
+                               APR_PROTO_TCP, p);
+        if (rv != APR_SUCCESS) goto leave;
+        apr_socket_opt_set(zb.listener, APR_SO_REUSEADDR, 1);
+        rv = apr_socket_bind(zb.listener, sa);
+        if (rv != APR_SUCCESS) goto leave;
+        rv = apr_socket_listen(zb.listener, 1);
+        if (rv != APR_SUCCESS) goto leave;
+        rv = apr_socket_addr_get(&sa, APR_LOCAL, zb.listener);
+        if (rv != APR_SUCCESS) goto leave;
+        apr_thread_create(&rx_thread, NULL, receiver_run, &zb, p);
+        rv = apr_socket_create(&zb.tx, APR_INET, SOCK_STREAM, APR_PROTO_TCP, p);
+        if (rv != APR_SUCCESS) goto leave;
+        apr_socket_timeout_set(zb.tx, -1);
+        rv = apr_socket_connect(zb.tx, sa);
+        if (rv != APR_SUCCESS) goto leave;
+    }
+
+    apr_thread_create(&tx_thread, NULL, sender_run, &zb, p);
+    apr_thread_join(&rv, tx_thread);
+    if (rx_thread) {
+        apr_thread_join(&rv, rx_thread);
+        rx_thread = NULL;
+    }
+    apr_socket_close(zb.tx);
+    zb.tx = NULL;
+    if (zb.tx_rv != APR_SUCCESS || zb.rx_rv != APR_SUCCESS) {
+        rv = (zb.tx_rv != APR_SUCCESS)? zb.tx_rv : zb.rx_rv;
+        goto leave;
+    }
+
+    secs = (double)(zb.end - zb.start) / APR_USEC_PER_SEC;
+    gb = (double)prm->mbytes / 1024.0;
+    printf("{\"bench\": \"zerocopy\", \"mode\": \"%s\", \"wsize\": %" APR_SIZE_T_FMT
+           ", \"sink\": \"%s\", \"mbytes\": %d, \"secs\": %.3f"
+           ", \"gb_per_s\": %.3f, \"tx_cpu_s_per_gb\": %.4f"
+           ", \"zc_sends\": %" APR_UINT64_T_FMT ", \"zc_copied\": %" APR_UINT64_T_FMT "}\n",
+           prm->zerocopy? "zerocopy" : "copy", prm->wsize,
+           prm->sink? prm->sink : "loopback", prm->mbytes, secs,
+           gb / secs, zb.tx_cpu_secs / gb, zb.zc_sends, zb.zc_copied);
+    fflush(stdout);
+
+leave:
+    if (rv != APR_SUCCESS) {
+        char buffer[256];
+        fprintf(stderr, "zerocopy %s/%" APR_SIZE_T_FMT ": %s\n",
+                prm->zerocopy? "zerocopy" : "copy", prm->wsize,
+                apr_strerror(rv, buffer, sizeof(buffer)));
+    }
+    if (zb.tx) apr_socket_close(zb.tx);
+    if (rx_thread) {
+        if (zb.listener) apr_socket_close(zb.listener);
+        apr_thread_join(&rv, rx_thread);
+    }
+    else if (zb.listener) {
+        apr_socket_close(zb.listener);
+    }
+}
+
+static void bench_matrix(zc_params *prm, apr_pool_t *pool)
+{
+    static const apr_size_t sizes[] = {
+        16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024
+    };
+    apr_pool_t *p;
+    int s, m;
+
+    for (s = 0; s < (int)(sizeof(sizes)/sizeof(sizes[0])); ++s) {
+        for (m = 0; m <= 1; ++m) {
+            prm->wsize = sizes[s];
+            prm->zerocopy = m;
+            apr_pool_create(&p, pool);
+            bench_zerocopy(prm, p);
+            apr_pool_destroy(p);
+        }
+    }
+}
+
+static void usage(const char *msg)
+{
+    if (msg) fprintf(stderr, "%s\n", msg);
+    fprintf(stderr, "usage: bench_zerocopy [-s size] [-m copy|zerocopy] "
+            "[-M mbytes] [-c host:port]\n");
+    exit(1);
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_pool_t *pool;
+    apr_getopt_t *opt;
+    apr_status_t rv;
+    zc_params prm;
+    const char *arg;
+    char c;
+    int single = 0;
+    apr_size_t i;
+
+    apr_app_initialize(&argc, &argv, NULL);
+    apr_pool_create(&pool, NULL);
+    for (i = 0; i < BENCH_DATA_SIZE; ++i) {
+        bench_data[i] = (char)('a' + (i % 26));
+    }
+
+    memset(&prm, 0, sizeof(prm));
+    prm.wsize = 256 * 1024;
+    prm.zerocopy = 1;
+    prm.mbytes = BENCH_DEF_MBYTES;
+
+    apr_getopt_init(&opt, pool, argc, argv);
+    while ((rv = apr_getopt(opt, "s:m:M:c:", &c, &arg)) == APR_SUCCESS) {
+        switch (c) {
+            case 's':
+                single = 1;
+                prm.wsize = (apr_size_t)apr_atoi64(arg);
+                break;
+            case 'm':
+                single = 1;
+                if (strcmp(arg, "copy") && strcmp(arg, "zerocopy")) {
+                    usage("mode must be 'copy' or 'zerocopy'");
+                }
+                prm.zerocopy = !strcmp(arg, "zerocopy");
+                break;
+            case 'M':
+                prm.mbytes = (int)apr_atoi64(arg);
+                break;
+            case 'c':
+                prm.sink = arg;
+                break;
+        }
+    }
+    if (rv != APR_EOF) usage(NULL);
+    if (prm.wsize == 0) usage("write size must be > 0");
+    if (prm.mbytes <= 0) usage("mbytes must be > 0");
+
+    if (single) {
+        bench_zerocopy(&prm, pool);
+    }
+    else {
+        bench_matrix(&prm, pool);
+    }
+
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}
@@ -20,6 +20,7 @@ static Suite *main_test_suite(void)
 {
     Suite *suite = suite_create("main");
 
+    suite_add_tcase(suite, h2_push_test_case());
     suite_add_tcase(suite, h2_util_test_case());
 
     return suite;
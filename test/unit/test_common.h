@@ -40,4 +40,5 @@
  * main_test_suite() in main.c.
  */
 
+TCase *h2_push_test_case(void);
 TCase *h2_util_test_case(void);
@@ -0,0 +1,362 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <apr.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include <httpd.h>
+#include <http_log.h>
+
+#include "test_common.h"
+#include "h2.h"
+#include "h2_util.h"
+#include "h2_push.h"
+#include "h2_session.h"
+
+/*
+ * Helpers
+ */
+
+#define TEST_SCHEME     "https"
+#define TEST_AUTHORITY  "test.example.org"
+
+static apr_pool_t *g_pool;
+static ap_logconf g_logconf;
+static h2_session g_session;
+
+/* the hash H2_PUSH_DIGEST_FAST records for a path */
+static apr_uint64_t path_hash(const char *path)
+{
+    apr_uint64_t val;
+
+    val = h2_util_hash64(TEST_SCHEME, strlen(TEST_SCHEME), 0);
+    val = h2_util_hash64(TEST_AUTHORITY, strlen(TEST_AUTHORITY), val);
+    return h2_util_hash64(path, strlen(path), val);
+}
+
+/* the slot in the diary's index a hash is looked up first, for an
+ * index of the given size (twice the allocated entries) */
+static int path_home(const char *path, int index_size)
+{
+    apr_uint64_t hash = path_hash(path) * APR_UINT64_C(0x9e3779b97f4a7c15);
+    return (int)(hash >> 32) & (index_size - 1);
+}
+
+static h2_push_diary *diary_create(int N)
+{
+    g_session.push_diary = h2_push_diary_create(g_pool, H2_PUSH_DIGEST_FAST, N);
+    ck_assert_ptr_nonnull(g_session.push_diary);
+    return g_session.push_diary;
+}
+
+/* Offer pushes for the paths to the diary, return how many of them
+ * were new to it. */
+static int diary_offer(const char **paths, int npaths)
+{
+    apr_array_header_t *pushes, *npushes;
+    h2_request *req;
+    h2_push *push;
+    int i;
+
+    pushes = apr_array_make(g_pool, npaths, sizeof(h2_push*));
+    for (i = 0; i < npaths; ++i) {
+        req = apr_pcalloc(g_pool, sizeof(*req));
+        req->method = "GET";
+        req->scheme = TEST_SCHEME;
+        req->authority = TEST_AUTHORITY;
+        req->path = paths[i];
+        push = apr_pcalloc(g_pool, sizeof(*push));
+        push->req = req;
+        APR_ARRAY_PUSH(pushes, h2_push*) = push;
+    }
+    npushes = h2_push_diary_update(&g_session, pushes);
+    return npushes? npushes->nelts : 0;
+}
+
+static int diary_offer1(const char *path)
+{
+    return diary_offer(&path, 1);
+}
+
+/* find a path not in avoid[] whose home slot is the given one */
+static const char *path_at_home(int home, int index_size,
+                                const char **avoid, int navoid)
+{
+    const char *path;
+    int i, j;
+
+    for (i = 0; i < 100000; ++i) {
+        path = apr_psprintf(g_pool, "/res/%d.css", i);
+        if (path_home(path, index_size) != home) continue;
+        for (j = 0; j < navoid && strcmp(avoid[j], path); ++j);
+        if (j == navoid) return path;
+    }
+    ck_abort_msg("no path found for slot %d", home);
+    return NULL;
+}
+
+/*
+ * The golomb coded set of the cache digest as the diary produced it
+ * before it kept its hashes sorted, by sorting all of them every time.
+ */
+typedef struct {
+    unsigned char data[64 * 1024];
+    apr_size_t offset;
+    unsigned int bit;
+    int fixed_bits;
+    apr_uint64_t last;
+} ref_encoder;
+
+static const unsigned char ref_cbit_mask[] = {
+    0x80u, 0x40u, 0x20u, 0x10u, 0x08u, 0x04u, 0x02u, 0x01u,
+};
+
+static void ref_encode_bit(ref_encoder *enc, int bit)
+{
+    if (++enc->bit >= 8) {
+        ++enc->offset;
+        ck_assert(enc->offset < sizeof(enc->data));
+        enc->bit = 0;
+        enc->data[enc->offset] = 0xffu;
+    }
+    if (!bit) {
+        enc->data[enc->offset] &= ~ref_cbit_mask[enc->bit];
+    }
+}
+
+static void ref_encode_next(ref_encoder *enc, apr_uint64_t pval)
+{
+    apr_uint64_t delta = pval - enc->last, flex_bits;
+    int i;
+
+    enc->last = pval;
+    for (flex_bits = delta >> enc->fixed_bits; flex_bits; --flex_bits) {
+        ref_encode_bit(enc, 1);
+    }
+    ref_encode_bit(enc, 0);
+    for (i = enc->fixed_bits - 1; i >= 0; --i) {
+        ref_encode_bit(enc, (int)((delta >> i) & 1));
+    }
+}
+
+static int ref_ceil_power_of_2(int n)
+{
+    int p = 2;
+    while (p < n) p *= 2;
+    return p;
+}
+
+static int cmp_uint64(const void *p1, const void *p2)
+{
+    const apr_uint64_t *pu1 = p1, *pu2 = p2;
+    return (*pu1 > *pu2)? 1 : ((*pu1 == *pu2)? 0 : -1);
+}
+
+static apr_size_t ref_digest(ref_encoder *enc, const apr_uint64_t *hashes,
+                             int n, int maxP)
+{
+    apr_uint64_t *sorted;
+    unsigned char log2n, log2p;
+    int i, delta_bits;
+
+    log2n = h2_log2(ref_ceil_power_of_2(n));
+    log2p = H2MIN(64 - log2n, h2_log2(ref_ceil_power_of_2(maxP)));
+    delta_bits = 64 - (log2n + log2p);
+
+    memset(enc, 0, sizeof(*enc));
+    enc->data[0] = log2n;
+    enc->data[1] = log2p;
+    enc->offset = 1;
+    enc->bit = 8;
+    enc->fixed_bits = log2p;
+
+    sorted = apr_pcalloc(g_pool, sizeof(apr_uint64_t) * (apr_size_t)(n + 1));
+    for (i = 0; i < n; ++i) {
+        sorted[i] = hashes[i] >> delta_bits;
+    }
+    qsort(sorted, (apr_size_t)n, sizeof(apr_uint64_t), cmp_uint64);
+    for (i = 0; i < n; ++i) {
+        if (!i || sorted[i] != sorted[i-1]) {
+            ref_encode_next(enc, sorted[i]);
+        }
+    }
+    return enc->offset + 1;
+}
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static void h2_push_setup(void)
+{
+    conn_rec *c;
+
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+    /* the diary logs on the session's connection, keep that quiet */
+    g_logconf.module_levels = NULL;
+    g_logconf.level = APLOG_ERR;
+    c = apr_pcalloc(g_pool, sizeof(*c));
+    c->log = &g_logconf;
+    memset(&g_session, 0, sizeof(g_session));
+    g_session.c1 = c;
+    g_session.pool = g_pool;
+}
+
+static void h2_push_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+/*
+ * Tests
+ */
+START_TEST(diary_h2_push_insert_hit)
+{
+    const char *paths[] = { "/a.css", "/b.js", "/c.png" };
+    const char *more[] = { "/a.css", "/d.woff2" };
+
+    diary_create(16);
+    ck_assert_int_eq(3, diary_offer(paths, 3));
+    ck_assert_int_eq(0, diary_offer(paths, 3));
+    ck_assert_int_eq(1, diary_offer(more, 2));
+    ck_assert_int_eq(0, diary_offer(more, 2));
+    ck_assert_int_eq(4, g_session.push_diary->nelts);
+}
+END_TEST
+
+START_TEST(diary_h2_push_lru_evict)
+{
+    const char *paths[] = { "/0", "/1", "/2", "/3" };
+    const char *present[] = { "/0", "/2", "/3", "/4" };
+
+    diary_create(4);
+    ck_assert_int_eq(4, diary_offer(paths, 4));
+    /* a hit makes "/0" the most recently used, "/1" is oldest now */
+    ck_assert_int_eq(0, diary_offer1("/0"));
+    ck_assert_int_eq(1, diary_offer1("/4"));
+    ck_assert_int_eq(4, g_session.push_diary->nelts);
+    ck_assert_int_eq(0, diary_offer(present, 4));
+    ck_assert_int_eq(1, diary_offer1("/1"));
+    /* re-adding "/1" evicted "/0", the oldest after the hits above */
+    ck_assert_int_eq(1, diary_offer1("/0"));
+}
+END_TEST
+
+START_TEST(diary_h2_push_remove_wrap)
+{
+    const char *p[5], *present[4];
+    int size, last;
+
+    /* 4 entries, an index of 8 slots that does not grow */
+    diary_create(4);
+    ck_assert_int_eq(4, g_session.push_diary->nalloc);
+    size = g_session.push_diary->index_mask + 1;
+    ck_assert_int_eq(8, size);
+    last = size - 1;
+
+    /* three paths at home in the last slot, the 2nd and 3rd wrap around
+     * to slots 0 and 1. The fourth is at home in slot 0 and is pushed
+     * to slot 2 by them. */
+    p[0] = path_at_home(last, size, p, 0);
+    p[1] = path_at_home(last, size, p, 1);
+    p[2] = path_at_home(last, size, p, 2);
+    p[3] = path_at_home(0, size, p, 3);
+    p[4] = path_at_home(4, size, p, 4);
+    ck_assert_int_eq(4, diary_offer(p, 4));
+    ck_assert_int_eq(1, g_session.push_diary->index[last]);
+    ck_assert_int_eq(2, g_session.push_diary->index[0]);
+    ck_assert_int_eq(3, g_session.push_diary->index[1]);
+    ck_assert_int_eq(4, g_session.push_diary->index[2]);
+
+    /* evicting the first shifts the others back across the wrap */
+    ck_assert_int_eq(1, diary_offer1(p[4]));
+    ck_assert_int_eq(2, g_session.push_diary->index[last]);
+    ck_assert_int_eq(3, g_session.push_diary->index[0]);
+    ck_assert_int_eq(4, g_session.push_diary->index[1]);
+    ck_assert_int_eq(0, g_session.push_diary->index[2]);
+    present[0] = p[1];
+    present[1] = p[2];
+    present[2] = p[3];
+    present[3] = p[4];
+    ck_assert_int_eq(0, diary_offer(present, 4));
+    ck_assert_int_eq(1, diary_offer1(p[0]));
+}
+END_TEST
+
+START_TEST(diary_h2_push_digest_ref)
+{
+    enum { N = 64, NPATHS = 200, ROUNDS = 2000 };
+    apr_uint64_t model[N];
+    ref_encoder *enc;
+    const char *path, *data;
+    apr_size_t len, ref_len;
+    apr_uint64_t hash;
+    apr_uint32_t x = 2463534242u;
+    int i, j, n = 0, maxP;
+
+    enc = apr_pcalloc(g_pool, sizeof(*enc));
+    diary_create(N);
+    for (i = 0; i < ROUNDS; ++i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        path = apr_psprintf(g_pool, "/r/%u", (unsigned)(x % NPATHS));
+        hash = path_hash(path);
+        /* the same in a plain LRU list */
+        for (j = 0; j < n && model[j] != hash; ++j);
+        if (j < n) {
+            memmove(model + j, model + j + 1, sizeof(model[0]) * (apr_size_t)(n - j - 1));
+            --n;
+            ck_assert_int_eq(0, diary_offer1(path));
+        }
+        else {
+            if (n == N) {
+                memmove(model, model + 1, sizeof(model[0]) * (N - 1));
+                --n;
+            }
+            ck_assert_int_eq(1, diary_offer1(path));
+        }
+        model[n++] = hash;
+        ck_assert_int_eq(n, g_session.push_diary->nelts);
+
+        /* digests at irregular times, so that the diary's journal of
+         * changes sees few and many of them, up to overflowing */
+        if ((x % 13) == 0 || i == ROUNDS - 1) {
+            maxP = 1 << (x % 24);
+            ck_assert_int_eq(APR_SUCCESS, h2_push_diary_digest_get(
+                             g_session.push_diary, g_pool, maxP, "*", &data, &len));
+            ref_len = ref_digest(enc, model, n, maxP);
+            ck_assert_int_eq(ref_len, len);
+            ck_assert_mem_eq(enc->data, data, len);
+        }
+    }
+}
+END_TEST
+
+TCase *h2_push_test_case(void)
+{
+    TCase *testcase = tcase_create("h2_push");
+
+    tcase_add_checked_fixture(testcase, h2_push_setup, h2_push_teardown);
+
+    tcase_add_test(testcase, diary_h2_push_insert_hit);
+    tcase_add_test(testcase, diary_h2_push_lru_evict);
+    tcase_add_test(testcase, diary_h2_push_remove_wrap);
+    tcase_add_test(testcase, diary_h2_push_digest_ref);
+
+    return testcase;
+}
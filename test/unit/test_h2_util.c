@@ -101,6 +101,50 @@ START_TEST(base64_h2_util_largetrip)
 }
 END_TEST
 
+START_TEST(hash64_h2_util_stable)
+{
+    char buffer[128];
+    apr_uint64_t h1, h2;
+    int i;
+
+    for (i = 0; i < (int)sizeof(buffer); ++i) {
+        buffer[i] = (char)(i * 7 + 3);
+    }
+    for (i = 0; i <= (int)sizeof(buffer); ++i) {
+        h1 = h2_util_hash64(buffer, (apr_size_t)i, 0);
+        h2 = h2_util_hash64(buffer, (apr_size_t)i, 0);
+        ck_assert(h1 == h2);
+        /* seed is relevant */
+        ck_assert(h1 != h2_util_hash64(buffer, (apr_size_t)i, 1));
+    }
+}
+END_TEST
+
+START_TEST(hash64_h2_util_distinct)
+{
+    char buffer[128];
+    apr_uint64_t hashes[(sizeof(buffer) + 1) * 8];
+    int i, j, bit, n = 0;
+
+    /* all lengths and all single bit flips in the first byte give
+     * different values, in upper and lower 32 bits alike */
+    memset(buffer, 'a', sizeof(buffer));
+    for (i = 0; i <= (int)sizeof(buffer); ++i) {
+        for (bit = 0; bit < 8; ++bit) {
+            buffer[0] = (char)('a' ^ (1 << bit));
+            hashes[n++] = h2_util_hash64(buffer, (apr_size_t)i, 0);
+        }
+    }
+    for (i = 0; i < n; ++i) {
+        for (j = i + 1; j < n; ++j) {
+            if ((i / 8) == 0 && (j / 8) == 0) continue; /* empty input */
+            ck_assert((hashes[i] >> 32) != (hashes[j] >> 32));
+            ck_assert((hashes[i] & 0xffffffffu) != (hashes[j] & 0xffffffffu));
+        }
+    }
+}
+END_TEST
+
 TCase *h2_util_test_case(void)
 {
     TCase *testcase = tcase_create("h2_util");
@@ -109,6 +153,8 @@ TCase *h2_util_test_case(void)
 
     tcase_add_test(testcase, base64_h2_util_roundtrip);
     tcase_add_test(testcase, base64_h2_util_largetrip);
+    tcase_add_test(testcase, hash64_h2_util_stable);
+    tcase_add_test(testcase, hash64_h2_util_distinct);
 
     return testcase;
 }